@@ -0,0 +1,207 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "oklab_source.h"
+#include "oklab_parallel.h"
+#include "oklab_srgb8.h"
+
+namespace ok_color
+{
+
+// ------------------------ Curves ------------------------ //
+
+// Piecewise linear curve, sampled at evenly spaced inputs in [x_min, x_max].
+// Inputs outside the range are clamped, or wrapped around for periodic curves (used for hue).
+// A curve without values is the identity.
+struct Curve
+{
+	std::vector<float> values;
+	float x_min = 0.f;
+	float x_max = 1.f;
+	bool periodic = false;
+
+	bool empty() const
+	{
+		return values.empty();
+	}
+
+	float eval(float x) const
+	{
+		int n = (int)values.size();
+		if (n < 2)
+			return n == 1 ? values[0] : x;
+
+		float t = (x - x_min) / (x_max - x_min);
+		t = periodic ? t - floorf(t) : clamp(t, 0.f, 1.f);
+
+		float pos = t * (periodic ? n : n - 1);
+		pos = pos >= 0.f ? pos : 0.f; // also catches NaN
+
+		int i = (int)pos;
+		i = i < n - 1 ? i : (periodic ? n - 1 : n - 2);
+		int next = periodic && i == n - 1 ? 0 : i + 1;
+
+		return values[i] + (pos - i) * (values[next] - values[i]);
+	}
+};
+
+// Samples f at count evenly spaced points in [x_min, x_max].
+// For periodic curves x_max itself is not sampled, it wraps around to x_min.
+// A count below 1 gives an empty curve (identity), a count of 1 a constant f(x_min).
+template <class F>
+Curve make_curve(F f, int count, float x_min = 0.f, float x_max = 1.f, bool periodic = false)
+{
+	Curve curve;
+	curve.x_min = x_min;
+	curve.x_max = x_max;
+	curve.periodic = periodic;
+	if (count < 1)
+		return curve;
+
+	curve.values.resize(count);
+
+	int steps = periodic ? count : count - 1;
+	steps = steps > 0 ? steps : 1;
+	for (int i = 0; i < count; i++)
+		curve.values[i] = f(x_min + (x_max - x_min) * i / steps);
+
+	return curve;
+}
+
+// ------------------------ OkLch adjustments ------------------------ //
+
+// Image wide version of the OkLch methods on the Dart side, plus curves.
+// Applied in this order:
+// 1. lightness: > 0 moves L towards 1 (lighter), < 0 towards 0 (darker), by that fraction
+// 2. chroma: > 0 moves C towards 1 (saturate), < 0 towards 0 (desaturate), by that fraction
+// 3. hue_degrees: rotates the hue
+// 4. L_curve maps L, C_curve maps C
+// 5. C_by_hue scales C depending on the new hue, in radians as returned by atan2 (make it periodic over 2 pi)
+// Results outside of sRGB are brought back with the gamut clipping method in clip.
+struct LchAdjustment
+{
+	float lightness = 0.f;
+	float chroma = 0.f;
+	float hue_degrees = 0.f;
+
+	Curve L_curve;
+	Curve C_curve;
+	Curve C_by_hue;
+
+	GamutClip clip = GamutClip::preserve_chroma;
+};
+
+Lab adjust_oklab(const LchAdjustment& adjustment, float cos_h, float sin_h, Lab lab)
+{
+	float L = lab.L;
+	float C = sqrtf(lab.a * lab.a + lab.b * lab.b);
+
+	L = adjustment.lightness >= 0.f
+		? L + (1.f - L) * adjustment.lightness
+		: L - L * -adjustment.lightness;
+	C = adjustment.chroma >= 0.f
+		? C + (1.f - C) * adjustment.chroma
+		: C - C * -adjustment.chroma;
+
+	if (!adjustment.L_curve.empty())
+		L = adjustment.L_curve.eval(L);
+	if (!adjustment.C_curve.empty())
+		C = adjustment.C_curve.eval(C);
+
+	// Rotating (a, b) directly avoids going through atan2, cos and sin
+	float a = cos_h * lab.a - sin_h * lab.b;
+	float b = sin_h * lab.a + cos_h * lab.b;
+
+	if (!adjustment.C_by_hue.empty())
+		C *= adjustment.C_by_hue.eval(atan2f(b, a));
+
+	// Achromatic colors keep their (undefined) hue, so chroma can only be added along a = 1, b = 0
+	float C_old = sqrtf(a * a + b * b);
+	if (C_old > 1e-7f)
+	{
+		a *= C / C_old;
+		b *= C / C_old;
+	}
+	else
+	{
+		a = C;
+		b = 0.f;
+	}
+
+	return { L, a, b };
+}
+
+// Converts back to linear sRGB, clipping from the OkLab value we already have when out of gamut
+RGB clip_adjusted(const LchAdjustment& adjustment, Lab lab)
+{
+	return gamut_clip_oklab(lab, adjustment.clip);
+}
+
+// Adjusts linear sRGB values, results are gamut clipped but not clamped
+void adjust_linear_srgb(const LchAdjustment& adjustment, const RGB* in, RGB* out, size_t count, unsigned threads = 0)
+{
+	OKLAB_PROFILE_SCOPE(call, "adjust_linear_srgb");
+	float cos_h = cosf(adjustment.hue_degrees * pi / 180.f);
+	float sin_h = sinf(adjustment.hue_degrees * pi / 180.f);
+
+	parallel_for(count, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++)
+		{
+			Lab lab = adjust_oklab(adjustment, cos_h, sin_h, linear_srgb_to_oklab(in[i]));
+			out[i] = clip_adjusted(adjustment, lab);
+		}
+	}, threads);
+}
+
+void adjust_srgb(const LchAdjustment& adjustment, const RGB* in, RGB* out, size_t count, unsigned threads = 0)
+{
+	OKLAB_PROFILE_SCOPE(call, "adjust_srgb");
+	float cos_h = cosf(adjustment.hue_degrees * pi / 180.f);
+	float sin_h = sinf(adjustment.hue_degrees * pi / 180.f);
+
+	parallel_for(count, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++)
+		{
+			RGB linear_rgb = {
+				srgb_transfer_function_inv(in[i].r),
+				srgb_transfer_function_inv(in[i].g),
+				srgb_transfer_function_inv(in[i].b)
+			};
+
+			Lab lab = adjust_oklab(adjustment, cos_h, sin_h, linear_srgb_to_oklab(linear_rgb));
+			RGB rgb = clip_adjusted(adjustment, lab);
+
+			out[i] = {
+				srgb_transfer_function(rgb.r),
+				srgb_transfer_function(rgb.g),
+				srgb_transfer_function(rgb.b),
+			};
+		}
+	}, threads);
+}
+
+// Packed 0xAARRGGBB pixels, alpha is kept as is. Uses the 8 bit transfer function tables.
+void adjust_argb32(const LchAdjustment& adjustment, const uint32_t* in, uint32_t* out, size_t count, unsigned threads = 0)
+{
+	OKLAB_PROFILE_SCOPE(call, "adjust_argb32");
+	float cos_h = cosf(adjustment.hue_degrees * pi / 180.f);
+	float sin_h = sinf(adjustment.hue_degrees * pi / 180.f);
+
+	const Srgb8Tables& tables = srgb8_tables();
+
+	parallel_for(count, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++)
+		{
+			uint32_t argb = in[i];
+
+			Lab lab = adjust_oklab(adjustment, cos_h, sin_h, linear_srgb_to_oklab(argb32_to_linear_srgb(tables, argb)));
+			RGB rgb = clip_adjusted(adjustment, lab);
+
+			out[i] = linear_srgb_to_argb32(tables, rgb, argb >> 24);
+		}
+	}, threads);
+}
+
+} // namespace ok_color
@@ -0,0 +1,208 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include "oklab_source.h"
+
+namespace ok_color
+{
+
+// ------------------------ Conversion cache ------------------------ //
+
+// All the Ok* representations of one 8 bit sRGB color
+struct ColorSpaces { Lab lab; Lch lch; HSV hsv; HSL hsl; };
+
+struct CacheStats { uint64_t hits; uint64_t misses; uint64_t inserts; };
+
+ColorSpaces argb32_to_color_spaces(uint32_t argb)
+{
+	RGB rgb = argb32_to_srgb(argb);
+	RGB linear_rgb = {
+		srgb_transfer_function_inv(rgb.r),
+		srgb_transfer_function_inv(rgb.g),
+		srgb_transfer_function_inv(rgb.b)
+	};
+
+	Lab lab = linear_srgb_to_oklab(linear_rgb);
+	return { lab, oklab_to_lch(lab), oklab_to_okhsv(lab), oklab_to_okhsl(lab) };
+}
+
+// Thread safe memoization of argb32_to_color_spaces for UI code that converts the same
+// theme colors over and over.
+//
+// The cache is a fixed size, direct mapped hash table, so memory is bounded by the capacity
+// given at construction (64 bytes per slot). A new color evicts whatever color shared its slot.
+// Alpha does not affect any of the conversions, so colors only differing in alpha share an entry.
+//
+// Each slot is guarded by a sequence counter: readers never block or write shared state, and
+// retry as a miss if they observe a concurrent write. Writers that find the slot busy skip the
+// insert instead of waiting.
+//
+// Hit, miss and insert counts are optional. When enabled they are spread over shards on their own
+// cache lines, a thread always using the same shard, so lookups from different threads rarely
+// write the same line.
+class ConversionCache
+{
+public:
+	// capacity is rounded up to a power of two
+	explicit ConversionCache(size_t capacity = 4096, bool track_stats = false)
+	{
+		bits = 1;
+		while (((size_t)1 << bits) < capacity && bits < 31)
+			bits++;
+
+		slots.reset(new Slot[(size_t)1 << bits]);
+		if (track_stats)
+			shards.reset(new StatShard[stat_shards]);
+	}
+
+	size_t capacity() const
+	{
+		return (size_t)1 << bits;
+	}
+
+	// Returns the cached conversions for the color, computing and inserting them on a miss
+	ColorSpaces get(uint32_t argb)
+	{
+		ColorSpaces result;
+		if (find(argb, result))
+			return result;
+
+		result = argb32_to_color_spaces(argb);
+		insert(argb, result);
+		return result;
+	}
+
+	// Looks the color up without computing it on a miss
+	bool find(uint32_t argb, ColorSpaces& result)
+	{
+		uint32_t key = to_key(argb);
+		const Slot& slot = slots[index(key)];
+
+		uint32_t version = slot.version.load(std::memory_order_acquire);
+		if ((version & 1) == 0 && slot.key.load(std::memory_order_relaxed) == key)
+		{
+			uint32_t words[12];
+			for (int i = 0; i < 12; i++)
+				words[i] = slot.values[i].load(std::memory_order_relaxed);
+
+			std::atomic_thread_fence(std::memory_order_acquire);
+			if (slot.version.load(std::memory_order_relaxed) == version)
+			{
+				memcpy(&result, words, sizeof(result));
+				if (shards)
+					count(shards[shard()].hits);
+				return true;
+			}
+		}
+
+		if (shards)
+			count(shards[shard()].misses);
+		return false;
+	}
+
+	void insert(uint32_t argb, const ColorSpaces& value)
+	{
+		uint32_t key = to_key(argb);
+		Slot& slot = slots[index(key)];
+
+		uint32_t version = slot.version.load(std::memory_order_relaxed);
+		if ((version & 1) != 0 || !slot.version.compare_exchange_strong(version, version + 1, std::memory_order_acquire))
+			return;
+
+		std::atomic_thread_fence(std::memory_order_release);
+
+		uint32_t words[12];
+		memcpy(words, &value, sizeof(words));
+
+		slot.key.store(key, std::memory_order_relaxed);
+		for (int i = 0; i < 12; i++)
+			slot.values[i].store(words[i], std::memory_order_relaxed);
+
+		slot.version.store(version + 2, std::memory_order_release);
+		if (shards)
+			count(shards[shard()].inserts);
+	}
+
+	// Drops all entries. Not safe to call while other threads use the cache.
+	void clear()
+	{
+		for (size_t i = 0; i < capacity(); i++)
+			slots[i].key.store(0, std::memory_order_relaxed);
+	}
+
+	// All zeros unless the cache was constructed with track_stats
+	CacheStats stats() const
+	{
+		CacheStats total = { 0, 0, 0 };
+		for (int i = 0; shards && i < stat_shards; i++)
+		{
+			total.hits += shards[i].hits.load(std::memory_order_relaxed);
+			total.misses += shards[i].misses.load(std::memory_order_relaxed);
+			total.inserts += shards[i].inserts.load(std::memory_order_relaxed);
+		}
+		return total;
+	}
+
+	void reset_stats()
+	{
+		for (int i = 0; shards && i < stat_shards; i++)
+		{
+			shards[i].hits.store(0, std::memory_order_relaxed);
+			shards[i].misses.store(0, std::memory_order_relaxed);
+			shards[i].inserts.store(0, std::memory_order_relaxed);
+		}
+	}
+
+private:
+	static_assert(sizeof(ColorSpaces) == 12 * sizeof(uint32_t), "ColorSpaces must be 12 floats");
+
+	struct alignas(64) Slot
+	{
+		std::atomic<uint32_t> version{ 0 }; // odd while a write is in progress
+		std::atomic<uint32_t> key{ 0 };     // 0 marks an empty slot
+		std::atomic<uint32_t> values[12] = {};
+	};
+
+	// Keeps the rgb bits and sets a tag bit so no valid key is 0
+	static uint32_t to_key(uint32_t argb)
+	{
+		return (argb & 0x00ffffff) | 0x01000000;
+	}
+
+	size_t index(uint32_t key) const
+	{
+		return (size_t)((key * 0x9E3779B1u) >> (32 - bits));
+	}
+
+	struct alignas(64) StatShard
+	{
+		std::atomic<uint64_t> hits{ 0 };
+		std::atomic<uint64_t> misses{ 0 };
+		std::atomic<uint64_t> inserts{ 0 };
+	};
+
+	static constexpr int stat_shards = 16;
+
+	// Shard of the calling thread, threads are given shards in turn
+	static int shard()
+	{
+		static std::atomic<unsigned> next{ 0 };
+		static thread_local int index = (int)(next.fetch_add(1, std::memory_order_relaxed) % stat_shards);
+		return index;
+	}
+
+	static void count(std::atomic<uint64_t>& counter)
+	{
+		counter.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	int bits;
+	std::unique_ptr<Slot[]> slots;
+	std::unique_ptr<StatShard[]> shards;  // null when stats are off
+};
+
+} // namespace ok_color
@@ -0,0 +1,205 @@
+#pragma once
+
+#include <cstdint>
+#include "oklab_source.h"
+
+namespace ok_color
+{
+
+// ------------------------ Color ------------------------ //
+
+// A color value that keeps OkLab as its canonical representation and derives the other
+// representations on first use. Each one is computed at most once and cached inline, so chains like
+// color.to_lch() -> darker -> to_hsv() only pay for the conversions they actually need.
+//
+// The representation a color was created from is stored exactly, so reading it back never
+// round trips, and the OkLch operations (darker, lighter, saturate, desaturate, rotated)
+// stay in OkLch without going through sRGB.
+//
+// Not thread safe, even through a const reference: the const accessors fill the caches. Give each
+// thread its own copy (a Color is under 80 bytes) or guard a shared one with a lock.
+class Color
+{
+public:
+	static Color from_oklab(Lab lab)
+	{
+		return Color(lab);
+	}
+
+	static Color from_lch(Lch lch)
+	{
+		Color color(lch_to_oklab(lch));
+		color.lch = lch;
+		color.cached |= has_lch;
+		return color;
+	}
+
+	static Color from_linear_srgb(RGB rgb)
+	{
+		Color color(linear_srgb_to_oklab(rgb));
+		color.linear_rgb = rgb;
+		color.cached |= has_linear_rgb;
+		return color;
+	}
+
+	static Color from_srgb(RGB rgb)
+	{
+		RGB linear_rgb = {
+			srgb_transfer_function_inv(rgb.r),
+			srgb_transfer_function_inv(rgb.g),
+			srgb_transfer_function_inv(rgb.b)
+		};
+
+		Color color = from_linear_srgb(linear_rgb);
+		color.rgb = rgb;
+		color.cached |= has_rgb;
+		return color;
+	}
+
+	static Color from_argb32(uint32_t argb)
+	{
+		return from_srgb(argb32_to_srgb(argb));
+	}
+
+	static Color from_hsv(HSV hsv)
+	{
+		Color color(okhsv_to_oklab(hsv));
+		color.hsv = hsv;
+		color.cached |= has_hsv;
+		return color;
+	}
+
+	static Color from_hsl(HSL hsl)
+	{
+		Color color(okhsl_to_oklab(hsl));
+		color.hsl = hsl;
+		color.cached |= has_hsl;
+		return color;
+	}
+
+	// ------ Conversions ------ //
+
+	Lab to_oklab() const
+	{
+		return lab;
+	}
+
+	Lch to_lch() const
+	{
+		if (!(cached & has_lch))
+		{
+			lch = oklab_to_lch(lab);
+			cached |= has_lch;
+		}
+		return lch;
+	}
+
+	RGB to_linear_srgb() const
+	{
+		if (!(cached & has_linear_rgb))
+		{
+			linear_rgb = oklab_to_linear_srgb(lab);
+			cached |= has_linear_rgb;
+		}
+		return linear_rgb;
+	}
+
+	RGB to_srgb() const
+	{
+		if (!(cached & has_rgb))
+		{
+			RGB linear = to_linear_srgb();
+			rgb = {
+				srgb_transfer_function(linear.r),
+				srgb_transfer_function(linear.g),
+				srgb_transfer_function(linear.b)
+			};
+			cached |= has_rgb;
+		}
+		return rgb;
+	}
+
+	uint32_t to_argb32(uint32_t alpha = 0xff) const
+	{
+		return srgb_to_argb32(to_srgb(), alpha);
+	}
+
+	HSV to_hsv() const
+	{
+		if (!(cached & has_hsv))
+		{
+			hsv = oklab_to_okhsv(lab);
+			cached |= has_hsv;
+		}
+		return hsv;
+	}
+
+	HSL to_hsl() const
+	{
+		if (!(cached & has_hsl))
+		{
+			hsl = oklab_to_okhsl(lab);
+			cached |= has_hsl;
+		}
+		return hsl;
+	}
+
+	// ------ OkLch operations ------ //
+
+	// Same behavior as the Dart OkLch methods: percentages in [0, 1] move lightness or chroma
+	// towards their extremes, rotated takes degrees.
+
+	Color darker(float percentage) const
+	{
+		Lch c = to_lch();
+		return from_lch({ c.l + (0.f - c.l) * percentage, c.c, c.h });
+	}
+
+	Color lighter(float percentage) const
+	{
+		Lch c = to_lch();
+		return from_lch({ c.l + (1.f - c.l) * percentage, c.c, c.h });
+	}
+
+	Color saturate(float percentage) const
+	{
+		Lch c = to_lch();
+		return from_lch({ c.l, c.c + (1.f - c.c) * percentage, c.h });
+	}
+
+	Color desaturate(float percentage) const
+	{
+		Lch c = to_lch();
+		return from_lch({ c.l, c.c + (0.f - c.c) * percentage, c.h });
+	}
+
+	Color rotated(float degrees) const
+	{
+		Lch c = to_lch();
+		float h = fmodf(c.h + degrees * pi / 180.f, 2.f * pi);
+		return from_lch({ c.l, c.c, h < 0.f ? h + 2.f * pi : h });
+	}
+
+private:
+	enum : uint8_t
+	{
+		has_lch = 1 << 0,
+		has_linear_rgb = 1 << 1,
+		has_rgb = 1 << 2,
+		has_hsv = 1 << 3,
+		has_hsl = 1 << 4,
+	};
+
+	explicit Color(Lab lab) : lab(lab) {}
+
+	Lab lab;
+
+	mutable uint8_t cached = 0;
+	mutable Lch lch;
+	mutable RGB linear_rgb;
+	mutable RGB rgb;
+	mutable HSV hsv;
+	mutable HSL hsl;
+};
+
+} // namespace ok_color
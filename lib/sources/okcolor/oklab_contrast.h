@@ -0,0 +1,327 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include "oklab_source.h"
+#include "oklab_parallel.h"
+#include "oklab_srgb8.h"
+#include "oklab_tonal.h"
+
+namespace ok_color
+{
+
+// ------------------------ Luminance ------------------------ //
+
+enum class ContrastMetric
+{
+	wcag,  // WCAG 2 contrast ratio, 1 to 21
+	apca,  // APCA 0.0.98G lightness contrast |Lc|, 0 to about 108
+};
+
+// WCAG 2 relative luminance of linear sRGB
+float relative_luminance(RGB rgb)
+{
+	return 0.2126f * rgb.r + 0.7152f * rgb.g + 0.0722f * rgb.b;
+}
+
+// APCA estimates luminance from the encoded sRGB values with a plain 2.4 exponent, which would
+// take a powf for each transfer function and another for the exponent. Both are tabulated:
+// exactly for 8 bit codes, and interpolated over linear values for colors being solved for
+// (error below 1e-6).
+struct ApcaTables
+{
+	static constexpr int size = 4096;
+
+	float code[256];          // (i / 255)^2.4
+	float linear[size + 1];   // srgb_transfer_function(x)^2.4 at x = i / size
+};
+
+const ApcaTables& apca_tables()
+{
+	static const ApcaTables tables = [] {
+		ApcaTables t;
+		for (int i = 0; i < 256; i++)
+			t.code[i] = powf(i / 255.f, 2.4f);
+		for (int i = 0; i <= ApcaTables::size; i++)
+			t.linear[i] = powf(srgb_transfer_function((float)i / ApcaTables::size), 2.4f);
+		return t;
+	}();
+	return tables;
+}
+
+// Clamps to [0, 1]
+float apca_channel(const ApcaTables& tables, float x)
+{
+	float pos = (x > 0.f ? (x < 1.f ? x : 1.f) : 0.f) * ApcaTables::size;
+	int i = std::min((int)pos, ApcaTables::size - 1);
+	return tables.linear[i] + (pos - i) * (tables.linear[i + 1] - tables.linear[i]);
+}
+
+// APCA luminance with the soft clamp near black applied
+float apca_clamp(float Y)
+{
+	return Y < 0.022f ? Y + powf(0.022f - Y, 1.414f) : Y;
+}
+
+float apca_luminance(const ApcaTables& tables, RGB rgb)
+{
+	return apca_clamp(0.2126729f * apca_channel(tables, rgb.r)
+		+ 0.7151522f * apca_channel(tables, rgb.g)
+		+ 0.0721750f * apca_channel(tables, rgb.b));
+}
+
+float apca_luminance(const ApcaTables& tables, uint32_t argb)
+{
+	return apca_clamp(0.2126729f * tables.code[(argb >> 16) & 0xff]
+		+ 0.7151522f * tables.code[(argb >> 8) & 0xff]
+		+ 0.0721750f * tables.code[argb & 0xff]);
+}
+
+// Luminance as used by metric, for linear sRGB (clamped to [0, 1]) or a packed 0xAARRGGBB color
+float contrast_luminance(RGB rgb, ContrastMetric metric)
+{
+	if (metric == ContrastMetric::apca)
+		return apca_luminance(apca_tables(), rgb);
+	return relative_luminance({ clamp(rgb.r, 0.f, 1.f), clamp(rgb.g, 0.f, 1.f), clamp(rgb.b, 0.f, 1.f) });
+}
+
+float contrast_luminance(uint32_t argb, ContrastMetric metric)
+{
+	if (metric == ContrastMetric::apca)
+		return apca_luminance(apca_tables(), argb);
+	return relative_luminance(argb32_to_linear_srgb(srgb8_tables(), argb));
+}
+
+// ------------------------ Contrast ------------------------ //
+
+float wcag_contrast(float Y1, float Y2)
+{
+	return (std::max(Y1, Y2) + 0.05f) / (std::min(Y1, Y2) + 0.05f);
+}
+
+// Signed Lc: positive for dark text on a light background, negative for light text on a dark one.
+// Luminances are APCA luminances with the soft clamp applied.
+float apca_contrast(float Y_text, float Y_background)
+{
+	if (fabsf(Y_background - Y_text) < 0.0005f)
+		return 0.f;
+
+	if (Y_background > Y_text)
+	{
+		float S = (powf(Y_background, 0.56f) - powf(Y_text, 0.57f)) * 1.14f;
+		return S < 0.1f ? 0.f : (S - 0.027f) * 100.f;
+	}
+
+	float S = (powf(Y_background, 0.65f) - powf(Y_text, 0.62f)) * 1.14f;
+	return S > -0.1f ? 0.f : (S + 0.027f) * 100.f;
+}
+
+// WCAG ratio, or APCA |Lc|, of two luminances from contrast_luminance
+float contrast(float Y_text, float Y_background, ContrastMetric metric)
+{
+	if (metric == ContrastMetric::apca)
+		return fabsf(apca_contrast(Y_text, Y_background));
+	return wcag_contrast(Y_text, Y_background);
+}
+
+// Luminance of the text color reaching contrast target against the background, lighter or darker.
+// May be outside [0, 1] when the target can't be reached in that direction.
+float target_luminance(float Y_background, float target, bool lighter, ContrastMetric metric)
+{
+	if (metric == ContrastMetric::apca)
+	{
+		// Contrasts below Lc 7.3 are reported as 0, so the smallest reachable one is the step to 7.3
+		float S = std::max(target / 100.f + 0.027f, 0.1f) / 1.14f;
+		if (lighter)
+			return powf(powf(Y_background, 0.65f) + S, 1.f / 0.62f);
+
+		float x = powf(Y_background, 0.56f) - S;
+		return x > 0.f ? powf(x, 1.f / 0.57f) : -1.f;
+	}
+
+	return lighter ? target * (Y_background + 0.05f) - 0.05f : (Y_background + 0.05f) / target - 0.05f;
+}
+
+// ------------------------ Contrast solver ------------------------ //
+
+enum class ContrastPolarity
+{
+	lighter,  // text lighter than the background
+	darker,
+	either,   // whichever reaches the target closer to the seed lightness
+};
+
+struct ContrastOptions
+{
+	ContrastMetric metric = ContrastMetric::wcag;
+	ContrastPolarity polarity = ContrastPolarity::either;
+
+	// Solved lightness is within this of the exact one, on the side that meets the target
+	float tolerance = 1e-5f;
+
+	unsigned threads = 0;
+};
+
+// Luminance along the path a seed is solved on: its hue, its chroma capped by the gamut at L
+float path_luminance(const HueBoundary& boundary, float C_max, float L, ContrastMetric metric, const ApcaTables& tables)
+{
+	float C = std::min(C_max, boundary.max_chroma(L));
+	RGB rgb = oklab_to_linear_srgb({ L, C * boundary.a_, C * boundary.b_ });
+
+	if (metric == ContrastMetric::apca)
+		return apca_luminance(tables, rgb);
+	return relative_luminance({ clamp(rgb.r, 0.f, 1.f), clamp(rgb.g, 0.f, 1.f), clamp(rgb.b, 0.f, 1.f) });
+}
+
+// For each (seed, background, target) triple, finds the color with the seed's hue and at most its chroma
+// (less where sRGB doesn't reach it) whose contrast against the background is the target, by solving
+// for OkLch lightness. Colors are never below the target contrast (up to float rounding), except where
+// it can't be reached: those get the strongest contrast possible in the chosen direction.
+//
+// Both metrics turn into a luminance the text has to reach, so the solver only brackets a monotonic
+// function of L. Triples are solved a block at a time, every triple of the block taking one step of
+// the Illinois variant of regula falsi per pass, with the data for each in flat arrays.
+//
+// out receives the colors, achieved (optional) the contrast reached. Returns the number of triples
+// where the target was reached.
+size_t solve_contrast(const Lch* seeds, const uint32_t* backgrounds, const float* targets, size_t count,
+	Lch* out, float* achieved = nullptr, const ContrastOptions& options = {})
+{
+	OKLAB_PROFILE_SCOPE(call, "solve_contrast");
+	const ApcaTables& tables = apca_tables();
+	const ContrastMetric metric = options.metric;
+	const size_t block = 256;
+
+	size_t reached_total = 0;
+	std::mutex mutex;
+
+	parallel_for((count + block - 1) / block, [&](size_t block_begin, size_t block_end) {
+		HueBoundary boundary[block];
+		float C_max[block], Y_background[block];
+		float lo[block], hi[block], f_lo[block], f_hi[block], Y_target[block];
+		int side[block];
+		bool active[block];
+
+		float L_best[block], best_distance[block];
+		bool best_reached[block];
+
+		size_t reached = 0;
+
+		for (size_t b = block_begin; b < block_end; b++)
+		{
+			size_t first = b * block;
+			size_t n = std::min(block, count - first);
+
+			for (size_t i = 0; i < n; i++)
+			{
+				const Lch& seed = seeds[first + i];
+				boundary[i] = HueBoundary(seed.h);
+				C_max[i] = std::max(seed.c, 0.f);
+				Y_background[i] = contrast_luminance(backgrounds[first + i], metric);
+				L_best[i] = NAN;
+				best_distance[i] = INFINITY;
+				best_reached[i] = false;
+			}
+
+			for (int pass = 0; pass < 2; pass++)
+			{
+				bool lighter = pass == 0;
+				if ((lighter && options.polarity == ContrastPolarity::darker) || (!lighter && options.polarity == ContrastPolarity::lighter))
+					continue;
+
+				// Brackets, f(L) = luminance - target goes from f(0) <= 0 to f(1) >= 0
+				bool any = false;
+				for (size_t i = 0; i < n; i++)
+				{
+					Y_target[i] = target_luminance(Y_background[i], targets[first + i], lighter, metric);
+					lo[i] = 0.f;
+					hi[i] = 1.f;
+					f_lo[i] = path_luminance(boundary[i], C_max[i], 0.f, metric, tables) - Y_target[i];
+					f_hi[i] = path_luminance(boundary[i], C_max[i], 1.f, metric, tables) - Y_target[i];
+					side[i] = 0;
+					active[i] = f_lo[i] <= 0.f && f_hi[i] >= 0.f;
+					any = any || active[i];
+				}
+
+				for (int iteration = 0; iteration < 64 && any; iteration++)
+				{
+					any = false;
+					for (size_t i = 0; i < n; i++)
+					{
+						if (!active[i])
+							continue;
+
+						float x = (lo[i] * f_hi[i] - hi[i] * f_lo[i]) / (f_hi[i] - f_lo[i]);
+						x = x > lo[i] && x < hi[i] ? x : 0.5f * (lo[i] + hi[i]);
+						float f = path_luminance(boundary[i], C_max[i], x, metric, tables) - Y_target[i];
+
+						// Illinois: halve the weight of an end point that stays put twice in a row
+						if (f < 0.f)
+						{
+							lo[i] = x;
+							f_lo[i] = f;
+							if (side[i] == -1)
+								f_hi[i] *= 0.5f;
+							side[i] = -1;
+						}
+						else if (f > 0.f)
+						{
+							hi[i] = x;
+							f_hi[i] = f;
+							if (side[i] == 1)
+								f_lo[i] *= 0.5f;
+							side[i] = 1;
+						}
+						else
+						{
+							lo[i] = hi[i] = x;
+							f_lo[i] = f_hi[i] = 0.f;
+						}
+
+						active[i] = hi[i] - lo[i] > options.tolerance;
+						any = any || active[i];
+					}
+				}
+
+				for (size_t i = 0; i < n; i++)
+				{
+					// Lighter text meets the target from above the root, darker text from below.
+					// Out of reach: the extreme in this direction. Targets every color meets: the other extreme.
+					bool ok = lighter ? f_hi[i] >= 0.f : f_lo[i] <= 0.f;
+					float L = lighter ? (f_lo[i] > 0.f ? lo[i] : hi[i]) : (f_hi[i] < 0.f ? hi[i] : lo[i]);
+
+					float distance = fabsf(L - seeds[first + i].l);
+					if ((ok && !best_reached[i]) || (ok == best_reached[i] && distance < best_distance[i]))
+					{
+						L_best[i] = L;
+						best_distance[i] = distance;
+						best_reached[i] = ok;
+					}
+				}
+			}
+
+			for (size_t i = 0; i < n; i++)
+			{
+				float L = L_best[i];
+				float C = std::min(C_max[i], boundary[i].max_chroma(L));
+				out[first + i] = { L, C, seeds[first + i].h };
+
+				if (achieved)
+				{
+					float Y = path_luminance(boundary[i], C_max[i], L, metric, tables);
+					achieved[first + i] = contrast(Y, Y_background[i], metric);
+				}
+				reached += best_reached[i];
+			}
+		}
+
+		std::lock_guard<std::mutex> lock(mutex);
+		reached_total += reached;
+	}, options.threads, 4);
+
+	return reached_total;
+}
+
+} // namespace ok_color
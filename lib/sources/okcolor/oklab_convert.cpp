@@ -0,0 +1,130 @@
+// Converts binary PPM, PAM and PFM images between sRGB and OkLab, OkLch, OkHSV or OkHSL. Both files
+// are memory mapped and converted a band of rows at a time, the rows of a band in parallel, and the
+// pages of each band are released once it is written, so images larger than RAM convert with
+// bounded resident memory.
+//
+//   oklab_convert [options] in out
+//
+//   --from SPACE     color space of the input: srgb (default), oklab, oklch, okhsv or okhsl
+//   --to SPACE       color space of the output: srgb, oklab (default), oklch, okhsv or okhsl
+//   --clip METHOD    clipping of out of gamut colors: none (default), preserve_chroma, project_to_0_5,
+//                    project_to_L_cusp, adaptive_L0_0_5 or adaptive_L0_L_cusp
+//   --alpha A        alpha of the adaptive clipping methods (default 0.05)
+//   --depth D        bits per sample of sRGB output: 8, 16 or 32 for PFM (default: 32 when the output
+//                    ends in .pfm, else the depth of the input, 8 for PFM input)
+//   --band-mb N      megabytes of input converted between page releases (default 64)
+//   --threads N      threads per band (default: all cores)
+//   --profile FILE   writes the time spent on each band as Chrome trace events, or latency
+//                    statistics when FILE ends in .csv. Needs a build with -DOKLAB_PROFILE.
+//
+// sRGB is gamma encoded in PPM and PAM files (8 or 16 bit samples) and linear in PFM files. The other
+// spaces are read and written as PFM, with OkLch hue in radians and OkHSV and OkHSL hue in [0, 1].
+// Integer outputs are PAM with alpha when they end in .pam, PPM when they end in .ppm, and have the
+// channels of the input otherwise. Alpha is kept from PAM to PAM and set opaque when only the output
+// has it. PFM output to a .ppm or .pam path, and integer output to a .pfm path, are refused.
+//
+// Prints the size and throughput of the conversion. Exits with 0 on success and 2 on errors.
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include "oklab_image_convert.h"
+
+using namespace ok_color;
+
+int main(int argc, char** argv)
+{
+	ImageConversion options;
+	const char* profile_path = nullptr;
+	std::vector<const char*> paths;
+
+	for (int i = 1; i < argc; i++)
+	{
+		bool has_value = i + 1 < argc;
+		bool ok = true;
+		if (!strcmp(argv[i], "--from") && has_value)
+			ok = parse_image_space(argv[++i], options.from);
+		else if (!strcmp(argv[i], "--to") && has_value)
+			ok = parse_image_space(argv[++i], options.to);
+		else if (!strcmp(argv[i], "--clip") && has_value)
+			ok = parse_gamut_clip(argv[++i], options.clip);
+		else if (!strcmp(argv[i], "--alpha") && has_value)
+			options.alpha = (float)atof(argv[++i]);
+		else if (!strcmp(argv[i], "--depth") && has_value)
+		{
+			options.depth = atoi(argv[++i]);
+			ok = options.depth == 8 || options.depth == 16 || options.depth == 32;
+		}
+		else if (!strcmp(argv[i], "--band-mb") && has_value)
+			options.band_mb = atof(argv[++i]);
+		else if (!strcmp(argv[i], "--threads") && has_value)
+			options.threads = (unsigned)atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--profile") && has_value)
+		{
+			profile_path = argv[++i];
+			if (!profiling_enabled)
+			{
+				fprintf(stderr, "--profile needs a build with -DOKLAB_PROFILE\n");
+				return 2;
+			}
+		}
+		else if (argv[i][0] == '-')
+		{
+			fprintf(stderr, "unknown option %s\n", argv[i]);
+			return 2;
+		}
+		else
+			paths.push_back(argv[i]);
+
+		if (!ok)
+		{
+			fprintf(stderr, "invalid value for %s: %s\n", argv[i - 1], argv[i]);
+			return 2;
+		}
+	}
+
+	if (paths.size() != 2)
+	{
+		fprintf(stderr, "usage: oklab_convert [--from SPACE] [--to SPACE] [--clip METHOD] [--alpha A] [--depth 8|16|32] [--band-mb N] [--threads N] [--profile FILE] in out\n");
+		return 2;
+	}
+
+	const auto start = std::chrono::steady_clock::now();
+	ImageConvertResult result = convert_image(paths[0], paths[1], options);
+
+	switch (result.status)
+	{
+	case ImageConvertStatus::unreadable_input:
+		fprintf(stderr, "%s: can't read a binary PPM, PAM or PFM image\n", paths[0]);
+		return 2;
+	case ImageConvertStatus::input_not_pfm:
+		fprintf(stderr, "%s: OkLab, OkLch, OkHSV and OkHSL images must be PFM\n", paths[0]);
+		return 2;
+	case ImageConvertStatus::output_extension:
+		fprintf(stderr, "%s: PFM output needs a .pfm path, 8 and 16 bit output a .ppm or .pam path\n", paths[1]);
+		return 2;
+	case ImageConvertStatus::output_not_created:
+		fprintf(stderr, "%s: can't create the output\n", paths[1]);
+		return 2;
+	default:
+		break;
+	}
+
+	const PnmHeader& in = result.in;
+	const PnmHeader& out = result.out;
+	const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	const double pixels = (double)in.width * in.height;
+	printf("%s -> %s: %dx%d, %.3f s, %.1f Mpixels/s, %.1f MB/s in, %.1f MB/s out\n",
+		paths[0], paths[1], in.width, in.height, seconds, pixels / seconds * 1e-6,
+		(double)in.row_bytes() * in.height / seconds / 1048576.0, (double)out.row_bytes() * out.height / seconds / 1048576.0);
+
+	if (profile_path && !(path_ends_with(profile_path, ".csv") ? write_profile_csv(profile_path) : write_profile_trace(profile_path)))
+	{
+		fprintf(stderr, "%s: can't write the profile\n", profile_path);
+		return 2;
+	}
+
+	return 0;
+}
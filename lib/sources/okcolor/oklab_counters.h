@@ -0,0 +1,177 @@
+#pragma once
+
+#include <cstdint>
+
+#if defined(OKLAB_COUNTERS)
+#include <atomic>
+#include <mutex>
+#include <vector>
+#endif
+
+namespace ok_color
+{
+
+// ------------------------ Instrumentation counters ------------------------ //
+
+// Counts how often the conversions take their expensive or unusual branches, to tell which fast
+// paths are worth it for a workload. Compiled in only when OKLAB_COUNTERS is defined (for example
+// -DOKLAB_COUNTERS), otherwise OKLAB_COUNT expands to nothing and snapshots are all zeros.
+//
+// The counts come from the generic conversions of oklab_source.h, so the float functions, the
+// gamut templates, the hue table batches and the Jacobians all count the same events.
+//
+// Each thread increments its own counters, without atomic read-modify-writes or shared cache
+// lines. Snapshots add up the live threads and those that have exited.
+enum class Counter
+{
+	gamut_intersection_lower,  // find_gamut_intersection, closed form below the cusp
+	gamut_intersection_upper,  // find_gamut_intersection, Halley step above the cusp
+	gamut_clip_in_gamut,       // gamut clipping returned early, the color was in gamut
+	gamut_clip_clipped,        // gamut clipping computed
+	okhsl_zero_chroma,         // oklab_to_okhsl with C = 0, which divides by zero and gives NaN
+	okhsv_zero_chroma,         // oklab_to_okhsv with C = 0, same
+	okhsl_out_of_range,        // OkHSL to RGB with linear values outside [0, 1]
+	okhsv_out_of_range,        // OkHSV to RGB with linear values outside [0, 1]
+	count,
+};
+
+constexpr int counter_count = (int)Counter::count;
+
+const char* counter_name(Counter counter)
+{
+	static const char* names[counter_count] = {
+		"gamut_intersection_lower",
+		"gamut_intersection_upper",
+		"gamut_clip_in_gamut",
+		"gamut_clip_clipped",
+		"okhsl_zero_chroma",
+		"okhsv_zero_chroma",
+		"okhsl_out_of_range",
+		"okhsv_out_of_range",
+	};
+	return (int)counter >= 0 && (int)counter < counter_count ? names[(int)counter] : "";
+}
+
+struct CounterSnapshot
+{
+	uint64_t values[counter_count] = {};
+
+	uint64_t operator[](Counter counter) const
+	{
+		return values[(int)counter];
+	}
+};
+
+#if defined(OKLAB_COUNTERS)
+
+constexpr bool counters_enabled = true;
+
+// Counters of one thread. Only the owning thread writes them, so an increment is a relaxed load and
+// store, and other threads can still read them while taking a snapshot.
+struct ThreadCounters
+{
+	std::atomic<uint64_t> values[counter_count] = {};
+
+	ThreadCounters();
+	~ThreadCounters();
+};
+
+struct CounterRegistry
+{
+	std::mutex mutex;
+	std::vector<ThreadCounters*> threads;
+	uint64_t exited[counter_count] = {};    // totals of the threads that have exited
+	uint64_t baseline[counter_count] = {};  // totals at the last reset
+};
+
+CounterRegistry& counter_registry()
+{
+	// Never destroyed, threads can exit after static destructors have run
+	static CounterRegistry* registry = new CounterRegistry();
+	return *registry;
+}
+
+ThreadCounters::ThreadCounters()
+{
+	CounterRegistry& registry = counter_registry();
+	std::lock_guard<std::mutex> lock(registry.mutex);
+	registry.threads.push_back(this);
+}
+
+ThreadCounters::~ThreadCounters()
+{
+	CounterRegistry& registry = counter_registry();
+	std::lock_guard<std::mutex> lock(registry.mutex);
+	for (int i = 0; i < counter_count; i++)
+		registry.exited[i] += values[i].load(std::memory_order_relaxed);
+	for (size_t i = 0; i < registry.threads.size(); i++)
+	{
+		if (registry.threads[i] == this)
+		{
+			registry.threads[i] = registry.threads.back();
+			registry.threads.pop_back();
+			break;
+		}
+	}
+}
+
+void count_event(Counter counter)
+{
+	static thread_local ThreadCounters counters;
+	std::atomic<uint64_t>& value = counters.values[(int)counter];
+	value.store(value.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+}
+
+// Totals over every thread, with the registry locked
+void counter_totals(const CounterRegistry& registry, uint64_t* totals)
+{
+	for (int i = 0; i < counter_count; i++)
+	{
+		totals[i] = registry.exited[i];
+		for (ThreadCounters* thread : registry.threads)
+			totals[i] += thread->values[i].load(std::memory_order_relaxed);
+	}
+}
+
+// Totals since the start or the last reset, over every thread
+CounterSnapshot counters_snapshot()
+{
+	CounterRegistry& registry = counter_registry();
+	std::lock_guard<std::mutex> lock(registry.mutex);
+
+	CounterSnapshot snapshot;
+	counter_totals(registry, snapshot.values);
+	for (int i = 0; i < counter_count; i++)
+		snapshot.values[i] -= registry.baseline[i];
+	return snapshot;
+}
+
+// Later snapshots count from here. The threads' counters are left alone, since they can only be
+// written by their owner.
+void counters_reset()
+{
+	CounterRegistry& registry = counter_registry();
+	std::lock_guard<std::mutex> lock(registry.mutex);
+	counter_totals(registry, registry.baseline);
+}
+
+#define OKLAB_COUNT(counter) ::ok_color::count_event(::ok_color::Counter::counter)
+
+#else
+
+constexpr bool counters_enabled = false;
+
+CounterSnapshot counters_snapshot()
+{
+	return {};
+}
+
+void counters_reset()
+{
+}
+
+#define OKLAB_COUNT(counter) ((void)0)
+
+#endif
+
+} // namespace ok_color
@@ -0,0 +1,317 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <numeric>
+#include <vector>
+#include "oklab_source.h"
+#include "oklab_parallel.h"
+#include "oklab_srgb8.h"
+
+namespace ok_color
+{
+
+// ------------------------ Color distances ------------------------ //
+
+// Euclidean distance in OkLab
+float delta_e(Lab x, Lab y)
+{
+	float dL = x.L - y.L;
+	float da = x.a - y.a;
+	float db = x.b - y.b;
+	return sqrtf(dL * dL + da * da + db * db);
+}
+
+// out[i] = delta_e(x[i], y[i])
+void delta_e(const Lab* x, const Lab* y, float* out, size_t count, unsigned threads = 0)
+{
+	OKLAB_PROFILE_SCOPE(call, "delta_e");
+	parallel_for(count, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++)
+			out[i] = delta_e(x[i], y[i]);
+	}, threads, 65536);
+}
+
+// Packed 0xAARRGGBB pixels, alpha is ignored
+void delta_e_argb32(const uint32_t* x, const uint32_t* y, float* out, size_t count, unsigned threads = 0)
+{
+	OKLAB_PROFILE_SCOPE(call, "delta_e_argb32");
+	const Srgb8Tables& tables = srgb8_tables();
+
+	parallel_for(count, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++)
+		{
+			if (((x[i] ^ y[i]) & 0x00ffffff) == 0)
+			{
+				out[i] = 0.f;
+				continue;
+			}
+
+			out[i] = delta_e(
+				linear_srgb_to_oklab_fast(argb32_to_linear_srgb(tables, x[i])),
+				linear_srgb_to_oklab_fast(argb32_to_linear_srgb(tables, y[i])));
+		}
+	}, threads, 16384);
+}
+
+// ------ Distance matrices ------ //
+
+// Planar copy of a list of colors, so distance loops over it vectorize
+struct LabPlanes
+{
+	std::vector<float> L, a, b;
+
+	LabPlanes() = default;
+
+	LabPlanes(const Lab* colors, size_t count) : L(count), a(count), b(count)
+	{
+		for (size_t i = 0; i < count; i++)
+		{
+			L[i] = colors[i].L;
+			a[i] = colors[i].a;
+			b[i] = colors[i].b;
+		}
+	}
+
+	size_t size() const
+	{
+		return L.size();
+	}
+
+	// out[j] = squared distance from lab to colors [begin, end)
+	void squared_distances(Lab lab, size_t begin, size_t end, float* out) const
+	{
+		const float* Ls = L.data();
+		const float* as = a.data();
+		const float* bs = b.data();
+
+		for (size_t j = begin; j < end; j++)
+		{
+			float dL = Ls[j] - lab.L;
+			float da = as[j] - lab.a;
+			float db = bs[j] - lab.b;
+			out[j - begin] = dL * dL + da * da + db * db;
+		}
+	}
+};
+
+// Row major rows x cols matrix of distances, out[i * cols + j] = delta_e(x[i], y[j]).
+// Columns are processed in blocks that stay in L1 cache while every row of a thread's range is done.
+void distance_matrix(const Lab* x, size_t rows, const Lab* y, size_t cols, float* out, unsigned threads = 0)
+{
+	OKLAB_PROFILE_SCOPE(call, "distance_matrix");
+	LabPlanes planes(y, cols);
+	const size_t block = 1024;
+
+	parallel_for(rows, [&](size_t begin, size_t end) {
+		for (size_t start = 0; start < cols; start += block)
+		{
+			size_t stop = std::min(cols, start + block);
+			for (size_t i = begin; i < end; i++)
+			{
+				float* row = out + i * cols;
+				planes.squared_distances(x[i], start, stop, row + start);
+				for (size_t j = start; j < stop; j++)
+					row[j] = sqrtf(row[j]);
+			}
+		}
+	}, threads, std::max<size_t>(1, 65536 / std::max<size_t>(cols, 1)));
+}
+
+// ------ Close pairs ------ //
+
+struct ColorPair
+{
+	uint32_t i, j;
+	float distance;
+};
+
+// Colors sorted into a uniform grid of cubic cells, stored as runs of colors per occupied cell.
+// Cell keys pack the integer cell coordinates (L slowest, then a, then b) into 21 bits each,
+// so the three cells along b around a given cell are next to each other in key order.
+struct ColorGrid
+{
+	float cell;
+	float origin[3];
+
+	std::vector<uint32_t> order;   // original index of each sorted color
+	LabPlanes planes;              // sorted colors
+	std::vector<uint64_t> keys;    // occupied cells, ascending
+	std::vector<uint32_t> starts;  // first sorted color of each cell, plus the total count at the end
+
+	static constexpr uint64_t axis_cells = 1u << 21;
+
+	ColorGrid(const Lab* colors, size_t count, float cell, const float (&origin)[3]) : cell(cell), origin{ origin[0], origin[1], origin[2] }
+	{
+		std::vector<uint64_t> sort_keys(count);
+		for (size_t i = 0; i < count; i++)
+			sort_keys[i] = key(colors[i]);
+
+		order.resize(count);
+		std::iota(order.begin(), order.end(), 0u);
+		std::sort(order.begin(), order.end(), [&](uint32_t x, uint32_t y) {
+			return sort_keys[x] != sort_keys[y] ? sort_keys[x] < sort_keys[y] : x < y;
+		});
+
+		std::vector<Lab> sorted(count);
+		for (size_t i = 0; i < count; i++)
+		{
+			sorted[i] = colors[order[i]];
+			if (i == 0 || sort_keys[order[i]] != keys.back())
+			{
+				keys.push_back(sort_keys[order[i]]);
+				starts.push_back((uint32_t)i);
+			}
+		}
+		starts.push_back((uint32_t)count);
+		planes = LabPlanes(sorted.data(), count);
+	}
+
+	uint64_t coordinate(float x, int axis) const
+	{
+		float t = (x - origin[axis]) / cell;
+		return (uint64_t)(t > 0.f ? std::min(t, (float)(axis_cells - 1)) : 0.f);
+	}
+
+	uint64_t key(Lab lab) const
+	{
+		return (coordinate(lab.L, 0) << 42) | (coordinate(lab.a, 1) << 21) | coordinate(lab.b, 2);
+	}
+};
+
+// Pairs of colors within epsilon of each other (inclusive), sorted by i then j.
+// same_set: x and y are the same grid, only pairs with i < j are reported.
+//
+// Cells are at least epsilon wide, so only the 27 cells around a cell can hold colors close enough.
+// Cells of x are visited in key order, so for each of the 9 rows of neighbors along b, the position
+// of the row in y only moves forward and is found with a cursor instead of a search.
+std::vector<ColorPair> close_pairs(const ColorGrid& x, const ColorGrid& y, bool same_set, float epsilon, unsigned threads)
+{
+	float epsilon2 = epsilon * epsilon;
+	std::vector<ColorPair> pairs;
+	std::mutex mutex;
+
+	const uint64_t mask = ColorGrid::axis_cells - 1;
+
+	parallel_for(x.keys.size(), [&](size_t begin, size_t end) {
+		std::vector<ColorPair> local;
+		std::vector<float> d2;
+		size_t cursors[9];
+		std::fill(cursors, cursors + 9, SIZE_MAX);
+
+		for (size_t cx = begin; cx < end; cx++)
+		{
+			uint64_t key = x.keys[cx];
+			uint64_t L = key >> 42, a = (key >> 21) & mask, b = key & mask;
+
+			for (int row = 0; row < 9; row++)
+			{
+				int dL = row / 3 - 1, da = row % 3 - 1;
+				if ((dL < 0 && L == 0) || (da < 0 && a == 0) || L + dL > mask || a + da > mask)
+					continue;
+
+				uint64_t row_key = ((L + dL) << 42) | ((a + da) << 21);
+				uint64_t first = row_key | (b > 0 ? b - 1 : 0);
+				uint64_t last = row_key | std::min(b + 1, mask);
+
+				size_t& cursor = cursors[row];
+				if (cursor == SIZE_MAX)
+					cursor = std::lower_bound(y.keys.begin(), y.keys.end(), first) - y.keys.begin();
+				while (cursor < y.keys.size() && y.keys[cursor] < first)
+					cursor++;
+
+				for (size_t cy = cursor; cy < y.keys.size() && y.keys[cy] <= last; cy++)
+				{
+					size_t y_begin = y.starts[cy], y_end = y.starts[cy + 1];
+
+					for (size_t i = x.starts[cx]; i < x.starts[cx + 1]; i++)
+					{
+						// Each pair once, from the color that comes first in the grid
+						size_t start = same_set ? std::max(y_begin, i + 1) : y_begin;
+						if (start >= y_end)
+							continue;
+
+						Lab lab = { x.planes.L[i], x.planes.a[i], x.planes.b[i] };
+						d2.resize(y_end - start);
+						y.planes.squared_distances(lab, start, y_end, d2.data());
+
+						for (size_t j = start; j < y_end; j++)
+						{
+							if (d2[j - start] <= epsilon2)
+							{
+								uint32_t xi = x.order[i], yj = y.order[j];
+								if (same_set && xi > yj)
+									std::swap(xi, yj);
+								local.push_back({ xi, yj, sqrtf(d2[j - start]) });
+							}
+						}
+					}
+				}
+			}
+		}
+
+		std::lock_guard<std::mutex> lock(mutex);
+		pairs.insert(pairs.end(), local.begin(), local.end());
+	}, threads, 256);
+
+	std::sort(pairs.begin(), pairs.end(), [](const ColorPair& p, const ColorPair& q) {
+		return p.i != q.i ? p.i < q.i : p.j < q.j;
+	});
+	return pairs;
+}
+
+// Cell size and origin of a grid covering both sets of colors, with cells at least epsilon wide
+void grid_layout(const Lab* x, size_t x_count, const Lab* y, size_t y_count, float epsilon, float& cell, float (&origin)[3])
+{
+	float lo[3] = { INFINITY, INFINITY, INFINITY };
+	float hi[3] = { -INFINITY, -INFINITY, -INFINITY };
+	auto extend = [&](const Lab* colors, size_t count) {
+		for (size_t i = 0; i < count; i++)
+		{
+			float v[3] = { colors[i].L, colors[i].a, colors[i].b };
+			for (int axis = 0; axis < 3; axis++)
+			{
+				lo[axis] = fminf(lo[axis], v[axis]);
+				hi[axis] = fmaxf(hi[axis], v[axis]);
+			}
+		}
+	};
+	extend(x, x_count);
+	extend(y, y_count);
+
+	float extent = 0.f;
+	for (int axis = 0; axis < 3; axis++)
+	{
+		origin[axis] = lo[axis] <= hi[axis] ? lo[axis] : 0.f;
+		extent = std::max(extent, hi[axis] - lo[axis]);
+	}
+
+	// Keeps cell coordinates within their 21 bits
+	cell = std::max({ epsilon, extent / (ColorGrid::axis_cells - 2), 1e-30f });
+}
+
+// Pairs i < j of colors within epsilon of each other, e.g. near duplicates in a palette or asset library.
+// Runs in time proportional to the number of colors plus the number of close pairs, rather than N x N.
+std::vector<ColorPair> close_pairs(const Lab* colors, size_t count, float epsilon, unsigned threads = 0)
+{
+	OKLAB_PROFILE_SCOPE(call, "close_pairs");
+	float cell, origin[3];
+	grid_layout(colors, count, nullptr, 0, epsilon, cell, origin);
+
+	ColorGrid grid(colors, count, cell, origin);
+	return close_pairs(grid, grid, true, epsilon, threads);
+}
+
+// Pairs (i, j) with x[i] and y[j] within epsilon of each other
+std::vector<ColorPair> close_pairs(const Lab* x, size_t x_count, const Lab* y, size_t y_count, float epsilon, unsigned threads = 0)
+{
+	OKLAB_PROFILE_SCOPE(call, "close_pairs");
+	float cell, origin[3];
+	grid_layout(x, x_count, y, y_count, epsilon, cell, origin);
+
+	return close_pairs(ColorGrid(x, x_count, cell, origin), ColorGrid(y, y_count, cell, origin), false, epsilon, threads);
+}
+
+} // namespace ok_color
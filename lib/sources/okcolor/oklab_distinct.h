@@ -0,0 +1,255 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "oklab_source.h"
+#include "oklab_parallel.h"
+#include "oklab_distance.h"
+#include "oklab_kmeans.h"
+
+namespace ok_color
+{
+
+// ------------------------ Distinct palettes ------------------------ //
+
+struct DistinctPaletteOptions
+{
+	int colors = 8;
+
+	// Region the colors are picked from, intersected with the sRGB gamut. Where the gamut doesn't reach
+	// C_min at some lightness and hue, colors there get the most chroma the gamut allows.
+	float L_min = 0.4f, L_max = 0.9f;
+	float C_min = 0.04f, C_max = 0.4f;
+
+	// Colors the palette has to stay away from as well, e.g. the chart background, not part of the result
+	const Lab* fixed = nullptr;
+	size_t fixed_count = 0;
+
+	// Independent runs from different seeds, spread across threads, the best one is kept
+	int restarts = 8;
+
+	// Refinement sweeps per run, and moves tried for each color moved in a sweep
+	int iterations = 50;
+	int candidates = 8;
+
+	uint64_t seed = 1;
+	unsigned threads = 0;
+};
+
+struct DistinctPalette
+{
+	std::vector<Lab> colors;
+
+	// Smallest OkLab distance between two colors, or between a color and a fixed color
+	// (infinity with fewer than two colors in total)
+	float min_distance;
+};
+
+// Moves lab into the region of the options: L and C clamped to their ranges,
+// then C reduced at constant lightness and hue until the color is in sRGB
+Lab constrain_to_region(Lab lab, const DistinctPaletteOptions& options)
+{
+	float L = clamp(lab.L, options.L_min, options.L_max);
+	float C = sqrtf(lab.a * lab.a + lab.b * lab.b);
+	float a_ = C > 1e-7f ? lab.a / C : 1.f;
+	float b_ = C > 1e-7f ? lab.b / C : 0.f;
+	C = clamp(C, options.C_min, options.C_max);
+
+	RGB rgb = oklab_to_linear_srgb({ L, C * a_, C * b_ });
+	if (rgb.r < 0.f || rgb.g < 0.f || rgb.b < 0.f || rgb.r > 1.f || rgb.g > 1.f || rgb.b > 1.f)
+	{
+		// Slightly inside, find_gamut_intersection is only accurate to a few 1e-6
+		C *= std::max(find_gamut_intersection(a_, b_, L, C, L), 0.f) * 0.9999f;
+	}
+
+	return { L, C * a_, C * b_ };
+}
+
+// One run: farthest point seeding from a random sample of the region, then hill climbing on the
+// colors closest to their neighbors, trying a batch of moves for each. A color only moves when
+// that increases its distance to its nearest neighbor, so the smallest distance of the palette
+// never decreases.
+DistinctPalette distinct_palette_run(const DistinctPaletteOptions& options, uint64_t seed)
+{
+	uint64_t counter = 0;
+	auto random = [&] {
+		return (splitmix64(seed ^ splitmix64(counter++)) >> 40) * (1.f / 16777216.f);
+	};
+
+	const size_t fixed = options.fixed ? options.fixed_count : 0;
+	const size_t count = (size_t)std::max(options.colors, 0);
+	const size_t total = fixed + count;
+
+	// ------ Seeding ------ //
+
+	const size_t pool_size = std::max<size_t>(1024, 32 * count);
+	std::vector<Lab> pool(pool_size);
+	for (size_t i = 0; i < pool_size; i++)
+	{
+		float h = 2.f * pi * random();
+		float C = options.C_min + (options.C_max - options.C_min) * random();
+		float L = options.L_min + (options.L_max - options.L_min) * random();
+		pool[i] = constrain_to_region({ L, C * cosf(h), C * sinf(h) }, options);
+	}
+
+	LabPlanes pool_planes(pool.data(), pool_size);
+	std::vector<float> nearest(pool_size, INFINITY), d2(std::max(pool_size, total));
+
+	auto pick = [&](Lab lab) {
+		pool_planes.squared_distances(lab, 0, pool_size, d2.data());
+		for (size_t j = 0; j < pool_size; j++)
+			nearest[j] = std::min(nearest[j], d2[j]);
+	};
+
+	std::vector<Lab> colors(options.fixed, options.fixed + fixed);
+	for (const Lab& lab : colors)
+		pick(lab);
+
+	for (size_t k = 0; k < count; k++)
+	{
+		size_t best = (size_t)(random() * pool_size) % pool_size;
+		if (!colors.empty())
+			best = std::max_element(nearest.begin(), nearest.end()) - nearest.begin();
+
+		colors.push_back(pool[best]);
+		pick(pool[best]);
+	}
+
+	// ------ Refinement ------ //
+
+	LabPlanes planes(colors.data(), total);
+
+	// Squared distance from color i to its nearest neighbor, with lab in place of color i
+	auto nearest_d2 = [&](size_t i, Lab lab) {
+		planes.squared_distances(lab, 0, total, d2.data());
+		d2[i] = INFINITY;
+		float best = INFINITY;
+		for (size_t j = 0; j < total; j++)
+			best = d2[j] < best ? d2[j] : best;
+		return best;
+	};
+
+	std::vector<float> own(total);
+	auto palette_min = [&] {
+		float best = INFINITY;
+		for (size_t i = fixed; i < total; i++)
+		{
+			own[i] = nearest_d2(i, colors[i]);
+			best = std::min(best, own[i]);
+		}
+		return best;
+	};
+
+	float min_d2 = palette_min();
+
+	// Each color has its own step, longer after a move and shorter after a failed one
+	std::vector<float> steps(total, min_d2 < INFINITY ? 0.25f * sqrtf(min_d2) : 0.f);
+	for (int iteration = 0; iteration < options.iterations; iteration++)
+	{
+		bool moved = false, tried = false;
+
+		// Colors well clear of their neighbors can't raise the minimum
+		float limit = min_d2 * 1.05f * 1.05f;
+
+		for (size_t i = fixed; i < total; i++)
+		{
+			if (own[i] > limit || steps[i] < 1e-4f)
+				continue;
+			tried = true;
+
+			// First candidate straight away from the nearest neighbor, the others in random directions
+			planes.squared_distances(colors[i], 0, total, d2.data());
+			d2[i] = INFINITY;
+			size_t neighbor = std::min_element(d2.begin(), d2.begin() + total) - d2.begin();
+
+			Lab best = colors[i];
+			float best_d2 = own[i];
+			for (int c = 0; c < options.candidates; c++)
+			{
+				float dL, da, db;
+				if (c == 0)
+				{
+					dL = colors[i].L - colors[neighbor].L;
+					da = colors[i].a - colors[neighbor].a;
+					db = colors[i].b - colors[neighbor].b;
+				}
+				else
+				{
+					float z = 2.f * random() - 1.f;
+					float h = 2.f * pi * random();
+					float r = sqrtf(1.f - z * z);
+					dL = z;
+					da = r * cosf(h);
+					db = r * sinf(h);
+				}
+
+				float length = sqrtf(dL * dL + da * da + db * db);
+				if (length == 0.f)
+					continue;
+
+				float s = steps[i] / length;
+				Lab candidate = constrain_to_region({ colors[i].L + s * dL, colors[i].a + s * da, colors[i].b + s * db }, options);
+
+				float candidate_d2 = nearest_d2(i, candidate);
+				if (candidate_d2 > best_d2)
+				{
+					best = candidate;
+					best_d2 = candidate_d2;
+				}
+			}
+
+			if (best_d2 > own[i])
+			{
+				colors[i] = best;
+				planes.L[i] = best.L;
+				planes.a[i] = best.a;
+				planes.b[i] = best.b;
+				steps[i] *= 1.5f;
+				moved = true;
+			}
+			else
+				steps[i] *= 0.5f;
+		}
+
+		if (!tried)
+			break;
+
+		// Distances to the moved colors changed for their neighbors as well
+		if (moved)
+			min_d2 = palette_min();
+	}
+
+	DistinctPalette result;
+	result.colors.assign(colors.begin() + fixed, colors.end());
+	result.min_distance = sqrtf(min_d2);
+	return result;
+}
+
+// Colors as far apart from each other in OkLab as possible, maximizing the smallest distance
+// between any two of them, all inside sRGB and the lightness and chroma bounds of the options.
+//
+// Colors are in the order they were seeded, farthest point first, so a prefix of the palette
+// is also well spread out. The result only depends on the seed, not on the number of threads.
+DistinctPalette distinct_palette(const DistinctPaletteOptions& options = {})
+{
+	OKLAB_PROFILE_SCOPE(call, "distinct_palette");
+	int restarts = std::max(options.restarts, 1);
+	std::vector<DistinctPalette> runs(restarts);
+
+	parallel_for((size_t)restarts, [&](size_t begin, size_t end) {
+		for (size_t r = begin; r < end; r++)
+			runs[r] = distinct_palette_run(options, splitmix64(options.seed ^ splitmix64(r)));
+	}, options.threads, 1);
+
+	size_t best = 0;
+	for (size_t r = 1; r < runs.size(); r++)
+	{
+		if (runs[r].min_distance > runs[best].min_distance)
+			best = r;
+	}
+	return runs[best];
+}
+
+} // namespace ok_color
@@ -0,0 +1,371 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "oklab_source.h"
+#include "oklab_palette_index.h"
+#include "oklab_srgb8.h"
+
+namespace ok_color
+{
+
+// ------------------------ Threshold tiles ------------------------ //
+
+// Ranks 0..63 of the 8x8 Bayer matrix, row major
+const uint16_t* bayer_tile()
+{
+	static const std::vector<uint16_t> tile = [] {
+		std::vector<uint16_t> ranks(64);
+		for (int y = 0; y < 8; y++)
+		{
+			for (int x = 0; x < 8; x++)
+			{
+				// Bit reversed interleaving of x ^ y and y
+				int xy = x ^ y;
+				int rank = 0;
+				for (int bit = 0; bit < 3; bit++)
+					rank = (rank << 2) | (((xy >> bit) & 1) << 1) | ((y >> bit) & 1);
+				ranks[y * 8 + x] = (uint16_t)rank;
+			}
+		}
+		return ranks;
+	}();
+
+	return tile.data();
+}
+
+// Ranks 0..4095 of a 64x64 blue noise tile, row major, made with the void and cluster method.
+// Computed on first use (a few tens of milliseconds).
+const uint16_t* blue_noise_tile()
+{
+	static const std::vector<uint16_t> tile = [] {
+		const int size = 64;
+		const int mask = size - 1;
+		const int n = size * size;
+		const float sigma = 1.5f;
+
+		// Gaussian energy around a point, on a torus
+		std::vector<float> kernel(n);
+		for (int y = 0; y < size; y++)
+		{
+			for (int x = 0; x < size; x++)
+			{
+				int dx = std::min(x, size - x);
+				int dy = std::min(y, size - y);
+				kernel[y * size + x] = expf(-(dx * dx + dy * dy) / (2.f * sigma * sigma));
+			}
+		}
+
+		std::vector<uint8_t> pattern(n, 0);
+		std::vector<float> energy(n, 0.f);
+
+		auto toggle = [&](int p) {
+			float sign = pattern[p] ? -1.f : 1.f;
+			pattern[p] ^= 1;
+
+			int px = p & mask, py = p / size;
+			for (int y = 0; y < size; y++)
+				for (int x = 0; x < size; x++)
+					energy[y * size + x] += sign * kernel[((y - py) & mask) * size + ((x - px) & mask)];
+		};
+
+		// Tightest cluster (value 1) or largest void (value 0)
+		auto extreme = [&](uint8_t value) {
+			int best = -1;
+			for (int p = 0; p < n; p++)
+			{
+				if (pattern[p] != value)
+					continue;
+				if (best < 0 || (value ? energy[p] > energy[best] : energy[p] < energy[best]))
+					best = p;
+			}
+			return best;
+		};
+
+		// Initial pattern: a tenth of the points at random, spread out by moving points
+		// from the tightest cluster to the largest void until that no longer changes anything
+		uint32_t seed = 12345;
+		int ones = n / 10;
+		for (int placed = 0; placed < ones;)
+		{
+			seed = seed * 1664525u + 1013904223u;
+			int p = (int)(seed >> 20) & (n - 1);
+			if (!pattern[p])
+			{
+				toggle(p);
+				placed++;
+			}
+		}
+
+		for (int i = 0; i < n; i++)
+		{
+			int cluster = extreme(1);
+			toggle(cluster);
+			int void_ = extreme(0);
+			toggle(void_);
+			if (void_ == cluster)
+				break;
+		}
+
+		std::vector<uint8_t> initial_pattern = pattern;
+		std::vector<float> initial_energy = energy;
+		std::vector<uint16_t> ranks(n);
+
+		// Ranks below the initial points: remove the tightest clusters first
+		for (int rank = ones - 1; rank >= 0; rank--)
+		{
+			int p = extreme(1);
+			toggle(p);
+			ranks[p] = (uint16_t)rank;
+		}
+
+		// Ranks above: fill the largest voids first
+		pattern = initial_pattern;
+		energy = initial_energy;
+		for (int rank = ones; rank < n; rank++)
+		{
+			int p = extreme(0);
+			toggle(p);
+			ranks[p] = (uint16_t)rank;
+		}
+
+		return ranks;
+	}();
+
+	return tile.data();
+}
+
+// ------------------------ Dithering ------------------------ //
+
+enum class Dither { none, floyd_steinberg, sierra_lite, ordered, blue_noise };
+
+struct DitherOptions
+{
+	Dither method = Dither::floyd_steinberg;
+
+	// Error diffusion alternates direction on every row
+	bool serpentine = true;
+
+	// Fraction of the error that is diffused, or scale of the ordered and blue noise thresholds
+	float strength = 1.f;
+
+	// Amplitude of the ordered and blue noise thresholds in OkLab, 0 uses the average distance
+	// between neighboring palette colors
+	float spread = 0.f;
+
+	// Passed on to the palette search, see PaletteIndex
+	float epsilon = 0.f;
+};
+
+// Average distance from each palette color to its closest other color
+float palette_spacing(const PaletteIndex& palette)
+{
+	if (palette.size() < 2)
+		return 0.f;
+
+	float sum = 0.f;
+	for (size_t i = 0; i < palette.size(); i++)
+	{
+		PaletteMatch matches[2];
+		palette.nearest(palette.color((uint32_t)i), 2, matches);
+		sum += matches[1].distance;
+	}
+	return sum / palette.size();
+}
+
+// Quantizes an image to a palette one row at a time, top to bottom, writing palette indices.
+//
+// Error diffusion works on OkLab errors and only keeps the errors for the current and the next row,
+// and the threshold methods keep no state between rows, so memory is O(width) whatever the height:
+// rows can be fed straight from a decoder.
+//
+// Ordered and blue noise dithering offset L, a and b by thresholds from the tile, read at
+// different offsets for each component, then pick the nearest palette color.
+class PaletteDitherer
+{
+public:
+	// palette must not be empty, and must outlive the ditherer
+	PaletteDitherer(const PaletteIndex& palette, int width, DitherOptions options = {})
+		: palette(palette), width(width), options(options)
+	{
+		if (options.method == Dither::ordered)
+		{
+			tile = bayer_tile();
+			tile_size = 8;
+		}
+		else if (options.method == Dither::blue_noise)
+		{
+			tile = blue_noise_tile();
+			tile_size = 64;
+		}
+
+		if (tile)
+		{
+			float spread = options.spread > 0.f ? options.spread : palette_spacing(palette);
+			threshold_scale = spread * options.strength;
+		}
+
+		error_row.resize(width + 2);
+		error_next.resize(width + 2);
+		lab_row.resize(width);
+		reset();
+	}
+
+	// Starts a new image
+	void reset()
+	{
+		y = 0;
+		std::fill(error_row.begin(), error_row.end(), Lab{ 0.f, 0.f, 0.f });
+		std::fill(error_next.begin(), error_next.end(), Lab{ 0.f, 0.f, 0.f });
+	}
+
+	// Index of the next row
+	int row() const
+	{
+		return y;
+	}
+
+	void dither_row(const Lab* in, uint32_t* out)
+	{
+		if (tile)
+			threshold_row(in, out);
+		else if (options.method == Dither::none)
+			nearest_row(in, out);
+		else
+			diffuse_row(in, out);
+
+		y++;
+	}
+
+	// Packed 0xAARRGGBB pixels, alpha is ignored
+	void dither_row(const uint32_t* in, uint32_t* out)
+	{
+		const Srgb8Tables& tables = srgb8_tables();
+		for (int x = 0; x < width; x++)
+			lab_row[x] = linear_srgb_to_oklab_fast(argb32_to_linear_srgb(tables, in[x]));
+
+		dither_row(lab_row.data(), out);
+	}
+
+private:
+	void nearest_row(const Lab* in, uint32_t* out)
+	{
+		for (int x = 0; x < width; x++)
+		{
+			hint = palette.nearest_from(in[x], hint, options.epsilon).index;
+			out[x] = hint;
+		}
+	}
+
+	// Tile ranks mapped to [-0.5, 0.5], scaled
+	float threshold(int x, int row) const
+	{
+		int mask = tile_size - 1;
+		float rank = tile[(row & mask) * tile_size + (x & mask)];
+		return ((rank + 0.5f) / (tile_size * tile_size) - 0.5f) * threshold_scale;
+	}
+
+	void threshold_row(const Lab* in, uint32_t* out)
+	{
+		int offset = tile_size / 2;
+		for (int x = 0; x < width; x++)
+		{
+			Lab c = {
+				in[x].L + threshold(x, y),
+				in[x].a + threshold(x + offset, y),
+				in[x].b + threshold(x, y + offset),
+			};
+
+			hint = palette.nearest_from(c, hint, options.epsilon).index;
+			out[x] = hint;
+		}
+	}
+
+	void diffuse_row(const Lab* in, uint32_t* out)
+	{
+		bool reverse = options.serpentine && (y & 1);
+		int dir = reverse ? -1 : 1;
+
+		for (int i = 0; i < width; i++)
+		{
+			int x = reverse ? width - 1 - i : i;
+			int e = x + 1; // error rows have one padding entry on each side
+
+			// Errors can pile up in regions the palette does not cover, so keep the target
+			// within the range of OkLab values
+			Lab c = {
+				clamp(in[x].L + error_row[e].L, 0.f, 1.f),
+				clamp(in[x].a + error_row[e].a, -0.5f, 0.5f),
+				clamp(in[x].b + error_row[e].b, -0.5f, 0.5f),
+			};
+
+			hint = palette.nearest_from(c, hint, options.epsilon).index;
+			out[x] = hint;
+
+			Lab q = palette.color(hint);
+			Lab error = {
+				(c.L - q.L) * options.strength,
+				(c.a - q.a) * options.strength,
+				(c.b - q.b) * options.strength,
+			};
+
+			if (options.method == Dither::floyd_steinberg)
+			{
+				add_error(error_row[e + dir], error, 7.f / 16.f);
+				add_error(error_next[e - dir], error, 3.f / 16.f);
+				add_error(error_next[e], error, 5.f / 16.f);
+				add_error(error_next[e + dir], error, 1.f / 16.f);
+			}
+			else
+			{
+				add_error(error_row[e + dir], error, 2.f / 4.f);
+				add_error(error_next[e - dir], error, 1.f / 4.f);
+				add_error(error_next[e], error, 1.f / 4.f);
+			}
+		}
+
+		std::swap(error_row, error_next);
+		std::fill(error_next.begin(), error_next.end(), Lab{ 0.f, 0.f, 0.f });
+	}
+
+	static void add_error(Lab& target, Lab error, float weight)
+	{
+		target.L += error.L * weight;
+		target.a += error.a * weight;
+		target.b += error.b * weight;
+	}
+
+	const PaletteIndex& palette;
+	int width;
+	DitherOptions options;
+
+	const uint16_t* tile = nullptr;
+	int tile_size = 0;
+	float threshold_scale = 0.f;
+
+	int y = 0;
+	uint32_t hint = 0;
+	std::vector<Lab> error_row;
+	std::vector<Lab> error_next;
+	std::vector<Lab> lab_row;
+};
+
+// Whole image convenience wrapper, strides are in pixels. An empty palette gives UINT32_MAX indices.
+void dither_argb32(const PaletteIndex& palette, const uint32_t* in, size_t in_stride, uint32_t* out, size_t out_stride,
+	int width, int height, DitherOptions options = {})
+{
+	if (palette.size() == 0)
+	{
+		for (int y = 0; y < height; y++)
+			std::fill(out + y * out_stride, out + y * out_stride + width, UINT32_MAX);
+		return;
+	}
+
+	PaletteDitherer ditherer(palette, width, options);
+	for (int y = 0; y < height; y++)
+		ditherer.dither_row(in + y * in_stride, out + y * out_stride);
+}
+
+} // namespace ok_color
@@ -0,0 +1,317 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include "oklab_source.h"
+#include "oklab_parallel.h"
+#include "oklab_srgb8.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+namespace ok_color
+{
+
+// ------------------------ Fixed point 8 bit conversions ------------------------ //
+
+// Integer only conversions between 8 bit sRGB and OkLab, for machines where float throughput is
+// the bottleneck. Values are in Q15 (1 << 15 is 1.0) throughout:
+//
+// - sRGB codes are decoded by tables that already hold their linear value times each column of
+//   linear_srgb_to_oklab's first matrix, in Q30, so LMS is the sum of three lookups. Decoding to Q15
+//   linear values and multiplying would lose too much precision in dark colors.
+// - cube roots come from two linearly interpolated tables, a fine one below 2^-6 where the cube
+//   root is steep and a coarse one above
+// - the second matrix has Q14 coefficients, rounded so that grays keep a = b = 0 exactly
+//
+// Against linear_srgb_to_oklab over all 2^24 colors, the error is below 5e-5 in L and 1.5e-4 in a and
+// b, about 5 steps of Q15. Grays give a = b = 0 and white L = 1 exactly. The other direction clamps
+// to the sRGB cube without gamut clipping. It gives the same codes as the float path (linear_to_srgb8
+// after oklab_to_linear_srgb) for 99.95% of colors and is off by one for the rest. sRGB -> Lab16 ->
+// sRGB round trips are exact for 99.4% of colors and off by one otherwise, except about a hundred
+// colors with a channel at 0 next to a bright one, off by two.
+//
+// Every step is a table lookup, an add or a 32 bit multiply add, except the cubes of the inverse,
+// which are computed in 64 bits. Several matrix coefficients (e.g. 32408, -39790, 42319) don't fit
+// in 16 bits, so there is no 16 bit (pmaddwd) path. The batches have AVX2 kernels with 32 bit lanes
+// instead, table lookups as gathers, used when the compiler targets AVX2 (e.g. -mavx2). They give
+// the same results as the scalar functions.
+//
+// Throughput on one core, 2^24 colors in shuffled order, -O3, in millions of colors per second:
+//
+//                      scalar   AVX2   float
+//   argb32_to_lab16       57      91      38
+//   lab16_to_argb32       61     140      50
+//
+// where float is linear_srgb_to_oklab_fast after argb32_to_linear_srgb, and oklab_to_linear_srgb
+// then linear_srgb_to_argb32, without -mavx2. The gathers dominate the kernels: 15 per 8 colors one
+// way, 5 the other.
+
+// OkLab in Q15: L in [0, 32768], a and b in [-32768, 32767]
+struct Lab16 { uint16_t L; int16_t a; int16_t b; };
+
+Lab16 oklab_to_lab16(Lab c)
+{
+	auto quantize = [](float x, float lo, float hi) {
+		x = x * 32768.f;
+		x = x > lo ? (x < hi ? x : hi) : lo;
+		return (int)(x + (x >= 0.f ? 0.5f : -0.5f));
+	};
+	return { (uint16_t)quantize(c.L, 0.f, 32768.f), (int16_t)quantize(c.a, -32768.f, 32767.f), (int16_t)quantize(c.b, -32768.f, 32767.f) };
+}
+
+Lab lab16_to_oklab(Lab16 c)
+{
+	return { c.L / 32768.f, c.a / 32768.f, c.b / 32768.f };
+}
+
+struct FixedTables
+{
+	static constexpr int cbrt_size = 4096;
+
+	int32_t lms[3][256][3];               // [channel][code] contribution to l, m and s, in Q30
+	uint16_t cbrt_fine[cbrt_size + 1];    // cbrt over [0, 2^-6], steps of 2^-18
+	uint16_t cbrt_coarse[cbrt_size + 1];  // cbrt over [0, 1], steps of 2^-12
+	uint8_t encode[32768 + 4];            // code of each linear value, padded for 32 bit gathers
+};
+
+const FixedTables& fixed_tables()
+{
+	static const FixedTables tables = [] {
+		FixedTables t = {};
+
+		const double to_lms[3][3] = {
+			{ 0.4122214708, 0.5363325363, 0.0514459929 },
+			{ 0.2119034982, 0.6806995451, 0.1073969566 },
+			{ 0.0883024619, 0.2817188376, 0.6299787005 },
+		};
+		for (int channel = 0; channel < 3; channel++)
+			for (int i = 0; i < 256; i++)
+				for (int j = 0; j < 3; j++)
+					t.lms[channel][i][j] = (int32_t)(srgb_transfer_function_inv(i / 255.f) * to_lms[j][channel] * (1 << 30) + 0.5);
+
+		for (int i = 0; i <= FixedTables::cbrt_size; i++)
+		{
+			t.cbrt_fine[i] = (uint16_t)(cbrt(i / 262144.0) * 32768.0 + 0.5);
+			t.cbrt_coarse[i] = (uint16_t)(cbrt(i / 4096.0) * 32768.0 + 0.5);
+		}
+
+		for (int i = 0; i <= 32768; i++)
+			t.encode[i] = (uint8_t)(srgb_transfer_function(i / 32768.f) * 255.f + 0.5f);
+
+		return t;
+	}();
+
+	return tables;
+}
+
+// Cube root of a Q30 value in [0, 2^30], in Q15
+int32_t cbrt_q30(const FixedTables& t, int32_t x)
+{
+	if (x < (1 << 24))
+	{
+		int32_t i = x >> 12, f = x & 0xfff;
+		return t.cbrt_fine[i] + (((t.cbrt_fine[i + 1] - t.cbrt_fine[i]) * f + (1 << 11)) >> 12);
+	}
+
+	int32_t i = x >> 18, f = x & 0x3ffff;
+	if (i >= FixedTables::cbrt_size)
+		return t.cbrt_coarse[FixedTables::cbrt_size];
+	return t.cbrt_coarse[i] + (((t.cbrt_coarse[i + 1] - t.cbrt_coarse[i]) * f + (1 << 17)) >> 18);
+}
+
+// Packed 0xAARRGGBB pixel, alpha is ignored
+Lab16 argb32_to_lab16(const FixedTables& t, uint32_t argb)
+{
+	const int32_t* r = t.lms[0][(argb >> 16) & 0xff];
+	const int32_t* g = t.lms[1][(argb >> 8) & 0xff];
+	const int32_t* b = t.lms[2][argb & 0xff];
+
+	int32_t l_ = cbrt_q30(t, r[0] + g[0] + b[0]);
+	int32_t m_ = cbrt_q30(t, r[1] + g[1] + b[1]);
+	int32_t s_ = cbrt_q30(t, r[2] + g[2] + b[2]);
+
+	return {
+		(uint16_t)((3448 * l_ + 13003 * m_ - 67 * s_ + (1 << 13)) >> 14),
+		(int16_t)((32408 * l_ - 39790 * m_ + 7382 * s_ + (1 << 13)) >> 14),
+		(int16_t)((424 * l_ + 12825 * m_ - 13249 * s_ + (1 << 13)) >> 14),
+	};
+}
+
+// Returns 0xffRRGGBB, out of gamut colors are clamped per channel
+uint32_t lab16_to_argb32(const FixedTables& t, Lab16 c)
+{
+	auto clamp = [](int32_t x, int32_t lo, int32_t hi) { return x > lo ? (x < hi ? x : hi) : lo; };
+
+	// l_, m_ and s_ are kept in Q16 and cubed in 64 bits, the third matrix amplifies their errors
+	// up to 7.6 times, rounding them to Q15 first gives colors off by two codes
+	auto cube = [](int32_t x) { return (int32_t)(((int64_t)x * x * x + (1ll << 32)) >> 33); };
+
+	int32_t L = c.L << 1, a = c.a, b = c.b;
+	int32_t l = cube(clamp(L + ((12987 * a + 7071 * b + (1 << 13)) >> 14), -65536, 65536));
+	int32_t m = cube(clamp(L + ((-3459 * a - 2092 * b + (1 << 13)) >> 14), -65536, 65536));
+	int32_t s = cube(clamp(L + ((-2932 * a - 42319 * b + (1 << 13)) >> 14), -65536, 65536));
+
+	int32_t red = clamp((33397 * l - 27097 * m + 1892 * s + (1 << 12)) >> 13, 0, 32768);
+	int32_t green = clamp((-10391 * l + 21379 * m - 2796 * s + (1 << 12)) >> 13, 0, 32768);
+	int32_t blue = clamp((-34 * l - 5763 * m + 13989 * s + (1 << 12)) >> 13, 0, 32768);
+
+	return 0xff000000u | ((uint32_t)t.encode[red] << 16) | ((uint32_t)t.encode[green] << 8) | t.encode[blue];
+}
+
+// ------ Batches ------ //
+
+#if defined(__AVX2__)
+// cbrt_q30 of 8 values. A 32 bit gather from a uint16_t table gets an entry and the next one.
+inline __m256i cbrt_q30_8(const FixedTables& t, __m256i x)
+{
+	auto interpolate = [](const uint16_t* table, __m256i i, __m256i f, int bits) {
+		__m256i pair = _mm256_i32gather_epi32((const int*)table, i, 2);
+		__m256i t0 = _mm256_and_si256(pair, _mm256_set1_epi32(0xffff));
+		__m256i t1 = _mm256_srli_epi32(pair, 16);
+		__m256i step = _mm256_mullo_epi32(_mm256_sub_epi32(t1, t0), f);
+		return _mm256_add_epi32(t0, _mm256_srai_epi32(_mm256_add_epi32(step, _mm256_set1_epi32(1 << (bits - 1))), bits));
+	};
+
+	// Both tables, then the one of each lane. The fine index is kept in range for the lanes that
+	// use the coarse table, the coarse one for those past its end.
+	__m256i fine_lanes = _mm256_cmpgt_epi32(_mm256_set1_epi32(1 << 24), x);
+	__m256i i_fine = _mm256_min_epi32(_mm256_srli_epi32(x, 12), _mm256_set1_epi32(FixedTables::cbrt_size - 1));
+	__m256i fine = interpolate(t.cbrt_fine, i_fine, _mm256_and_si256(x, _mm256_set1_epi32(0xfff)), 12);
+
+	__m256i i_coarse = _mm256_srli_epi32(x, 18);
+	__m256i past_end = _mm256_cmpgt_epi32(i_coarse, _mm256_set1_epi32(FixedTables::cbrt_size - 1));
+	i_coarse = _mm256_min_epi32(i_coarse, _mm256_set1_epi32(FixedTables::cbrt_size - 1));
+	__m256i coarse = interpolate(t.cbrt_coarse, i_coarse, _mm256_and_si256(x, _mm256_set1_epi32(0x3ffff)), 18);
+	coarse = _mm256_blendv_epi8(coarse, _mm256_set1_epi32(t.cbrt_coarse[FixedTables::cbrt_size]), past_end);
+
+	return _mm256_blendv_epi8(coarse, fine, fine_lanes);
+}
+
+// Index of the first pixel left to the scalar loop
+size_t argb32_to_lab16_8(const FixedTables& t, const uint32_t* in, Lab16* out, size_t count)
+{
+	const __m256i three = _mm256_set1_epi32(3), byte = _mm256_set1_epi32(0xff);
+	auto dot = [](int c0, __m256i x0, int c1, __m256i x1, int c2, __m256i x2, int shift) {
+		__m256i sum = _mm256_add_epi32(_mm256_mullo_epi32(_mm256_set1_epi32(c0), x0), _mm256_mullo_epi32(_mm256_set1_epi32(c1), x1));
+		sum = _mm256_add_epi32(_mm256_add_epi32(sum, _mm256_mullo_epi32(_mm256_set1_epi32(c2), x2)), _mm256_set1_epi32(1 << (shift - 1)));
+		return _mm256_srai_epi32(sum, shift);
+	};
+
+	size_t i = 0;
+	for (; i + 8 <= count; i += 8)
+	{
+		__m256i argb = _mm256_loadu_si256((const __m256i*)(in + i));
+		__m256i r = _mm256_mullo_epi32(_mm256_and_si256(_mm256_srli_epi32(argb, 16), byte), three);
+		__m256i g = _mm256_mullo_epi32(_mm256_and_si256(_mm256_srli_epi32(argb, 8), byte), three);
+		__m256i b = _mm256_mullo_epi32(_mm256_and_si256(argb, byte), three);
+
+		__m256i lms[3];
+		for (int j = 0; j < 3; j++)
+		{
+			__m256i x = _mm256_i32gather_epi32(&t.lms[0][0][j], r, 4);
+			x = _mm256_add_epi32(x, _mm256_i32gather_epi32(&t.lms[1][0][j], g, 4));
+			x = _mm256_add_epi32(x, _mm256_i32gather_epi32(&t.lms[2][0][j], b, 4));
+			lms[j] = cbrt_q30_8(t, x);
+		}
+
+		alignas(32) int32_t L[8], a[8], b_[8];
+		_mm256_store_si256((__m256i*)L, dot(3448, lms[0], 13003, lms[1], -67, lms[2], 14));
+		_mm256_store_si256((__m256i*)a, dot(32408, lms[0], -39790, lms[1], 7382, lms[2], 14));
+		_mm256_store_si256((__m256i*)b_, dot(424, lms[0], 12825, lms[1], -13249, lms[2], 14));
+		for (int k = 0; k < 8; k++)
+			out[i + k] = { (uint16_t)L[k], (int16_t)a[k], (int16_t)b_[k] };
+	}
+	return i;
+}
+
+// Cubes of 8 Q16 values in [-2^16, 2^16], as in lab16_to_argb32. The cubes are below 2^48, so they
+// are exact in doubles, and the rounding shift is a floor of an exact power of two scaling.
+inline __m256i cube_q16_8(__m256i x)
+{
+	auto cube4 = [](__m128i x) {
+		__m256d d = _mm256_cvtepi32_pd(x);
+		d = _mm256_mul_pd(_mm256_mul_pd(d, d), d);
+		d = _mm256_floor_pd(_mm256_mul_pd(_mm256_add_pd(d, _mm256_set1_pd(4294967296.0)), _mm256_set1_pd(1.0 / 8589934592.0)));
+		return _mm256_cvtpd_epi32(d);
+	};
+	return _mm256_setr_m128i(cube4(_mm256_castsi256_si128(x)), cube4(_mm256_extracti128_si256(x, 1)));
+}
+
+size_t lab16_to_argb32_8(const FixedTables& t, const Lab16* in, uint32_t* out, size_t count)
+{
+	static_assert(sizeof(Lab16) == 6, "Lab16 is 3 packed 16 bit values");
+
+	auto clamp = [](__m256i x, int lo, int hi) { return _mm256_min_epi32(_mm256_max_epi32(x, _mm256_set1_epi32(lo)), _mm256_set1_epi32(hi)); };
+	auto dot = [](int c0, __m256i x0, int c1, __m256i x1, int c2, __m256i x2, int shift) {
+		__m256i sum = _mm256_add_epi32(_mm256_mullo_epi32(_mm256_set1_epi32(c0), x0), _mm256_mullo_epi32(_mm256_set1_epi32(c1), x1));
+		sum = _mm256_add_epi32(_mm256_add_epi32(sum, _mm256_mullo_epi32(_mm256_set1_epi32(c2), x2)), _mm256_set1_epi32(1 << (shift - 1)));
+		return _mm256_srai_epi32(sum, shift);
+	};
+	// code of each linear value, a 32 bit gather of the bytes at the index
+	auto encode = [&](__m256i x) {
+		return _mm256_and_si256(_mm256_i32gather_epi32((const int*)t.encode, x, 1), _mm256_set1_epi32(0xff));
+	};
+
+	// Offsets in 16 bit units of L and a of each color, a 32 bit gather also gets the next value
+	const __m256i offsets = _mm256_setr_epi32(0, 3, 6, 9, 12, 15, 18, 21);
+
+	size_t i = 0;
+	for (; i + 8 <= count; i += 8)
+	{
+		const int* p = (const int*)(in + i);
+		__m256i L_a = _mm256_i32gather_epi32(p, offsets, 2);
+		__m256i a_b = _mm256_i32gather_epi32((const int*)((const uint16_t*)p + 1), offsets, 2);
+
+		__m256i L = _mm256_slli_epi32(_mm256_and_si256(L_a, _mm256_set1_epi32(0xffff)), 1);
+		__m256i a = _mm256_srai_epi32(_mm256_slli_epi32(a_b, 16), 16);
+		__m256i b = _mm256_srai_epi32(a_b, 16);
+
+		__m256i zero = _mm256_setzero_si256();
+		__m256i l = cube_q16_8(clamp(_mm256_add_epi32(L, dot(12987, a, 7071, b, 0, zero, 14)), -65536, 65536));
+		__m256i m = cube_q16_8(clamp(_mm256_add_epi32(L, dot(-3459, a, -2092, b, 0, zero, 14)), -65536, 65536));
+		__m256i s = cube_q16_8(clamp(_mm256_add_epi32(L, dot(-2932, a, -42319, b, 0, zero, 14)), -65536, 65536));
+
+		__m256i red = encode(clamp(dot(33397, l, -27097, m, 1892, s, 13), 0, 32768));
+		__m256i green = encode(clamp(dot(-10391, l, 21379, m, -2796, s, 13), 0, 32768));
+		__m256i blue = encode(clamp(dot(-34, l, -5763, m, 13989, s, 13), 0, 32768));
+
+		__m256i argb = _mm256_or_si256(_mm256_set1_epi32((int)0xff000000u), _mm256_or_si256(_mm256_slli_epi32(red, 16), _mm256_or_si256(_mm256_slli_epi32(green, 8), blue)));
+		_mm256_storeu_si256((__m256i*)(out + i), argb);
+	}
+	return i;
+}
+#endif
+
+void argb32_to_lab16(const uint32_t* in, Lab16* out, size_t count, unsigned threads = 0)
+{
+	OKLAB_PROFILE_SCOPE(call, "argb32_to_lab16");
+	const FixedTables& tables = fixed_tables();
+
+	parallel_for(count, [&](size_t begin, size_t end) {
+		size_t i = begin;
+#if defined(__AVX2__)
+		i += argb32_to_lab16_8(tables, in + begin, out + begin, end - begin);
+#endif
+		for (; i < end; i++)
+			out[i] = argb32_to_lab16(tables, in[i]);
+	}, threads, 16384);
+}
+
+void lab16_to_argb32(const Lab16* in, uint32_t* out, size_t count, unsigned threads = 0)
+{
+	OKLAB_PROFILE_SCOPE(call, "lab16_to_argb32");
+	const FixedTables& tables = fixed_tables();
+
+	parallel_for(count, [&](size_t begin, size_t end) {
+		size_t i = begin;
+#if defined(__AVX2__)
+		i += lab16_to_argb32_8(tables, in + begin, out + begin, end - begin);
+#endif
+		for (; i < end; i++)
+			out[i] = lab16_to_argb32(tables, in[i]);
+	}, threads, 16384);
+}
+
+} // namespace ok_color
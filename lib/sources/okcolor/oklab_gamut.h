@@ -0,0 +1,195 @@
+#pragma once
+
+#include <cmath>
+#include "oklab_source.h"
+
+namespace ok_color
+{
+
+// ------------------------ RGB gamuts ------------------------ //
+
+// More RGB gamuts with D65 white for the template parameter G, next to SrgbGamut of oklab_source.h,
+// e.g. okhsl_to_oklab<DisplayP3Gamut>(hsl). The coefficients come from oklab_gamut_fit, and there is
+// no iterative solver at runtime.
+
+// Display P3 primaries. Its transfer function is the sRGB one.
+struct DisplayP3Gamut
+{
+	// Linear RGB to LMS
+	static constexpr float to_lms[3][3] = {
+		{ +0.4813798551f, +0.4621183723f, +0.0565017725f },
+		{ +0.2288319424f, +0.6532168190f, +0.1179512386f },
+		{ +0.0839457536f, +0.2241652693f, +0.6918889771f },
+	};
+	// LMS to linear RGB
+	static constexpr float from_lms[3][3] = {
+		{ +3.1277689573f, -2.2571357663f, +0.1293668090f },
+		{ -1.0910090160f, +2.4133317135f, -0.3223226975f },
+		{ -0.0260108092f, -0.5080413222f, +1.5340521314f },
+	};
+
+	// Red reaches 0 first at the maximum saturation where sector[0] . (a, b) > 1, else green where
+	// sector[1] . (a, b) > 1, else blue
+	static constexpr float sector[2][2] = {
+		{ -1.77234405f, -0.82075866f },
+		{ +1.80319893f, -1.19328150f },
+	};
+	static constexpr float k[3][5] = {
+		{ +1.46460271f, +2.06316982f, +0.73890622f, +0.84399777f, +0.67286160f },
+		{ +0.77606445f, -0.45673208f, +0.11774890f, +0.13696729f, -0.17364017f },
+		{ +1.47856205f, -0.03111863f, -1.24111578f, -0.53187681f, +0.02538492f },
+	};
+
+	// Smooth approximation of the cusp, S = S_mid[0] + 1 / (S_mid[1] + S_mid[2] b + a (S_mid[3] + ...)),
+	// terms in the order of get_ST_mid, same for T
+	static constexpr float S_mid[10] = { +0.11388923f, +5.46452177f, +3.03710030f, -1.02947463f, +1.50673702f, -2.07521454f, -6.41757711f, -1.33077758f, +1.99593999f, +1.88748598f };
+	static constexpr float T_mid[10] = { +0.29783182f, +2.13864078f, -1.35254276f, +0.39528356f, +1.21381862f, -1.14629387f, +1.49702823f, +0.03050284f, -0.49212477f, +0.15797588f };
+};
+
+// ITU-R BT.2020 primaries, see rec2020_transfer_function
+struct Rec2020Gamut
+{
+	// Linear RGB to LMS
+	static constexpr float to_lms[3][3] = {
+		{ +0.6167557879f, +0.3601984021f, +0.0230458100f },
+		{ +0.2651330603f, +0.6358393714f, +0.0990275683f },
+		{ +0.1001026313f, +0.2039065205f, +0.6959908482f },
+	};
+	// LMS to linear RGB
+	static constexpr float from_lms[3][3] = {
+		{ +2.1399067200f, -1.2463894955f, +0.1064827755f },
+		{ -0.8847358342f, +2.1632309413f, -0.2784951071f },
+		{ -0.0485737534f, -0.4545031403f, +1.5030768938f },
+	};
+
+	// Red reaches 0 first at the maximum saturation where sector[0] . (a, b) > 1, else green where
+	// sector[1] . (a, b) > 1, else blue
+	static constexpr float sector[2][2] = {
+		{ -1.36834903f, -0.46664763f },
+		{ +2.01150832f, -2.03790997f },
+	};
+	static constexpr float k[3][5] = {
+		{ +2.66004738f, +3.99833404f, +1.02859337f, +1.73098636f, +0.92043697f },
+		{ +0.92353741f, -0.58825349f, +0.22178521f, +0.19920162f, -0.28908086f },
+		{ +1.70583928f, -0.06767827f, -1.46150841f, -0.66047056f, +0.06323445f },
+	};
+
+	// Smooth approximation of the cusp, S = S_mid[0] + 1 / (S_mid[1] + S_mid[2] b + a (S_mid[3] + ...)),
+	// terms in the order of get_ST_mid, same for T
+	static constexpr float S_mid[10] = { +0.12051972f, +5.15277553f, +3.42549753f, +0.45625065f, +0.02755527f, -3.82750717f, -4.20643513f, -1.09258887f, +1.42636964f, +1.71889460f };
+	static constexpr float T_mid[10] = { +0.30632358f, +1.91990207f, -1.42320556f, +0.19006991f, +0.70085521f, -1.08122108f, +1.26679227f, +0.01880426f, -0.10760623f, -0.02556186f };
+};
+
+// BT.2020 OETF, linear to encoded, negative values stay on the linear segment like with srgb_transfer_function
+float rec2020_transfer_function(float a)
+{
+	return 0.018053968510807f >= a ? 4.5f * a : 1.09929682680944f * powf(a, 0.45f) - 0.09929682680944f;
+}
+
+float rec2020_transfer_function_inv(float a)
+{
+	return 0.081242858298635f < a ? powf((a + 0.09929682680944f) / 1.09929682680944f, 1.f / 0.45f) : a / 4.5f;
+}
+
+// ------------------------ Conversions ------------------------ //
+
+// Same as the functions of the same names in oklab_source.h, for linear RGB in gamut G
+
+template <class G>
+Lab linear_rgb_to_oklab(RGB c)
+{
+	return from_generic(generic::linear_rgb_to_oklab<G>(to_generic(c)));
+}
+
+template <class G>
+RGB oklab_to_linear_rgb(Lab c)
+{
+	return from_generic(generic::oklab_to_linear_rgb<G>(to_generic(c)));
+}
+
+// a and b must be normalized so a^2 + b^2 == 1
+template <class G>
+float compute_max_saturation(float a, float b)
+{
+	return generic::compute_max_saturation<G>(a, b);
+}
+
+template <class G>
+LC find_cusp(float a, float b)
+{
+	return from_generic(generic::find_cusp<G>(a, b));
+}
+
+template <class G>
+float find_gamut_intersection(float a, float b, float L1, float C1, float L0, LC cusp)
+{
+	return generic::find_gamut_intersection<G>(a, b, L1, C1, L0, to_generic(cusp));
+}
+
+template <class G>
+float find_gamut_intersection(float a, float b, float L1, float C1, float L0)
+{
+	return generic::find_gamut_intersection<G>(a, b, L1, C1, L0);
+}
+
+// Same as the non template gamut_clip_oklab, returns linear RGB in gamut G
+template <class G>
+RGB gamut_clip_oklab(Lab lab, GamutClip method, float alpha = 0.05f)
+{
+	return from_generic(generic::gamut_clip_oklab<G>(to_generic(lab), method, alpha));
+}
+
+template <class G>
+RGB gamut_clip(RGB rgb, GamutClip method, float alpha = 0.05f)
+{
+	return from_generic(generic::gamut_clip<G>(to_generic(rgb), method, alpha));
+}
+
+// ------------------------ OkHSL and OkHSV ------------------------ //
+
+// The hue independent parts (the toe, C_0 of OkHSL and S_0 of OkHSV) are the same for every gamut
+
+template <class G>
+ST get_ST_mid(float a_, float b_)
+{
+	return from_generic(generic::get_ST_mid<G>(a_, b_));
+}
+
+template <class G>
+Cs get_Cs(float L, float a_, float b_, LC cusp, ST ST_mid)
+{
+	generic::Cs<float> cs = generic::get_Cs<G>(L, a_, b_, to_generic(cusp), to_generic(ST_mid));
+	return { cs.C_0, cs.C_mid, cs.C_max };
+}
+
+template <class G>
+Cs get_Cs(float L, float a_, float b_)
+{
+	return get_Cs<G>(L, a_, b_, find_cusp<G>(a_, b_), get_ST_mid<G>(a_, b_));
+}
+
+template <class G>
+Lab okhsl_to_oklab(HSL hsl)
+{
+	return from_generic(generic::okhsl_to_oklab<G>(to_generic(hsl)));
+}
+
+template <class G>
+HSL oklab_to_okhsl(Lab lab)
+{
+	return from_generic(generic::oklab_to_okhsl<G>(to_generic(lab)));
+}
+
+template <class G>
+Lab okhsv_to_oklab(HSV hsv)
+{
+	return from_generic(generic::okhsv_to_oklab<G>(to_generic(hsv)));
+}
+
+template <class G>
+HSV oklab_to_okhsv(Lab lab)
+{
+	return from_generic(generic::oklab_to_okhsv<G>(to_generic(lab)));
+}
+
+} // namespace ok_color
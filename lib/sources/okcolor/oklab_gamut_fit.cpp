@@ -0,0 +1,409 @@
+// Fits the coefficients oklab_gamut.h needs for an RGB gamut with D65 white, from its primaries.
+//
+//   oklab_gamut_fit NAME xr yr xg yg xb yb
+//   oklab_gamut_fit srgb|display-p3|rec2020
+//
+// Prints a gamut struct to paste into oklab_gamut.h, followed by the errors of the fitted
+// approximations as comments. Everything is computed in double precision:
+//
+// - the matrices between linear RGB and LMS, through the OkLab XYZ to LMS matrix, with the rows of the
+//   RGB to LMS one scaled so white maps to LMS (1, 1, 1)
+// - the lines splitting hues by the channel that reaches 0 first at the maximum saturation, which pass
+//   through the hues of the primaries
+// - for each of those, the polynomial S = k0 + k1 a + k2 b + k3 a^2 + k4 a b fitted by least squares
+//   to the exact maximum saturation (compute_max_saturation then refines it with one Halley step)
+// - the smooth approximations of the cusp used by OkHSL and OkHSV, S = c + 1 / P(a, b) with P of degree
+//   4, fitted so they stay just below the exact cusp values like those of get_ST_mid
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+namespace
+{
+
+using Matrix = double[3][3];
+
+const double xyz_to_lms[3][3] = {
+	{ 0.8189330101, 0.3618667424, -0.1288597137 },
+	{ 0.0329845436, 0.9293118715, 0.0361456387 },
+	{ 0.0482003018, 0.2643662691, 0.6338517070 },
+};
+
+const double lms_to_lab[3][3] = {
+	{ 0.2104542553, +0.7936177850, -0.0040720468 },
+	{ 1.9779984951, -2.4285922050, +0.4505937099 },
+	{ 0.0259040371, +0.7827717662, -0.8086757660 },
+};
+
+// l_, m_, s_ = L + k_lms[i][0] * a + k_lms[i][1] * b
+const double k_lms[3][2] = {
+	{ +0.3963377774, +0.2158037573 },
+	{ -0.1055613458, -0.0638541728 },
+	{ -0.0894841775, -1.2914855480 },
+};
+
+void multiply(const Matrix A, const Matrix B, Matrix out)
+{
+	for (int i = 0; i < 3; i++)
+		for (int j = 0; j < 3; j++)
+			out[i][j] = A[i][0] * B[0][j] + A[i][1] * B[1][j] + A[i][2] * B[2][j];
+}
+
+void invert(const Matrix m, Matrix out)
+{
+	double det = m[0][0] * (m[1][1] * m[2][2] - m[1][2] * m[2][1])
+		- m[0][1] * (m[1][0] * m[2][2] - m[1][2] * m[2][0])
+		+ m[0][2] * (m[1][0] * m[2][1] - m[1][1] * m[2][0]);
+
+	for (int i = 0; i < 3; i++)
+	{
+		for (int j = 0; j < 3; j++)
+		{
+			int i1 = (j + 1) % 3, i2 = (j + 2) % 3, j1 = (i + 1) % 3, j2 = (i + 2) % 3;
+			out[i][j] = (m[i1][j1] * m[i2][j2] - m[i1][j2] * m[i2][j1]) / det;
+		}
+	}
+}
+
+// Solves the normal equations of a (weighted) linear least squares problem, n unknowns
+std::vector<double> least_squares(const std::vector<std::vector<double>>& rows, const std::vector<double>& y, const std::vector<double>& w)
+{
+	size_t n = rows[0].size();
+	std::vector<std::vector<double>> A(n, std::vector<double>(n + 1, 0.0));
+	for (size_t k = 0; k < rows.size(); k++)
+	{
+		for (size_t i = 0; i < n; i++)
+		{
+			for (size_t j = 0; j < n; j++)
+				A[i][j] += w[k] * rows[k][i] * rows[k][j];
+			A[i][n] += w[k] * rows[k][i] * y[k];
+		}
+	}
+
+	// Gaussian elimination with partial pivoting
+	for (size_t c = 0; c < n; c++)
+	{
+		size_t pivot = c;
+		for (size_t r = c + 1; r < n; r++)
+		{
+			if (fabs(A[r][c]) > fabs(A[pivot][c]))
+				pivot = r;
+		}
+		std::swap(A[c], A[pivot]);
+		for (size_t r = 0; r < n; r++)
+		{
+			if (r == c)
+				continue;
+			double f = A[r][c] / A[c][c];
+			for (size_t j = c; j <= n; j++)
+				A[r][j] -= f * A[c][j];
+		}
+	}
+
+	std::vector<double> x(n);
+	for (size_t i = 0; i < n; i++)
+		x[i] = A[i][n] / A[i][i];
+	return x;
+}
+
+struct Gamut
+{
+	Matrix to_lms, from_lms;
+
+	// Channel c of the linear RGB color at OkLab (L, a, b)
+	double channel(int c, double L, double a, double b) const
+	{
+		double r = 0.0;
+		for (int j = 0; j < 3; j++)
+		{
+			double x = L + k_lms[j][0] * a + k_lms[j][1] * b;
+			r += from_lms[c][j] * x * x * x;
+		}
+		return r;
+	}
+
+	// Unit (a, b) of the hue of a primary
+	void primary_hue(int c, double& a, double& b) const
+	{
+		double lms_[3], lab[3];
+		for (int i = 0; i < 3; i++)
+			lms_[i] = cbrt(to_lms[i][c]);
+		for (int i = 0; i < 3; i++)
+			lab[i] = lms_to_lab[i][0] * lms_[0] + lms_to_lab[i][1] * lms_[1] + lms_to_lab[i][2] * lms_[2];
+
+		double C = sqrt(lab[1] * lab[1] + lab[2] * lab[2]);
+		a = lab[1] / C;
+		b = lab[2] / C;
+	}
+
+	// Saturation C / L where channel c reaches 0 first along the hue, at L = 1
+	double zero_saturation(int c, double a, double b) const
+	{
+		double lo = 0.0, hi = 0.0;
+		while (channel(c, 1.0, hi * a, hi * b) > 0.0)
+		{
+			lo = hi;
+			hi += 0.01;
+			if (hi > 20.0)
+				return INFINITY;
+		}
+		for (int i = 0; i < 100; i++)
+		{
+			double mid = 0.5 * (lo + hi);
+			(channel(c, 1.0, mid * a, mid * b) > 0.0 ? lo : hi) = mid;
+		}
+		return 0.5 * (lo + hi);
+	}
+
+	void cusp(double a, double b, double& S, double& T) const
+	{
+		S = std::min(zero_saturation(0, a, b), std::min(zero_saturation(1, a, b), zero_saturation(2, a, b)));
+		double max_rgb = std::max(channel(0, 1.0, S * a, S * b), std::max(channel(1, 1.0, S * a, S * b), channel(2, 1.0, S * a, S * b)));
+		double L = cbrt(1.0 / max_rgb);
+		T = L * S / (1.0 - L);
+	}
+};
+
+// compute_max_saturation with fitted coefficients k, as oklab_gamut.h evaluates it
+double approximate_max_saturation(const Gamut& gamut, int c, const double* k, double a, double b)
+{
+	double S = k[0] + k[1] * a + k[2] * b + k[3] * a * a + k[4] * a * b;
+
+	double f = 0.0, f1 = 0.0, f2 = 0.0;
+	for (int j = 0; j < 3; j++)
+	{
+		double kj = k_lms[j][0] * a + k_lms[j][1] * b;
+		double x = 1.0 + S * kj;
+		f += gamut.from_lms[c][j] * x * x * x;
+		f1 += gamut.from_lms[c][j] * 3.0 * kj * x * x;
+		f2 += gamut.from_lms[c][j] * 6.0 * kj * kj * x;
+	}
+	return S - f * f1 / (f1 * f1 - 0.5 * f * f2);
+}
+
+std::vector<double> st_mid_terms(double a, double b)
+{
+	return { 1.0, b, a, a * b, a * a, a * a * b, a * a * a, a * a * a * b, a * a * a * a };
+}
+
+// X = c + 1 / P(a, b), fitted on 1 / (X - c) with asymmetric weights so the fit ends up just below the
+// exact values (P above 1 / (X - c)), smooth where the exact values have sharp peaks
+std::vector<double> fit_st_mid(const std::vector<double>& a, const std::vector<double>& b, const std::vector<double>& X, double c)
+{
+	std::vector<std::vector<double>> rows;
+	std::vector<double> y, w(X.size(), 1.0);
+	for (size_t i = 0; i < X.size(); i++)
+	{
+		rows.push_back(st_mid_terms(a[i], b[i]));
+		y.push_back(1.0 / (X[i] - c));
+	}
+
+	std::vector<double> p;
+	for (int iteration = 0; iteration < 100; iteration++)
+	{
+		p = least_squares(rows, y, w);
+		for (size_t i = 0; i < X.size(); i++)
+		{
+			double P = 0.0;
+			for (size_t j = 0; j < p.size(); j++)
+				P += p[j] * rows[i][j];
+			w[i] = P < y[i] ? 0.99 : 0.01;
+		}
+	}
+	return p;
+}
+
+double evaluate_st_mid(const std::vector<double>& p, double c, double a, double b)
+{
+	std::vector<double> terms = st_mid_terms(a, b);
+	double P = 0.0;
+	for (size_t j = 0; j < p.size(); j++)
+		P += p[j] * terms[j];
+	return c + 1.0 / P;
+}
+
+void print_matrix(const char* name, const Matrix m, const char* comment)
+{
+	printf("\t// %s\n", comment);
+	printf("\tstatic constexpr float %s[3][3] = {\n", name);
+	for (int i = 0; i < 3; i++)
+		printf("\t\t{ %+.10ff, %+.10ff, %+.10ff },\n", m[i][0], m[i][1], m[i][2]);
+	printf("\t};\n");
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+	const char* name;
+	double xy[3][2];
+
+	if (argc == 8)
+	{
+		name = argv[1];
+		for (int i = 0; i < 6; i++)
+			xy[i / 2][i % 2] = atof(argv[2 + i]);
+	}
+	else if (argc == 2 && !strcmp(argv[1], "srgb"))
+	{
+		name = "SrgbGamut";
+		double p[3][2] = { { 0.64, 0.33 }, { 0.30, 0.60 }, { 0.15, 0.06 } };
+		memcpy(xy, p, sizeof(xy));
+	}
+	else if (argc == 2 && !strcmp(argv[1], "display-p3"))
+	{
+		name = "DisplayP3Gamut";
+		double p[3][2] = { { 0.680, 0.320 }, { 0.265, 0.690 }, { 0.150, 0.060 } };
+		memcpy(xy, p, sizeof(xy));
+	}
+	else if (argc == 2 && !strcmp(argv[1], "rec2020"))
+	{
+		name = "Rec2020Gamut";
+		double p[3][2] = { { 0.708, 0.292 }, { 0.170, 0.797 }, { 0.131, 0.046 } };
+		memcpy(xy, p, sizeof(xy));
+	}
+	else
+	{
+		fprintf(stderr, "usage: oklab_gamut_fit NAME xr yr xg yg xb yb\n       oklab_gamut_fit srgb|display-p3|rec2020\n");
+		return 2;
+	}
+
+	// ------ Matrices ------ //
+
+	const double white[3] = { 0.3127 / 0.3290, 1.0, (1.0 - 0.3127 - 0.3290) / 0.3290 };
+
+	Matrix primaries, primaries_inv, rgb_to_xyz, to_lms;
+	for (int c = 0; c < 3; c++)
+	{
+		primaries[0][c] = xy[c][0] / xy[c][1];
+		primaries[1][c] = 1.0;
+		primaries[2][c] = (1.0 - xy[c][0] - xy[c][1]) / xy[c][1];
+	}
+	invert(primaries, primaries_inv);
+	for (int c = 0; c < 3; c++)
+	{
+		double scale = primaries_inv[c][0] * white[0] + primaries_inv[c][1] * white[1] + primaries_inv[c][2] * white[2];
+		for (int i = 0; i < 3; i++)
+			rgb_to_xyz[i][c] = primaries[i][c] * scale;
+	}
+	multiply(xyz_to_lms, rgb_to_xyz, to_lms);
+
+	Gamut gamut;
+	for (int i = 0; i < 3; i++)
+	{
+		double sum = to_lms[i][0] + to_lms[i][1] + to_lms[i][2];
+		for (int j = 0; j < 3; j++)
+			gamut.to_lms[i][j] = to_lms[i][j] / sum;
+	}
+	invert(gamut.to_lms, gamut.from_lms);
+
+	// ------ Max saturation ------ //
+
+	double hue_a[3], hue_b[3];
+	for (int c = 0; c < 3; c++)
+		gamut.primary_hue(c, hue_a[c], hue_b[c]);
+
+	// The channel c reaches 0 first between the hues of the other two primaries, beyond the line
+	// n . (a, b) = 1 through them
+	double lines[3][2];
+	for (int c = 0; c < 3; c++)
+	{
+		int p = (c + 1) % 3, q = (c + 2) % 3;
+		double det = hue_a[p] * hue_b[q] - hue_b[p] * hue_a[q];
+		lines[c][0] = (hue_b[q] - hue_b[p]) / det;
+		lines[c][1] = (hue_a[p] - hue_a[q]) / det;
+	}
+
+	double k[3][5], k_error[3];
+	for (int c = 0; c < 3; c++)
+	{
+		// Hues from one of the other primaries to the other, the short way round
+		int p = (c + 1) % 3, q = (c + 2) % 3;
+		double h0 = atan2(hue_b[p], hue_a[p]), h1 = atan2(hue_b[q], hue_a[q]);
+		double span = remainder(h1 - h0, 2.0 * M_PI);
+
+		std::vector<std::vector<double>> rows;
+		std::vector<double> y, a, b;
+		const int samples = 2000;
+		for (int i = 0; i <= samples; i++)
+		{
+			double h = h0 + span * i / samples;
+			a.push_back(cos(h));
+			b.push_back(sin(h));
+			rows.push_back({ 1.0, a.back(), b.back(), a.back() * a.back(), a.back() * b.back() });
+			y.push_back(gamut.zero_saturation(c, a.back(), b.back()));
+		}
+
+		std::vector<double> fit = least_squares(rows, y, std::vector<double>(y.size(), 1.0));
+		for (int j = 0; j < 5; j++)
+			k[c][j] = fit[j];
+
+		k_error[c] = 0.0;
+		for (size_t i = 0; i < y.size(); i++)
+			k_error[c] = std::max(k_error[c], fabs(approximate_max_saturation(gamut, c, k[c], a[i], b[i]) - y[i]));
+	}
+
+	// ------ Cusp approximation for OkHSL and OkHSV ------ //
+
+	std::vector<double> a, b, S, T;
+	const int samples = 3600;
+	for (int i = 0; i < samples; i++)
+	{
+		double h = 2.0 * M_PI * i / samples, S_cusp, T_cusp;
+		gamut.cusp(cos(h), sin(h), S_cusp, T_cusp);
+		a.push_back(cos(h));
+		b.push_back(sin(h));
+		S.push_back(S_cusp);
+		T.push_back(T_cusp);
+	}
+
+	double S_min = *std::min_element(S.begin(), S.end()), T_min = *std::min_element(T.begin(), T.end());
+	double S_c = 0.5 * S_min, T_c = 0.5 * T_min;
+	std::vector<double> S_mid = fit_st_mid(a, b, S, S_c), T_mid = fit_st_mid(a, b, T, T_c);
+
+	double S_ratio[2] = { INFINITY, 0.0 }, T_ratio[2] = { INFINITY, 0.0 };
+	for (int i = 0; i < samples; i++)
+	{
+		double s = evaluate_st_mid(S_mid, S_c, a[i], b[i]) / S[i];
+		double t = evaluate_st_mid(T_mid, T_c, a[i], b[i]) / T[i];
+		S_ratio[0] = std::min(S_ratio[0], s);
+		S_ratio[1] = std::max(S_ratio[1], s);
+		T_ratio[0] = std::min(T_ratio[0], t);
+		T_ratio[1] = std::max(T_ratio[1], t);
+	}
+
+	// ------ Output ------ //
+
+	printf("struct %s\n{\n", name);
+	print_matrix("to_lms", gamut.to_lms, "Linear RGB to LMS");
+	print_matrix("from_lms", gamut.from_lms, "LMS to linear RGB");
+	printf("\n\t// Red reaches 0 first at the maximum saturation where sector[0] . (a, b) > 1, else green where\n");
+	printf("\t// sector[1] . (a, b) > 1, else blue\n");
+	printf("\tstatic constexpr float sector[2][2] = {\n");
+	for (int c = 0; c < 2; c++)
+		printf("\t\t{ %+.8ff, %+.8ff },\n", lines[c][0], lines[c][1]);
+	printf("\t};\n");
+	printf("\tstatic constexpr float k[3][5] = {\n");
+	for (int c = 0; c < 3; c++)
+		printf("\t\t{ %+.8ff, %+.8ff, %+.8ff, %+.8ff, %+.8ff },\n", k[c][0], k[c][1], k[c][2], k[c][3], k[c][4]);
+	printf("\t};\n");
+	printf("\n\t// Smooth approximation of the cusp, S = S_mid[0] + 1 / (S_mid[1] + S_mid[2] b + a (S_mid[3] + ...)),\n");
+	printf("\t// terms in the order of get_ST_mid, same for T\n");
+	printf("\tstatic constexpr float S_mid[10] = { %+.8ff", S_c);
+	for (double p : S_mid)
+		printf(", %+.8ff", p);
+	printf(" };\n");
+	printf("\tstatic constexpr float T_mid[10] = { %+.8ff", T_c);
+	for (double p : T_mid)
+		printf(", %+.8ff", p);
+	printf(" };\n");
+	printf("};\n\n");
+
+	printf("// Max saturation error after one Halley step: red %.2g, green %.2g, blue %.2g\n", k_error[0], k_error[1], k_error[2]);
+	printf("// S_mid / S_cusp in [%.3f, %.3f], T_mid / T_cusp in [%.3f, %.3f]\n", S_ratio[0], S_ratio[1], T_ratio[0], T_ratio[1]);
+	return 0;
+}
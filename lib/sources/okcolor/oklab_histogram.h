@@ -0,0 +1,265 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+#include "oklab_source.h"
+#include "oklab_parallel.h"
+#include "oklab_srgb8.h"
+
+namespace ok_color
+{
+
+// ------------------------ Color histogram ------------------------ //
+
+enum class HistogramSpace { oklab, hue_chroma };
+
+struct HistogramConfig
+{
+	HistogramSpace space = HistogramSpace::oklab;
+
+	// oklab: L, a and b bins. hue_chroma: h and C bins, the third count is ignored.
+	int bins[3] = { 32, 32, 32 };
+
+	// Ranges covered by the bins, values outside land in the edge bins.
+	// L covers [0, 1], h covers [-pi, pi]
+	float ab_range = 0.4f;  // a and b in [-ab_range, ab_range]
+	float C_max = 0.4f;     // C in [0, C_max]
+
+	// Separate 1D lightness histogram, used for the median
+	int L_bins = 256;
+};
+
+struct ColorStatistics
+{
+	uint64_t count;
+
+	Lab mean;
+	float L_std;
+	float L_median;
+
+	float C_mean;
+	float C_std;
+
+	// Chroma weighted circular mean of the hue in radians, and how concentrated hues are around it,
+	// from 0 (spread evenly, or no chroma) to 1 (a single hue)
+	float hue_mean;
+	float hue_concentration;
+
+	// Hasler and Suesstrunk's colorfulness, with OkLab a and b in place of the opponent channels:
+	// sqrt(var(a) + var(b)) + 0.3 * sqrt(mean(a)^2 + mean(b)^2)
+	float colorfulness;
+};
+
+// Streaming color distribution of any number of pixels, in fixed size memory.
+//
+// Pixels can be added in any order, and histograms with the same config can be merged, so work can be
+// split across tiles, threads and images and combined at the end.
+class ColorHistogram
+{
+public:
+	explicit ColorHistogram(HistogramConfig config = {}) : layout(config)
+	{
+		for (int& n : layout.bins)
+			n = std::max(n, 1);
+		layout.L_bins = std::max(layout.L_bins, 1);
+
+		int third = layout.space == HistogramSpace::oklab ? layout.bins[2] : 1;
+		counts.assign((size_t)layout.bins[0] * layout.bins[1] * third, 0);
+		L_counts.assign(layout.L_bins, 0);
+	}
+
+	const HistogramConfig& config() const
+	{
+		return layout;
+	}
+
+	// Row major, the first axis (L, or h) changes slowest
+	const std::vector<uint64_t>& bins() const
+	{
+		return counts;
+	}
+
+	const std::vector<uint64_t>& L_histogram() const
+	{
+		return L_counts;
+	}
+
+	uint64_t count() const
+	{
+		return total;
+	}
+
+	size_t bin_index(Lab lab) const
+	{
+		if (layout.space == HistogramSpace::oklab)
+		{
+			size_t i = bin(lab.L, 0.f, 1.f, layout.bins[0]);
+			size_t j = bin(lab.a, -layout.ab_range, layout.ab_range, layout.bins[1]);
+			size_t k = bin(lab.b, -layout.ab_range, layout.ab_range, layout.bins[2]);
+			return (i * layout.bins[1] + j) * layout.bins[2] + k;
+		}
+
+		float C = sqrtf(lab.a * lab.a + lab.b * lab.b);
+		size_t i = bin(atan2f(lab.b, lab.a), -pi, pi, layout.bins[0]);
+		size_t j = bin(C, 0.f, layout.C_max, layout.bins[1]);
+		return i * layout.bins[1] + j;
+	}
+
+	void add(Lab lab)
+	{
+		counts[bin_index(lab)]++;
+		L_counts[bin(lab.L, 0.f, 1.f, layout.L_bins)]++;
+
+		float C = sqrtf(lab.a * lab.a + lab.b * lab.b);
+
+		total++;
+		sum.L += lab.L;
+		sum.a += lab.a;
+		sum.b += lab.b;
+		sum.C += C;
+		sum.L2 += (double)lab.L * lab.L;
+		sum.a2 += (double)lab.a * lab.a;
+		sum.b2 += (double)lab.b * lab.b;
+		sum.C2 += (double)C * C;
+	}
+
+	void add(const Lab* pixels, size_t count)
+	{
+		for (size_t i = 0; i < count; i++)
+			add(pixels[i]);
+	}
+
+	// Packed 0xAARRGGBB pixels, alpha is ignored
+	void add_argb32(const uint32_t* pixels, size_t count)
+	{
+		const Srgb8Tables& tables = srgb8_tables();
+		for (size_t i = 0; i < count; i++)
+			add(linear_srgb_to_oklab_fast(argb32_to_linear_srgb(tables, pixels[i])));
+	}
+
+	// Adds the pixels of other, which must have the same config. Returns false and leaves the
+	// histogram unchanged when the configs differ.
+	bool merge(const ColorHistogram& other)
+	{
+		const HistogramConfig& c = other.layout;
+		bool third = layout.space == HistogramSpace::oklab;
+		if (c.space != layout.space || c.bins[0] != layout.bins[0] || c.bins[1] != layout.bins[1]
+			|| (third && c.bins[2] != layout.bins[2]) || c.ab_range != layout.ab_range || c.C_max != layout.C_max
+			|| c.L_bins != layout.L_bins)
+			return false;
+
+		for (size_t i = 0; i < counts.size(); i++)
+			counts[i] += other.counts[i];
+		for (size_t i = 0; i < L_counts.size(); i++)
+			L_counts[i] += other.L_counts[i];
+
+		total += other.total;
+		sum.L += other.sum.L;
+		sum.a += other.sum.a;
+		sum.b += other.sum.b;
+		sum.C += other.sum.C;
+		sum.L2 += other.sum.L2;
+		sum.a2 += other.sum.a2;
+		sum.b2 += other.sum.b2;
+		sum.C2 += other.sum.C2;
+		return true;
+	}
+
+	void clear()
+	{
+		std::fill(counts.begin(), counts.end(), 0);
+		std::fill(L_counts.begin(), L_counts.end(), 0);
+		total = 0;
+		sum = {};
+	}
+
+	ColorStatistics statistics() const
+	{
+		ColorStatistics stats = {};
+		stats.count = total;
+		if (total == 0)
+			return stats;
+
+		double n = (double)total;
+		double L = sum.L / n, a = sum.a / n, b = sum.b / n, C = sum.C / n;
+
+		auto deviation = [n](double sum2, double mean) {
+			return (float)sqrt(std::max(sum2 / n - mean * mean, 0.0));
+		};
+
+		stats.mean = { (float)L, (float)a, (float)b };
+		stats.L_std = deviation(sum.L2, L);
+		stats.L_median = L_median();
+
+		stats.C_mean = (float)C;
+		stats.C_std = deviation(sum.C2, C);
+
+		// Weighting unit hue vectors by chroma gives back a and b, so no per pixel atan2 is needed
+		stats.hue_mean = (float)atan2(b, a);
+		stats.hue_concentration = sum.C > 0.0 ? (float)(sqrt(sum.a * sum.a + sum.b * sum.b) / sum.C) : 0.f;
+
+		float a_std = deviation(sum.a2, a);
+		float b_std = deviation(sum.b2, b);
+		stats.colorfulness = (float)(sqrt(a_std * a_std + b_std * b_std) + 0.3 * sqrt(a * a + b * b));
+
+		return stats;
+	}
+
+private:
+	static size_t bin(float x, float min, float max, int n)
+	{
+		float t = (x - min) / (max - min) * n;
+		int i = t > 0.f ? (int)std::min(t, (float)(n - 1)) : 0; // NaN lands in the first bin
+		return (size_t)i;
+	}
+
+	// Interpolated within the bin the median falls in
+	float L_median() const
+	{
+		double half = total / 2.0;
+		double below = 0.0;
+		for (int i = 0; i < layout.L_bins; i++)
+		{
+			double in_bin = (double)L_counts[i];
+			if (below + in_bin >= half && in_bin > 0.0)
+				return (float)((i + (half - below) / in_bin) / layout.L_bins);
+			below += in_bin;
+		}
+		return 1.f;
+	}
+
+	struct Sums
+	{
+		double L, a, b, C;
+		double L2, a2, b2, C2;
+	};
+
+	HistogramConfig layout;
+	std::vector<uint64_t> counts;
+	std::vector<uint64_t> L_counts;
+	uint64_t total = 0;
+	Sums sum = {};
+};
+
+// Adds an image of packed 0xAARRGGBB pixels, stride in pixels. Rows are split between threads,
+// each filling a private histogram that is merged into histogram at the end.
+void accumulate_argb32(ColorHistogram& histogram, const uint32_t* pixels, int width, int height, size_t stride, unsigned threads = 0)
+{
+	OKLAB_PROFILE_SCOPE(call, "accumulate_argb32");
+	std::mutex mutex;
+	size_t min_rows = std::max<size_t>(1, 65536 / std::max(width, 1));
+
+	parallel_for((size_t)height, [&](size_t begin, size_t end) {
+		ColorHistogram local(histogram.config());
+		for (size_t y = begin; y < end; y++)
+			local.add_argb32(pixels + y * stride, width);
+
+		std::lock_guard<std::mutex> lock(mutex);
+		histogram.merge(local);
+	}, threads, min_rows);
+}
+
+} // namespace ok_color
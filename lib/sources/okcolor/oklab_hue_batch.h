@@ -0,0 +1,225 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+#include "oklab_source.h"
+#include "oklab_parallel.h"
+#include "oklab_profile.h"
+
+namespace ok_color
+{
+
+// ------------------------ Hue table ------------------------ //
+
+// The OkHSL and OkHSV conversions spend most of their time on terms that only depend on hue:
+// the cusp (find_cusp) and the smooth cusp approximation (get_ST_mid).
+// Image content repeats hues heavily, so for batches these are sampled once into a table
+// indexed by hue h in [0, 1) and linearly interpolated per pixel.
+// Everything that depends on L or C is still computed exactly for each pixel.
+//
+// Accuracy, measured against the scalar functions over a 64^3 grid of sRGB inputs:
+// with the default 2048 entries, okhsl/okhsv s and v differ by less than 2e-4 and
+// conversions back to sRGB differ by less than 2.5e-4 (about 1/16 of an 8 bit step).
+// The error drops roughly with the square of the table size.
+struct HueTable
+{
+	int size;
+	std::vector<LC> cusp;
+	std::vector<ST> ST_mid;
+
+	// Set for buckets where the cusp has a kink, since interpolating across it is inaccurate.
+	// Those buckets are computed exactly instead, which only affects a handful of hues.
+	std::vector<bool> exact;
+};
+
+struct HueTerms { LC cusp; ST ST_mid; };
+
+// Identifies which piece of the gamut boundary the cusp lies on for a hue:
+// the component that goes below zero first in compute_max_saturation
+// and the component that reaches one first in find_cusp
+int cusp_segment(float a, float b)
+{
+	int min_component;
+	if (SrgbGamut::sector[0][0] * a + SrgbGamut::sector[0][1] * b > 1.f)
+		min_component = 0;
+	else if (SrgbGamut::sector[1][0] * a + SrgbGamut::sector[1][1] * b > 1.f)
+		min_component = 1;
+	else
+		min_component = 2;
+
+	float S_cusp = compute_max_saturation(a, b);
+	RGB rgb_at_max = oklab_to_linear_srgb({ 1, S_cusp * a, S_cusp * b });
+	int max_component = rgb_at_max.r >= rgb_at_max.g
+		? (rgb_at_max.r >= rgb_at_max.b ? 0 : 2)
+		: (rgb_at_max.g >= rgb_at_max.b ? 1 : 2);
+
+	return min_component * 3 + max_component;
+}
+
+HueTable make_hue_table(int size = 2048)
+{
+	OKLAB_PROFILE_SCOPE(call, "make_hue_table");
+	HueTable table;
+	table.size = size;
+
+	// One extra entry so interpolation at the last bucket does not need to wrap
+	table.cusp.resize(size + 1);
+	table.ST_mid.resize(size + 1);
+	table.exact.resize(size);
+
+	int previous_segment = 0;
+	for (int i = 0; i <= size; i++)
+	{
+		float h = (float)i / size;
+		float a_ = cosf(2.f * pi * h);
+		float b_ = sinf(2.f * pi * h);
+
+		table.cusp[i] = find_cusp(a_, b_);
+		table.ST_mid[i] = get_ST_mid(a_, b_);
+
+		int segment = cusp_segment(a_, b_);
+		if (i > 0)
+			table.exact[i - 1] = segment != previous_segment;
+		previous_segment = segment;
+	}
+
+	return table;
+}
+
+// a_ and b_ are only used for the few buckets that are computed exactly
+HueTerms lookup_hue_terms(const HueTable& table, float h, float a_, float b_)
+{
+	float x = (h - floorf(h)) * table.size;
+	x = x >= 0.f ? x : 0.f; // also catches NaN
+
+	int i = (int)x;
+	i = i < table.size ? i : table.size - 1;
+	float t = x - i;
+
+	if (table.exact[i])
+		return { find_cusp(a_, b_), get_ST_mid(a_, b_) };
+
+	LC c0 = table.cusp[i];
+	LC c1 = table.cusp[i + 1];
+	ST s0 = table.ST_mid[i];
+	ST s1 = table.ST_mid[i + 1];
+
+	return {
+		{ c0.L + t * (c1.L - c0.L), c0.C + t * (c1.C - c0.C) },
+		{ s0.S + t * (s1.S - s0.S), s0.T + t * (s1.T - s0.T) },
+	};
+}
+
+// Hue source of the generic conversions that interpolates the table
+struct TableHue
+{
+	const HueTable& table;
+
+	generic::LC<float> cusp(float h, float a_, float b_) const
+	{
+		return to_generic(lookup_hue_terms(table, h, a_, b_).cusp);
+	}
+
+	generic::HueTerms<float> terms(float h, float a_, float b_) const
+	{
+		HueTerms terms = lookup_hue_terms(table, h, a_, b_);
+		return { to_generic(terms.cusp), to_generic(terms.ST_mid) };
+	}
+};
+
+// ------------------------ OkHSL batch ------------------------ //
+
+// Same as okhsl_to_srgb, with the hue dependent terms taken from the table
+void okhsl_to_srgb(const HueTable& table, const HSL* in, RGB* out, size_t count, unsigned threads = 0)
+{
+	OKLAB_PROFILE_SCOPE(call, "okhsl_to_srgb");
+	TableHue hue = { table };
+
+	parallel_for(count, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++)
+		{
+			if (in[i].l == 1.0f)
+			{
+				out[i] = { 1.f, 1.f, 1.f };
+				continue;
+			}
+			else if (in[i].l == 0.f)
+			{
+				out[i] = { 0.f, 0.f, 0.f };
+				continue;
+			}
+
+			RGB rgb = from_generic(generic::okhsl_to_linear_rgb<SrgbGamut>(to_generic(in[i]), hue));
+			out[i] = {
+				srgb_transfer_function(rgb.r),
+				srgb_transfer_function(rgb.g),
+				srgb_transfer_function(rgb.b),
+			};
+		}
+	}, threads);
+}
+
+// Same as srgb_to_okhsl, with the hue dependent terms taken from the table
+void srgb_to_okhsl(const HueTable& table, const RGB* in, HSL* out, size_t count, unsigned threads = 0)
+{
+	OKLAB_PROFILE_SCOPE(call, "srgb_to_okhsl");
+	TableHue hue = { table };
+
+	parallel_for(count, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++)
+		{
+			RGB linear_rgb = {
+				srgb_transfer_function_inv(in[i].r),
+				srgb_transfer_function_inv(in[i].g),
+				srgb_transfer_function_inv(in[i].b)
+			};
+
+			Lab lab = linear_srgb_to_oklab(linear_rgb);
+			out[i] = from_generic(generic::oklab_to_okhsl<SrgbGamut>(to_generic(lab), hue));
+		}
+	}, threads);
+}
+
+// ------------------------ OkHSV batch ------------------------ //
+
+// Same as okhsv_to_srgb, with the cusp taken from the table
+void okhsv_to_srgb(const HueTable& table, const HSV* in, RGB* out, size_t count, unsigned threads = 0)
+{
+	OKLAB_PROFILE_SCOPE(call, "okhsv_to_srgb");
+	TableHue hue = { table };
+
+	parallel_for(count, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++)
+		{
+			RGB rgb = from_generic(generic::okhsv_to_linear_rgb<SrgbGamut>(to_generic(in[i]), hue));
+			out[i] = {
+				srgb_transfer_function(rgb.r),
+				srgb_transfer_function(rgb.g),
+				srgb_transfer_function(rgb.b),
+			};
+		}
+	}, threads);
+}
+
+// Same as srgb_to_okhsv, with the cusp taken from the table
+void srgb_to_okhsv(const HueTable& table, const RGB* in, HSV* out, size_t count, unsigned threads = 0)
+{
+	OKLAB_PROFILE_SCOPE(call, "srgb_to_okhsv");
+	TableHue hue = { table };
+
+	parallel_for(count, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++)
+		{
+			RGB linear_rgb = {
+				srgb_transfer_function_inv(in[i].r),
+				srgb_transfer_function_inv(in[i].g),
+				srgb_transfer_function_inv(in[i].b)
+			};
+
+			Lab lab = linear_srgb_to_oklab(linear_rgb);
+			out[i] = from_generic(generic::oklab_to_okhsv<SrgbGamut>(to_generic(lab), hue));
+		}
+	}, threads);
+}
+
+} // namespace ok_color
@@ -0,0 +1,348 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include "oklab_source.h"
+#include "oklab_parallel.h"
+#include "oklab_pnm.h"
+#include "oklab_profile.h"
+#include "oklab_srgb8.h"
+
+namespace ok_color
+{
+
+// ------------------------ Image conversion ------------------------ //
+
+// Converts binary PPM, PAM and PFM image files between sRGB and OkLab, OkLch, OkHSV or OkHSL. Both
+// files are memory mapped and converted a band of rows at a time, the rows of a band in parallel,
+// and the pages of each band are released once it is written, so images larger than RAM convert
+// with bounded resident memory.
+//
+// sRGB is gamma encoded in PPM and PAM files (8 or 16 bit samples) and linear in PFM files. The other
+// spaces are read and written as PFM, with OkLch hue in radians and OkHSV and OkHSL hue in [0, 1].
+enum class ImageSpace
+{
+	srgb,
+	oklab,
+	oklch,
+	okhsv,
+	okhsl,
+};
+
+struct ImageConversion
+{
+	ImageSpace from = ImageSpace::srgb;
+	ImageSpace to = ImageSpace::oklab;
+
+	// Clipping of out of gamut colors, alpha is the parameter of the adaptive methods
+	GamutClip clip = GamutClip::none;
+	float alpha = 0.05f;
+
+	// Bits per sample of sRGB output: 8, 16, or 32 for PFM. 0 picks 32 when the output ends in .pfm,
+	// else the depth of the input (8 for PFM input). Other spaces are always PFM.
+	int depth = 0;
+
+	double band_mb = 64.0;  // megabytes of input converted between page releases
+	unsigned threads = 0;   // threads per band
+};
+
+enum class ImageConvertStatus
+{
+	ok,
+	unreadable_input,   // not a binary PPM, PAM or PFM image
+	input_not_pfm,      // OkLab, OkLch, OkHSV and OkHSL inputs must be PFM
+	output_extension,   // .pfm for integer output, or .ppm or .pam for PFM output
+	output_not_created,
+};
+
+struct ImageConvertResult
+{
+	ImageConvertStatus status;
+	PnmHeader in, out;  // the formats read and written, when status is ok
+};
+
+bool parse_image_space(const char* name, ImageSpace& space)
+{
+	const char* names[] = { "srgb", "oklab", "oklch", "okhsv", "okhsl" };
+	for (int i = 0; i < 5; i++)
+	{
+		if (!strcmp(name, names[i]))
+		{
+			space = (ImageSpace)i;
+			return true;
+		}
+	}
+	return false;
+}
+
+bool parse_gamut_clip(const char* name, GamutClip& clip)
+{
+	const char* names[] = { "none", "preserve_chroma", "project_to_0_5", "project_to_L_cusp", "adaptive_L0_0_5", "adaptive_L0_L_cusp" };
+	for (int i = 0; i < 6; i++)
+	{
+		if (!strcmp(name, names[i]))
+		{
+			clip = (GamutClip)i;
+			return true;
+		}
+	}
+	return false;
+}
+
+bool path_ends_with(const char* path, const char* suffix)
+{
+	size_t n = strlen(path), m = strlen(suffix);
+	return n >= m && !strcmp(path + n - m, suffix);
+}
+
+// Converts rows from the in format and space to the out format and space
+struct ImageRowConverter
+{
+	ImageSpace from = ImageSpace::srgb, to = ImageSpace::oklab;
+	GamutClip clip = GamutClip::none;
+	float alpha = 0.05f;
+
+	PnmHeader in, out;
+	bool swap_in = false;  // PFM input in the other byte order
+
+	const Srgb8Tables& tables = srgb8_tables();
+	const TransferTable& transfer = srgb_transfer_table();
+
+	// Sample i of a row as a float, decoded to linear for sRGB color channels
+	float read(const uint8_t* row, size_t i, bool color) const
+	{
+		if (in.sample == PnmSample::f32)
+		{
+			uint8_t b[4];
+			memcpy(b, row + 4 * i, 4);
+			if (swap_in)
+			{
+				std::swap(b[0], b[3]);
+				std::swap(b[1], b[2]);
+			}
+			float x;
+			memcpy(&x, b, 4);
+			return x;
+		}
+
+		uint32_t v = in.sample == PnmSample::u8 ? row[i] : (row[2 * i] << 8) | row[2 * i + 1];
+		if (!color || from != ImageSpace::srgb)
+			return (float)v / in.maxval;
+		if (in.maxval == 255)
+			return tables.decode[v];
+		return transfer((float)v / in.maxval);
+	}
+
+	// Encodes linear sRGB color channels, alpha and PFM values as they are
+	void write(uint8_t* row, size_t i, float x, bool color) const
+	{
+		if (out.sample == PnmSample::f32)
+		{
+			memcpy(row + 4 * i, &x, 4);
+			return;
+		}
+
+		x = x > 0.f ? (x < 1.f ? x : 1.f) : 0.f;
+		if (out.sample == PnmSample::u8)
+		{
+			row[i] = (uint8_t)(color ? linear_to_srgb8(tables, x) : (uint32_t)(x * 255.f + 0.5f));
+			return;
+		}
+
+		uint32_t v = (uint32_t)((color ? srgb_transfer_function(x) : x) * 65535.f + 0.5f);
+		row[2 * i] = (uint8_t)(v >> 8);
+		row[2 * i + 1] = (uint8_t)v;
+	}
+
+	Lab to_oklab(float x, float y, float z) const
+	{
+		switch (from)
+		{
+		case ImageSpace::srgb: return linear_srgb_to_oklab_fast({ x, y, z });
+		case ImageSpace::oklch: return lch_to_oklab({ x, y, z });
+		case ImageSpace::okhsv: return okhsv_to_oklab({ x, y, z });
+		case ImageSpace::okhsl: return okhsl_to_oklab({ x, y, z });
+		default: return { x, y, z };
+		}
+	}
+
+	void from_oklab(Lab lab, RGB rgb, float* values) const
+	{
+		switch (to)
+		{
+		case ImageSpace::srgb:
+			values[0] = rgb.r;
+			values[1] = rgb.g;
+			values[2] = rgb.b;
+			return;
+		case ImageSpace::oklch:
+		{
+			Lch lch = oklab_to_lch(lab);
+			values[0] = lch.l;
+			values[1] = lch.c;
+			values[2] = lch.h;
+			return;
+		}
+		case ImageSpace::okhsv:
+		{
+			HSV hsv = oklab_to_okhsv(lab);
+			values[0] = hsv.h;
+			values[1] = hsv.s;
+			values[2] = hsv.v;
+			return;
+		}
+		case ImageSpace::okhsl:
+		{
+			HSL hsl = oklab_to_okhsl(lab);
+			values[0] = hsl.h;
+			values[1] = hsl.s;
+			values[2] = hsl.l;
+			return;
+		}
+		default:
+			values[0] = lab.L;
+			values[1] = lab.a;
+			values[2] = lab.b;
+		}
+	}
+
+	void convert_row(const uint8_t* in_row, uint8_t* out_row) const
+	{
+		const size_t in_channels = in.channels, out_channels = out.channels;
+
+		for (size_t x = 0; x < (size_t)in.width; x++)
+		{
+			const size_t i = x * in_channels, o = x * out_channels;
+			float values[3] = { read(in_row, i, true), read(in_row, i + 1, true), read(in_row, i + 2, true) };
+
+			// sRGB to sRGB without clipping only changes the encoding
+			if (from != ImageSpace::srgb || to != ImageSpace::srgb || clip != GamutClip::none)
+			{
+				Lab lab = to_oklab(values[0], values[1], values[2]);
+				RGB rgb = { values[0], values[1], values[2] };
+				if (to == ImageSpace::srgb || clip != GamutClip::none)
+				{
+					if (from != ImageSpace::srgb)
+						rgb = oklab_to_linear_srgb(lab);
+					if (clip != GamutClip::none && (rgb.r < 0.f || rgb.g < 0.f || rgb.b < 0.f || rgb.r > 1.f || rgb.g > 1.f || rgb.b > 1.f))
+					{
+						rgb = gamut_clip_oklab(lab, clip, alpha);
+						lab = linear_srgb_to_oklab_fast(rgb);
+					}
+				}
+				from_oklab(lab, rgb, values);
+			}
+
+			for (int c = 0; c < 3; c++)
+				write(out_row, o + c, values[c], to == ImageSpace::srgb);
+			if (out_channels == 4)
+				write(out_row, o + 3, in_channels == 4 ? read(in_row, i + 3, false) : 1.f, false);
+		}
+	}
+};
+
+// Integer outputs are PAM with alpha when the path ends in .pam, PPM when it ends in .ppm, and have
+// the channels of the input otherwise. Alpha is kept from PAM to PAM and set opaque when only the
+// output has it. A .pfm path with integer output, or a .ppm or .pam path with PFM output, is refused
+// rather than written with the wrong format.
+ImageConvertResult convert_image(const char* in_path, const char* out_path, const ImageConversion& options = {})
+{
+	OKLAB_PROFILE_SCOPE(call, "convert_image");
+
+	ImageRowConverter converter;
+	converter.from = options.from;
+	converter.to = options.to;
+	converter.clip = options.clip;
+	converter.alpha = options.alpha;
+
+	ImageConvertResult result = {};
+	PnmHeader& in = converter.in;
+	PnmHeader& out = converter.out;
+
+	MappedFile input;
+	if (!input.open_read(in_path) || !parse_image_header(input.data(), input.size(), in))
+	{
+		result.status = ImageConvertStatus::unreadable_input;
+		return result;
+	}
+	if (options.from != ImageSpace::srgb && in.sample != PnmSample::f32)
+	{
+		result.status = ImageConvertStatus::input_not_pfm;
+		return result;
+	}
+	converter.swap_in = in.big_endian == host_is_little_endian();
+
+	// Output format
+	int depth = options.depth;
+	if (options.to != ImageSpace::srgb)
+		depth = 32;
+	else if (depth == 0)
+		depth = path_ends_with(out_path, ".pfm") ? 32 : (in.sample == PnmSample::u16 ? 16 : 8);
+
+	bool pfm_path = path_ends_with(out_path, ".pfm");
+	bool pnm_path = path_ends_with(out_path, ".ppm") || path_ends_with(out_path, ".pam");
+	if (depth == 32 ? pnm_path : pfm_path)
+	{
+		result.status = ImageConvertStatus::output_extension;
+		return result;
+	}
+
+	out.width = in.width;
+	out.height = in.height;
+
+	std::string header;
+	if (depth == 32)
+	{
+		out.sample = PnmSample::f32;
+		out.channels = 3;
+		out.bottom_up = true;
+		header = pfm_header(out.width, out.height);
+	}
+	else
+	{
+		out.sample = depth == 16 ? PnmSample::u16 : PnmSample::u8;
+		out.maxval = depth == 16 ? 65535 : 255;
+		out.channels = path_ends_with(out_path, ".pam") ? 4 : (path_ends_with(out_path, ".ppm") ? 3 : in.channels);
+		header = pnm_header(out.width, out.height, out.channels, out.maxval);
+	}
+	out.data_offset = header.size();
+
+	MappedFile output;
+	if (!output.create(out_path, header.size() + out.row_bytes() * out.height))
+	{
+		result.status = ImageConvertStatus::output_not_created;
+		return result;
+	}
+	memcpy(output.data(), header.data(), header.size());
+
+	// Rows of a band are converted in parallel, then the band's pages are released
+	const size_t band_rows = std::max<size_t>(1, (size_t)(options.band_mb * 1048576.0) / std::max(in.row_bytes(), out.row_bytes()));
+	for (size_t y0 = 0; y0 < (size_t)in.height; y0 += band_rows)
+	{
+		OKLAB_PROFILE_SCOPE(stage, "band");
+		const size_t y1 = std::min((size_t)in.height, y0 + band_rows);
+
+		parallel_for(y1 - y0, [&](size_t begin, size_t end) {
+			for (size_t y = y0 + begin; y < y0 + end; y++)
+				converter.convert_row(input.data() + in.row_offset((int)y), output.data() + out.row_offset((int)y));
+		}, options.threads, 1);
+
+		// PFM bands run backwards through the file
+		OKLAB_PROFILE_SCOPE(stage, "release band");
+		size_t in_first = std::min(in.row_offset((int)y0), in.row_offset((int)y1 - 1));
+		size_t out_first = std::min(out.row_offset((int)y0), out.row_offset((int)y1 - 1));
+		input.release(in_first, (y1 - y0) * in.row_bytes());
+		output.release(out_first, (y1 - y0) * out.row_bytes());
+	}
+	output.close();
+
+	result.status = ImageConvertStatus::ok;
+	result.in = in;
+	result.out = out;
+	return result;
+}
+
+} // namespace ok_color
@@ -0,0 +1,233 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+#include "oklab_source.h"
+#include "oklab_parallel.h"
+#include "oklab_srgb8.h"
+
+namespace ok_color
+{
+
+// ------------------------ Image diff ------------------------ //
+
+// Interleaved 8 bit sRGB (3 channels) or sRGB + alpha (4 channels, alpha is ignored) pixels, stride in bytes
+struct ImageView8
+{
+	const uint8_t* data;
+	int width;
+	int height;
+	int channels;
+	size_t stride;
+};
+
+enum class DiffComponent
+{
+	delta_e,    // full OkLab distance
+	lightness,  // |L1 - L2| only
+	chroma,     // distance in the (a, b) plane only, covering chroma and hue
+};
+
+struct DiffOptions
+{
+	DiffComponent component = DiffComponent::delta_e;
+
+	// Pixels differing by more than this count as different, the default is about a just noticeable difference
+	float threshold = 0.02f;
+
+	// Difference where the heatmap reaches its strongest color
+	float heat_scale = 0.2f;
+
+	// Rows per tile, tiles are spread across threads
+	int tile_rows = 32;
+	unsigned threads = 0;
+};
+
+struct DiffSummary
+{
+	uint64_t pixels;
+	uint64_t above_threshold;
+
+	float max;
+	int max_x, max_y;  // first pixel with the maximum difference
+
+	float mean;
+	float p99;         // 99th percentile, to 1 / 4096
+};
+
+float pixel_difference(Lab x, Lab y, DiffComponent component)
+{
+	float dL = x.L - y.L;
+	float da = x.a - y.a;
+	float db = x.b - y.b;
+
+	switch (component)
+	{
+	case DiffComponent::lightness:
+		return fabsf(dL);
+	case DiffComponent::chroma:
+		return sqrtf(da * da + db * db);
+	default:
+		return sqrtf(dL * dL + da * da + db * db);
+	}
+}
+
+// Heatmap colors for differences from the threshold up to heat_scale, from yellow to red, in OkHSL
+struct HeatRamp
+{
+	uint8_t rgb[256][3];
+
+	HeatRamp()
+	{
+		for (int i = 0; i < 256; i++)
+		{
+			float t = i / 255.f;
+			RGB c = okhsl_to_srgb({ (90.f - 70.f * t) / 360.f, 1.f, 0.85f - 0.3f * t });
+			rgb[i][0] = (uint8_t)(clamp(c.r, 0.f, 1.f) * 255.f + 0.5f);
+			rgb[i][1] = (uint8_t)(clamp(c.g, 0.f, 1.f) * 255.f + 0.5f);
+			rgb[i][2] = (uint8_t)(clamp(c.b, 0.f, 1.f) * 255.f + 0.5f);
+		}
+	}
+};
+
+// Differences of two images of the same size, in OkLab.
+//
+// The images are read one tile of rows at a time, tiles are spread across threads, and the
+// percentile comes from a fixed size histogram, so memory does not grow with the image size.
+// Identical pixels, usually most of a screenshot, are counted without being converted.
+//
+// heatmap (optional) receives width x height RGB pixels: the dimmed first image where the
+// difference is within the threshold, a yellow to red ramp elsewhere.
+DiffSummary diff_images(const ImageView8& x, const ImageView8& y, const DiffOptions& options = {},
+	uint8_t* heatmap = nullptr, size_t heatmap_stride = 0)
+{
+	OKLAB_PROFILE_SCOPE(call, "diff_images");
+	const int bins = 4096;  // over differences in [0, 1], plus one bin for anything larger
+
+	struct Partial
+	{
+		std::vector<uint64_t> histogram = std::vector<uint64_t>(bins + 1, 0);
+		uint64_t identical = 0;
+		uint64_t above = 0;
+		double sum = 0.0;
+		float max = 0.f;
+		int max_x = 0, max_y = 0;
+	};
+
+	Partial total;
+	std::mutex mutex;
+
+	const Srgb8Tables& tables = srgb8_tables();
+	static const HeatRamp ramp;
+
+	int width = std::min(x.width, y.width);
+	int height = std::min(x.height, y.height);
+	int tile_rows = std::max(options.tile_rows, 1);
+	size_t tiles = (size_t)(height + tile_rows - 1) / tile_rows;
+
+	auto to_oklab = [&](const uint8_t* p) {
+		return linear_srgb_to_oklab_fast({ tables.decode[p[0]], tables.decode[p[1]], tables.decode[p[2]] });
+	};
+
+	parallel_for(tiles, [&](size_t begin, size_t end) {
+		Partial local;
+
+		for (int row = (int)begin * tile_rows; row < std::min(height, (int)end * tile_rows); row++)
+		{
+			const uint8_t* px = x.data + row * x.stride;
+			const uint8_t* py = y.data + row * y.stride;
+			uint8_t* heat = heatmap ? heatmap + row * heatmap_stride : nullptr;
+
+			for (int col = 0; col < width; col++, px += x.channels, py += y.channels)
+			{
+				float d = 0.f;
+				if (px[0] != py[0] || px[1] != py[1] || px[2] != py[2])
+					d = pixel_difference(to_oklab(px), to_oklab(py), options.component);
+
+				if (d == 0.f)
+					local.identical++;
+				else
+					local.histogram[d < 1.f ? (int)(d * bins) : bins]++;
+				local.sum += d;
+
+				if (d > local.max)
+				{
+					local.max = d;
+					local.max_x = col;
+					local.max_y = row;
+				}
+
+				bool above = d > options.threshold;
+				local.above += above;
+
+				if (heat)
+				{
+					uint8_t* out = heat + 3 * col;
+					if (above)
+					{
+						float t = (d - options.threshold) / std::max(options.heat_scale - options.threshold, 1e-6f);
+						int i = (int)(std::min(t, 1.f) * 255.f);
+						out[0] = ramp.rgb[i][0];
+						out[1] = ramp.rgb[i][1];
+						out[2] = ramp.rgb[i][2];
+					}
+					else
+					{
+						uint8_t gray = (uint8_t)((px[0] * 54 + px[1] * 183 + px[2] * 19) >> 10);
+						out[0] = out[1] = out[2] = gray;
+					}
+				}
+			}
+		}
+
+		OKLAB_PROFILE_SCOPE(stage, "diff_images merge");
+		std::lock_guard<std::mutex> lock(mutex);
+		for (int i = 0; i <= bins; i++)
+			total.histogram[i] += local.histogram[i];
+		total.identical += local.identical;
+		total.above += local.above;
+		total.sum += local.sum;
+
+		// Ties go to the first pixel in row order, whichever thread finishes first
+		bool earlier = local.max_y < total.max_y || (local.max_y == total.max_y && local.max_x < total.max_x);
+		if (local.max > total.max || (local.max == total.max && local.max > 0.f && earlier))
+		{
+			total.max = local.max;
+			total.max_x = local.max_x;
+			total.max_y = local.max_y;
+		}
+	}, options.threads, 1);
+
+	DiffSummary summary = {};
+	summary.pixels = (uint64_t)width * height;
+	summary.above_threshold = total.above;
+	summary.max = total.max;
+	summary.max_x = total.max_x;
+	summary.max_y = total.max_y;
+
+	if (summary.pixels == 0)
+		return summary;
+
+	summary.mean = (float)(total.sum / summary.pixels);
+
+	// Upper edge of the bin holding the 99th percentile, capped by the actual maximum
+	uint64_t rank = (uint64_t)ceil(0.99 * summary.pixels);
+	uint64_t seen = total.identical;
+	summary.p99 = seen >= rank ? 0.f : summary.max;
+	for (int i = 0; i < bins && seen < rank; i++)
+	{
+		seen += total.histogram[i];
+		if (seen >= rank)
+		{
+			summary.p99 = std::min((i + 1.f) / bins, summary.max);
+			break;
+		}
+	}
+
+	return summary;
+}
+
+} // namespace ok_color
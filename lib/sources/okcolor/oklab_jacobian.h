@@ -0,0 +1,428 @@
+#pragma once
+
+#include <cstddef>
+#include "oklab_source.h"
+
+namespace ok_color
+{
+
+// ------------------------ Dual numbers ------------------------ //
+
+// Scalars for the generic conversions of oklab_source.h that also carry the derivatives with respect
+// to N inputs (forward mode automatic differentiation), e.g. Dual<3> for a full Jacobian or Dual<1>
+// for a directional derivative.
+// Derivatives are those of the functions as implemented, including their polynomial approximations.
+namespace generic
+{
+
+template <int N>
+struct Dual
+{
+	float v;
+	float d[N];
+
+	Dual(float value = 0.f) : v(value), d{}
+	{
+	}
+
+	// The i-th of the N inputs
+	static Dual variable(float value, int i)
+	{
+		Dual x(value);
+		x.d[i] = 1.f;
+		return x;
+	}
+};
+
+template <int N> Dual<N> operator-(const Dual<N>& x)
+{
+	Dual<N> r(-x.v);
+	for (int i = 0; i < N; i++)
+		r.d[i] = -x.d[i];
+	return r;
+}
+
+template <int N> Dual<N> operator+(const Dual<N>& x, const Dual<N>& y)
+{
+	Dual<N> r(x.v + y.v);
+	for (int i = 0; i < N; i++)
+		r.d[i] = x.d[i] + y.d[i];
+	return r;
+}
+
+template <int N> Dual<N> operator-(const Dual<N>& x, const Dual<N>& y)
+{
+	Dual<N> r(x.v - y.v);
+	for (int i = 0; i < N; i++)
+		r.d[i] = x.d[i] - y.d[i];
+	return r;
+}
+
+template <int N> Dual<N> operator*(const Dual<N>& x, const Dual<N>& y)
+{
+	Dual<N> r(x.v * y.v);
+	for (int i = 0; i < N; i++)
+		r.d[i] = x.d[i] * y.v + x.v * y.d[i];
+	return r;
+}
+
+template <int N> Dual<N> operator/(const Dual<N>& x, const Dual<N>& y)
+{
+	float inv = 1.f / y.v;
+	Dual<N> r(x.v * inv);
+	for (int i = 0; i < N; i++)
+		r.d[i] = (x.d[i] - r.v * y.d[i]) * inv;
+	return r;
+}
+
+template <int N> Dual<N> operator+(const Dual<N>& x, float y) { return x + Dual<N>(y); }
+template <int N> Dual<N> operator+(float x, const Dual<N>& y) { return Dual<N>(x) + y; }
+template <int N> Dual<N> operator-(const Dual<N>& x, float y) { return x - Dual<N>(y); }
+template <int N> Dual<N> operator-(float x, const Dual<N>& y) { return Dual<N>(x) - y; }
+template <int N> Dual<N> operator/(const Dual<N>& x, float y) { return x / Dual<N>(y); }
+template <int N> Dual<N> operator/(float x, const Dual<N>& y) { return Dual<N>(x) / y; }
+
+template <int N> Dual<N> operator*(const Dual<N>& x, float y)
+{
+	Dual<N> r(x.v * y);
+	for (int i = 0; i < N; i++)
+		r.d[i] = x.d[i] * y;
+	return r;
+}
+
+template <int N> Dual<N> operator*(float x, const Dual<N>& y)
+{
+	return y * x;
+}
+
+// Comparisons only look at values, so branches follow the same path as with float
+template <int N> bool operator<(const Dual<N>& x, const Dual<N>& y) { return x.v < y.v; }
+template <int N> bool operator<(const Dual<N>& x, float y) { return x.v < y; }
+template <int N> bool operator<(float x, const Dual<N>& y) { return x < y.v; }
+template <int N> bool operator>(const Dual<N>& x, const Dual<N>& y) { return x.v > y.v; }
+template <int N> bool operator>(const Dual<N>& x, float y) { return x.v > y; }
+template <int N> bool operator>(float x, const Dual<N>& y) { return x > y.v; }
+template <int N> bool operator<=(const Dual<N>& x, const Dual<N>& y) { return x.v <= y.v; }
+template <int N> bool operator<=(const Dual<N>& x, float y) { return x.v <= y; }
+template <int N> bool operator<=(float x, const Dual<N>& y) { return x <= y.v; }
+template <int N> bool operator>=(const Dual<N>& x, const Dual<N>& y) { return x.v >= y.v; }
+template <int N> bool operator>=(const Dual<N>& x, float y) { return x.v >= y; }
+template <int N> bool operator>=(float x, const Dual<N>& y) { return x >= y.v; }
+template <int N> bool operator==(const Dual<N>& x, float y) { return x.v == y; }
+
+// Functions of one variable: value f and derivative df at x.v
+template <int N> Dual<N> chain(const Dual<N>& x, float f, float df)
+{
+	Dual<N> r(f);
+	for (int i = 0; i < N; i++)
+		r.d[i] = df * x.d[i];
+	return r;
+}
+
+template <int N> Dual<N> sqrt(const Dual<N>& x)
+{
+	float v = sqrtf(x.v);
+	return chain(x, v, 0.5f / v);
+}
+
+template <int N> Dual<N> cbrt(const Dual<N>& x)
+{
+	float v = cbrtf(x.v);
+	return chain(x, v, 1.f / (3.f * v * v));
+}
+
+template <int N> Dual<N> pow(const Dual<N>& x, float p)
+{
+	float v = powf(x.v, p);
+	return chain(x, v, p * v / x.v);
+}
+
+template <int N> Dual<N> cos(const Dual<N>& x)
+{
+	return chain(x, cosf(x.v), -sinf(x.v));
+}
+
+template <int N> Dual<N> sin(const Dual<N>& x)
+{
+	return chain(x, sinf(x.v), cosf(x.v));
+}
+
+template <int N> Dual<N> atan2(const Dual<N>& y, const Dual<N>& x)
+{
+	float r2 = x.v * x.v + y.v * y.v;
+	Dual<N> r(atan2f(y.v, x.v));
+	for (int i = 0; i < N; i++)
+		r.d[i] = (x.v * y.d[i] - y.v * x.d[i]) / r2;
+	return r;
+}
+
+template <int N> Dual<N> fmin(const Dual<N>& x, const Dual<N>& y)
+{
+	return y.v < x.v ? y : x;
+}
+
+template <int N> Dual<N> fmax(const Dual<N>& x, const Dual<N>& y)
+{
+	return y.v > x.v ? y : x;
+}
+
+template <int N> Dual<N> fabs(const Dual<N>& x)
+{
+	return x.v < 0.f ? -x : x;
+}
+
+// The generic conversions pick these overloads for Dual scalars.
+// Hue only terms: a and b are cos and sin of the hue angle, so their derivatives all go through
+// d(angle) = a db - b da. These are evaluated with a single derivative, with respect to the angle,
+// and expanded afterwards, which saves most of the cost of the Jacobians.
+template <int N>
+Dual<N> expand_hue_derivative(const Dual<1>& x, const Dual<N>& a, const Dual<N>& b)
+{
+	Dual<N> r(x.v);
+	for (int i = 0; i < N; i++)
+		r.d[i] = x.d[0] * (a.v * b.d[i] - b.v * a.d[i]);
+	return r;
+}
+
+template <class G, int N>
+LC<Dual<N>> find_cusp(Dual<N> a, Dual<N> b)
+{
+	Dual<1> a1(a.v), b1(b.v);
+	a1.d[0] = -b.v;
+	b1.d[0] = a.v;
+
+	LC<Dual<1>> cusp = find_cusp<G, Dual<1>>(a1, b1);
+	return { expand_hue_derivative(cusp.L, a, b), expand_hue_derivative(cusp.C, a, b) };
+}
+
+template <class G, int N>
+ST<Dual<N>> get_ST_mid(Dual<N> a_, Dual<N> b_)
+{
+	Dual<1> a1(a_.v), b1(b_.v);
+	a1.d[0] = -b_.v;
+	b1.d[0] = a_.v;
+
+	ST<Dual<1>> st = get_ST_mid<G, Dual<1>>(a1, b1);
+	return { expand_hue_derivative(st.S, a_, b_), expand_hue_derivative(st.T_, a_, b_) };
+}
+
+} // namespace generic
+
+// ------------------------ Jacobians ------------------------ //
+
+// m[i][j] is the derivative of output component i with respect to input component j,
+// components in the order of the structs (L, a, b / r, g, b / h, s, l / h, s, v)
+struct Jacobian
+{
+	float m[3][3];
+};
+
+// Analytic: the linear maps around the cube root. Infinite where an LMS component is 0 (e.g. black).
+Lab linear_srgb_to_oklab(RGB c, Jacobian& J)
+{
+	static const float M1[3][3] = {
+		{ 0.4122214708f, 0.5363325363f, 0.0514459929f },
+		{ 0.2119034982f, 0.6806995451f, 0.1073969566f },
+		{ 0.0883024619f, 0.2817188376f, 0.6299787005f },
+	};
+	static const float M2[3][3] = {
+		{ 0.2104542553f, +0.7936177850f, -0.0040720468f },
+		{ 1.9779984951f, -2.4285922050f, +0.4505937099f },
+		{ 0.0259040371f, +0.7827717662f, -0.8086757660f },
+	};
+
+	float lms_[3], dlms[3];
+	for (int k = 0; k < 3; k++)
+	{
+		float x = M1[k][0] * c.r + M1[k][1] * c.g + M1[k][2] * c.b;
+		lms_[k] = cbrtf(x);
+		dlms[k] = 1.f / (3.f * lms_[k] * lms_[k]);
+	}
+
+	for (int i = 0; i < 3; i++)
+		for (int j = 0; j < 3; j++)
+			J.m[i][j] = M2[i][0] * dlms[0] * M1[0][j] + M2[i][1] * dlms[1] * M1[1][j] + M2[i][2] * dlms[2] * M1[2][j];
+
+	return {
+		M2[0][0] * lms_[0] + M2[0][1] * lms_[1] + M2[0][2] * lms_[2],
+		M2[1][0] * lms_[0] + M2[1][1] * lms_[1] + M2[1][2] * lms_[2],
+		M2[2][0] * lms_[0] + M2[2][1] * lms_[1] + M2[2][2] * lms_[2],
+	};
+}
+
+// Analytic
+RGB oklab_to_linear_srgb(Lab c, Jacobian& J)
+{
+	static const float M2_inv[3][3] = {
+		{ 1.f, +0.3963377774f, +0.2158037573f },
+		{ 1.f, -0.1055613458f, -0.0638541728f },
+		{ 1.f, -0.0894841775f, -1.2914855480f },
+	};
+	static const float M1_inv[3][3] = {
+		{ +4.0767416621f, -3.3077115913f, +0.2309699292f },
+		{ -1.2684380046f, +2.6097574011f, -0.3413193965f },
+		{ -0.0041960863f, -0.7034186147f, +1.7076147010f },
+	};
+
+	float lms[3], dlms[3];
+	for (int k = 0; k < 3; k++)
+	{
+		float x = M2_inv[k][0] * c.L + M2_inv[k][1] * c.a + M2_inv[k][2] * c.b;
+		lms[k] = x * x * x;
+		dlms[k] = 3.f * x * x;
+	}
+
+	for (int i = 0; i < 3; i++)
+		for (int j = 0; j < 3; j++)
+			J.m[i][j] = M1_inv[i][0] * dlms[0] * M2_inv[0][j] + M1_inv[i][1] * dlms[1] * M2_inv[1][j] + M1_inv[i][2] * dlms[2] * M2_inv[2][j];
+
+	return {
+		M1_inv[0][0] * lms[0] + M1_inv[0][1] * lms[1] + M1_inv[0][2] * lms[2],
+		M1_inv[1][0] * lms[0] + M1_inv[1][1] * lms[1] + M1_inv[1][2] * lms[2],
+		M1_inv[2][0] * lms[0] + M1_inv[2][1] * lms[1] + M1_inv[2][2] * lms[2],
+	};
+}
+
+void set_jacobian_row(Jacobian& J, int i, const generic::Dual<3>& y)
+{
+	for (int j = 0; j < 3; j++)
+		J.m[i][j] = y.d[j];
+}
+
+// With dual numbers, as the cusp and gamut intersections make analytic forms unwieldy
+HSL oklab_to_okhsl(Lab lab, Jacobian& J)
+{
+	using D = generic::Dual<3>;
+	generic::HSL<D> y = generic::oklab_to_okhsl(generic::Lab<D>{ D::variable(lab.L, 0), D::variable(lab.a, 1), D::variable(lab.b, 2) });
+
+	set_jacobian_row(J, 0, y.h);
+	set_jacobian_row(J, 1, y.s);
+	set_jacobian_row(J, 2, y.l);
+	return { y.h.v, y.s.v, y.l.v };
+}
+
+Lab okhsl_to_oklab(HSL hsl, Jacobian& J)
+{
+	using D = generic::Dual<3>;
+	generic::Lab<D> y = generic::okhsl_to_oklab(generic::HSL<D>{ D::variable(hsl.h, 0), D::variable(hsl.s, 1), D::variable(hsl.l, 2) });
+
+	set_jacobian_row(J, 0, y.L);
+	set_jacobian_row(J, 1, y.a);
+	set_jacobian_row(J, 2, y.b);
+	return { y.L.v, y.a.v, y.b.v };
+}
+
+HSV oklab_to_okhsv(Lab lab, Jacobian& J)
+{
+	using D = generic::Dual<3>;
+	generic::HSV<D> y = generic::oklab_to_okhsv(generic::Lab<D>{ D::variable(lab.L, 0), D::variable(lab.a, 1), D::variable(lab.b, 2) });
+
+	set_jacobian_row(J, 0, y.h);
+	set_jacobian_row(J, 1, y.s);
+	set_jacobian_row(J, 2, y.v);
+	return { y.h.v, y.s.v, y.v.v };
+}
+
+Lab okhsv_to_oklab(HSV hsv, Jacobian& J)
+{
+	using D = generic::Dual<3>;
+	generic::Lab<D> y = generic::okhsv_to_oklab(generic::HSV<D>{ D::variable(hsv.h, 0), D::variable(hsv.s, 1), D::variable(hsv.v, 2) });
+
+	set_jacobian_row(J, 0, y.L);
+	set_jacobian_row(J, 1, y.a);
+	set_jacobian_row(J, 2, y.b);
+	return { y.L.v, y.a.v, y.b.v };
+}
+
+// J = A * B
+Jacobian operator*(const Jacobian& A, const Jacobian& B)
+{
+	Jacobian J;
+	for (int i = 0; i < 3; i++)
+		for (int j = 0; j < 3; j++)
+			J.m[i][j] = A.m[i][0] * B.m[0][j] + A.m[i][1] * B.m[1][j] + A.m[i][2] * B.m[2][j];
+	return J;
+}
+
+// ------ Batches ------ //
+
+// J may be null when only values are needed, the plain conversions are used then
+void linear_srgb_to_oklab(const RGB* in, Lab* out, Jacobian* J, size_t count)
+{
+	if (!J)
+	{
+		for (size_t i = 0; i < count; i++)
+			out[i] = linear_srgb_to_oklab(in[i]);
+		return;
+	}
+
+	for (size_t i = 0; i < count; i++)
+		out[i] = linear_srgb_to_oklab(in[i], J[i]);
+}
+
+void oklab_to_linear_srgb(const Lab* in, RGB* out, Jacobian* J, size_t count)
+{
+	if (!J)
+	{
+		for (size_t i = 0; i < count; i++)
+			out[i] = oklab_to_linear_srgb(in[i]);
+		return;
+	}
+
+	for (size_t i = 0; i < count; i++)
+		out[i] = oklab_to_linear_srgb(in[i], J[i]);
+}
+
+void oklab_to_okhsl(const Lab* in, HSL* out, Jacobian* J, size_t count)
+{
+	if (!J)
+	{
+		for (size_t i = 0; i < count; i++)
+			out[i] = oklab_to_okhsl(in[i]);
+		return;
+	}
+
+	for (size_t i = 0; i < count; i++)
+		out[i] = oklab_to_okhsl(in[i], J[i]);
+}
+
+void okhsl_to_oklab(const HSL* in, Lab* out, Jacobian* J, size_t count)
+{
+	if (!J)
+	{
+		for (size_t i = 0; i < count; i++)
+			out[i] = okhsl_to_oklab(in[i]);
+		return;
+	}
+
+	for (size_t i = 0; i < count; i++)
+		out[i] = okhsl_to_oklab(in[i], J[i]);
+}
+
+void oklab_to_okhsv(const Lab* in, HSV* out, Jacobian* J, size_t count)
+{
+	if (!J)
+	{
+		for (size_t i = 0; i < count; i++)
+			out[i] = oklab_to_okhsv(in[i]);
+		return;
+	}
+
+	for (size_t i = 0; i < count; i++)
+		out[i] = oklab_to_okhsv(in[i], J[i]);
+}
+
+void okhsv_to_oklab(const HSV* in, Lab* out, Jacobian* J, size_t count)
+{
+	if (!J)
+	{
+		for (size_t i = 0; i < count; i++)
+			out[i] = okhsv_to_oklab(in[i]);
+		return;
+	}
+
+	for (size_t i = 0; i < count; i++)
+		out[i] = okhsv_to_oklab(in[i], J[i]);
+}
+
+} // namespace ok_color
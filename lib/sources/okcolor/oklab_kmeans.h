@@ -0,0 +1,285 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+#include "oklab_source.h"
+#include "oklab_parallel.h"
+#include "oklab_srgb8.h"
+
+namespace ok_color
+{
+
+// ------------------------ Palette extraction ------------------------ //
+
+struct PaletteColor
+{
+	Lch lch;
+	float share;  // fraction of the pixels closest to this color
+};
+
+struct PaletteExtraction
+{
+	int colors = 16;
+
+	// Pixels sampled for k-means++ seeding and for each mini-batch iteration
+	int seed_samples = 16384;
+	int batch_size = 8192;
+	int max_iterations = 100;
+
+	// Stops once no centroid moved more than this in OkLab for a few iterations in a row,
+	// well below visible differences (around 0.02)
+	float tolerance = 1e-3f;
+
+	// Pixels sampled to measure the shares, 0 uses every pixel
+	size_t share_samples = 1 << 18;
+
+	// Moves the resulting colors into sRGB, none keeps the cluster centers as they are
+	GamutClip clip = GamutClip::none;
+
+	uint64_t seed = 1;
+	unsigned threads = 0;
+};
+
+// Planar cluster centers, so the distance loop over them vectorizes
+struct Centroids
+{
+	std::vector<float> L, a, b;
+
+	int size() const
+	{
+		return (int)L.size();
+	}
+
+	void push_back(Lab lab)
+	{
+		L.push_back(lab.L);
+		a.push_back(lab.a);
+		b.push_back(lab.b);
+	}
+
+	Lab operator[](int i) const
+	{
+		return { L[i], a[i], b[i] };
+	}
+
+	int nearest(Lab lab) const
+	{
+		int best = 0;
+		float best_d2 = INFINITY;
+		for (int i = 0; i < size(); i++)
+		{
+			float dL = L[i] - lab.L;
+			float da = a[i] - lab.a;
+			float db = b[i] - lab.b;
+			float d2 = dL * dL + da * da + db * db;
+
+			best = d2 < best_d2 ? i : best;
+			best_d2 = d2 < best_d2 ? d2 : best_d2;
+		}
+		return best;
+	}
+};
+
+// Stateless random numbers, so samples don't depend on how the work is split between threads
+uint64_t splitmix64(uint64_t x)
+{
+	x += 0x9E3779B97F4A7C15ull;
+	x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+	x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+	return x ^ (x >> 31);
+}
+
+// Mini-batch k-means (Sculley 2010) in OkLab, seeded with k-means++.
+//
+// Each iteration assigns a random batch of pixels to their nearest centers in parallel, then moves
+// every center towards the mean of its pixels by n / (pixels assigned so far), so the centers settle as
+// they see more pixels. Only the sampled pixels are ever converted to OkLab.
+//
+// lab_at(i) returns pixel i in OkLab and must be safe to call from several threads.
+// Results are sorted by share, centers that ended up without pixels are left out.
+template <class F>
+std::vector<PaletteColor> extract_palette_from(F lab_at, size_t count, const PaletteExtraction& options = {})
+{
+	OKLAB_PROFILE_SCOPE(call, "extract_palette");
+	if (count == 0 || options.colors <= 0)
+		return {};
+
+	auto sample = [&](uint64_t stream, uint64_t i) {
+		return (size_t)(splitmix64(options.seed ^ splitmix64(stream) ^ i) % count);
+	};
+
+	// ------ k-means++ seeding ------ //
+
+	std::vector<Lab> pool((size_t)std::max(options.seed_samples, options.colors));
+	for (size_t i = 0; i < pool.size(); i++)
+		pool[i] = lab_at(sample(0, i));
+
+	Centroids centroids;
+	centroids.push_back(pool[0]);
+
+	std::vector<float> d2(pool.size(), INFINITY);
+	for (int k = 1; k < options.colors; k++)
+	{
+		Lab last = centroids[k - 1];
+		double total = 0.0;
+		for (size_t i = 0; i < pool.size(); i++)
+		{
+			float dL = pool[i].L - last.L;
+			float da = pool[i].a - last.a;
+			float db = pool[i].b - last.b;
+			d2[i] = std::min(d2[i], dL * dL + da * da + db * db);
+			total += d2[i];
+		}
+
+		// Every sample is already a center
+		if (!(total > 0.0))
+			break;
+
+		double target = (splitmix64(options.seed ^ k) >> 11) * (1.0 / 9007199254740992.0) * total;
+		size_t pick = 0;
+		for (double sum = 0.0; pick < pool.size() - 1; pick++)
+		{
+			sum += d2[pick];
+			if (sum > target)
+				break;
+		}
+
+		centroids.push_back(pool[pick]);
+	}
+
+	int k = centroids.size();
+
+	// ------ Mini-batch iterations ------ //
+
+	std::vector<double> seen(k, 0.0);
+	std::mutex mutex;
+	int calm = 0;
+
+	// The batch is summed in chunks of a fixed size, and the chunks' sums are added up in order,
+	// so the rounding of the sums doesn't depend on the thread count or on thread timing
+	const size_t chunk = 1024;
+	const size_t batch_size = (size_t)std::max(options.batch_size, 0);
+	const size_t chunks = (batch_size + chunk - 1) / chunk;
+	std::vector<double> partials(chunks * 4 * k);
+
+	// The same threads run every iteration: each sums its share of the chunks, then the first
+	// one updates the centers between two barriers while the others wait
+	const unsigned threads = options.threads > 0 ? options.threads : default_thread_count();
+	const size_t workers = std::max<size_t>(1, std::min<size_t>(threads, chunks));
+	Barrier barrier((unsigned)workers);
+	bool done = false;
+
+	parallel_for(workers, [&](size_t worker, size_t) {
+		for (int iteration = 0; iteration < options.max_iterations; iteration++)
+		{
+			OKLAB_PROFILE_SCOPE(stage, "extract_palette iteration");
+
+			for (size_t j = worker; j < chunks; j += workers)
+			{
+				double* partial = &partials[j * 4 * k];
+				std::fill(partial, partial + 4 * k, 0.0);
+				for (size_t i = j * chunk; i < std::min(batch_size, (j + 1) * chunk); i++)
+				{
+					Lab lab = lab_at(sample(iteration + 1, i));
+					int c = centroids.nearest(lab);
+					partial[4 * c + 0] += 1.0;
+					partial[4 * c + 1] += lab.L;
+					partial[4 * c + 2] += lab.a;
+					partial[4 * c + 3] += lab.b;
+				}
+			}
+
+			barrier.arrive_and_wait();
+			if (worker == 0)
+			{
+				// Per center pixel count and sums of L, a and b
+				std::vector<double> batch(4 * k, 0.0);
+				for (size_t j = 0; j < chunks; j++)
+					for (int i = 0; i < 4 * k; i++)
+						batch[i] += partials[j * 4 * k + i];
+
+				float shift = 0.f;
+				for (int c = 0; c < k; c++)
+				{
+					double n = batch[4 * c];
+					if (n == 0.0)
+						continue;
+
+					seen[c] += n;
+					float eta = (float)(n / seen[c]);
+
+					float dL = eta * ((float)(batch[4 * c + 1] / n) - centroids.L[c]);
+					float da = eta * ((float)(batch[4 * c + 2] / n) - centroids.a[c]);
+					float db = eta * ((float)(batch[4 * c + 3] / n) - centroids.b[c]);
+					centroids.L[c] += dL;
+					centroids.a[c] += da;
+					centroids.b[c] += db;
+
+					shift = std::max(shift, sqrtf(dL * dL + da * da + db * db));
+				}
+
+				calm = shift < options.tolerance ? calm + 1 : 0;
+				done = calm >= 3;
+			}
+			barrier.arrive_and_wait();
+
+			if (done)
+				break;
+		}
+	}, (unsigned)workers, 1);
+
+	// ------ Shares ------ //
+
+	OKLAB_PROFILE_SCOPE(stage, "extract_palette shares");
+	bool every_pixel = options.share_samples == 0 || options.share_samples >= count;
+	size_t share_count = every_pixel ? count : options.share_samples;
+
+	std::vector<uint64_t> pixels(k, 0);
+	parallel_for(share_count, [&](size_t begin, size_t end) {
+		std::vector<uint64_t> partial(k, 0);
+		for (size_t i = begin; i < end; i++)
+			partial[centroids.nearest(lab_at(every_pixel ? i : sample(~0ull, i)))]++;
+
+		std::lock_guard<std::mutex> lock(mutex);
+		for (int c = 0; c < k; c++)
+			pixels[c] += partial[c];
+	}, options.threads);
+
+	std::vector<PaletteColor> palette;
+	for (int c = 0; c < k; c++)
+	{
+		if (pixels[c] == 0)
+			continue;
+
+		Lab lab = centroids[c];
+		if (options.clip != GamutClip::none)
+			lab = linear_srgb_to_oklab(gamut_clip(oklab_to_linear_srgb(lab), options.clip));
+
+		palette.push_back({ oklab_to_lch(lab), (float)pixels[c] / share_count });
+	}
+
+	std::sort(palette.begin(), palette.end(), [](const PaletteColor& x, const PaletteColor& y) {
+		return x.share > y.share;
+	});
+
+	return palette;
+}
+
+std::vector<PaletteColor> extract_palette(const Lab* pixels, size_t count, const PaletteExtraction& options = {})
+{
+	return extract_palette_from([pixels](size_t i) { return pixels[i]; }, count, options);
+}
+
+// Packed 0xAARRGGBB pixels, alpha is ignored
+std::vector<PaletteColor> extract_palette_argb32(const uint32_t* pixels, size_t count, const PaletteExtraction& options = {})
+{
+	const Srgb8Tables& tables = srgb8_tables();
+	return extract_palette_from([pixels, &tables](size_t i) {
+		return linear_srgb_to_oklab_fast(argb32_to_linear_srgb(tables, pixels[i]));
+	}, count, options);
+}
+
+} // namespace ok_color
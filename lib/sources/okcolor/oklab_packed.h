@@ -0,0 +1,321 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include "oklab_source.h"
+#include "oklab_parallel.h"
+#include "oklab_palette_index.h"
+#include "oklab_pixel_formats.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+namespace ok_color
+{
+
+// ------------------------ Packed OkLab ------------------------ //
+
+// OkLab in 32 bits: L in bits 22-31 (10 bits), a in bits 11-21 and b in bits 0-10 (11 bits each).
+// The ranges cover every sRGB color, a in [-0.234, 0.277] and b in [-0.312, 0.199], with a small
+// margin. Colors outside (wide gamut or out of range L) are clamped to the box.
+//
+// Quantization error is at most half a step: 4.9e-4 for L, 1.3e-4 for a and b, 5.2e-4 in delta_e,
+// well below the ~0.02 of a just noticeable difference.
+struct PackedLab { uint32_t bits; };
+
+// OkLch in 32 bits, the same layout with C in [0, 0.4] and h in [0, 2 pi). Hue wraps around, the
+// error is at most 1.5e-3 radians, which is below 5e-4 in a and b for sRGB chromas.
+struct PackedLch { uint32_t bits; };
+
+// OkLab as 3 half floats, 48 bits. Relative error 2^-11: below 2.5e-4 for L and 1.3e-4 for a and b,
+// any range.
+struct HalfLab { uint16_t L; uint16_t a; uint16_t b; };
+
+struct PackedRange
+{
+	float min, step;
+	uint32_t max_code;
+
+	constexpr PackedRange(float min, float max, int bits)
+		: min(min), step((max - min) / ((1u << bits) - 1)), max_code((1u << bits) - 1) {}
+
+	// Codes are below 2^11, so conversions go through int32_t, which SIMD instruction sets have
+	// (there is no float to uint32_t conversion before AVX-512). The clamps are max and min, NaN
+	// giving 0, the same as _mm256_max_ps and _mm256_min_ps.
+	uint32_t encode(float x) const
+	{
+		float q = (x - min) / step;
+		q = q > 0.f ? (q < (float)(int32_t)max_code ? q : (float)(int32_t)max_code) : 0.f;
+		return (uint32_t)(int32_t)(q + 0.5f);
+	}
+
+	float decode(uint32_t q) const
+	{
+		return min + (float)(int32_t)q * step;
+	}
+};
+
+constexpr PackedRange packed_L = { 0.f, 1.f, 10 };
+constexpr PackedRange packed_a = { -0.24f, 0.28f, 11 };
+constexpr PackedRange packed_b = { -0.32f, 0.2f, 11 };
+constexpr PackedRange packed_C = { 0.f, 0.4f, 11 };
+
+PackedLab pack_oklab(Lab c)
+{
+	return { (packed_L.encode(c.L) << 22) | (packed_a.encode(c.a) << 11) | packed_b.encode(c.b) };
+}
+
+Lab unpack_oklab(PackedLab p)
+{
+	return { packed_L.decode(p.bits >> 22), packed_a.decode((p.bits >> 11) & 0x7ff), packed_b.decode(p.bits & 0x7ff) };
+}
+
+PackedLch pack_oklch(Lch c)
+{
+	// Hue in turns, rounded and wrapped to 11 bits
+	float turns = c.h * (0.5f / pi);
+	turns -= floorf(turns);
+	uint32_t h = (uint32_t)(int32_t)(turns * 2048.f + 0.5f) & 0x7ff;
+	return { (packed_L.encode(c.l) << 22) | (packed_C.encode(c.c) << 11) | h };
+}
+
+Lch unpack_oklch(PackedLch p)
+{
+	return { packed_L.decode(p.bits >> 22), packed_C.decode((p.bits >> 11) & 0x7ff), (float)(int32_t)(p.bits & 0x7ff) * (2.f * pi / 2048.f) };
+}
+
+HalfLab pack_oklab_half(Lab c)
+{
+	return { float_to_half(c.L), float_to_half(c.a), float_to_half(c.b) };
+}
+
+Lab unpack_oklab_half(HalfLab p)
+{
+	return { half_to_float(p.L), half_to_float(p.a), half_to_float(p.b) };
+}
+
+// ------ Batches ------ //
+
+// The unpacking loops are vectorized by the compiler (8 colors per iteration with AVX2). Packing
+// and delta_e are not: GCC keeps the float clamps as branches under the default -ftrapping-math,
+// and sqrtf as a call for errno. They have AVX2 kernels instead when the compiler targets it
+// (e.g. -mavx2 or -march=native). Packing gives the same results as the scalar functions, delta_e
+// too unless the compiler fuses the scalar multiply adds (-mfma), then they differ by rounding.
+
+#if defined(__AVX2__)
+// Lab and Lch are 3 floats, so the components of 8 colors are 8 gathers 3 floats apart
+inline __m256i packed_components()
+{
+	return _mm256_setr_epi32(0, 3, 6, 9, 12, 15, 18, 21);
+}
+
+inline __m256i encode8(const PackedRange& range, __m256 x)
+{
+	__m256 q = _mm256_div_ps(_mm256_sub_ps(x, _mm256_set1_ps(range.min)), _mm256_set1_ps(range.step));
+	q = _mm256_min_ps(_mm256_max_ps(q, _mm256_setzero_ps()), _mm256_set1_ps((float)(int32_t)range.max_code));
+	return _mm256_cvttps_epi32(_mm256_add_ps(q, _mm256_set1_ps(0.5f)));
+}
+
+// Index of the first color left to the scalar loop
+size_t pack_oklab8(const Lab* in, PackedLab* out, size_t count)
+{
+	const __m256i index = packed_components();
+	size_t i = 0;
+	for (; i + 8 <= count; i += 8)
+	{
+		const float* p = &in[i].L;
+		__m256i L = encode8(packed_L, _mm256_i32gather_ps(p, index, 4));
+		__m256i a = encode8(packed_a, _mm256_i32gather_ps(p + 1, index, 4));
+		__m256i b = encode8(packed_b, _mm256_i32gather_ps(p + 2, index, 4));
+		__m256i bits = _mm256_or_si256(_mm256_or_si256(_mm256_slli_epi32(L, 22), _mm256_slli_epi32(a, 11)), b);
+		_mm256_storeu_si256((__m256i*)(out + i), bits);
+	}
+	return i;
+}
+
+size_t pack_oklch8(const Lch* in, PackedLch* out, size_t count)
+{
+	const __m256i index = packed_components();
+	size_t i = 0;
+	for (; i + 8 <= count; i += 8)
+	{
+		const float* p = &in[i].l;
+		__m256i L = encode8(packed_L, _mm256_i32gather_ps(p, index, 4));
+		__m256i C = encode8(packed_C, _mm256_i32gather_ps(p + 1, index, 4));
+
+		__m256 turns = _mm256_mul_ps(_mm256_i32gather_ps(p + 2, index, 4), _mm256_set1_ps(0.5f / pi));
+		turns = _mm256_sub_ps(turns, _mm256_floor_ps(turns));
+		__m256i h = _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(turns, _mm256_set1_ps(2048.f)), _mm256_set1_ps(0.5f)));
+		h = _mm256_and_si256(h, _mm256_set1_epi32(0x7ff));
+
+		__m256i bits = _mm256_or_si256(_mm256_or_si256(_mm256_slli_epi32(L, 22), _mm256_slli_epi32(C, 11)), h);
+		_mm256_storeu_si256((__m256i*)(out + i), bits);
+	}
+	return i;
+}
+
+size_t delta_e8(const PackedLab* x, const PackedLab* y, float* out, size_t count)
+{
+	const __m256i mask = _mm256_set1_epi32(0x7ff);
+	size_t i = 0;
+	for (; i + 8 <= count; i += 8)
+	{
+		__m256i p = _mm256_loadu_si256((const __m256i*)(x + i));
+		__m256i q = _mm256_loadu_si256((const __m256i*)(y + i));
+
+		__m256i dL = _mm256_sub_epi32(_mm256_srli_epi32(p, 22), _mm256_srli_epi32(q, 22));
+		__m256i da = _mm256_sub_epi32(_mm256_and_si256(_mm256_srli_epi32(p, 11), mask), _mm256_and_si256(_mm256_srli_epi32(q, 11), mask));
+		__m256i db = _mm256_sub_epi32(_mm256_and_si256(p, mask), _mm256_and_si256(q, mask));
+
+		__m256 L = _mm256_mul_ps(_mm256_cvtepi32_ps(dL), _mm256_set1_ps(packed_L.step));
+		__m256 a = _mm256_mul_ps(_mm256_cvtepi32_ps(da), _mm256_set1_ps(packed_a.step));
+		__m256 b = _mm256_mul_ps(_mm256_cvtepi32_ps(db), _mm256_set1_ps(packed_b.step));
+
+		// Multiplies and adds in the order of the scalar code
+		__m256 d = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(L, L), _mm256_mul_ps(a, a)), _mm256_mul_ps(b, b));
+		_mm256_storeu_ps(out + i, _mm256_sqrt_ps(d));
+	}
+	return i;
+}
+#endif
+
+void pack_oklab(const Lab* in, PackedLab* out, size_t count, unsigned threads = 0)
+{
+	OKLAB_PROFILE_SCOPE(call, "pack_oklab");
+	parallel_for(count, [&](size_t begin, size_t end) {
+		size_t i = begin;
+#if defined(__AVX2__)
+		i += pack_oklab8(in + begin, out + begin, end - begin);
+#endif
+		for (; i < end; i++)
+			out[i] = pack_oklab(in[i]);
+	}, threads, 65536);
+}
+
+void unpack_oklab(const PackedLab* in, Lab* out, size_t count, unsigned threads = 0)
+{
+	OKLAB_PROFILE_SCOPE(call, "unpack_oklab");
+	parallel_for(count, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++)
+			out[i] = unpack_oklab(in[i]);
+	}, threads, 65536);
+}
+
+void pack_oklch(const Lch* in, PackedLch* out, size_t count, unsigned threads = 0)
+{
+	OKLAB_PROFILE_SCOPE(call, "pack_oklch");
+	parallel_for(count, [&](size_t begin, size_t end) {
+		size_t i = begin;
+#if defined(__AVX2__)
+		i += pack_oklch8(in + begin, out + begin, end - begin);
+#endif
+		for (; i < end; i++)
+			out[i] = pack_oklch(in[i]);
+	}, threads, 65536);
+}
+
+void unpack_oklch(const PackedLch* in, Lch* out, size_t count, unsigned threads = 0)
+{
+	OKLAB_PROFILE_SCOPE(call, "unpack_oklch");
+	parallel_for(count, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++)
+			out[i] = unpack_oklch(in[i]);
+	}, threads, 65536);
+}
+
+// Half floats go through floats_to_halves and halves_to_floats (F16C when available)
+void pack_oklab_half(const Lab* in, HalfLab* out, size_t count, unsigned threads = 0)
+{
+	OKLAB_PROFILE_SCOPE(call, "pack_oklab_half");
+	static_assert(sizeof(Lab) == 3 * sizeof(float) && sizeof(HalfLab) == 3 * sizeof(uint16_t), "Lab and HalfLab are arrays of 3 values");
+
+	parallel_for(count, [&](size_t begin, size_t end) {
+		floats_to_halves(&in[begin].L, &out[begin].L, 3 * (end - begin));
+	}, threads, 65536);
+}
+
+void unpack_oklab_half(const HalfLab* in, Lab* out, size_t count, unsigned threads = 0)
+{
+	OKLAB_PROFILE_SCOPE(call, "unpack_oklab_half");
+	parallel_for(count, [&](size_t begin, size_t end) {
+		halves_to_floats(&in[begin].L, &out[begin].L, 3 * (end - begin));
+	}, threads, 65536);
+}
+
+// ------ Distances ------ //
+
+// Both colors are decoded on the fly, the differences of the codes scaled by the steps
+float delta_e(PackedLab x, PackedLab y)
+{
+	int32_t dL = (int32_t)(x.bits >> 22) - (int32_t)(y.bits >> 22);
+	int32_t da = (int32_t)((x.bits >> 11) & 0x7ff) - (int32_t)((y.bits >> 11) & 0x7ff);
+	int32_t db = (int32_t)(x.bits & 0x7ff) - (int32_t)(y.bits & 0x7ff);
+	float L = (float)dL * packed_L.step, a = (float)da * packed_a.step, b = (float)db * packed_b.step;
+	return sqrtf(L * L + a * a + b * b);
+}
+
+void delta_e(const PackedLab* x, const PackedLab* y, float* out, size_t count, unsigned threads = 0)
+{
+	OKLAB_PROFILE_SCOPE(call, "delta_e_packed");
+	parallel_for(count, [&](size_t begin, size_t end) {
+		size_t i = begin;
+#if defined(__AVX2__)
+		i += delta_e8(x + begin, y + begin, out + begin, end - begin);
+#endif
+		for (; i < end; i++)
+			out[i] = delta_e(x[i], y[i]);
+	}, threads, 65536);
+}
+
+// out[j] = squared distance from lab to colors[j], j in [0, count)
+void squared_distances(Lab lab, const PackedLab* colors, size_t count, float* out)
+{
+	for (size_t j = 0; j < count; j++)
+	{
+		uint32_t p = colors[j].bits;
+		float dL = packed_L.decode(p >> 22) - lab.L;
+		float da = packed_a.decode((p >> 11) & 0x7ff) - lab.a;
+		float db = packed_b.decode(p & 0x7ff) - lab.b;
+		out[j] = dL * dL + da * da + db * db;
+	}
+}
+
+// Nearest of count packed colors by a linear scan, for sets that change too often for a PaletteIndex.
+// Distances are to the decoded colors. Ties go to the first color, an empty set gives UINT32_MAX.
+PaletteMatch nearest_packed(Lab lab, const PackedLab* colors, size_t count)
+{
+	const size_t block = 256;
+	float distances[block];
+
+	PaletteMatch best = { UINT32_MAX, INFINITY };
+	for (size_t start = 0; start < count; start += block)
+	{
+		size_t n = std::min(block, count - start);
+		squared_distances(lab, colors + start, n, distances);
+
+		// Only blocks that improve on the best are searched for the position
+		float block_min = *std::min_element(distances, distances + n);
+		if (block_min < best.distance)
+		{
+			best.distance = block_min;
+			best.index = (uint32_t)(start + (std::find(distances, distances + n, block_min) - distances));
+		}
+	}
+
+	best.distance = sqrtf(best.distance);
+	return best;
+}
+
+// out[i] = index of the packed color nearest to in[i]
+void nearest_packed(const Lab* in, uint32_t* out, size_t count, const PackedLab* colors, size_t color_count, unsigned threads = 0)
+{
+	OKLAB_PROFILE_SCOPE(call, "nearest_packed");
+	parallel_for(count, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++)
+			out[i] = nearest_packed(in[i], colors, color_count).index;
+	}, threads, std::max<size_t>(1, 65536 / std::max<size_t>(color_count, 1)));
+}
+
+} // namespace ok_color
@@ -0,0 +1,433 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <numeric>
+#include <vector>
+#include "oklab_source.h"
+#include "oklab_parallel.h"
+#include "oklab_srgb8.h"
+
+namespace ok_color
+{
+
+// ------------------------ Palette index ------------------------ //
+
+struct PaletteMatch
+{
+	uint32_t index;  // position in the palette given to the index
+	float distance;  // euclidean distance in OkLab
+};
+
+// Nearest color search over a fixed palette, by euclidean distance in OkLab.
+//
+// The palette is stored in a k-d tree, split at the median of the widest axis until at most
+// leaf_size colors are left. Leaves are contiguous runs of planar L, a and b values, so they are
+// scanned with a simple loop the compiler can vectorize.
+//
+// Queries take an epsilon: 0 gives the exact nearest colors, larger values skip subtrees that cannot
+// be more than (1 + epsilon) times closer than the current best, so results are at most that much
+// further away than the exact ones, in exchange for visiting fewer leaves.
+class PaletteIndex
+{
+public:
+	PaletteIndex() = default;
+
+	PaletteIndex(const Lab* colors, size_t count, int leaf_size = 8)
+	{
+		build(colors, count, leaf_size);
+	}
+
+	// Palette of packed 0xAARRGGBB colors, alpha is ignored
+	static PaletteIndex from_argb32(const uint32_t* colors, size_t count, int leaf_size = 8)
+	{
+		std::vector<Lab> lab(count);
+		for (size_t i = 0; i < count; i++)
+			lab[i] = linear_srgb_to_oklab(argb32_to_linear_srgb(srgb8_tables(), colors[i]));
+
+		return PaletteIndex(lab.data(), count, leaf_size);
+	}
+
+	void build(const Lab* colors, size_t count, int leaf_size = 8)
+	{
+		leaf_size = std::max(leaf_size, 1);
+
+		nodes.clear();
+		palette_size = count;
+
+		std::vector<uint32_t> order(count);
+		std::iota(order.begin(), order.end(), 0u);
+		if (count > 0)
+			build_node(colors, order, 0, (uint32_t)count, leaf_size);
+
+		// Lays the leaves out in blocks of block_size colors, padded with colors at infinity
+		ids.clear();
+		L.clear();
+		a.clear();
+		b.clear();
+		for (Node& node : nodes)
+		{
+			if (node.axis >= 0)
+				continue;
+
+			uint32_t begin = (uint32_t)ids.size();
+			for (uint32_t i = node.begin; i < node.end; i++)
+			{
+				ids.push_back(order[i]);
+				L.push_back(colors[order[i]].L);
+				a.push_back(colors[order[i]].a);
+				b.push_back(colors[order[i]].b);
+			}
+			while (ids.size() % block_size != 0)
+			{
+				ids.push_back(0);
+				L.push_back(INFINITY);
+				a.push_back(INFINITY);
+				b.push_back(INFINITY);
+			}
+
+			node.begin = begin;
+			node.end = (uint32_t)ids.size();
+		}
+
+		slot.resize(count);
+		for (Node& node : nodes)
+		{
+			if (node.axis < 0)
+			{
+				for (uint32_t i = node.begin; i < node.end && L[i] != INFINITY; i++)
+					slot[ids[i]] = i;
+			}
+		}
+	}
+
+	size_t size() const
+	{
+		return palette_size;
+	}
+
+	Lab color(uint32_t index) const
+	{
+		uint32_t i = slot[index];
+		return { L[i], a[i], b[i] };
+	}
+
+	// ------ Single queries ------ //
+
+	// The palette must not be empty
+	PaletteMatch nearest(Lab lab, float epsilon = 0.f) const
+	{
+		return search_from(lab, 0, epsilon);
+	}
+
+	// Same as nearest, starting from a palette color that is likely close, such as the result for
+	// the previous pixel, so more of the tree is pruned early
+	PaletteMatch nearest_from(Lab lab, uint32_t hint, float epsilon = 0.f) const
+	{
+		return search_from(lab, slot[hint], epsilon);
+	}
+
+	// Writes the min(k, size()) nearest colors to out, closest first, and returns how many were written
+	int nearest(Lab lab, int k, PaletteMatch* out, float epsilon = 0.f) const
+	{
+		k = (int)std::min<size_t>(std::max(k, 0), size());
+		if (k == 0)
+			return 0;
+
+		Knn knn = { out, 0, k, INFINITY, scale(epsilon) };
+		float offset[3] = { 0.f, 0.f, 0.f };
+		search_k(0, lab, knn, 0.f, offset);
+
+		for (int i = 0; i < k; i++)
+		{
+			out[i].index = ids[out[i].index];
+			out[i].distance = sqrtf(out[i].distance);
+		}
+		return k;
+	}
+
+	// ------ Batch queries ------ //
+
+	// The batch queries accept an empty palette, indices are then UINT32_MAX
+
+	// Each search starts from the previous result, which is a tight bound for image data
+	// where neighboring pixels tend to be close.
+	void nearest(const Lab* in, uint32_t* out, size_t count, float epsilon = 0.f, unsigned threads = 0) const
+	{
+		OKLAB_PROFILE_SCOPE(call, "PaletteIndex::nearest");
+		if (size() == 0)
+		{
+			std::fill(out, out + count, UINT32_MAX);
+			return;
+		}
+
+		parallel_for(count, [&](size_t begin, size_t end) {
+			uint32_t hint = 0;
+			for (size_t i = begin; i < end; i++)
+			{
+				PaletteMatch match = search_from(in[i], hint, epsilon);
+				hint = slot[match.index];
+				out[i] = match.index;
+			}
+		}, threads);
+	}
+
+	// out holds k matches per query, slots past the palette size are left untouched (all of them
+	// for an empty palette)
+	void nearest(const Lab* in, int k, PaletteMatch* out, size_t count, float epsilon = 0.f, unsigned threads = 0) const
+	{
+		OKLAB_PROFILE_SCOPE(call, "PaletteIndex::nearest_k");
+		parallel_for(count, [&](size_t begin, size_t end) {
+			for (size_t i = begin; i < end; i++)
+				nearest(in[i], k, out + i * k, epsilon);
+		}, threads);
+	}
+
+	// Maps packed 0xAARRGGBB pixels to palette indices.
+	// Images repeat colors a lot, so each thread keeps a small direct mapped cache of recent results.
+	void map_argb32(const uint32_t* in, uint32_t* out, size_t count, float epsilon = 0.f, unsigned threads = 0) const
+	{
+		OKLAB_PROFILE_SCOPE(call, "PaletteIndex::map_argb32");
+		if (size() == 0)
+		{
+			std::fill(out, out + count, UINT32_MAX);
+			return;
+		}
+
+		const Srgb8Tables& tables = srgb8_tables();
+
+		parallel_for(count, [&](size_t begin, size_t end) {
+			constexpr int cache_bits = 12;
+			std::vector<uint32_t> keys(1 << cache_bits, 0);
+			std::vector<uint32_t> values(1 << cache_bits);
+
+			uint32_t hint = 0;
+			for (size_t i = begin; i < end; i++)
+			{
+				uint32_t key = (in[i] & 0x00ffffff) | 0x01000000;
+				uint32_t h = (key * 0x9E3779B1u) >> (32 - cache_bits);
+				if (keys[h] == key)
+				{
+					out[i] = values[h];
+					continue;
+				}
+
+				Lab lab = linear_srgb_to_oklab_fast(argb32_to_linear_srgb(tables, in[i]));
+				PaletteMatch match = search_from(lab, hint, epsilon);
+				hint = slot[match.index];
+
+				keys[h] = key;
+				values[h] = match.index;
+				out[i] = match.index;
+			}
+		}, threads);
+	}
+
+private:
+	static constexpr uint32_t block_size = 8;
+
+	// Leaves have axis < 0 and cover [begin, end) of the planar arrays, a whole number of blocks
+	struct Node
+	{
+		int axis;
+		float split;
+		uint32_t begin, end;
+		uint32_t left, right;
+	};
+
+	struct Knn
+	{
+		PaletteMatch* best;  // sorted by squared distance, indices into the planar arrays
+		int count;
+		int k;
+		float bound;         // squared distance of the k-th match, INFINITY until there are k
+		float scale;
+	};
+
+	static float scale(float epsilon)
+	{
+		return (1.f + epsilon) * (1.f + epsilon);
+	}
+
+	static float axis_value(Lab lab, int axis)
+	{
+		return axis == 0 ? lab.L : (axis == 1 ? lab.a : lab.b);
+	}
+
+	uint32_t build_node(const Lab* points, std::vector<uint32_t>& order, uint32_t begin, uint32_t end, int leaf_size)
+	{
+		uint32_t index = (uint32_t)nodes.size();
+		nodes.push_back({ -1, 0.f, begin, end, 0, 0 });
+
+		if (end - begin <= (uint32_t)leaf_size)
+			return index;
+
+		float lo[3] = { INFINITY, INFINITY, INFINITY };
+		float hi[3] = { -INFINITY, -INFINITY, -INFINITY };
+		for (uint32_t i = begin; i < end; i++)
+		{
+			for (int axis = 0; axis < 3; axis++)
+			{
+				float v = axis_value(points[order[i]], axis);
+				lo[axis] = fmin(lo[axis], v);
+				hi[axis] = fmax(hi[axis], v);
+			}
+		}
+
+		int axis = 0;
+		for (int i = 1; i < 3; i++)
+			if (hi[i] - lo[i] > hi[axis] - lo[axis])
+				axis = i;
+
+		// All remaining colors are the same
+		if (!(hi[axis] > lo[axis]))
+			return index;
+
+		uint32_t mid = begin + (end - begin) / 2;
+		std::nth_element(order.begin() + begin, order.begin() + mid, order.begin() + end, [&](uint32_t x, uint32_t y) {
+			return axis_value(points[x], axis) < axis_value(points[y], axis);
+		});
+
+		float split = axis_value(points[order[mid]], axis);
+
+		uint32_t left = build_node(points, order, begin, mid, leaf_size);
+		uint32_t right = build_node(points, order, mid, end, leaf_size);
+
+		// nodes may have been reallocated by the recursive calls
+		Node& node = nodes[index];
+		node.axis = axis;
+		node.split = split;
+		node.left = left;
+		node.right = right;
+		return index;
+	}
+
+	// Squared distances to one block of colors, a fixed size loop the compiler can vectorize
+	void block_distances(uint32_t begin, Lab lab, float* d2) const
+	{
+		const float* Ls = L.data() + begin;
+		const float* as = a.data() + begin;
+		const float* bs = b.data() + begin;
+
+		for (uint32_t i = 0; i < block_size; i++)
+		{
+			float dL = Ls[i] - lab.L;
+			float da = as[i] - lab.a;
+			float db = bs[i] - lab.b;
+			d2[i] = dL * dL + da * da + db * db;
+		}
+	}
+
+	// hint is a position in the planar arrays
+	PaletteMatch search_from(Lab lab, uint32_t hint, float epsilon) const
+	{
+		float dL = L[hint] - lab.L;
+		float da = a[hint] - lab.a;
+		float db = b[hint] - lab.b;
+
+		PaletteMatch best = { hint, dL * dL + da * da + db * db };
+		float offset[3] = { 0.f, 0.f, 0.f };
+		search_1(0, lab, best, scale(epsilon), 0.f, offset);
+
+		return { ids[best.index], sqrtf(best.distance) };
+	}
+
+	// cell_d2 is the squared distance from the query to the cell of the node, offset holds its
+	// per axis components, updated as the search crosses split planes (Arya and Mount).
+	void search_1(uint32_t index, Lab lab, PaletteMatch& best, float scale, float cell_d2, float* offset) const
+	{
+		const Node& node = nodes[index];
+
+		if (node.axis < 0)
+		{
+			for (uint32_t start = node.begin; start < node.end; start += block_size)
+			{
+				float d2[block_size];
+				block_distances(start, lab, d2);
+
+				for (uint32_t i = 0; i < block_size; i++)
+				{
+					bool closer = d2[i] < best.distance;
+					best.index = closer ? start + i : best.index;
+					best.distance = closer ? d2[i] : best.distance;
+				}
+			}
+			return;
+		}
+
+		float diff = axis_value(lab, node.axis) - node.split;
+		uint32_t near = diff < 0.f ? node.left : node.right;
+		uint32_t far = diff < 0.f ? node.right : node.left;
+
+		search_1(near, lab, best, scale, cell_d2, offset);
+
+		float old = offset[node.axis];
+		float far_d2 = cell_d2 - old * old + diff * diff;
+		if (far_d2 * scale < best.distance)
+		{
+			offset[node.axis] = diff;
+			search_1(far, lab, best, scale, far_d2, offset);
+			offset[node.axis] = old;
+		}
+	}
+
+	void search_k(uint32_t index, Lab lab, Knn& knn, float cell_d2, float* offset) const
+	{
+		const Node& node = nodes[index];
+
+		if (node.axis < 0)
+		{
+			for (uint32_t start = node.begin; start < node.end; start += block_size)
+			{
+				float d2[block_size];
+				block_distances(start, lab, d2);
+
+				for (uint32_t i = 0; i < block_size; i++)
+				{
+					// Padding is only found at the end of a leaf
+					if (L[start + i] == INFINITY)
+						break;
+					if (knn.count == knn.k && !(d2[i] < knn.bound))
+						continue;
+
+					// Insertion into the sorted list of matches
+					int j = knn.count < knn.k ? knn.count++ : knn.k - 1;
+					while (j > 0 && knn.best[j - 1].distance > d2[i])
+					{
+						knn.best[j] = knn.best[j - 1];
+						j--;
+					}
+					knn.best[j] = { start + i, d2[i] };
+
+					if (knn.count == knn.k)
+						knn.bound = knn.best[knn.k - 1].distance;
+				}
+			}
+			return;
+		}
+
+		float diff = axis_value(lab, node.axis) - node.split;
+		uint32_t near = diff < 0.f ? node.left : node.right;
+		uint32_t far = diff < 0.f ? node.right : node.left;
+
+		search_k(near, lab, knn, cell_d2, offset);
+
+		float old = offset[node.axis];
+		float far_d2 = cell_d2 - old * old + diff * diff;
+		if (far_d2 * knn.scale < knn.bound)
+		{
+			offset[node.axis] = diff;
+			search_k(far, lab, knn, far_d2, offset);
+			offset[node.axis] = old;
+		}
+	}
+
+	size_t palette_size = 0;
+	std::vector<Node> nodes;
+	std::vector<uint32_t> ids;   // palette index of each position in the planar arrays
+	std::vector<uint32_t> slot;  // position in the planar arrays of each palette index
+	std::vector<float> L, a, b;
+};
+
+} // namespace ok_color
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "oklab_profile.h"
+
+namespace ok_color
+{
+
+// ------------------------ Parallel for ------------------------ //
+
+// Number of threads to use when a batch function is given 0 threads
+unsigned default_thread_count()
+{
+	unsigned threads = std::thread::hardware_concurrency();
+	return threads > 0 ? threads : 1;
+}
+
+// Splits [0, count) into contiguous ranges and calls f(begin, end) for each of them in parallel.
+// Ranges are at least min_range long, so small batches run on the calling thread only.
+// The calling thread processes the first range, then waits for the others.
+// With OKLAB_PROFILE, each range is a span named after the profiled call or stage that started it.
+template <class F>
+void parallel_for(size_t count, F f, unsigned threads = 0, size_t min_range = 4096)
+{
+	if (threads == 0)
+		threads = default_thread_count();
+
+	const char* name = OKLAB_PROFILE_SCOPE_NAME();
+	auto run = [&](size_t begin, size_t end) {
+		OKLAB_PROFILE_SCOPE(range, name);
+		f(begin, end);
+	};
+	(void)name;
+
+	size_t ranges = std::min<size_t>(threads, (count + min_range - 1) / std::max<size_t>(min_range, 1));
+	if (ranges <= 1)
+	{
+		if (count > 0)
+			run((size_t)0, count);
+		return;
+	}
+
+	size_t range = (count + ranges - 1) / ranges;
+
+	std::vector<std::thread> workers;
+	workers.reserve(ranges - 1);
+	for (size_t begin = range; begin < count; begin += range)
+		workers.emplace_back(run, begin, std::min(begin + range, count));
+
+	run((size_t)0, range);
+
+	for (std::thread& worker : workers)
+		worker.join();
+}
+
+// Blocks the threads that arrive until count of them have, then releases them all. Reusable, the
+// next arrivals wait for the next round. For loops that keep the same threads over several steps
+// with parallel_for(threads, f, threads, 1) instead of starting new threads for each step.
+class Barrier
+{
+public:
+	explicit Barrier(unsigned count) : count(count) {}
+
+	void arrive_and_wait()
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		uint64_t round = rounds;
+		if (++arrived == count)
+		{
+			arrived = 0;
+			rounds++;
+			released.notify_all();
+			return;
+		}
+		released.wait(lock, [&] { return rounds != round; });
+	}
+
+private:
+	std::mutex mutex;
+	std::condition_variable released;
+	unsigned count;
+	unsigned arrived = 0;
+	uint64_t rounds = 0;
+};
+
+} // namespace ok_color
@@ -0,0 +1,356 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include "oklab_source.h"
+
+namespace ok_color
+{
+namespace pipeline
+{
+
+// ------------------------ Fused conversion pipelines ------------------------ //
+
+// Chains of conversions are built from stages joined with |, for example:
+//
+//   auto recolor = srgb_transfer_inv() | linear_srgb_to_oklab() | oklab_to_lch()
+//       | map<Lch>([](Lch c) { c.l *= 0.9f; return c; })
+//       | lch_to_oklab() | oklab_to_linear_srgb()
+//       | map<RGB>([](RGB c) { return gamut_clip_preserve_chroma(c); })
+//       | srgb_transfer();
+//   recolor.run(in, out, count);
+//
+// Joining is simplified at compile time, based on the stage types:
+// - adjacent inverse stages are removed (oklab_to_lch | lch_to_oklab, cbrt | cube, the OkLab matrices, the transfer functions)
+// - adjacent matrices are multiplied together into a single matrix
+// so converting OkLab to linear sRGB and back, with nothing in between, results in an empty pipeline.
+//
+// run() processes the pixels in blocks, applying every stage to a whole block of planar values
+// before moving on, so intermediate values stay in cache and the simple stages can be vectorized.
+
+// ------ Stages ------ //
+
+// Every stage transforms blocks of n values, given as three planes
+struct SrgbTransfer
+{
+	void apply(float* x, float* y, float* z, int n) const
+	{
+		for (int i = 0; i < n; i++)
+		{
+			x[i] = srgb_transfer_function(x[i]);
+			y[i] = srgb_transfer_function(y[i]);
+			z[i] = srgb_transfer_function(z[i]);
+		}
+	}
+};
+
+struct SrgbTransferInv
+{
+	void apply(float* x, float* y, float* z, int n) const
+	{
+		for (int i = 0; i < n; i++)
+		{
+			x[i] = srgb_transfer_function_inv(x[i]);
+			y[i] = srgb_transfer_function_inv(y[i]);
+			z[i] = srgb_transfer_function_inv(z[i]);
+		}
+	}
+};
+
+struct Cbrt
+{
+	void apply(float* x, float* y, float* z, int n) const
+	{
+		for (int i = 0; i < n; i++)
+		{
+			x[i] = cbrtf(x[i]);
+			y[i] = cbrtf(y[i]);
+			z[i] = cbrtf(z[i]);
+		}
+	}
+};
+
+struct Cube
+{
+	void apply(float* x, float* y, float* z, int n) const
+	{
+		for (int i = 0; i < n; i++)
+		{
+			x[i] = x[i] * x[i] * x[i];
+			y[i] = y[i] * y[i] * y[i];
+			z[i] = z[i] * z[i] * z[i];
+		}
+	}
+};
+
+// Lab to Lch, same as oklab_to_lch
+struct ToPolar
+{
+	void apply(float*, float* y, float* z, int n) const
+	{
+		for (int i = 0; i < n; i++)
+		{
+			float C = sqrtf(y[i] * y[i] + z[i] * z[i]);
+			float h = atan2f(z[i], y[i]);
+			y[i] = C;
+			z[i] = h;
+		}
+	}
+};
+
+// Lch to Lab, same as lch_to_oklab
+struct FromPolar
+{
+	void apply(float*, float* y, float* z, int n) const
+	{
+		for (int i = 0; i < n; i++)
+		{
+			float a = y[i] * cosf(z[i]);
+			float b = y[i] * sinf(z[i]);
+			y[i] = a;
+			z[i] = b;
+		}
+	}
+};
+
+// Tags for the fixed OkLab matrices, so their inverse pairs can be recognized by type
+struct LinearToLms {};
+struct LmsToLinear {};
+struct LmsToLab {};
+struct LabToLms {};
+
+// Row major 3x3 matrix. Tag is void for arbitrary matrices, including products of other matrices.
+template <class Tag = void>
+struct Matrix
+{
+	float m[9];
+
+	void apply(float* x, float* y, float* z, int n) const
+	{
+		for (int i = 0; i < n; i++)
+		{
+			float x_ = m[0] * x[i] + m[1] * y[i] + m[2] * z[i];
+			float y_ = m[3] * x[i] + m[4] * y[i] + m[5] * z[i];
+			float z_ = m[6] * x[i] + m[7] * y[i] + m[8] * z[i];
+			x[i] = x_;
+			y[i] = y_;
+			z[i] = z_;
+		}
+	}
+};
+
+// Applies f to each value, viewed as T (any struct of three floats, e.g. Lab, Lch or RGB)
+template <class T, class F>
+struct Map
+{
+	static_assert(sizeof(T) == 3 * sizeof(float), "T must be three floats");
+
+	F f;
+
+	void apply(float* x, float* y, float* z, int n) const
+	{
+		for (int i = 0; i < n; i++)
+		{
+			T value = f(T{ x[i], y[i], z[i] });
+
+			float v[3];
+			memcpy(v, &value, sizeof(v));
+			x[i] = v[0];
+			y[i] = v[1];
+			z[i] = v[2];
+		}
+	}
+};
+
+// ------ Simplification rules ------ //
+
+template <class A, class B> struct cancels : std::false_type {};
+template <> struct cancels<SrgbTransfer, SrgbTransferInv> : std::true_type {};
+template <> struct cancels<SrgbTransferInv, SrgbTransfer> : std::true_type {};
+template <> struct cancels<Cbrt, Cube> : std::true_type {};
+template <> struct cancels<Cube, Cbrt> : std::true_type {};
+template <> struct cancels<ToPolar, FromPolar> : std::true_type {};
+template <> struct cancels<Matrix<LinearToLms>, Matrix<LmsToLinear>> : std::true_type {};
+template <> struct cancels<Matrix<LmsToLinear>, Matrix<LinearToLms>> : std::true_type {};
+template <> struct cancels<Matrix<LmsToLab>, Matrix<LabToLms>> : std::true_type {};
+template <> struct cancels<Matrix<LabToLms>, Matrix<LmsToLab>> : std::true_type {};
+
+template <class T> struct is_matrix : std::false_type {};
+template <class Tag> struct is_matrix<Matrix<Tag>> : std::true_type {};
+
+// Applying first and then second is the same as applying second * first
+template <class A, class B>
+Matrix<> multiply(const Matrix<A>& second, const Matrix<B>& first)
+{
+	Matrix<> result;
+	for (int row = 0; row < 3; row++)
+		for (int col = 0; col < 3; col++)
+			result.m[row * 3 + col] =
+				second.m[row * 3 + 0] * first.m[0 * 3 + col] +
+				second.m[row * 3 + 1] * first.m[1 * 3 + col] +
+				second.m[row * 3 + 2] * first.m[2 * 3 + col];
+	return result;
+}
+
+// ------ Pipeline ------ //
+
+template <class... Stages>
+struct Pipeline
+{
+	std::tuple<Stages...> stages;
+
+	static constexpr size_t size = sizeof...(Stages);
+
+	// In and Out can be any struct of three floats, in and out may be the same buffer
+	template <class In, class Out>
+	void run(const In* in, Out* out, size_t count) const
+	{
+		static_assert(sizeof(In) == 3 * sizeof(float) && sizeof(Out) == 3 * sizeof(float), "In and Out must be three floats");
+
+		constexpr int block = 256;
+		float x[block], y[block], z[block];
+
+		for (size_t start = 0; start < count; start += block)
+		{
+			int n = (int)std::min<size_t>(block, count - start);
+
+			for (int i = 0; i < n; i++)
+			{
+				float v[3];
+				memcpy(v, &in[start + i], sizeof(v));
+				x[i] = v[0];
+				y[i] = v[1];
+				z[i] = v[2];
+			}
+
+			std::apply([&](const auto&... stage) { (stage.apply(x, y, z, n), ...); }, stages);
+
+			for (int i = 0; i < n; i++)
+			{
+				float v[3] = { x[i], y[i], z[i] };
+				memcpy(&out[start + i], v, sizeof(v));
+			}
+		}
+	}
+
+	// Converts a single value, e.g. pipeline.convert<Lab>(rgb)
+	template <class Out, class In>
+	Out convert(In value) const
+	{
+		Out result;
+		run(&value, &result, 1);
+		return result;
+	}
+};
+
+template <class Tuple, size_t... I>
+auto make_pipeline(const Tuple& stages, std::index_sequence<I...>)
+{
+	return Pipeline<std::tuple_element_t<I, Tuple>...>{ { std::get<I>(stages)... } };
+}
+
+template <class... S>
+auto drop_last(const Pipeline<S...>& p)
+{
+	return make_pipeline(p.stages, std::make_index_sequence<sizeof...(S) - 1>());
+}
+
+// Appends a stage, applying the simplification rules against the current last stage
+template <class T, class... S>
+auto push(const Pipeline<S...>& p, const T& stage)
+{
+	if constexpr (sizeof...(S) == 0)
+	{
+		return Pipeline<T>{ std::tuple<T>(stage) };
+	}
+	else
+	{
+		using Last = std::tuple_element_t<sizeof...(S) - 1, std::tuple<S...>>;
+		const Last& last = std::get<sizeof...(S) - 1>(p.stages);
+
+		if constexpr (cancels<Last, T>::value)
+			return drop_last(p);
+		else if constexpr (is_matrix<Last>::value && is_matrix<T>::value)
+			return push(drop_last(p), multiply(stage, last));
+		else
+			return Pipeline<S..., T>{ std::tuple_cat(p.stages, std::tuple<T>(stage)) };
+	}
+}
+
+template <size_t I = 0, class P, class... B>
+auto push_all(const P& p, const std::tuple<B...>& stages)
+{
+	if constexpr (I == sizeof...(B))
+		return p;
+	else
+		return push_all<I + 1>(push(p, std::get<I>(stages)), stages);
+}
+
+template <class... A, class... B>
+auto operator|(const Pipeline<A...>& first, const Pipeline<B...>& second)
+{
+	return push_all(first, second.stages);
+}
+
+// ------ Building blocks ------ //
+
+Pipeline<SrgbTransfer> srgb_transfer() { return {}; }
+Pipeline<SrgbTransferInv> srgb_transfer_inv() { return {}; }
+
+Pipeline<Matrix<LinearToLms>, Cbrt, Matrix<LmsToLab>> linear_srgb_to_oklab()
+{
+	return { {
+		{ {
+			0.4122214708f, 0.5363325363f, 0.0514459929f,
+			0.2119034982f, 0.6806995451f, 0.1073969566f,
+			0.0883024619f, 0.2817188376f, 0.6299787005f,
+		} },
+		{},
+		{ {
+			0.2104542553f, +0.7936177850f, -0.0040720468f,
+			1.9779984951f, -2.4285922050f, +0.4505937099f,
+			0.0259040371f, +0.7827717662f, -0.8086757660f,
+		} },
+	} };
+}
+
+Pipeline<Matrix<LabToLms>, Cube, Matrix<LmsToLinear>> oklab_to_linear_srgb()
+{
+	return { {
+		{ {
+			1.f, +0.3963377774f, +0.2158037573f,
+			1.f, -0.1055613458f, -0.0638541728f,
+			1.f, -0.0894841775f, -1.2914855480f,
+		} },
+		{},
+		{ {
+			+4.0767416621f, -3.3077115913f, +0.2309699292f,
+			-1.2684380046f, +2.6097574011f, -0.3413193965f,
+			-0.0041960863f, -0.7034186147f, +1.7076147010f,
+		} },
+	} };
+}
+
+Pipeline<ToPolar> oklab_to_lch() { return {}; }
+Pipeline<FromPolar> lch_to_oklab() { return {}; }
+
+// Row major 3x3 matrix, e.g. to bring another linear RGB space or XYZ into linear sRGB
+Pipeline<Matrix<>> matrix(const float (&m)[9])
+{
+	Matrix<> stage;
+	memcpy(stage.m, m, sizeof(stage.m));
+	return { { stage } };
+}
+
+template <class T, class F>
+Pipeline<Map<T, F>> map(F f)
+{
+	return { { Map<T, F>{ f } } };
+}
+
+} // namespace pipeline
+} // namespace ok_color
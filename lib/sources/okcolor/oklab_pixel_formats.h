@@ -0,0 +1,344 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include "oklab_source.h"
+#include "oklab_parallel.h"
+#include "oklab_srgb8.h"
+
+#if defined(__F16C__)
+#include <immintrin.h>
+#endif
+
+namespace ok_color
+{
+
+// ------------------------ Half floats ------------------------ //
+
+// IEEE 754 binary16, rounded to nearest even. Overflow gives infinity, NaN stays NaN.
+uint16_t float_to_half(float f)
+{
+	uint32_t x;
+	memcpy(&x, &f, sizeof(x));
+
+	uint32_t sign = (x >> 16) & 0x8000;
+	x &= 0x7fffffff;
+
+	if (x >= 0x7f800000)
+		return (uint16_t)(sign | 0x7c00 | (x > 0x7f800000 ? 0x200 : 0));
+
+	// 65520 and above round to infinity
+	if (x >= 0x477ff000)
+		return (uint16_t)(sign | 0x7c00);
+
+	// Below 2^-14 the result is subnormal: adding 0.5 lines the half mantissa up with the low float
+	// bits and lets the FPU do the rounding
+	if (x < 0x38800000)
+	{
+		float v;
+		memcpy(&v, &x, sizeof(v));
+		v += 0.5f;
+		memcpy(&x, &v, sizeof(x));
+		return (uint16_t)(sign | (x - 0x3f000000));
+	}
+
+	// Rebias the exponent, round the 13 dropped bits to nearest even
+	x += 0xc8000fff + ((x >> 13) & 1);
+	return (uint16_t)(sign | (x >> 13));
+}
+
+float half_to_float(uint16_t h)
+{
+	uint32_t x = (uint32_t)(h & 0x7fff) << 13;
+	uint32_t exponent = x & 0x0f800000;
+	x += (127 - 15) << 23;
+
+	if (exponent == 0x0f800000)
+	{
+		// Infinity or NaN
+		x += (128 - 16) << 23;
+	}
+	else if (exponent == 0)
+	{
+		// Subnormal, renormalized by the FPU
+		x += 1 << 23;
+		float f;
+		memcpy(&f, &x, sizeof(f));
+		f -= 6.103515625e-05f;
+		memcpy(&x, &f, sizeof(x));
+	}
+
+	x |= (uint32_t)(h & 0x8000) << 16;
+	float f;
+	memcpy(&f, &x, sizeof(f));
+	return f;
+}
+
+// Batches, 8 values at a time with F16C when the compiler targets it (e.g. -mf16c or -march=native).
+// Both paths give the same results.
+void floats_to_halves(const float* in, uint16_t* out, size_t count)
+{
+	size_t i = 0;
+#if defined(__F16C__)
+	for (; i + 8 <= count; i += 8)
+		_mm_storeu_si128((__m128i*)(out + i), _mm256_cvtps_ph(_mm256_loadu_ps(in + i), _MM_FROUND_TO_NEAREST_INT));
+#endif
+	for (; i < count; i++)
+		out[i] = float_to_half(in[i]);
+}
+
+void halves_to_floats(const uint16_t* in, float* out, size_t count)
+{
+	size_t i = 0;
+#if defined(__F16C__)
+	for (; i + 8 <= count; i += 8)
+		_mm256_storeu_ps(out + i, _mm256_cvtph_ps(_mm_loadu_si128((const __m128i*)(in + i))));
+#endif
+	for (; i < count; i++)
+		out[i] = half_to_float(in[i]);
+}
+
+// ------------------------ HDR gamut clipping ------------------------ //
+
+// gamut_clip_oklab for linear values in [0, peak] instead of [0, 1]. Scaling linear RGB by peak
+// scales OkLab by cbrt(peak), so the color is clipped scaled down and scaled back up.
+RGB gamut_clip_oklab_hdr(Lab lab, float peak, GamutClip method, float alpha = 0.05f)
+{
+	float k = cbrtf(peak);
+	RGB rgb = gamut_clip_oklab({ lab.L / k, lab.a / k, lab.b / k }, method, alpha);
+	return { rgb.r * peak, rgb.g * peak, rgb.b * peak };
+}
+
+RGB gamut_clip_hdr(RGB rgb, float peak, GamutClip method, float alpha = 0.05f)
+{
+	if (method == GamutClip::none || (rgb.r <= peak && rgb.g <= peak && rgb.b <= peak && rgb.r >= 0 && rgb.g >= 0 && rgb.b >= 0))
+		return rgb;
+
+	return gamut_clip_oklab_hdr(linear_srgb_to_oklab(rgb), peak, method, alpha);
+}
+
+// ------------------------ Pixel formats ------------------------ //
+
+// Linear sRGB, 4 half floats per pixel
+struct RgbaHalf { uint16_t r; uint16_t g; uint16_t b; uint16_t a; };
+
+// 16 bit unorm, 3 per pixel
+struct Rgb16 { uint16_t r; uint16_t g; uint16_t b; };
+
+// RGB10A2 pixels are 32 bit words with red in bits 0-9, green in 10-19, blue in 20-29 and alpha
+// in 30-31, as DXGI_FORMAT_R10G10B10A2_UNORM and VK_FORMAT_A2B10G10R10_UNORM_PACK32.
+// Unorm formats hold linear values or sRGB encoded ones.
+enum class PixelTransfer
+{
+	linear,
+	srgb,
+};
+
+struct PixelOutput
+{
+	PixelTransfer transfer = PixelTransfer::srgb;  // unorm formats only, half floats are linear
+
+	// Out of gamut colors are clipped to [0, peak], peak only applies to half floats.
+	// Values are clamped to [0, peak] after clipping, or left alone with GamutClip::none.
+	GamutClip clip = GamutClip::preserve_chroma;
+	float peak = 1.f;
+
+	unsigned threads = 0;
+};
+
+// Values are converted a block at a time, half floats with floats_to_halves and halves_to_floats
+constexpr size_t pixel_block = 256;
+
+// Rounding leaves in gamut colors (e.g. the primaries) slightly outside, those are clamped rather than
+// sent through the clipping, whose approximate intersection would move them further than the clamp.
+// The clipped colors are clamped as well for the same reason.
+RGB clip_pixel(Lab lab, GamutClip clip, float peak)
+{
+	RGB rgb = oklab_to_linear_srgb(lab);
+	if (clip == GamutClip::none)
+		return rgb;
+
+	float lo = -1e-5f * peak, hi = peak - lo;
+	if (rgb.r < lo || rgb.g < lo || rgb.b < lo || rgb.r > hi || rgb.g > hi || rgb.b > hi)
+		rgb = gamut_clip_oklab_hdr(lab, peak, clip);
+
+	auto clamp = [peak](float x) { return x > 0.f ? (x < peak ? x : peak) : 0.f; };
+	return { clamp(rgb.r), clamp(rgb.g), clamp(rgb.b) };
+}
+
+// ------ Half floats ------ //
+
+// Values above 1 are kept (OkLab L above 1), alpha is ignored
+void rgba_half_to_oklab(const RgbaHalf* in, Lab* out, size_t count, unsigned threads = 0)
+{
+	OKLAB_PROFILE_SCOPE(call, "rgba_half_to_oklab");
+	parallel_for(count, [&](size_t begin, size_t end) {
+		float values[4 * pixel_block];
+		for (size_t first = begin; first < end; first += pixel_block)
+		{
+			size_t n = std::min(pixel_block, end - first);
+			halves_to_floats(&in[first].r, values, 4 * n);
+			for (size_t i = 0; i < n; i++)
+				out[first + i] = linear_srgb_to_oklab_fast({ values[4 * i], values[4 * i + 1], values[4 * i + 2] });
+		}
+	}, threads);
+}
+
+// Alpha is set to 1
+void oklab_to_rgba_half(const Lab* in, RgbaHalf* out, size_t count, const PixelOutput& options = {})
+{
+	OKLAB_PROFILE_SCOPE(call, "oklab_to_rgba_half");
+	parallel_for(count, [&](size_t begin, size_t end) {
+		float values[4 * pixel_block];
+		for (size_t first = begin; first < end; first += pixel_block)
+		{
+			size_t n = std::min(pixel_block, end - first);
+			for (size_t i = 0; i < n; i++)
+			{
+				RGB rgb = clip_pixel(in[first + i], options.clip, options.peak);
+				values[4 * i] = rgb.r;
+				values[4 * i + 1] = rgb.g;
+				values[4 * i + 2] = rgb.b;
+				values[4 * i + 3] = 1.f;
+			}
+			floats_to_halves(values, &out[first].r, 4 * n);
+		}
+	}, options.threads);
+}
+
+// OkLab planes (e.g. from yuv_to_oklab) stored as half floats, for half the memory.
+// L and |a|, |b| below 1 keep about 11 significant bits, an error below 5e-4.
+void oklab_to_half_planes(const Lab* in, uint16_t* L, uint16_t* a, uint16_t* b, size_t count, unsigned threads = 0)
+{
+	OKLAB_PROFILE_SCOPE(call, "oklab_to_half_planes");
+	parallel_for(count, [&](size_t begin, size_t end) {
+		float values[3][pixel_block];
+		for (size_t first = begin; first < end; first += pixel_block)
+		{
+			size_t n = std::min(pixel_block, end - first);
+			for (size_t i = 0; i < n; i++)
+			{
+				values[0][i] = in[first + i].L;
+				values[1][i] = in[first + i].a;
+				values[2][i] = in[first + i].b;
+			}
+			floats_to_halves(values[0], L + first, n);
+			floats_to_halves(values[1], a + first, n);
+			floats_to_halves(values[2], b + first, n);
+		}
+	}, threads);
+}
+
+void half_planes_to_oklab(const uint16_t* L, const uint16_t* a, const uint16_t* b, Lab* out, size_t count, unsigned threads = 0)
+{
+	OKLAB_PROFILE_SCOPE(call, "half_planes_to_oklab");
+	parallel_for(count, [&](size_t begin, size_t end) {
+		float values[3][pixel_block];
+		for (size_t first = begin; first < end; first += pixel_block)
+		{
+			size_t n = std::min(pixel_block, end - first);
+			halves_to_floats(L + first, values[0], n);
+			halves_to_floats(a + first, values[1], n);
+			halves_to_floats(b + first, values[2], n);
+			for (size_t i = 0; i < n; i++)
+				out[first + i] = { values[0][i], values[1][i], values[2][i] };
+		}
+	}, threads);
+}
+
+// ------ Unorm ------ //
+
+// Linear value of each 10 bit code
+const float* rgb10_decode_table(PixelTransfer transfer)
+{
+	static const struct Tables
+	{
+		float linear[1024], srgb[1024];
+
+		Tables()
+		{
+			for (int i = 0; i < 1024; i++)
+			{
+				linear[i] = i / 1023.f;
+				srgb[i] = srgb_transfer_function_inv(i / 1023.f);
+			}
+		}
+	} tables;
+
+	return transfer == PixelTransfer::srgb ? tables.srgb : tables.linear;
+}
+
+// Linear value to a unorm code of max + 1 levels
+uint32_t encode_unorm(float x, PixelTransfer transfer, float max)
+{
+	x = x > 0.f ? (x < 1.f ? x : 1.f) : 0.f;
+	if (transfer == PixelTransfer::srgb)
+		x = srgb_transfer_function(x);
+	return (uint32_t)(x * max + 0.5f);
+}
+
+// Alpha is ignored
+void rgb10a2_to_oklab(const uint32_t* in, Lab* out, size_t count, PixelTransfer transfer = PixelTransfer::srgb, unsigned threads = 0)
+{
+	OKLAB_PROFILE_SCOPE(call, "rgb10a2_to_oklab");
+	const float* decode = rgb10_decode_table(transfer);
+
+	parallel_for(count, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++)
+		{
+			uint32_t p = in[i];
+			out[i] = linear_srgb_to_oklab_fast({ decode[p & 0x3ff], decode[(p >> 10) & 0x3ff], decode[(p >> 20) & 0x3ff] });
+		}
+	}, threads);
+}
+
+// Alpha is set to 3 (opaque)
+void oklab_to_rgb10a2(const Lab* in, uint32_t* out, size_t count, const PixelOutput& options = {})
+{
+	OKLAB_PROFILE_SCOPE(call, "oklab_to_rgb10a2");
+	parallel_for(count, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++)
+		{
+			RGB rgb = clip_pixel(in[i], options.clip, 1.f);
+			out[i] = encode_unorm(rgb.r, options.transfer, 1023.f)
+				| (encode_unorm(rgb.g, options.transfer, 1023.f) << 10)
+				| (encode_unorm(rgb.b, options.transfer, 1023.f) << 20)
+				| (3u << 30);
+		}
+	}, options.threads);
+}
+
+void rgb16_to_oklab(const Rgb16* in, Lab* out, size_t count, PixelTransfer transfer = PixelTransfer::srgb, unsigned threads = 0)
+{
+	OKLAB_PROFILE_SCOPE(call, "rgb16_to_oklab");
+	const TransferTable& table = srgb_transfer_table();
+
+	parallel_for(count, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++)
+		{
+			RGB rgb = { in[i].r / 65535.f, in[i].g / 65535.f, in[i].b / 65535.f };
+			if (transfer == PixelTransfer::srgb)
+				rgb = { table(rgb.r), table(rgb.g), table(rgb.b) };
+			out[i] = linear_srgb_to_oklab_fast(rgb);
+		}
+	}, threads);
+}
+
+void oklab_to_rgb16(const Lab* in, Rgb16* out, size_t count, const PixelOutput& options = {})
+{
+	OKLAB_PROFILE_SCOPE(call, "oklab_to_rgb16");
+	parallel_for(count, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++)
+		{
+			RGB rgb = clip_pixel(in[i], options.clip, 1.f);
+			out[i] = {
+				(uint16_t)encode_unorm(rgb.r, options.transfer, 65535.f),
+				(uint16_t)encode_unorm(rgb.g, options.transfer, 65535.f),
+				(uint16_t)encode_unorm(rgb.b, options.transfer, 65535.f),
+			};
+		}
+	}, options.threads);
+}
+
+} // namespace ok_color
@@ -0,0 +1,313 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace ok_color
+{
+
+// ------------------------ Memory mapped files ------------------------ //
+
+// Read only or read write mapping of a whole file (POSIX). Pages are read in by the OS as
+// they are touched, so large images can be processed a tile at a time without loading them.
+class MappedFile
+{
+public:
+	MappedFile() = default;
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	~MappedFile()
+	{
+		close();
+	}
+
+	bool open_read(const char* path)
+	{
+		close();
+
+		int fd = ::open(path, O_RDONLY);
+		if (fd < 0)
+			return false;
+
+		struct stat st;
+		if (fstat(fd, &st) != 0 || st.st_size <= 0)
+		{
+			::close(fd);
+			return false;
+		}
+
+		void* p = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+		::close(fd);
+		if (p == MAP_FAILED)
+			return false;
+
+		madvise(p, (size_t)st.st_size, MADV_SEQUENTIAL);
+		bytes = (uint8_t*)p;
+		length = (size_t)st.st_size;
+		return true;
+	}
+
+	// Creates or truncates the file to size bytes
+	bool create(const char* path, size_t size)
+	{
+		close();
+
+		int fd = ::open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+		if (fd < 0)
+			return false;
+
+		if (ftruncate(fd, (off_t)size) != 0)
+		{
+			::close(fd);
+			return false;
+		}
+
+		void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		::close(fd);
+		if (p == MAP_FAILED)
+			return false;
+
+		bytes = (uint8_t*)p;
+		length = size;
+		writable = true;
+		return true;
+	}
+
+	// Drops the pages of [offset, offset + size) from memory, writing them to the file first if the
+	// mapping is writable. They are read back if touched again, so this only bounds the resident memory
+	// of a pass over a file larger than RAM.
+	void release(size_t offset, size_t size)
+	{
+		size_t page = (size_t)sysconf(_SC_PAGESIZE);
+		size_t begin = offset / page * page;
+		size_t end = std::min(offset + size, length);
+		if (!bytes || begin >= end)
+			return;
+
+		if (writable)
+			msync(bytes + begin, end - begin, MS_SYNC);
+		madvise(bytes + begin, end - begin, MADV_DONTNEED);
+	}
+
+	void close()
+	{
+		if (bytes)
+			munmap(bytes, length);
+		bytes = nullptr;
+		length = 0;
+		writable = false;
+	}
+
+	uint8_t* data() const
+	{
+		return bytes;
+	}
+
+	size_t size() const
+	{
+		return length;
+	}
+
+private:
+	uint8_t* bytes = nullptr;
+	size_t length = 0;
+	bool writable = false;
+};
+
+// ------------------------ PNM headers ------------------------ //
+
+enum class PnmSample
+{
+	u8,   // PPM and PAM with maxval up to 255
+	u16,  // PPM and PAM with maxval 256 to 65535, big endian
+	f32,  // PFM, linear values by convention
+};
+
+// Binary PPM (P6), PAM (P7) and color PFM (PF) images
+struct PnmHeader
+{
+	int width;
+	int height;
+	int channels;        // 3 for RGB, 4 for RGB_ALPHA
+	size_t data_offset;  // start of the pixel rows
+
+	PnmSample sample = PnmSample::u8;
+	int maxval = 255;         // integer samples only
+	bool big_endian = true;   // PFM samples are big endian when the scale is positive
+	bool bottom_up = false;   // PFM rows go from the bottom of the image to the top
+
+	size_t bytes_per_sample() const
+	{
+		return sample == PnmSample::u8 ? 1 : (sample == PnmSample::u16 ? 2 : 4);
+	}
+
+	size_t row_bytes() const
+	{
+		return (size_t)width * channels * bytes_per_sample();
+	}
+
+	// Offset of image row y, 0 being the top row
+	size_t row_offset(int y) const
+	{
+		return data_offset + (size_t)(bottom_up ? height - 1 - y : y) * row_bytes();
+	}
+};
+
+bool host_is_little_endian()
+{
+	uint16_t x = 1;
+	uint8_t first;
+	memcpy(&first, &x, 1);
+	return first == 1;
+}
+
+// Any of the formats of PnmHeader. Returns false for malformed or unsupported files.
+bool parse_image_header(const uint8_t* data, size_t size, PnmHeader& header)
+{
+	size_t pos = 0;
+
+	auto skip_space = [&] {
+		while (pos < size)
+		{
+			if (data[pos] == '#')
+			{
+				while (pos < size && data[pos] != '\n')
+					pos++;
+			}
+			else if (data[pos] == ' ' || data[pos] == '\t' || data[pos] == '\r' || data[pos] == '\n')
+				pos++;
+			else
+				break;
+		}
+	};
+	auto read_int = [&](int& value) {
+		skip_space();
+		if (pos >= size || data[pos] < '0' || data[pos] > '9')
+			return false;
+		long v = 0;
+		while (pos < size && data[pos] >= '0' && data[pos] <= '9' && v < (1l << 30))
+			v = v * 10 + (data[pos++] - '0');
+		value = (int)v;
+		return true;
+	};
+	auto read_word = [&] {
+		skip_space();
+		std::string word;
+		while (pos < size && data[pos] > ' ')
+			word += (char)data[pos++];
+		return word;
+	};
+
+	if (size < 2 || data[0] != 'P')
+		return false;
+
+	header = PnmHeader();
+	int maxval = 0;
+	if (data[1] == '6')
+	{
+		pos = 2;
+		header.channels = 3;
+		if (!read_int(header.width) || !read_int(header.height) || !read_int(maxval))
+			return false;
+		pos++; // single whitespace before the pixels
+	}
+	else if (data[1] == '7')
+	{
+		pos = 2;
+		header.width = header.height = header.channels = 0;
+		for (;;)
+		{
+			std::string key = read_word();
+			bool ok = true;
+			if (key == "ENDHDR")
+				break;
+			else if (key == "WIDTH")
+				ok = read_int(header.width);
+			else if (key == "HEIGHT")
+				ok = read_int(header.height);
+			else if (key == "DEPTH")
+				ok = read_int(header.channels);
+			else if (key == "MAXVAL")
+				ok = read_int(maxval);
+			else if (key == "TUPLTYPE")
+				read_word();
+			else
+				ok = false;
+
+			if (!ok)
+				return false;
+		}
+		while (pos < size && data[pos] != '\n')
+			pos++;
+		pos++;
+	}
+	else if (data[1] == 'F')
+	{
+		// The scale is a float whose sign gives the byte order
+		pos = 2;
+		header.channels = 3;
+		header.sample = PnmSample::f32;
+		header.bottom_up = true;
+		if (!read_int(header.width) || !read_int(header.height))
+			return false;
+		std::string scale = read_word();
+		if (scale.empty() || atof(scale.c_str()) == 0.0)
+			return false;
+		header.big_endian = scale[0] != '-';
+		maxval = 1;
+		pos++;
+	}
+	else
+		return false;
+
+	if (header.sample != PnmSample::f32)
+	{
+		if (maxval < 1 || maxval > 65535)
+			return false;
+		header.sample = maxval > 255 ? PnmSample::u16 : PnmSample::u8;
+		header.maxval = maxval;
+	}
+	header.data_offset = pos;
+
+	return (header.channels == 3 || header.channels == 4)
+		&& header.width > 0 && header.height > 0
+		&& header.data_offset <= size && (size - header.data_offset) / header.row_bytes() >= (size_t)header.height;
+}
+
+// Binary PPM (P6) and PAM (P7) with 8 bit samples. Returns false for malformed or unsupported files
+// (other formats, maxval other than 255).
+bool parse_pnm_header(const uint8_t* data, size_t size, PnmHeader& header)
+{
+	return parse_image_header(data, size, header) && header.sample == PnmSample::u8 && header.maxval == 255;
+}
+
+// Header for a PPM (3 channels) or PAM (4 channels) file, with 16 bit samples when maxval is above 255
+std::string pnm_header(int width, int height, int channels, int maxval = 255)
+{
+	char text[128];
+	if (channels == 3)
+		snprintf(text, sizeof(text), "P6\n%d %d\n%d\n", width, height, maxval);
+	else
+		snprintf(text, sizeof(text), "P7\nWIDTH %d\nHEIGHT %d\nDEPTH 4\nMAXVAL %d\nTUPLTYPE RGB_ALPHA\nENDHDR\n", width, height, maxval);
+	return text;
+}
+
+// Header for a color PFM file with floats in the byte order of the host
+std::string pfm_header(int width, int height)
+{
+	char text[64];
+	snprintf(text, sizeof(text), "PF\n%d %d\n%s\n", width, height, host_is_little_endian() ? "-1.0" : "1.0");
+	return text;
+}
+
+} // namespace ok_color
@@ -0,0 +1,435 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#if defined(OKLAB_PROFILE)
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <utility>
+#endif
+
+namespace ok_color
+{
+
+// ------------------------ Latency histograms ------------------------ //
+
+// Histogram of durations in nanoseconds with a bounded relative error, in the style of
+// HdrHistogram: values below 64 have a bucket each, larger ones fall in 32 buckets per power of two,
+// so any value is known within 1/32 (3%) from 1 ns to centuries, in 1920 buckets.
+class LatencyHistogram
+{
+public:
+	static constexpr int sub_buckets = 32;
+	static constexpr int bucket_count = 64 + 58 * sub_buckets;
+
+	void record(uint64_t ns)
+	{
+		counts[bucket(ns)]++;
+		total_count++;
+		sum += ns;
+		min_ns = ns < min_ns ? ns : min_ns;
+		max_ns = ns > max_ns ? ns : max_ns;
+	}
+
+	void merge(const LatencyHistogram& other)
+	{
+		for (int i = 0; i < bucket_count; i++)
+			counts[i] += other.counts[i];
+		total_count += other.total_count;
+		sum += other.sum;
+		min_ns = other.min_ns < min_ns ? other.min_ns : min_ns;
+		max_ns = other.max_ns > max_ns ? other.max_ns : max_ns;
+	}
+
+	uint64_t count() const { return total_count; }
+	uint64_t total() const { return sum; }
+	uint64_t min() const { return total_count > 0 ? min_ns : 0; }
+	uint64_t max() const { return max_ns; }
+	double mean() const { return total_count > 0 ? (double)sum / total_count : 0.0; }
+
+	// Value at quantile q in [0, 1]: the middle of the bucket holding it, within [min, max]
+	uint64_t percentile(double q) const
+	{
+		if (total_count == 0)
+			return 0;
+
+		uint64_t rank = (uint64_t)(q * total_count + 0.5);
+		rank = rank < 1 ? 1 : (rank > total_count ? total_count : rank);
+
+		uint64_t seen = 0;
+		for (int i = 0; i < bucket_count; i++)
+		{
+			seen += counts[i];
+			if (seen >= rank)
+			{
+				uint64_t middle = lower_bound(i) + (width(i) - 1) / 2;
+				return middle < min_ns ? min_ns : (middle > max_ns ? max_ns : middle);
+			}
+		}
+		return max_ns;
+	}
+
+	static int bucket(uint64_t ns)
+	{
+		if (ns < 64)
+			return (int)ns;
+
+		int shift = 0;
+		while ((ns >> shift) >= 64)
+			shift++;
+		// ns >> shift is in [32, 64)
+		return 64 + (shift - 1) * sub_buckets + (int)((ns >> shift) - 32);
+	}
+
+	static uint64_t lower_bound(int bucket)
+	{
+		if (bucket < 64)
+			return (uint64_t)bucket;
+		int shift = (bucket - 64) / sub_buckets + 1;
+		return (uint64_t)((bucket - 64) % sub_buckets + 32) << shift;
+	}
+
+	static uint64_t width(int bucket)
+	{
+		return bucket < 64 ? 1 : (uint64_t)1 << ((bucket - 64) / sub_buckets + 1);
+	}
+
+private:
+	std::vector<uint64_t> counts = std::vector<uint64_t>(bucket_count, 0);
+	uint64_t total_count = 0;
+	uint64_t sum = 0;
+	uint64_t min_ns = UINT64_MAX;
+	uint64_t max_ns = 0;
+};
+
+// ------------------------ Profiling ------------------------ //
+
+// Records how long the batch and image functions take, to find where the time of a slow job goes.
+// Compiled in only when OKLAB_PROFILE is defined (for example -DOKLAB_PROFILE), otherwise the
+// OKLAB_PROFILE_SCOPE markers expand to nothing and the profile is empty.
+//
+// Each marked scope records a span (name, thread, start and duration) and adds its duration to the
+// latency histogram of its name:
+// - call spans cover a whole batch or image function
+// - stage spans cover the steps of the functions that have some, e.g. the iterations of k-means,
+//   the reading, converting and writing of a tile, the bands of oklab_convert
+// - range spans cover each range of a parallel_for, on the thread that ran it, and are named after
+//   the innermost call or stage that started it. The gap between the start of a call and of its
+//   ranges is the thread start up time.
+//
+// Per pixel work (transfer functions, cusp searches, clipping) is too fine for spans, the branch
+// counters of oklab_counters.h tell how often it takes its slow paths.
+//
+// Spans are added under a lock, at most one per range of pixels, so the cost is a few hundred
+// nanoseconds per call and per range. The spans kept are capped (profile_span_limit), the
+// histograms keep counting past the cap.
+enum class SpanKind
+{
+	call,
+	range,
+	stage,
+};
+
+const char* span_kind_name(SpanKind kind)
+{
+	return kind == SpanKind::call ? "call" : (kind == SpanKind::range ? "range" : "stage");
+}
+
+struct ProfileSpan
+{
+	const char* name;
+	SpanKind kind;
+	uint32_t thread;     // from 1, reused once the thread that had it exits
+	uint64_t start_ns;   // since the profile started or was last reset
+	uint64_t duration_ns;
+};
+
+struct ProfileEntry
+{
+	std::string name;
+	SpanKind kind;
+	LatencyHistogram latency;
+};
+
+#if defined(OKLAB_PROFILE)
+
+constexpr bool profiling_enabled = true;
+
+// Histograms are keyed by the address of the name and the kind, so recording a span doesn't build a
+// string. The same name can have several addresses, one per translation unit, profile_latencies
+// merges them.
+struct ProfileKeyLess
+{
+	bool operator()(const std::pair<const char*, int>& x, const std::pair<const char*, int>& y) const
+	{
+		return x.second != y.second ? x.second < y.second : std::less<const char*>()(x.first, y.first);
+	}
+};
+
+struct ProfileRegistry
+{
+	using clock = std::chrono::steady_clock;
+
+	std::mutex mutex;
+	clock::time_point epoch = clock::now();
+	std::vector<ProfileSpan> spans;
+	size_t span_limit = (size_t)1 << 20;
+	uint64_t dropped = 0;
+	std::map<std::pair<const char*, int>, LatencyHistogram, ProfileKeyLess> latencies;
+
+	// Thread ids in use are 1 to threads, minus the free ones
+	uint32_t threads = 0;
+	std::vector<uint32_t> free_threads;
+};
+
+ProfileRegistry& profile_registry()
+{
+	// Never destroyed, like the counter registry
+	static ProfileRegistry* registry = new ProfileRegistry();
+	return *registry;
+}
+
+// parallel_for starts new threads for every call, so a thread gives its id back when it exits and
+// the next thread takes the smallest free one. The trace then shows as many threads as ran at once.
+class ProfileThreadId
+{
+public:
+	ProfileThreadId()
+	{
+		ProfileRegistry& registry = profile_registry();
+		std::lock_guard<std::mutex> lock(registry.mutex);
+		if (registry.free_threads.empty())
+			id = ++registry.threads;
+		else
+		{
+			auto smallest = std::min_element(registry.free_threads.begin(), registry.free_threads.end());
+			id = *smallest;
+			registry.free_threads.erase(smallest);
+		}
+	}
+
+	~ProfileThreadId()
+	{
+		ProfileRegistry& registry = profile_registry();
+		std::lock_guard<std::mutex> lock(registry.mutex);
+		registry.free_threads.push_back(id);
+	}
+
+	ProfileThreadId(const ProfileThreadId&) = delete;
+	ProfileThreadId& operator=(const ProfileThreadId&) = delete;
+
+	uint32_t id;
+};
+
+uint32_t profile_thread_id()
+{
+	static thread_local ProfileThreadId thread;
+	return thread.id;
+}
+
+// Name of the innermost call or stage being profiled on this thread, nullptr outside of them
+const char*& profile_scope_name()
+{
+	static thread_local const char* name = nullptr;
+	return name;
+}
+
+class ProfileScope
+{
+public:
+	ProfileScope(const char* name, SpanKind kind)
+		: name(name ? name : "parallel_for"), kind(kind), outer(profile_scope_name()), start(ProfileRegistry::clock::now())
+	{
+		if (kind != SpanKind::range)
+			profile_scope_name() = this->name;
+	}
+
+	~ProfileScope()
+	{
+		auto end = ProfileRegistry::clock::now();
+		if (kind != SpanKind::range)
+			profile_scope_name() = outer;
+
+		ProfileRegistry& registry = profile_registry();
+		uint32_t thread = profile_thread_id();
+
+		std::lock_guard<std::mutex> lock(registry.mutex);
+		uint64_t start_ns = start > registry.epoch ? (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(start - registry.epoch).count() : 0;
+		uint64_t duration_ns = (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+
+		if (registry.spans.size() < registry.span_limit)
+			registry.spans.push_back({ name, kind, thread, start_ns, duration_ns });
+		else
+			registry.dropped++;
+		registry.latencies[{ name, (int)kind }].record(duration_ns);
+	}
+
+	ProfileScope(const ProfileScope&) = delete;
+	ProfileScope& operator=(const ProfileScope&) = delete;
+
+private:
+	const char* name;
+	SpanKind kind;
+	const char* outer;
+	ProfileRegistry::clock::time_point start;
+};
+
+// Clears the spans and histograms, span start times count from now
+void profile_reset()
+{
+	ProfileRegistry& registry = profile_registry();
+	std::lock_guard<std::mutex> lock(registry.mutex);
+	registry.epoch = ProfileRegistry::clock::now();
+	registry.spans.clear();
+	registry.dropped = 0;
+	registry.latencies.clear();
+}
+
+// Spans kept at most, later ones only go to the histograms
+void profile_span_limit(size_t limit)
+{
+	ProfileRegistry& registry = profile_registry();
+	std::lock_guard<std::mutex> lock(registry.mutex);
+	registry.span_limit = limit;
+}
+
+std::vector<ProfileSpan> profile_spans()
+{
+	ProfileRegistry& registry = profile_registry();
+	std::lock_guard<std::mutex> lock(registry.mutex);
+	return registry.spans;
+}
+
+uint64_t profile_dropped_spans()
+{
+	ProfileRegistry& registry = profile_registry();
+	std::lock_guard<std::mutex> lock(registry.mutex);
+	return registry.dropped;
+}
+
+// One entry per name and kind, sorted by name
+std::vector<ProfileEntry> profile_latencies()
+{
+	ProfileRegistry& registry = profile_registry();
+	std::lock_guard<std::mutex> lock(registry.mutex);
+
+	std::vector<ProfileEntry> entries;
+	for (const auto& latency : registry.latencies)
+		entries.push_back({ latency.first.first, (SpanKind)latency.first.second, latency.second });
+
+	std::sort(entries.begin(), entries.end(), [](const ProfileEntry& x, const ProfileEntry& y) {
+		return x.name != y.name ? x.name < y.name : x.kind < y.kind;
+	});
+
+	// Copies of a name from other translation units
+	std::vector<ProfileEntry> merged;
+	for (ProfileEntry& entry : entries)
+	{
+		if (!merged.empty() && merged.back().name == entry.name && merged.back().kind == entry.kind)
+			merged.back().latency.merge(entry.latency);
+		else
+			merged.push_back(std::move(entry));
+	}
+	return merged;
+}
+
+#define OKLAB_PROFILE_JOIN_(x, y) x##y
+#define OKLAB_PROFILE_JOIN(x, y) OKLAB_PROFILE_JOIN_(x, y)
+#define OKLAB_PROFILE_SCOPE(kind, name) \
+	::ok_color::ProfileScope OKLAB_PROFILE_JOIN(profile_scope_, __LINE__)(name, ::ok_color::SpanKind::kind)
+#define OKLAB_PROFILE_SCOPE_NAME() (::ok_color::profile_scope_name())
+
+#else
+
+constexpr bool profiling_enabled = false;
+
+void profile_reset()
+{
+}
+
+void profile_span_limit(size_t)
+{
+}
+
+std::vector<ProfileSpan> profile_spans()
+{
+	return {};
+}
+
+uint64_t profile_dropped_spans()
+{
+	return 0;
+}
+
+std::vector<ProfileEntry> profile_latencies()
+{
+	return {};
+}
+
+#define OKLAB_PROFILE_SCOPE(kind, name) ((void)0)
+#define OKLAB_PROFILE_SCOPE_NAME() ((const char*)nullptr)
+
+#endif
+
+// ------ Export ------ //
+
+// Writes the spans as Chrome trace events (chrome://tracing, ui.perfetto.dev), one complete event
+// per span with the kind as category. Returns false when the file can't be written.
+bool write_profile_trace(const char* path)
+{
+	FILE* file = fopen(path, "w");
+	if (!file)
+		return false;
+
+	std::vector<ProfileSpan> spans = profile_spans();
+
+	fprintf(file, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+	for (size_t i = 0; i < spans.size(); i++)
+	{
+		const ProfileSpan& span = spans[i];
+
+		// Names are identifiers from the code, only quotes and backslashes need escaping
+		std::string name;
+		for (const char* c = span.name; *c; c++)
+		{
+			if (*c == '"' || *c == '\\')
+				name += '\\';
+			name += *c;
+		}
+
+		fprintf(file, "%s\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%u}",
+			i > 0 ? "," : "", name.c_str(), span_kind_name(span.kind), span.start_ns / 1000.0, span.duration_ns / 1000.0, span.thread);
+	}
+	fprintf(file, "\n]}\n");
+
+	return fclose(file) == 0;
+}
+
+// Writes one line per name and kind with the latency statistics, in microseconds. Returns false
+// when the file can't be written.
+bool write_profile_csv(const char* path)
+{
+	FILE* file = fopen(path, "w");
+	if (!file)
+		return false;
+
+	fprintf(file, "kind,name,calls,total_us,mean_us,min_us,p50_us,p90_us,p99_us,max_us\n");
+	for (const ProfileEntry& entry : profile_latencies())
+	{
+		const LatencyHistogram& h = entry.latency;
+		fprintf(file, "%s,%s,%llu,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f\n",
+			span_kind_name(entry.kind), entry.name.c_str(), (unsigned long long)h.count(), h.total() / 1000.0, h.mean() / 1000.0,
+			h.min() / 1000.0, h.percentile(0.5) / 1000.0, h.percentile(0.9) / 1000.0, h.percentile(0.99) / 1000.0, h.max() / 1000.0);
+	}
+
+	return fclose(file) == 0;
+}
+
+} // namespace ok_color
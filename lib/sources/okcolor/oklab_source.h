@@ -19,6 +19,10 @@
 
 #include <cmath>
 #include <cfloat>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include "oklab_counters.h"
 
 namespace ok_color
 {
@@ -64,15 +68,143 @@ float srgb_transfer_function_inv(float a)
 	return .04045f < a ? powf((a + .055f) / 1.055f, 2.4f) : a / 12.92f;
 }
 
-Lab linear_srgb_to_oklab(RGB c)
+// sRGB in [0, 1] for the color channels of a packed 0xAARRGGBB value, alpha is ignored
+RGB argb32_to_srgb(uint32_t argb)
 {
-	float l = 0.4122214708f * c.r + 0.5363325363f * c.g + 0.0514459929f * c.b;
-	float m = 0.2119034982f * c.r + 0.6806995451f * c.g + 0.1073969566f * c.b;
-	float s = 0.0883024619f * c.r + 0.2817188376f * c.g + 0.6299787005f * c.b;
+	return {
+		((argb >> 16) & 0xff) / 255.f,
+		((argb >> 8) & 0xff) / 255.f,
+		(argb & 0xff) / 255.f,
+	};
+}
+
+// Rounds sRGB in [0, 1] to 8 bits per channel, values outside the range are clamped
+uint32_t srgb_to_argb32(RGB rgb, uint32_t alpha = 0xff)
+{
+	uint32_t r = (uint32_t)(clamp(rgb.r, 0.f, 1.f) * 255.f + 0.5f);
+	uint32_t g = (uint32_t)(clamp(rgb.g, 0.f, 1.f) * 255.f + 0.5f);
+	uint32_t b = (uint32_t)(clamp(rgb.b, 0.f, 1.f) * 255.f + 0.5f);
+	return (alpha << 24) | (r << 16) | (g << 8) | b;
+}
+
+// ------------------------ RGB gamuts ------------------------ //
+
+// Linear RGB gamuts with D65 white, the template parameter G of the generic conversions below. The
+// coefficients are compile time constants, so each gamut gets a kernel as fast as the sRGB one.
+// oklab_gamut.h has Display P3 and Rec. 2020, and oklab_gamut_fit computes the coefficients of others.
+struct SrgbGamut
+{
+	// Linear RGB to LMS
+	static constexpr float to_lms[3][3] = {
+		{ +0.4122214708f, +0.5363325363f, +0.0514459929f },
+		{ +0.2119034982f, +0.6806995451f, +0.1073969566f },
+		{ +0.0883024619f, +0.2817188376f, +0.6299787005f },
+	};
+	// LMS to linear RGB
+	static constexpr float from_lms[3][3] = {
+		{ +4.0767416621f, -3.3077115913f, +0.2309699292f },
+		{ -1.2684380046f, +2.6097574011f, -0.3413193965f },
+		{ -0.0041960863f, -0.7034186147f, +1.7076147010f },
+	};
+
+	// Red reaches 0 first at the maximum saturation where sector[0] . (a, b) > 1, else green where
+	// sector[1] . (a, b) > 1, else blue
+	static constexpr float sector[2][2] = {
+		{ -1.88170328f, -0.80936493f },
+		{ +1.81444104f, -1.19445276f },
+	};
+	static constexpr float k[3][5] = {
+		{ +1.19086277f, +1.76576728f, +0.59662641f, +0.75515197f, +0.56771245f },
+		{ +0.73956515f, -0.45954404f, +0.08285427f, +0.12541070f, +0.14503204f },
+		{ +1.35733652f, -0.00915799f, -1.15130210f, -0.50559606f, +0.00692167f },
+	};
+
+	// Smooth approximation of the cusp, S = S_mid[0] + 1 / (S_mid[1] + S_mid[2] b + a (S_mid[3] + ...)),
+	// terms in the order of get_ST_mid, same for T
+	static constexpr float S_mid[10] = { +0.11516993f, +7.44778970f, +4.15901240f, -2.19557347f, +1.75198401f, -2.13704948f, -10.02301043f, -4.24894561f, +5.38770819f, +4.69891013f };
+	static constexpr float T_mid[10] = { +0.11239642f, +1.61320320f, -0.68124379f, +0.40370612f, +0.90148123f, -0.27087943f, +0.61223990f, +0.00299215f, -0.45399568f, -0.14661872f };
+};
+
+// Selects one of the gamut_clip_* functions at runtime, for batch APIs that take the method as a setting.
+// gamut_clip returns values in [0, 1] unchanged, including the boundaries, where gamut_clip_* would
+// otherwise try to clip black and return NaN.
+enum class GamutClip
+{
+	none,
+	preserve_chroma,
+	project_to_0_5,
+	project_to_L_cusp,
+	adaptive_L0_0_5,
+	adaptive_L0_L_cusp,
+};
+
+// ------------------------ Generic conversions ------------------------ //
+
+// The conversions, written once for any scalar type T and gamut G. The float functions further down,
+// the gamut templates of oklab_gamut.h and the table based batches of oklab_hue_batch.h all call
+// these. oklab_jacobian.h adds Dual<N> scalars, which also carry derivatives.
+namespace generic
+{
+
+// Same names for float as for the other scalar types, so the templates read like plain float code
+inline float sqrt(float x) { return sqrtf(x); }
+inline float cbrt(float x) { return cbrtf(x); }
+inline float pow(float x, float p) { return powf(x, p); }
+inline float cos(float x) { return cosf(x); }
+inline float sin(float x) { return sinf(x); }
+inline float atan2(float y, float x) { return atan2f(y, x); }
+// double like the ::fabs called by the original gamut clipping, so float results match it bit for bit
+inline double fabs(float x) { return ::fabs((double)x); }
+inline float fmin(float x, float y) { return fminf(x, y); }
+inline float fmax(float x, float y) { return fmaxf(x, y); }
+
+template <class T> struct Lab { T L; T a; T b; };
+template <class T> struct RGB { T r; T g; T b; };
+template <class T> struct HSV { T h; T s; T v; };
+template <class T> struct HSL { T h; T s; T l; };
+template <class T> struct LC { T L; T C; };
+template <class T> struct ST { T S; T T_; };
+template <class T> struct Cs { T C_0; T C_mid; T C_max; };
+
+template <class T>
+float sgn(T x)
+{
+	return (float)(0.f < x) - (float)(x < 0.f);
+}
+
+template <class T>
+T clamp(T x, float min, float max)
+{
+	if (x < min)
+		return T(min);
+	if (x > max)
+		return T(max);
+
+	return x;
+}
+
+template <class T>
+T srgb_transfer_function(T a)
+{
+	return .0031308f >= a ? 12.92f * a : 1.055f * pow(a, .4166666666666667f) - .055f;
+}
 
-	float l_ = cbrtf(l);
-	float m_ = cbrtf(m);
-	float s_ = cbrtf(s);
+template <class T>
+T srgb_transfer_function_inv(T a)
+{
+	return .04045f < a ? pow((a + .055f) / 1.055f, 2.4f) : a / 12.92f;
+}
+
+template <class G = SrgbGamut, class T>
+Lab<T> linear_rgb_to_oklab(RGB<T> c)
+{
+	T l = G::to_lms[0][0] * c.r + G::to_lms[0][1] * c.g + G::to_lms[0][2] * c.b;
+	T m = G::to_lms[1][0] * c.r + G::to_lms[1][1] * c.g + G::to_lms[1][2] * c.b;
+	T s = G::to_lms[2][0] * c.r + G::to_lms[2][1] * c.g + G::to_lms[2][2] * c.b;
+
+	T l_ = cbrt(l);
+	T m_ = cbrt(m);
+	T s_ = cbrt(s);
 
 	return {
 		0.2104542553f * l_ + 0.7936177850f * m_ - 0.0040720468f * s_,
@@ -81,83 +213,81 @@ Lab linear_srgb_to_oklab(RGB c)
 	};
 }
 
-RGB oklab_to_linear_srgb(Lab c)
+template <class G = SrgbGamut, class T>
+RGB<T> oklab_to_linear_rgb(Lab<T> c)
 {
-	float l_ = c.L + 0.3963377774f * c.a + 0.2158037573f * c.b;
-	float m_ = c.L - 0.1055613458f * c.a - 0.0638541728f * c.b;
-	float s_ = c.L - 0.0894841775f * c.a - 1.2914855480f * c.b;
+	T l_ = c.L + 0.3963377774f * c.a + 0.2158037573f * c.b;
+	T m_ = c.L - 0.1055613458f * c.a - 0.0638541728f * c.b;
+	T s_ = c.L - 0.0894841775f * c.a - 1.2914855480f * c.b;
 
-	float l = l_ * l_ * l_;
-	float m = m_ * m_ * m_;
-	float s = s_ * s_ * s_;
+	T l = l_ * l_ * l_;
+	T m = m_ * m_ * m_;
+	T s = s_ * s_ * s_;
 
 	return {
-		+4.0767416621f * l - 3.3077115913f * m + 0.2309699292f * s,
-		-1.2684380046f * l + 2.6097574011f * m - 0.3413193965f * s,
-		-0.0041960863f * l - 0.7034186147f * m + 1.7076147010f * s,
+		G::from_lms[0][0] * l + G::from_lms[0][1] * m + G::from_lms[0][2] * s,
+		G::from_lms[1][0] * l + G::from_lms[1][1] * m + G::from_lms[1][2] * s,
+		G::from_lms[2][0] * l + G::from_lms[2][1] * m + G::from_lms[2][2] * s,
 	};
 }
 
-// Finds the maximum saturation possible for a given hue that fits in sRGB
+template <class T>
+Lab<T> linear_srgb_to_oklab(RGB<T> c)
+{
+	return linear_rgb_to_oklab<SrgbGamut>(c);
+}
+
+template <class T>
+RGB<T> oklab_to_linear_srgb(Lab<T> c)
+{
+	return oklab_to_linear_rgb<SrgbGamut>(c);
+}
+
+// Finds the maximum saturation possible for a given hue that fits in the gamut
 // Saturation here is defined as S = C/L
 // a and b must be normalized so a^2 + b^2 == 1
-float compute_max_saturation(float a, float b)
+template <class G = SrgbGamut, class T>
+T compute_max_saturation(T a, T b)
 {
 	// Max saturation will be when one of r, g or b goes below zero.
 
 	// Select different coefficients depending on which component goes below zero first
-	float k0, k1, k2, k3, k4, wl, wm, ws;
+	int c = G::sector[0][0] * a + G::sector[0][1] * b > 1.f ? 0 : G::sector[1][0] * a + G::sector[1][1] * b > 1.f ? 1 : 2;
 
-	if (-1.88170328f * a - 0.80936493f * b > 1)
-	{
-		// Red component
-		k0 = +1.19086277f; k1 = +1.76576728f; k2 = +0.59662641f; k3 = +0.75515197f; k4 = +0.56771245f;
-		wl = +4.0767416621f; wm = -3.3077115913f; ws = +0.2309699292f;
-	}
-	else if (1.81444104f * a - 1.19445276f * b > 1)
-	{
-		// Green component
-		k0 = +0.73956515f; k1 = -0.45954404f; k2 = +0.08285427f; k3 = +0.12541070f; k4 = +0.14503204f;
-		wl = -1.2684380046f; wm = +2.6097574011f; ws = -0.3413193965f;
-	}
-	else
-	{
-		// Blue component
-		k0 = +1.35733652f; k1 = -0.00915799f; k2 = -1.15130210f; k3 = -0.50559606f; k4 = +0.00692167f;
-		wl = -0.0041960863f; wm = -0.7034186147f; ws = +1.7076147010f;
-	}
+	const float* k = G::k[c];
+	float wl = G::from_lms[c][0], wm = G::from_lms[c][1], ws = G::from_lms[c][2];
 
 	// Approximate max saturation using a polynomial:
-	float S = k0 + k1 * a + k2 * b + k3 * a * a + k4 * a * b;
+	T S = k[0] + k[1] * a + k[2] * b + k[3] * a * a + k[4] * a * b;
 
 	// Do one step Halley's method to get closer
 	// this gives an error less than 10e6, except for some blue hues where the dS/dh is close to infinite
 	// this should be sufficient for most applications, otherwise do two/three steps 
 
-	float k_l = +0.3963377774f * a + 0.2158037573f * b;
-	float k_m = -0.1055613458f * a - 0.0638541728f * b;
-	float k_s = -0.0894841775f * a - 1.2914855480f * b;
+	T k_l = +0.3963377774f * a + 0.2158037573f * b;
+	T k_m = -0.1055613458f * a - 0.0638541728f * b;
+	T k_s = -0.0894841775f * a - 1.2914855480f * b;
 
 	{
-		float l_ = 1.f + S * k_l;
-		float m_ = 1.f + S * k_m;
-		float s_ = 1.f + S * k_s;
+		T l_ = 1.f + S * k_l;
+		T m_ = 1.f + S * k_m;
+		T s_ = 1.f + S * k_s;
 
-		float l = l_ * l_ * l_;
-		float m = m_ * m_ * m_;
-		float s = s_ * s_ * s_;
+		T l = l_ * l_ * l_;
+		T m = m_ * m_ * m_;
+		T s = s_ * s_ * s_;
 
-		float l_dS = 3.f * k_l * l_ * l_;
-		float m_dS = 3.f * k_m * m_ * m_;
-		float s_dS = 3.f * k_s * s_ * s_;
+		T l_dS = 3.f * k_l * l_ * l_;
+		T m_dS = 3.f * k_m * m_ * m_;
+		T s_dS = 3.f * k_s * s_ * s_;
 
-		float l_dS2 = 6.f * k_l * k_l * l_;
-		float m_dS2 = 6.f * k_m * k_m * m_;
-		float s_dS2 = 6.f * k_s * k_s * s_;
+		T l_dS2 = 6.f * k_l * k_l * l_;
+		T m_dS2 = 6.f * k_m * k_m * m_;
+		T s_dS2 = 6.f * k_s * k_s * s_;
 
-		float f = wl * l + wm * m + ws * s;
-		float f1 = wl * l_dS + wm * m_dS + ws * s_dS;
-		float f2 = wl * l_dS2 + wm * m_dS2 + ws * s_dS2;
+		T f = wl * l + wm * m + ws * s;
+		T f1 = wl * l_dS + wm * m_dS + ws * s_dS;
+		T f2 = wl * l_dS2 + wm * m_dS2 + ws * s_dS2;
 
 		S = S - f * f1 / (f1 * f1 - 0.5f * f * f2);
 	}
@@ -167,15 +297,16 @@ float compute_max_saturation(float a, float b)
 
 // finds L_cusp and C_cusp for a given hue
 // a and b must be normalized so a^2 + b^2 == 1
-LC find_cusp(float a, float b)
+template <class G = SrgbGamut, class T>
+LC<T> find_cusp(T a, T b)
 {
 	// First, find the maximum saturation (saturation S = C/L)
-	float S_cusp = compute_max_saturation(a, b);
+	T S_cusp = compute_max_saturation<G>(a, b);
 
-	// Convert to linear sRGB to find the first point where at least one of r,g or b >= 1:
-	RGB rgb_at_max = oklab_to_linear_srgb({ 1, S_cusp * a, S_cusp * b });
-	float L_cusp = cbrtf(1.f / fmax(fmax(rgb_at_max.r, rgb_at_max.g), rgb_at_max.b));
-	float C_cusp = L_cusp * S_cusp;
+	// Convert to linear RGB to find the first point where at least one of r,g or b >= 1:
+	RGB<T> rgb_at_max = oklab_to_linear_rgb<G>(Lab<T>{ T(1.f), S_cusp * a, S_cusp * b });
+	T L_cusp = cbrt(1.f / fmax(fmax(rgb_at_max.r, rgb_at_max.g), rgb_at_max.b));
+	T C_cusp = L_cusp * S_cusp;
 
 	return { L_cusp , C_cusp };
 }
@@ -184,84 +315,76 @@ LC find_cusp(float a, float b)
 // L = L0 * (1 - t) + t * L1;
 // C = t * C1;
 // a and b must be normalized so a^2 + b^2 == 1
-float find_gamut_intersection(float a, float b, float L1, float C1, float L0, LC cusp)
+template <class G = SrgbGamut, class T>
+T find_gamut_intersection(T a, T b, T L1, T C1, T L0, LC<T> cusp)
 {
 	// Find the intersection for upper and lower half seprately
-	float t;
+	T t;
 	if (((L1 - L0) * cusp.C - (cusp.L - L0) * C1) <= 0.f)
 	{
 		// Lower half
+		OKLAB_COUNT(gamut_intersection_lower);
 
 		t = cusp.C * L0 / (C1 * cusp.L + cusp.C * (L0 - L1));
 	}
 	else
 	{
 		// Upper half
+		OKLAB_COUNT(gamut_intersection_upper);
 
 		// First intersect with triangle
 		t = cusp.C * (L0 - 1.f) / (C1 * (cusp.L - 1.f) + cusp.C * (L0 - L1));
 
 		// Then one step Halley's method
 		{
-			float dL = L1 - L0;
-			float dC = C1;
+			T dL = L1 - L0;
+			T dC = C1;
 
-			float k_l = +0.3963377774f * a + 0.2158037573f * b;
-			float k_m = -0.1055613458f * a - 0.0638541728f * b;
-			float k_s = -0.0894841775f * a - 1.2914855480f * b;
+			T k_l = +0.3963377774f * a + 0.2158037573f * b;
+			T k_m = -0.1055613458f * a - 0.0638541728f * b;
+			T k_s = -0.0894841775f * a - 1.2914855480f * b;
 
-			float l_dt = dL + dC * k_l;
-			float m_dt = dL + dC * k_m;
-			float s_dt = dL + dC * k_s;
+			T l_dt = dL + dC * k_l;
+			T m_dt = dL + dC * k_m;
+			T s_dt = dL + dC * k_s;
 
 
 			// If higher accuracy is required, 2 or 3 iterations of the following block can be used:
 			{
-				float L = L0 * (1.f - t) + t * L1;
-				float C = t * C1;
-
-				float l_ = L + C * k_l;
-				float m_ = L + C * k_m;
-				float s_ = L + C * k_s;
-
-				float l = l_ * l_ * l_;
-				float m = m_ * m_ * m_;
-				float s = s_ * s_ * s_;
-
-				float ldt = 3 * l_dt * l_ * l_;
-				float mdt = 3 * m_dt * m_ * m_;
-				float sdt = 3 * s_dt * s_ * s_;
-
-				float ldt2 = 6 * l_dt * l_dt * l_;
-				float mdt2 = 6 * m_dt * m_dt * m_;
-				float sdt2 = 6 * s_dt * s_dt * s_;
-
-				float r = 4.0767416621f * l - 3.3077115913f * m + 0.2309699292f * s - 1;
-				float r1 = 4.0767416621f * ldt - 3.3077115913f * mdt + 0.2309699292f * sdt;
-				float r2 = 4.0767416621f * ldt2 - 3.3077115913f * mdt2 + 0.2309699292f * sdt2;
-
-				float u_r = r1 / (r1 * r1 - 0.5f * r * r2);
-				float t_r = -r * u_r;
-
-				float g = -1.2684380046f * l + 2.6097574011f * m - 0.3413193965f * s - 1;
-				float g1 = -1.2684380046f * ldt + 2.6097574011f * mdt - 0.3413193965f * sdt;
-				float g2 = -1.2684380046f * ldt2 + 2.6097574011f * mdt2 - 0.3413193965f * sdt2;
-
-				float u_g = g1 / (g1 * g1 - 0.5f * g * g2);
-				float t_g = -g * u_g;
-
-				float b = -0.0041960863f * l - 0.7034186147f * m + 1.7076147010f * s - 1;
-				float b1 = -0.0041960863f * ldt - 0.7034186147f * mdt + 1.7076147010f * sdt;
-				float b2 = -0.0041960863f * ldt2 - 0.7034186147f * mdt2 + 1.7076147010f * sdt2;
-
-				float u_b = b1 / (b1 * b1 - 0.5f * b * b2);
-				float t_b = -b * u_b;
-
-				t_r = u_r >= 0.f ? t_r : FLT_MAX;
-				t_g = u_g >= 0.f ? t_g : FLT_MAX;
-				t_b = u_b >= 0.f ? t_b : FLT_MAX;
-
-				t += fmin(t_r, fmin(t_g, t_b));
+				T L = L0 * (1.f - t) + t * L1;
+				T C = t * C1;
+
+				T l_ = L + C * k_l;
+				T m_ = L + C * k_m;
+				T s_ = L + C * k_s;
+
+				T l = l_ * l_ * l_;
+				T m = m_ * m_ * m_;
+				T s = s_ * s_ * s_;
+
+				T ldt = 3.f * l_dt * l_ * l_;
+				T mdt = 3.f * m_dt * m_ * m_;
+				T sdt = 3.f * s_dt * s_ * s_;
+
+				T ldt2 = 6.f * l_dt * l_dt * l_;
+				T mdt2 = 6.f * m_dt * m_dt * m_;
+				T sdt2 = 6.f * s_dt * s_dt * s_;
+
+				// Step to where each channel reaches 1, the closest one wins
+				T t_min = T(FLT_MAX);
+				for (int c = 0; c < 3; c++)
+				{
+					const float* w = G::from_lms[c];
+					T x = w[0] * l + w[1] * m + w[2] * s - 1.f;
+					T x1 = w[0] * ldt + w[1] * mdt + w[2] * sdt;
+					T x2 = w[0] * ldt2 + w[1] * mdt2 + w[2] * sdt2;
+
+					T u = x1 / (x1 * x1 - 0.5f * x * x2);
+					T t_x = u >= 0.f ? -x * u : T(FLT_MAX);
+					t_min = fmin(t_min, t_x);
+				}
+
+				t = t + t_min;
 			}
 		}
 	}
@@ -269,146 +392,109 @@ float find_gamut_intersection(float a, float b, float L1, float C1, float L0, LC
 	return t;
 }
 
-float find_gamut_intersection(float a, float b, float L1, float C1, float L0)
+template <class G = SrgbGamut, class T>
+T find_gamut_intersection(T a, T b, T L1, T C1, T L0)
 {
 	// Find the cusp of the gamut triangle
-	LC cusp = find_cusp(a, b);
+	LC<T> cusp = find_cusp<G>(a, b);
 
-	return find_gamut_intersection(a, b, L1, C1, L0, cusp);
+	return find_gamut_intersection<G>(a, b, L1, C1, L0, cusp);
 }
 
-RGB gamut_clip_preserve_chroma(RGB rgb)
+// Clips OkLab colors outside the gamut, without testing whether they are: the part shared by
+// gamut_clip_oklab and the gamut_clip_* functions
+template <class G = SrgbGamut, class T>
+RGB<T> clip_oklab(Lab<T> lab, GamutClip method, float alpha = 0.05f)
 {
-	if (rgb.r < 1 && rgb.g < 1 && rgb.b < 1 && rgb.r > 0 && rgb.g > 0 && rgb.b > 0)
-		return rgb;
-
-	Lab lab = linear_srgb_to_oklab(rgb);
-
-	float L = lab.L;
+	T L = lab.L;
 	float eps = 0.00001f;
-	float C = fmax(eps, sqrtf(lab.a * lab.a + lab.b * lab.b));
-	float a_ = lab.a / C;
-	float b_ = lab.b / C;
-
-	float L0 = clamp(L, 0, 1);
-
-	float t = find_gamut_intersection(a_, b_, L, C, L0);
-	float L_clipped = L0 * (1 - t) + t * L;
-	float C_clipped = t * C;
-
-	return oklab_to_linear_srgb({ L_clipped, C_clipped * a_, C_clipped * b_ });
-}
-
-RGB gamut_clip_project_to_0_5(RGB rgb)
-{
-	if (rgb.r < 1 && rgb.g < 1 && rgb.b < 1 && rgb.r > 0 && rgb.g > 0 && rgb.b > 0)
-		return rgb;
+	T C = fmax(T(eps), sqrt(lab.a * lab.a + lab.b * lab.b));
+	T a_ = lab.a / C;
+	T b_ = lab.b / C;
 
-	Lab lab = linear_srgb_to_oklab(rgb);
+	LC<T> cusp = find_cusp<G>(a_, b_);
 
-	float L = lab.L;
-	float eps = 0.00001f;
-	float C = fmax(eps, sqrtf(lab.a * lab.a + lab.b * lab.b));
-	float a_ = lab.a / C;
-	float b_ = lab.b / C;
+	T L0;
+	switch (method)
+	{
+	case GamutClip::project_to_0_5:
+		L0 = T(0.5f);
+		break;
+	case GamutClip::project_to_L_cusp:
+		L0 = cusp.L;
+		break;
+	case GamutClip::adaptive_L0_0_5:
+	{
+		T Ld = L - 0.5f;
+		T e1 = 0.5f + fabs(Ld) + alpha * C;
+		L0 = 0.5f * (1.f + sgn(Ld) * (e1 - sqrt(e1 * e1 - 2.f * fabs(Ld))));
+		break;
+	}
+	case GamutClip::adaptive_L0_L_cusp:
+	{
+		T Ld = L - cusp.L;
+		T k = 2.f * (Ld > 0.f ? 1.f - cusp.L : cusp.L);
 
-	float L0 = 0.5;
+		T e1 = 0.5f * k + fabs(Ld) + alpha * C / k;
+		L0 = cusp.L + 0.5f * (sgn(Ld) * (e1 - sqrt(e1 * e1 - 2.f * k * fabs(Ld))));
+		break;
+	}
+	default:
+		L0 = clamp(L, 0.f, 1.f);
+		break;
+	}
 
-	float t = find_gamut_intersection(a_, b_, L, C, L0);
-	float L_clipped = L0 * (1 - t) + t * L;
-	float C_clipped = t * C;
+	T t = find_gamut_intersection<G>(a_, b_, L, C, L0, cusp);
+	T L_clipped = L0 * (1.f - t) + t * L;
+	T C_clipped = t * C;
 
-	return oklab_to_linear_srgb({ L_clipped, C_clipped * a_, C_clipped * b_ });
+	return oklab_to_linear_rgb<G>(Lab<T>{ L_clipped, C_clipped * a_, C_clipped * b_ });
 }
 
-RGB gamut_clip_project_to_L_cusp(RGB rgb)
+// Same results as gamut_clip, for colors that are already in OkLab: in gamut colors are returned
+// as linear RGB, the others are clipped. The cusp is only computed once, and callers that have the
+// OkLab value skip a conversion.
+template <class G = SrgbGamut, class T>
+RGB<T> gamut_clip_oklab(Lab<T> lab, GamutClip method, float alpha = 0.05f)
 {
-	if (rgb.r < 1 && rgb.g < 1 && rgb.b < 1 && rgb.r > 0 && rgb.g > 0 && rgb.b > 0)
+	RGB<T> rgb = oklab_to_linear_rgb<G>(lab);
+	if (method == GamutClip::none)
 		return rgb;
-
-	Lab lab = linear_srgb_to_oklab(rgb);
-
-	float L = lab.L;
-	float eps = 0.00001f;
-	float C = fmax(eps, sqrtf(lab.a * lab.a + lab.b * lab.b));
-	float a_ = lab.a / C;
-	float b_ = lab.b / C;
-
-	// The cusp is computed here and in find_gamut_intersection, an optimized solution would only compute it once.
-	LC cusp = find_cusp(a_, b_);
-
-	float L0 = cusp.L;
-
-	float t = find_gamut_intersection(a_, b_, L, C, L0);
-
-	float L_clipped = L0 * (1 - t) + t * L;
-	float C_clipped = t * C;
-
-	return oklab_to_linear_srgb({ L_clipped, C_clipped * a_, C_clipped * b_ });
-}
-
-RGB gamut_clip_adaptive_L0_0_5(RGB rgb, float alpha = 0.05f)
-{
-	if (rgb.r < 1 && rgb.g < 1 && rgb.b < 1 && rgb.r > 0 && rgb.g > 0 && rgb.b > 0)
+	if (rgb.r <= 1.f && rgb.g <= 1.f && rgb.b <= 1.f && rgb.r >= 0.f && rgb.g >= 0.f && rgb.b >= 0.f)
+	{
+		OKLAB_COUNT(gamut_clip_in_gamut);
 		return rgb;
+	}
 
-	Lab lab = linear_srgb_to_oklab(rgb);
-
-	float L = lab.L;
-	float eps = 0.00001f;
-	float C = fmax(eps, sqrtf(lab.a * lab.a + lab.b * lab.b));
-	float a_ = lab.a / C;
-	float b_ = lab.b / C;
-
-	float Ld = L - 0.5f;
-	float e1 = 0.5f + fabs(Ld) + alpha * C;
-	float L0 = 0.5f * (1.f + sgn(Ld) * (e1 - sqrtf(e1 * e1 - 2.f * fabs(Ld))));
-
-	float t = find_gamut_intersection(a_, b_, L, C, L0);
-	float L_clipped = L0 * (1.f - t) + t * L;
-	float C_clipped = t * C;
-
-	return oklab_to_linear_srgb({ L_clipped, C_clipped * a_, C_clipped * b_ });
+	OKLAB_COUNT(gamut_clip_clipped);
+	return clip_oklab<G>(lab, method, alpha);
 }
 
-RGB gamut_clip_adaptive_L0_L_cusp(RGB rgb, float alpha = 0.05f)
+template <class G = SrgbGamut, class T>
+RGB<T> gamut_clip(RGB<T> rgb, GamutClip method, float alpha = 0.05f)
 {
-	if (rgb.r < 1 && rgb.g < 1 && rgb.b < 1 && rgb.r > 0 && rgb.g > 0 && rgb.b > 0)
+	if (method == GamutClip::none)
 		return rgb;
+	if (rgb.r <= 1.f && rgb.g <= 1.f && rgb.b <= 1.f && rgb.r >= 0.f && rgb.g >= 0.f && rgb.b >= 0.f)
+	{
+		OKLAB_COUNT(gamut_clip_in_gamut);
+		return rgb;
+	}
 
-	Lab lab = linear_srgb_to_oklab(rgb);
-
-	float L = lab.L;
-	float eps = 0.00001f;
-	float C = fmax(eps, sqrtf(lab.a * lab.a + lab.b * lab.b));
-	float a_ = lab.a / C;
-	float b_ = lab.b / C;
-
-	// The cusp is computed here and in find_gamut_intersection, an optimized solution would only compute it once.
-	LC cusp = find_cusp(a_, b_);
-
-	float Ld = L - cusp.L;
-	float k = 2.f * (Ld > 0 ? 1.f - cusp.L : cusp.L);
-
-	float e1 = 0.5f * k + fabs(Ld) + alpha * C / k;
-	float L0 = cusp.L + 0.5f * (sgn(Ld) * (e1 - sqrtf(e1 * e1 - 2.f * k * fabs(Ld))));
-
-	float t = find_gamut_intersection(a_, b_, L, C, L0);
-	float L_clipped = L0 * (1.f - t) + t * L;
-	float C_clipped = t * C;
-
-	return oklab_to_linear_srgb({ L_clipped, C_clipped * a_, C_clipped * b_ });
+	return gamut_clip_oklab<G>(linear_rgb_to_oklab<G>(rgb), method, alpha);
 }
 
-float toe(float x)
+template <class T>
+T toe(T x)
 {
 	constexpr float k_1 = 0.206f;
 	constexpr float k_2 = 0.03f;
 	constexpr float k_3 = (1.f + k_1) / (1.f + k_2);
-	return 0.5f * (k_3 * x - k_1 + sqrtf((k_3 * x - k_1) * (k_3 * x - k_1) + 4 * k_2 * k_3 * x));
+	return 0.5f * (k_3 * x - k_1 + sqrt((k_3 * x - k_1) * (k_3 * x - k_1) + 4.f * k_2 * k_3 * x));
 }
 
-float toe_inv(float x)
+template <class T>
+T toe_inv(T x)
 {
 	constexpr float k_1 = 0.206f;
 	constexpr float k_2 = 0.03f;
@@ -416,106 +502,131 @@ float toe_inv(float x)
 	return (x * x + k_1 * x) / (k_3 * (x + k_2));
 }
 
-ST to_ST(LC cusp)
+template <class T>
+ST<T> to_ST(LC<T> cusp)
 {
-	float L = cusp.L;
-	float C = cusp.C;
-	return { C / L, C / (1 - L) };
+	T L = cusp.L;
+	T C = cusp.C;
+	return { C / L, C / (1.f - L) };
 }
 
 // Returns a smooth approximation of the location of the cusp
 // This polynomial was created by an optimization process
 // It has been designed so that S_mid < S_max and T_mid < T_max
-ST get_ST_mid(float a_, float b_)
+template <class G = SrgbGamut, class T>
+ST<T> get_ST_mid(T a_, T b_)
 {
-	float S = 0.11516993f + 1.f / (
-		+7.44778970f + 4.15901240f * b_
-		+ a_ * (-2.19557347f + 1.75198401f * b_
-			+ a_ * (-2.13704948f - 10.02301043f * b_
-				+ a_ * (-4.24894561f + 5.38770819f * b_ + 4.69891013f * a_
+	constexpr const float* p = G::S_mid;
+	T S = p[0] + 1.f / (
+		+p[1] + p[2] * b_
+		+ a_ * (p[3] + p[4] * b_
+			+ a_ * (p[5] + p[6] * b_
+				+ a_ * (p[7] + p[8] * b_ + p[9] * a_
 					)))
 		);
 
-	float T = 0.11239642f + 1.f / (
-		+1.61320320f - 0.68124379f * b_
-		+ a_ * (+0.40370612f + 0.90148123f * b_
-			+ a_ * (-0.27087943f + 0.61223990f * b_
-				+ a_ * (+0.00299215f - 0.45399568f * b_ - 0.14661872f * a_
+	constexpr const float* q = G::T_mid;
+	T T_ = q[0] + 1.f / (
+		+q[1] + q[2] * b_
+		+ a_ * (q[3] + q[4] * b_
+			+ a_ * (q[5] + q[6] * b_
+				+ a_ * (q[7] + q[8] * b_ + q[9] * a_
 					)))
 		);
 
-	return { S, T };
+	return { S, T_ };
 }
 
-struct Cs { float C_0; float C_mid; float C_max; };
-Cs get_Cs(float L, float a_, float b_)
+// The terms of OkHSL and OkHSV that only depend on hue. The conversions get them from a hue source,
+// ExactHue by default, so the table of oklab_hue_batch.h can interpolate them instead.
+template <class T> struct HueTerms { LC<T> cusp; ST<T> ST_mid; };
+
+template <class G>
+struct ExactHue
 {
-	LC cusp = find_cusp(a_, b_);
+	template <class T>
+	LC<T> cusp(T, T a_, T b_) const
+	{
+		return find_cusp<G>(a_, b_);
+	}
+
+	template <class T>
+	HueTerms<T> terms(T, T a_, T b_) const
+	{
+		return { find_cusp<G>(a_, b_), get_ST_mid<G>(a_, b_) };
+	}
+};
+
+template <class G = SrgbGamut, class T>
+Cs<T> get_Cs(T L, T a_, T b_, LC<T> cusp, ST<T> ST_mid)
+{
+	T C_max = find_gamut_intersection<G>(a_, b_, L, T(1.f), L, cusp);
+	ST<T> ST_max = to_ST(cusp);
 
-	float C_max = find_gamut_intersection(a_, b_, L, 1, L, cusp);
-	ST ST_max = to_ST(cusp);
-	
 	// Scale factor to compensate for the curved part of gamut shape:
-	float k = C_max / fmin((L * ST_max.S), (1 - L) * ST_max.T);
+	T k = C_max / fmin((L * ST_max.S), (1.f - L) * ST_max.T_);
 
-	float C_mid;
+	T C_mid;
 	{
-		ST ST_mid = get_ST_mid(a_, b_);
-
 		// Use a soft minimum function, instead of a sharp triangle shape to get a smooth value for chroma.
-		float C_a = L * ST_mid.S;
-		float C_b = (1.f - L) * ST_mid.T;
-		C_mid = 0.9f * k * sqrtf(sqrtf(1.f / (1.f / (C_a * C_a * C_a * C_a) + 1.f / (C_b * C_b * C_b * C_b))));
+		T C_a = L * ST_mid.S;
+		T C_b = (1.f - L) * ST_mid.T_;
+		C_mid = 0.9f * k * sqrt(sqrt(1.f / (1.f / (C_a * C_a * C_a * C_a) + 1.f / (C_b * C_b * C_b * C_b))));
 	}
 
-	float C_0;
+	T C_0;
 	{
 		// for C_0, the shape is independent of hue, so ST are constant. Values picked to roughly be the average values of ST.
-		float C_a = L * 0.4f;
-		float C_b = (1.f - L) * 0.8f;
+		T C_a = L * 0.4f;
+		T C_b = (1.f - L) * 0.8f;
 
 		// Use a soft minimum function, instead of a sharp triangle shape to get a smooth value for chroma.
-		C_0 = sqrtf(1.f / (1.f / (C_a * C_a) + 1.f / (C_b * C_b)));
+		C_0 = sqrt(1.f / (1.f / (C_a * C_a) + 1.f / (C_b * C_b)));
 	}
 
 	return { C_0, C_mid, C_max };
 }
 
-void print_float_bits(float f) {
-    uint32_t bits;
-    memcpy(&bits, &f, sizeof(float));
-    printf("0x%08x\n", bits);
+template <class G = SrgbGamut, class T>
+Cs<T> get_Cs(T L, T a_, T b_)
+{
+	LC<T> cusp = find_cusp<G>(a_, b_);
+	ST<T> ST_mid = get_ST_mid<G>(a_, b_);
+
+	return get_Cs<G>(L, a_, b_, cusp, ST_mid);
 }
 
-RGB okhsl_to_srgb(HSL hsl)
+template <class G = SrgbGamut, class T, class H = ExactHue<G>>
+Lab<T> okhsl_to_oklab(HSL<T> hsl, const H& hue = H())
 {
-	float h = hsl.h;
-	float s = hsl.s;
-	float l = hsl.l;
+	T h = hsl.h;
+	T s = hsl.s;
+	T l = hsl.l;
 
 	if (l == 1.0f)
 	{
-		return { 1.f, 1.f, 1.f };
+		return { T(1.f), T(0.f), T(0.f) };
 	}
 
 	else if (l == 0.f)
 	{
-		return { 0.f, 0.f, 0.f };
+		return { T(0.f), T(0.f), T(0.f) };
 	}
 
-	float a_ = cosf(2.f * pi * h);
-	float b_ = sinf(2.f * pi * h);
-	float L = toe_inv(l);
+	T a_ = cos(2.f * pi * h);
+	T b_ = sin(2.f * pi * h);
+	T L = toe_inv(l);
 
-	Cs cs = get_Cs(L, a_, b_);
-	float C_0 = cs.C_0;
-	float C_mid = cs.C_mid;
-	float C_max = cs.C_max;
+	HueTerms<T> terms = hue.terms(h, a_, b_);
+	Cs<T> cs = get_Cs<G>(L, a_, b_, terms.cusp, terms.ST_mid);
+	T C_0 = cs.C_0;
+	T C_mid = cs.C_mid;
+	T C_max = cs.C_max;
 
 	float mid = 0.8f;
 	float mid_inv = 1.25f;
 
-	float C, t, k_0, k_1, k_2;
+	T C, t, k_0, k_1, k_2;
 
 	if (s < mid)
 	{
@@ -528,7 +639,7 @@ RGB okhsl_to_srgb(HSL hsl)
 	}
 	else
 	{
-		t = (s - mid)/ (1 - mid);
+		t = (s - mid)/ (1.f - mid);
 
 		k_0 = C_mid;
 		k_1 = (1.f - mid) * C_mid * C_mid * mid_inv * mid_inv / C_0;
@@ -537,148 +648,129 @@ RGB okhsl_to_srgb(HSL hsl)
 		C = k_0 + t * k_1 / (1.f - k_2 * t);
 	}
 
-	RGB rgb = oklab_to_linear_srgb({ L, C * a_, C * b_ });
-	return {
-		srgb_transfer_function(rgb.r),
-		srgb_transfer_function(rgb.g),
-		srgb_transfer_function(rgb.b),
-	};
+	return { L, C * a_, C * b_ };
 }
 
-HSL srgb_to_okhsl(RGB rgb)
+template <class G = SrgbGamut, class T, class H = ExactHue<G>>
+HSL<T> oklab_to_okhsl(Lab<T> lab, const H& hue = H())
 {
-	RGB linear_rgb = {
-		srgb_transfer_function_inv(rgb.r),
-		srgb_transfer_function_inv(rgb.g),
-		srgb_transfer_function_inv(rgb.b)
-	};
+	T C = sqrt(lab.a * lab.a + lab.b * lab.b);
+	if (C == 0.f)
+		OKLAB_COUNT(okhsl_zero_chroma);
+	T a_ = lab.a / C;
+	T b_ = lab.b / C;
 
-	Lab lab = linear_srgb_to_oklab(linear_rgb);
-	
+	T L = lab.L;
+	T h = 0.5f + 0.5f * atan2(-lab.b, -lab.a) / pi;
 
-	float C = sqrtf(lab.a * lab.a + lab.b * lab.b);
-	float a_ = lab.a / C;
-	float b_ = lab.b / C;
-	
-	float L = lab.L;
-	float h = 0.5f + 0.5f * atan2f(-lab.b, -lab.a) / pi;
+	HueTerms<T> terms = hue.terms(h, a_, b_);
+	Cs<T> cs = get_Cs<G>(L, a_, b_, terms.cusp, terms.ST_mid);
+	T C_0 = cs.C_0;
+	T C_mid = cs.C_mid;
+	T C_max = cs.C_max;
 
-	Cs cs = get_Cs(L, a_, b_);
-	float C_0 = cs.C_0;
-	float C_mid = cs.C_mid;
-	float C_max = cs.C_max;
-
-	// Inverse of the interpolation in okhsl_to_srgb:
+	// Inverse of the interpolation in okhsl_to_oklab:
 
 	float mid = 0.8f;
 	float mid_inv = 1.25f;
 
-	float s;
+	T s;
 	if (C < C_mid)
 	{
-		float k_1 = mid * C_0;
-		float k_2 = (1.f - k_1 / C_mid);
+		T k_1 = mid * C_0;
+		T k_2 = (1.f - k_1 / C_mid);
 
-		float t = C / (k_1 + k_2 * C);
+		T t = C / (k_1 + k_2 * C);
 		s = t * mid;
 	}
 	else
 	{
-		float k_0 = C_mid;
-		float k_1 = (1.f - mid) * C_mid * C_mid * mid_inv * mid_inv / C_0;
-		float k_2 = (1.f - (k_1) / (C_max - C_mid));
+		T k_0 = C_mid;
+		T k_1 = (1.f - mid) * C_mid * C_mid * mid_inv * mid_inv / C_0;
+		T k_2 = (1.f - (k_1) / (C_max - C_mid));
 
-		float t = (C - k_0) / (k_1 + k_2 * (C - k_0));
+		T t = (C - k_0) / (k_1 + k_2 * (C - k_0));
 		s = mid + (1.f - mid) * t;
 	}
 
-	float l = toe(L);
+	T l = toe(L);
 	return { h, s, l };
 }
 
-
-RGB okhsv_to_srgb(HSV hsv)
+template <class G = SrgbGamut, class T, class H = ExactHue<G>>
+Lab<T> okhsv_to_oklab(HSV<T> hsv, const H& hue = H())
 {
-	float h = hsv.h;
-	float s = hsv.s;
-	float v = hsv.v;
+	T h = hsv.h;
+	T s = hsv.s;
+	T v = hsv.v;
 
-	float a_ = cosf(2.f * pi * h);
-	float b_ = sinf(2.f * pi * h);
-	
-	LC cusp = find_cusp(a_, b_);
-	ST ST_max = to_ST(cusp);
-	float S_max = ST_max.S;
-	float T_max = ST_max.T;
+	T a_ = cos(2.f * pi * h);
+	T b_ = sin(2.f * pi * h);
+
+	LC<T> cusp = hue.cusp(h, a_, b_);
+	ST<T> ST_max = to_ST(cusp);
+	T S_max = ST_max.S;
+	T T_max = ST_max.T_;
 	float S_0 = 0.5f;
-	float k = 1 - S_0 / S_max;
+	T k = 1.f - S_0 / S_max;
 
 	// first we compute L and V as if the gamut is a perfect triangle:
 
 	// L, C when v==1:
-	float L_v = 1     - s * S_0 / (S_0 + T_max - T_max * k * s);
-	float C_v = s * T_max * S_0 / (S_0 + T_max - T_max * k * s);
+	T L_v = 1.f   - s * S_0 / (S_0 + T_max - T_max * k * s);
+	T C_v = s * T_max * S_0 / (S_0 + T_max - T_max * k * s);
 
-	float L = v * L_v;
-	float C = v * C_v;
+	T L = v * L_v;
+	T C = v * C_v;
 
 	// then we compensate for both toe and the curved top part of the triangle:
-	float L_vt = toe_inv(L_v);
-	float C_vt = C_v * L_vt / L_v;
+	T L_vt = toe_inv(L_v);
+	T C_vt = C_v * L_vt / L_v;
 
-	float L_new = toe_inv(L);
+	T L_new = toe_inv(L);
 	C = C * L_new / L;
 	L = L_new;
 
-	RGB rgb_scale = oklab_to_linear_srgb({ L_vt, a_ * C_vt, b_ * C_vt });
-	float scale_L = cbrtf(1.f / fmax(fmax(rgb_scale.r, rgb_scale.g), fmax(rgb_scale.b, 0.f)));
+	RGB<T> rgb_scale = oklab_to_linear_rgb<G>(Lab<T>{ L_vt, a_ * C_vt, b_ * C_vt });
+	T scale_L = cbrt(1.f / fmax(fmax(rgb_scale.r, rgb_scale.g), fmax(rgb_scale.b, T(0.f))));
 
 	L = L * scale_L;
 	C = C * scale_L;
 
-	RGB rgb = oklab_to_linear_srgb({ L, C * a_, C * b_ });
-	return {
-		srgb_transfer_function(rgb.r),
-		srgb_transfer_function(rgb.g),
-		srgb_transfer_function(rgb.b),
-	};
+	return { L, C * a_, C * b_ };
 }
 
-HSV srgb_to_okhsv(RGB rgb)
+template <class G = SrgbGamut, class T, class H = ExactHue<G>>
+HSV<T> oklab_to_okhsv(Lab<T> lab, const H& hue = H())
 {
-	RGB linear_rgb = {
-		srgb_transfer_function_inv(rgb.r),
-		srgb_transfer_function_inv(rgb.g),
-		srgb_transfer_function_inv(rgb.b)
-		};
-	Lab lab = linear_srgb_to_oklab(linear_rgb);
-
-	float C = sqrtf(lab.a * lab.a + lab.b * lab.b);
-	float a_ = lab.a / C;
-	float b_ = lab.b / C;
-
-	float L = lab.L;
-	float h = 0.5f + 0.5f * atan2f(-lab.b, -lab.a) / pi;
-
-	LC cusp = find_cusp(a_, b_);
-	ST ST_max = to_ST(cusp);
-	float S_max = ST_max.S;
-	float T_max = ST_max.T;
+	T C = sqrt(lab.a * lab.a + lab.b * lab.b);
+	if (C == 0.f)
+		OKLAB_COUNT(okhsv_zero_chroma);
+	T a_ = lab.a / C;
+	T b_ = lab.b / C;
+
+	T L = lab.L;
+	T h = 0.5f + 0.5f * atan2(-lab.b, -lab.a) / pi;
+
+	LC<T> cusp = hue.cusp(h, a_, b_);
+	ST<T> ST_max = to_ST(cusp);
+	T S_max = ST_max.S;
+	T T_max = ST_max.T_;
 	float S_0 = 0.5f;
-	float k = 1 - S_0 / S_max;
+	T k = 1.f - S_0 / S_max;
 
 	// first we find L_v, C_v, L_vt and C_vt
 
-	float t = T_max / (C + L * T_max);
-	float L_v = t * L;
-	float C_v = t * C;
+	T t = T_max / (C + L * T_max);
+	T L_v = t * L;
+	T C_v = t * C;
 
-	float L_vt = toe_inv(L_v);
-	float C_vt = C_v * L_vt / L_v;
+	T L_vt = toe_inv(L_v);
+	T C_vt = C_v * L_vt / L_v;
 
 	// we can then use these to invert the step that compensates for the toe and the curved top part of the triangle:
-	RGB rgb_scale = oklab_to_linear_srgb({ L_vt, a_ * C_vt, b_ * C_vt });
-	float scale_L = cbrtf(1.f / fmax(fmax(rgb_scale.r, rgb_scale.g), fmax(rgb_scale.b, 0.f)));
+	RGB<T> rgb_scale = oklab_to_linear_rgb<G>(Lab<T>{ L_vt, a_ * C_vt, b_ * C_vt });
+	T scale_L = cbrt(1.f / fmax(fmax(rgb_scale.r, rgb_scale.g), fmax(rgb_scale.b, T(0.f))));
 
 	L = L / scale_L;
 	C = C / scale_L;
@@ -688,12 +780,310 @@ HSV srgb_to_okhsv(RGB rgb)
 
 	// we can now compute v and s:
 
-	float v = L / L_v;
-	float s = (S_0 + T_max) * C_v / ((T_max * S_0) + T_max * k * C_v);
+	T v = L / L_v;
+	T s = (S_0 + T_max) * C_v / ((T_max * S_0) + T_max * k * C_v);
 
 	return { h, s, v };
 }
 
+// okhsl_to_oklab then to linear RGB, exact for white and black where going through
+// oklab_to_linear_rgb would add rounding errors. Only in linear RGB: the sRGB transfer function
+// maps 1 to 0.99999994, so okhsl_to_srgb returns white and black itself.
+template <class G = SrgbGamut, class T, class H = ExactHue<G>>
+RGB<T> okhsl_to_linear_rgb(HSL<T> hsl, const H& hue = H())
+{
+	if (hsl.l == 1.0f)
+	{
+		return { T(1.f), T(1.f), T(1.f) };
+	}
+
+	else if (hsl.l == 0.f)
+	{
+		return { T(0.f), T(0.f), T(0.f) };
+	}
+
+	RGB<T> rgb = oklab_to_linear_rgb<G>(okhsl_to_oklab<G>(hsl, hue));
+	if (rgb.r < 0.f || rgb.g < 0.f || rgb.b < 0.f || rgb.r > 1.f || rgb.g > 1.f || rgb.b > 1.f)
+		OKLAB_COUNT(okhsl_out_of_range);
+	return rgb;
+}
+
+template <class G = SrgbGamut, class T, class H = ExactHue<G>>
+RGB<T> okhsv_to_linear_rgb(HSV<T> hsv, const H& hue = H())
+{
+	RGB<T> rgb = oklab_to_linear_rgb<G>(okhsv_to_oklab<G>(hsv, hue));
+	if (rgb.r < 0.f || rgb.g < 0.f || rgb.b < 0.f || rgb.r > 1.f || rgb.g > 1.f || rgb.b > 1.f)
+		OKLAB_COUNT(okhsv_out_of_range);
+	return rgb;
+}
+
+} // namespace generic
+
+// ------------------------ sRGB ------------------------ //
+
+// The float structs to and from their generic versions
+inline generic::Lab<float> to_generic(Lab c) { return { c.L, c.a, c.b }; }
+inline generic::RGB<float> to_generic(RGB c) { return { c.r, c.g, c.b }; }
+inline generic::HSV<float> to_generic(HSV c) { return { c.h, c.s, c.v }; }
+inline generic::HSL<float> to_generic(HSL c) { return { c.h, c.s, c.l }; }
+inline generic::LC<float> to_generic(LC c) { return { c.L, c.C }; }
+inline generic::ST<float> to_generic(ST c) { return { c.S, c.T }; }
+
+inline Lab from_generic(generic::Lab<float> c) { return { c.L, c.a, c.b }; }
+inline RGB from_generic(generic::RGB<float> c) { return { c.r, c.g, c.b }; }
+inline HSV from_generic(generic::HSV<float> c) { return { c.h, c.s, c.v }; }
+inline HSL from_generic(generic::HSL<float> c) { return { c.h, c.s, c.l }; }
+inline LC from_generic(generic::LC<float> c) { return { c.L, c.C }; }
+inline ST from_generic(generic::ST<float> c) { return { c.S, c.T_ }; }
+
+Lab linear_srgb_to_oklab(RGB c)
+{
+	return from_generic(generic::linear_rgb_to_oklab<SrgbGamut>(to_generic(c)));
+}
+
+// Cube root within 3 ulp of cbrtf for |x| > 1e-20, several times faster.
+// Starts from an estimate made by dividing the exponent bits by three, refined with two Halley steps.
+float cbrt_fast(float x)
+{
+	float ax = fabsf(x);
+	if (!(ax > 1e-20f))
+		return cbrtf(x);
+
+	uint32_t bits;
+	memcpy(&bits, &ax, sizeof(bits));
+	bits = bits / 3 + 709921077u;
+
+	float y;
+	memcpy(&y, &bits, sizeof(y));
+
+	float y3 = y * y * y;
+	y = y * (y3 + 2.f * ax) / (2.f * y3 + ax);
+	y3 = y * y * y;
+	y = y * (y3 + 2.f * ax) / (2.f * y3 + ax);
+
+	return copysignf(y, x);
+}
+
+// linear_srgb_to_oklab using cbrt_fast, for batch conversions where cbrtf dominates the cost
+Lab linear_srgb_to_oklab_fast(RGB c)
+{
+	float l = 0.4122214708f * c.r + 0.5363325363f * c.g + 0.0514459929f * c.b;
+	float m = 0.2119034982f * c.r + 0.6806995451f * c.g + 0.1073969566f * c.b;
+	float s = 0.0883024619f * c.r + 0.2817188376f * c.g + 0.6299787005f * c.b;
+
+	float l_ = cbrt_fast(l);
+	float m_ = cbrt_fast(m);
+	float s_ = cbrt_fast(s);
+
+	return {
+		0.2104542553f * l_ + 0.7936177850f * m_ - 0.0040720468f * s_,
+		1.9779984951f * l_ - 2.4285922050f * m_ + 0.4505937099f * s_,
+		0.0259040371f * l_ + 0.7827717662f * m_ - 0.8086757660f * s_,
+	};
+}
+
+RGB oklab_to_linear_srgb(Lab c)
+{
+	return from_generic(generic::oklab_to_linear_rgb<SrgbGamut>(to_generic(c)));
+}
+
+// Finds the maximum saturation possible for a given hue that fits in sRGB
+// Saturation here is defined as S = C/L
+// a and b must be normalized so a^2 + b^2 == 1
+float compute_max_saturation(float a, float b)
+{
+	return generic::compute_max_saturation<SrgbGamut>(a, b);
+}
+
+// finds L_cusp and C_cusp for a given hue
+// a and b must be normalized so a^2 + b^2 == 1
+LC find_cusp(float a, float b)
+{
+	return from_generic(generic::find_cusp<SrgbGamut>(a, b));
+}
+
+// Finds intersection of the line defined by 
+// L = L0 * (1 - t) + t * L1;
+// C = t * C1;
+// a and b must be normalized so a^2 + b^2 == 1
+float find_gamut_intersection(float a, float b, float L1, float C1, float L0, LC cusp)
+{
+	return generic::find_gamut_intersection<SrgbGamut>(a, b, L1, C1, L0, to_generic(cusp));
+}
+
+float find_gamut_intersection(float a, float b, float L1, float C1, float L0)
+{
+	return generic::find_gamut_intersection<SrgbGamut>(a, b, L1, C1, L0);
+}
+
+// The gamut_clip_* functions clip colors outside (0, 1), including those on its boundary
+RGB gamut_clip_method(RGB rgb, GamutClip method, float alpha)
+{
+	if (rgb.r < 1 && rgb.g < 1 && rgb.b < 1 && rgb.r > 0 && rgb.g > 0 && rgb.b > 0)
+	{
+		OKLAB_COUNT(gamut_clip_in_gamut);
+		return rgb;
+	}
+
+	OKLAB_COUNT(gamut_clip_clipped);
+	return from_generic(generic::clip_oklab<SrgbGamut>(generic::linear_rgb_to_oklab<SrgbGamut>(to_generic(rgb)), method, alpha));
+}
+
+RGB gamut_clip_preserve_chroma(RGB rgb)
+{
+	return gamut_clip_method(rgb, GamutClip::preserve_chroma, 0.05f);
+}
+
+RGB gamut_clip_project_to_0_5(RGB rgb)
+{
+	return gamut_clip_method(rgb, GamutClip::project_to_0_5, 0.05f);
+}
+
+RGB gamut_clip_project_to_L_cusp(RGB rgb)
+{
+	return gamut_clip_method(rgb, GamutClip::project_to_L_cusp, 0.05f);
+}
+
+RGB gamut_clip_adaptive_L0_0_5(RGB rgb, float alpha = 0.05f)
+{
+	return gamut_clip_method(rgb, GamutClip::adaptive_L0_0_5, alpha);
+}
+
+RGB gamut_clip_adaptive_L0_L_cusp(RGB rgb, float alpha = 0.05f)
+{
+	return gamut_clip_method(rgb, GamutClip::adaptive_L0_L_cusp, alpha);
+}
+
+// Same results as gamut_clip, for colors that are already in OkLab: in gamut colors are returned
+// as linear sRGB, the others are clipped. The cusp is only computed once, and callers that have the
+// OkLab value skip a conversion.
+RGB gamut_clip_oklab(Lab lab, GamutClip method, float alpha = 0.05f)
+{
+	return from_generic(generic::gamut_clip_oklab<SrgbGamut>(to_generic(lab), method, alpha));
+}
+
+RGB gamut_clip(RGB rgb, GamutClip method, float alpha = 0.05f)
+{
+	return from_generic(generic::gamut_clip<SrgbGamut>(to_generic(rgb), method, alpha));
+}
+
+float toe(float x)
+{
+	return generic::toe(x);
+}
+
+float toe_inv(float x)
+{
+	return generic::toe_inv(x);
+}
+
+ST to_ST(LC cusp)
+{
+	return from_generic(generic::to_ST(to_generic(cusp)));
+}
+
+// Returns a smooth approximation of the location of the cusp
+// This polynomial was created by an optimization process
+// It has been designed so that S_mid < S_max and T_mid < T_max
+ST get_ST_mid(float a_, float b_)
+{
+	return from_generic(generic::get_ST_mid<SrgbGamut>(a_, b_));
+}
+
+struct Cs { float C_0; float C_mid; float C_max; };
+Cs get_Cs(float L, float a_, float b_, LC cusp, ST ST_mid)
+{
+	generic::Cs<float> cs = generic::get_Cs<SrgbGamut>(L, a_, b_, to_generic(cusp), to_generic(ST_mid));
+	return { cs.C_0, cs.C_mid, cs.C_max };
+}
+
+Cs get_Cs(float L, float a_, float b_)
+{
+	// The hue dependent terms can be precomputed and passed in directly, see oklab_hue_batch.h
+	LC cusp = find_cusp(a_, b_);
+	ST ST_mid = get_ST_mid(a_, b_);
+
+	return get_Cs(L, a_, b_, cusp, ST_mid);
+}
+
+void print_float_bits(float f) {
+    uint32_t bits;
+    memcpy(&bits, &f, sizeof(float));
+    printf("0x%08x\n", bits);
+}
+
+Lab okhsl_to_oklab(HSL hsl)
+{
+	return from_generic(generic::okhsl_to_oklab<SrgbGamut>(to_generic(hsl)));
+}
+
+RGB okhsl_to_srgb(HSL hsl)
+{
+	if (hsl.l == 1.0f)
+	{
+		return { 1.f, 1.f, 1.f };
+	}
+
+	else if (hsl.l == 0.f)
+	{
+		return { 0.f, 0.f, 0.f };
+	}
+
+	RGB rgb = from_generic(generic::okhsl_to_linear_rgb<SrgbGamut>(to_generic(hsl)));
+	return {
+		srgb_transfer_function(rgb.r),
+		srgb_transfer_function(rgb.g),
+		srgb_transfer_function(rgb.b),
+	};
+}
+
+HSL oklab_to_okhsl(Lab lab)
+{
+	return from_generic(generic::oklab_to_okhsl<SrgbGamut>(to_generic(lab)));
+}
+
+HSL srgb_to_okhsl(RGB rgb)
+{
+	RGB linear_rgb = {
+		srgb_transfer_function_inv(rgb.r),
+		srgb_transfer_function_inv(rgb.g),
+		srgb_transfer_function_inv(rgb.b)
+	};
+
+	return oklab_to_okhsl(linear_srgb_to_oklab(linear_rgb));
+}
+
+Lab okhsv_to_oklab(HSV hsv)
+{
+	return from_generic(generic::okhsv_to_oklab<SrgbGamut>(to_generic(hsv)));
+}
+
+RGB okhsv_to_srgb(HSV hsv)
+{
+	RGB rgb = from_generic(generic::okhsv_to_linear_rgb<SrgbGamut>(to_generic(hsv)));
+	return {
+		srgb_transfer_function(rgb.r),
+		srgb_transfer_function(rgb.g),
+		srgb_transfer_function(rgb.b),
+	};
+}
+
+HSV oklab_to_okhsv(Lab lab)
+{
+	return from_generic(generic::oklab_to_okhsv<SrgbGamut>(to_generic(lab)));
+}
+
+HSV srgb_to_okhsv(RGB rgb)
+{
+	RGB linear_rgb = {
+		srgb_transfer_function_inv(rgb.r),
+		srgb_transfer_function_inv(rgb.g),
+		srgb_transfer_function_inv(rgb.b)
+	};
+
+	return oklab_to_okhsv(linear_srgb_to_oklab(linear_rgb));
+}
+
 // ------------------------ OkLch ------------------------ //
 
 Lch oklab_to_lch(Lab lab) {
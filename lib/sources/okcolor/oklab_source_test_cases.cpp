@@ -1,9 +1,37 @@
+#include <algorithm>
 #include <cmath>
 #include <cfloat>
 #include <iostream>
 #include <iomanip>
+#include <stdexcept>
 #include <vector>
 #include "oklab_source.h"
+#include "oklab_hue_batch.h"
+#include "oklab_cache.h"
+#include "oklab_color.h"
+#include "oklab_pipeline.h"
+#include "oklab_adjust.h"
+#include "oklab_palette_index.h"
+#include "oklab_dither.h"
+#include "oklab_kmeans.h"
+#include "oklab_histogram.h"
+#include "oklab_distance.h"
+#include "oklab_image_diff.h"
+#include "oklab_image_convert.h"
+#include "oklab_pnm.h"
+#include "oklab_distinct.h"
+#include "oklab_tonal.h"
+#include "oklab_contrast.h"
+#include "oklab_jacobian.h"
+#include "oklab_gamut.h"
+#include "oklab_xyz.h"
+#include "oklab_yuv.h"
+#include "oklab_pixel_formats.h"
+#include "oklab_packed.h"
+#include "oklab_fixed.h"
+#include "oklab_tile_pipeline.h"
+#include "oklab_counters.h"
+#include "oklab_profile.h"
 
 using namespace ok_color;
 
@@ -403,6 +431,2246 @@ void oklch_srgb_test_cases() {
     }
 }
 
+// ------------------------ Hue table batch test cases ------------------------ //
+
+void hue_batch_test_cases() {
+    std::cout << "\nRunning hue table batch OkHSL/OkHSV tests:" << std::endl;
+    std::cout << std::fixed << std::setprecision(9);
+
+    const int num_colors = sizeof(test_colors) / sizeof(test_colors[0]);
+    HueTable table = make_hue_table();
+
+    HSL hsl[num_colors];
+    HSV hsv[num_colors];
+    RGB from_hsl[num_colors];
+    RGB from_hsv[num_colors];
+    srgb_to_okhsl(table, test_colors, hsl, num_colors);
+    srgb_to_okhsv(table, test_colors, hsv, num_colors);
+    okhsl_to_srgb(table, hsl, from_hsl, num_colors);
+    okhsv_to_srgb(table, hsv, from_hsv, num_colors);
+
+    for (int i = 0; i < num_colors; ++i) {
+        RGB rgb_in = test_colors[i];
+        HSL hsl_ref = srgb_to_okhsl(rgb_in);
+        HSV hsv_ref = srgb_to_okhsv(rgb_in);
+
+        // The scalar functions return NaN for achromatic colors, the batch ones must match that
+        auto diff = [](float x, float y) { return std::isnan(x) && std::isnan(y) ? 0.f : std::abs(x - y); };
+        float max_diff = std::max({diff(hsl[i].s, hsl_ref.s), diff(hsl[i].l, hsl_ref.l),
+                                   diff(hsv[i].s, hsv_ref.s), diff(hsv[i].v, hsv_ref.v)});
+        if (!std::isnan(hsl_ref.s)) {
+            max_diff = std::max({max_diff, std::abs(from_hsl[i].r - rgb_in.r),
+                                 std::abs(from_hsl[i].g - rgb_in.g), std::abs(from_hsl[i].b - rgb_in.b),
+                                 std::abs(from_hsv[i].r - rgb_in.r),
+                                 std::abs(from_hsv[i].g - rgb_in.g), std::abs(from_hsv[i].b - rgb_in.b)});
+        }
+
+        std::cout << "RGB (" << rgb_in.r << ", " << rgb_in.g << ", " << rgb_in.b << ") -> "
+                  << "HSL (" << hsl[i].h << ", " << hsl[i].s << ", " << hsl[i].l << ") "
+                  << "HSV (" << hsv[i].h << ", " << hsv[i].s << ", " << hsv[i].v << ")";
+
+        if (max_diff < 2.5e-4) {
+            std::cout << " PASS";
+        } else {
+            std::cout << " FAIL (Max difference: " << max_diff << ")";
+        }
+        std::cout << std::endl;
+    }
+
+    // OkHSL white and black are exact in sRGB, not just close
+    {
+        HSL ends[2] = { { 0.3f, 0.5f, 1.f }, { 0.3f, 0.5f, 0.f } };
+        RGB batch[2];
+        okhsl_to_srgb(table, ends, batch, 2);
+        RGB white = okhsl_to_srgb(ends[0]);
+        RGB black = okhsl_to_srgb(ends[1]);
+        bool pass = white.r == 1.f && white.g == 1.f && white.b == 1.f && black.r == 0.f && black.g == 0.f && black.b == 0.f
+            && !memcmp(&batch[0], &white, sizeof(white)) && !memcmp(&batch[1], &black, sizeof(black));
+        std::cout << "OkHSL white and black exact (" << white.r << ", " << white.g << ", " << white.b << ")" << (pass ? " PASS" : " FAIL") << std::endl;
+    }
+}
+
+// ------------------------ Conversion cache test cases ------------------------ //
+
+void conversion_cache_test_cases() {
+    std::cout << "\nRunning conversion cache tests:" << std::endl;
+    std::cout << std::fixed << std::setprecision(9);
+
+    ConversionCache cache(64, true);
+    std::vector<uint32_t> colors = { 0xff000000, 0xffffffff, 0xffff0000, 0xff00ff00, 0xff0000ff, 0xff808080, 0xffb33a4d, 0x80b33a4d };
+
+    for (uint32_t argb : colors) {
+        ColorSpaces first = cache.get(argb);
+        ColorSpaces second = cache.get(argb);
+        ColorSpaces ref = argb32_to_color_spaces(argb);
+
+        bool same = memcmp(&first, &ref, sizeof(ref)) == 0 && memcmp(&second, &ref, sizeof(ref)) == 0;
+
+        std::cout << "ARGB 0x" << std::hex << argb << std::dec << " -> "
+                  << "LAB (" << second.lab.L << ", " << second.lab.a << ", " << second.lab.b << ")";
+        std::cout << (same ? " PASS" : " FAIL (cached value differs)") << std::endl;
+    }
+
+    // Every color misses once and hits once, except the last which only differs in alpha from the one before
+    CacheStats stats = cache.stats();
+    bool stats_ok = stats.hits == 9 && stats.misses == 7 && stats.inserts == 7;
+    std::cout << "stats: hits " << stats.hits << ", misses " << stats.misses << ", inserts " << stats.inserts
+              << (stats_ok ? " PASS" : " FAIL") << std::endl;
+
+    // Stats are off by default
+    ConversionCache untracked(64);
+    untracked.get(0xffb33a4d);
+    untracked.get(0xffb33a4d);
+    CacheStats none = untracked.stats();
+    bool off = none.hits == 0 && none.misses == 0 && none.inserts == 0;
+    std::cout << "stats off by default" << (off ? " PASS" : " FAIL") << std::endl;
+}
+
+// ------------------------ Color test cases ------------------------ //
+
+void test_color(RGB rgb_in) {
+    std::cout << std::fixed << std::setprecision(9);
+
+    Color color = Color::from_srgb(rgb_in);
+    HSV hsv = color.to_hsv();
+    HSL hsl = color.to_hsl();
+    HSV hsv_ref = srgb_to_okhsv(rgb_in);
+    HSL hsl_ref = srgb_to_okhsl(rgb_in);
+
+    // darker stays in OkLch, the reference goes through the scalar functions
+    Lch lch_ref = srgb_to_oklch(rgb_in);
+    RGB darker = color.darker(0.25f).to_srgb();
+    RGB darker_ref = oklch_to_srgb({ lch_ref.l * 0.75f, lch_ref.c, lch_ref.h });
+    RGB rotated = color.rotated(120).rotated(240).to_srgb();
+
+    auto diff = [](float x, float y) { return std::isnan(x) && std::isnan(y) ? 0.f : std::abs(x - y); };
+    RGB rgb_out = color.to_srgb();
+    float max_diff = std::max({diff(rgb_out.r, rgb_in.r), diff(rgb_out.g, rgb_in.g), diff(rgb_out.b, rgb_in.b),
+                               diff(hsv.s, hsv_ref.s), diff(hsv.v, hsv_ref.v), diff(hsl.s, hsl_ref.s), diff(hsl.l, hsl_ref.l),
+                               diff(darker.r, darker_ref.r), diff(darker.g, darker_ref.g), diff(darker.b, darker_ref.b),
+                               diff(rotated.r, rgb_in.r), diff(rotated.g, rgb_in.g), diff(rotated.b, rgb_in.b)});
+
+    std::cout << "RGB (" << rgb_in.r << ", " << rgb_in.g << ", " << rgb_in.b << ") -> "
+              << "darker(0.25) RGB (" << darker.r << ", " << darker.g << ", " << darker.b << ")";
+
+    if (max_diff < 1e-4) {
+        std::cout << " PASS";
+    } else {
+        std::cout << " FAIL (Max difference: " << max_diff << ")";
+    }
+    std::cout << std::endl;
+}
+
+void color_test_cases() {
+    std::cout << "\nRunning Color tests:" << std::endl;
+    for (const auto& color : test_colors) {
+        test_color(color);
+    }
+}
+
+// ------------------------ Pipeline test cases ------------------------ //
+
+void pipeline_test_cases() {
+    std::cout << "\nRunning fused pipeline tests:" << std::endl;
+    std::cout << std::fixed << std::setprecision(9);
+
+    namespace pl = ok_color::pipeline;
+
+    // Round trips through OkLab and OkLch collapse to nothing
+    auto round_trip = pl::srgb_transfer_inv() | pl::linear_srgb_to_oklab() | pl::oklab_to_lch()
+        | pl::lch_to_oklab() | pl::oklab_to_linear_srgb() | pl::srgb_transfer();
+    std::cout << "round trip stages: " << round_trip.size << (round_trip.size == 0 ? " PASS" : " FAIL") << std::endl;
+
+    // A matrix in front of the OkLab conversion is folded into its first matrix
+    const float mix[9] = { 0.8f, 0.15f, 0.05f, 0.1f, 0.7f, 0.2f, 0.05f, 0.25f, 0.7f };
+    auto folded = pl::matrix(mix) | pl::linear_srgb_to_oklab();
+    std::cout << "folded stages: " << folded.size << (folded.size == 3 ? " PASS" : " FAIL") << std::endl;
+
+    const int num_colors = sizeof(test_colors) / sizeof(test_colors[0]);
+    Lab folded_out[num_colors];
+    folded.run(test_colors, folded_out, num_colors);
+
+    float folded_diff = 0.f;
+    for (int i = 0; i < num_colors; ++i) {
+        RGB c = test_colors[i];
+        RGB mixed = { mix[0] * c.r + mix[1] * c.g + mix[2] * c.b,
+                      mix[3] * c.r + mix[4] * c.g + mix[5] * c.b,
+                      mix[6] * c.r + mix[7] * c.g + mix[8] * c.b };
+        Lab ref = ok_color::linear_srgb_to_oklab(mixed);
+        folded_diff = std::max({folded_diff, std::abs(folded_out[i].L - ref.L), std::abs(folded_out[i].a - ref.a), std::abs(folded_out[i].b - ref.b)});
+    }
+    std::cout << "folded stages same as unfolded:";
+    if (folded_diff < 1e-6) {
+        std::cout << " PASS";
+    } else {
+        std::cout << " FAIL (Max difference: " << folded_diff << ")";
+    }
+    std::cout << std::endl;
+
+    auto recolor = pl::srgb_transfer_inv() | pl::linear_srgb_to_oklab() | pl::oklab_to_lch()
+        | pl::map<Lch>([](Lch c) { c.l *= 0.8f; c.c *= 1.2f; return c; })
+        | pl::lch_to_oklab() | pl::oklab_to_linear_srgb()
+        | pl::map<RGB>([](RGB c) { return gamut_clip_preserve_chroma(c); })
+        | pl::srgb_transfer();
+
+    RGB out[num_colors];
+    recolor.run(test_colors, out, num_colors);
+
+    for (int i = 0; i < num_colors; ++i) {
+        RGB rgb_in = test_colors[i];
+
+        Lch lch = srgb_to_oklch(rgb_in);
+        lch.l *= 0.8f;
+        lch.c *= 1.2f;
+        RGB linear = gamut_clip_preserve_chroma(ok_color::oklab_to_linear_srgb(ok_color::lch_to_oklab(lch)));
+        RGB ref = { srgb_transfer_function(linear.r), srgb_transfer_function(linear.g), srgb_transfer_function(linear.b) };
+
+        std::cout << "RGB (" << rgb_in.r << ", " << rgb_in.g << ", " << rgb_in.b << ") -> "
+                  << "RGB (" << out[i].r << ", " << out[i].g << ", " << out[i].b << ")";
+
+        // Clipping black gives NaN in the reference as well
+        auto diff = [](float x, float y) { return std::isnan(x) && std::isnan(y) ? 0.f : std::abs(x - y); };
+        float max_diff = std::max({diff(out[i].r, ref.r), diff(out[i].g, ref.g), diff(out[i].b, ref.b)});
+        if (max_diff < 1e-6) {
+            std::cout << " PASS";
+        } else {
+            std::cout << " FAIL (Max difference: " << max_diff << ")";
+        }
+        std::cout << std::endl;
+    }
+}
+
+// ------------------------ OkLch adjustment test cases ------------------------ //
+
+void lch_adjustment_test_cases() {
+    std::cout << "\nRunning OkLch adjustment tests:" << std::endl;
+    std::cout << std::fixed << std::setprecision(9);
+
+    const int num_colors = sizeof(test_colors) / sizeof(test_colors[0]);
+
+    LchAdjustment adjustment;
+    adjustment.lightness = -0.2f;
+    adjustment.chroma = -0.1f;
+    adjustment.hue_degrees = 30.f;
+
+    RGB out[num_colors];
+    adjust_srgb(adjustment, test_colors, out, num_colors);
+
+    for (int i = 0; i < num_colors; ++i) {
+        RGB rgb_in = test_colors[i];
+
+        // Same adjustment through the Color type and the scalar gamut clipping
+        Lab lab = Color::from_srgb(rgb_in).darker(0.2f).desaturate(0.1f).rotated(30.f).to_oklab();
+        RGB linear = gamut_clip(ok_color::oklab_to_linear_srgb(lab), GamutClip::preserve_chroma);
+        RGB ref = { srgb_transfer_function(linear.r), srgb_transfer_function(linear.g), srgb_transfer_function(linear.b) };
+
+        std::cout << "RGB (" << rgb_in.r << ", " << rgb_in.g << ", " << rgb_in.b << ") -> "
+                  << "RGB (" << out[i].r << ", " << out[i].g << ", " << out[i].b << ")";
+
+        float max_diff = std::max({std::abs(out[i].r - ref.r), std::abs(out[i].g - ref.g), std::abs(out[i].b - ref.b)});
+        if (max_diff < 1e-4) {
+            std::cout << " PASS";
+        } else {
+            std::cout << " FAIL (Max difference: " << max_diff << ")";
+        }
+        std::cout << std::endl;
+    }
+
+    // Identity curves leave 8 bit colors unchanged
+    LchAdjustment curves;
+    curves.L_curve = make_curve([](float L) { return L; }, 256);
+    curves.C_curve = make_curve([](float C) { return C; }, 256, 0.f, 0.5f);
+    curves.C_by_hue = make_curve([](float) { return 1.f; }, 64, -pi, pi, true);
+
+    std::vector<uint32_t> argb = { 0xff000000, 0xffffffff, 0xffff0000, 0x8000ff00, 0xff0000ff, 0xff808080, 0x00b33a4d };
+    std::vector<uint32_t> argb_out(argb.size());
+    adjust_argb32(curves, argb.data(), argb_out.data(), argb.size());
+
+    bool same = argb == argb_out;
+    std::cout << "identity curves on 8 bit colors:" << (same ? " PASS" : " FAIL") << std::endl;
+
+    // Degenerate sample counts: one sample is constant, none is the identity
+    Curve single = make_curve([](float x) { return 0.25f + x; }, 1, 0.5f, 1.f);
+    Curve none = make_curve([](float x) { return 2.f * x; }, 0);
+    bool degenerate = single.values.size() == 1 && single.eval(0.9f) == 0.75f && none.empty() && none.eval(0.3f) == 0.3f;
+    std::cout << "curves with one or no samples:" << (degenerate ? " PASS" : " FAIL") << std::endl;
+
+    // gamut_clip_oklab leaves in gamut colors alone, like gamut_clip
+    bool kept = true;
+    for (int i = 0; i < num_colors; ++i) {
+        Lab lab = Color::from_srgb(test_colors[i]).to_oklab();
+        RGB linear = ok_color::oklab_to_linear_srgb(lab);
+        if (linear.r < 0.f || linear.g < 0.f || linear.b < 0.f || linear.r > 1.f || linear.g > 1.f || linear.b > 1.f)
+            continue;
+        for (GamutClip clip : { GamutClip::preserve_chroma, GamutClip::adaptive_L0_L_cusp }) {
+            RGB clipped = gamut_clip_oklab(lab, clip);
+            kept = kept && clipped.r == linear.r && clipped.g == linear.g && clipped.b == linear.b;
+        }
+    }
+    std::cout << "gamut_clip_oklab keeps in gamut colors:" << (kept ? " PASS" : " FAIL") << std::endl;
+}
+
+// ------------------------ Palette index test cases ------------------------ //
+
+void palette_index_test_cases() {
+    std::cout << "\nRunning palette index tests:" << std::endl;
+    std::cout << std::fixed << std::setprecision(9);
+
+    // Palette of evenly spread sRGB colors, with a duplicate
+    std::vector<uint32_t> palette;
+    for (int i = 0; i < 300; ++i)
+        palette.push_back(0xff000000 | ((i * 2654435761u) & 0x00ffffff));
+    palette.push_back(palette[7]);
+
+    PaletteIndex index = PaletteIndex::from_argb32(palette.data(), palette.size());
+
+    std::vector<Lab> queries;
+    for (int i = 0; i < 2000; ++i)
+        queries.push_back(linear_srgb_to_oklab(argb32_to_linear_srgb(srgb8_tables(), (i * 40503u) ^ (i << 13))));
+
+    auto brute_force = [&](Lab q, int k) {
+        std::vector<float> distances;
+        for (size_t j = 0; j < index.size(); ++j) {
+            Lab c = index.color((uint32_t)j);
+            distances.push_back(sqrtf((c.L - q.L) * (c.L - q.L) + (c.a - q.a) * (c.a - q.a) + (c.b - q.b) * (c.b - q.b)));
+        }
+        std::sort(distances.begin(), distances.end());
+        distances.resize(k);
+        return distances;
+    };
+
+    // Exact nearest and k nearest distances match a brute force search
+    std::vector<uint32_t> nearest(queries.size());
+    index.nearest(queries.data(), nearest.data(), queries.size());
+
+    const int k = 5;
+    std::vector<PaletteMatch> matches(queries.size() * k);
+    index.nearest(queries.data(), k, matches.data(), queries.size());
+
+    float max_diff = 0.f;
+    for (size_t i = 0; i < queries.size(); ++i) {
+        std::vector<float> expected = brute_force(queries[i], k);
+        Lab c = index.color(nearest[i]);
+        float d = sqrtf((c.L - queries[i].L) * (c.L - queries[i].L) + (c.a - queries[i].a) * (c.a - queries[i].a) + (c.b - queries[i].b) * (c.b - queries[i].b));
+        max_diff = std::max(max_diff, std::abs(d - expected[0]));
+        for (int j = 0; j < k; ++j)
+            max_diff = std::max(max_diff, std::abs(matches[i * k + j].distance - expected[j]));
+    }
+    std::cout << "exact nearest and k nearest against brute force: " << max_diff << (max_diff < 1e-6 ? " PASS" : " FAIL") << std::endl;
+
+    // Approximate results are within (1 + epsilon) of the exact distance
+    const float epsilon = 0.5f;
+    bool within = true;
+    for (size_t i = 0; i < queries.size(); ++i) {
+        PaletteMatch match = index.nearest(queries[i], epsilon);
+        within = within && match.distance <= (1.f + epsilon) * brute_force(queries[i], 1)[0] + 1e-6f;
+    }
+    std::cout << "approximate nearest within 1 + epsilon:" << (within ? " PASS" : " FAIL") << std::endl;
+
+    // Palette colors map to themselves (or their duplicate)
+    std::vector<uint32_t> mapped(palette.size());
+    index.map_argb32(palette.data(), mapped.data(), palette.size());
+    bool same = true;
+    for (size_t i = 0; i < palette.size(); ++i)
+        same = same && palette[mapped[i]] == palette[i];
+    std::cout << "palette colors map to themselves:" << (same ? " PASS" : " FAIL") << std::endl;
+
+    // The fast conversion used for 8 bit pixels
+    float max_rel = 0.f;
+    for (float x = 1e-6f; x < 2.f; x *= 1.001f)
+        max_rel = std::max({max_rel, std::abs(cbrt_fast(x) - cbrtf(x)) / cbrtf(x), std::abs(cbrt_fast(-x) + cbrtf(x)) / cbrtf(x)});
+    std::cout << "cbrt_fast relative error: " << max_rel << (max_rel < 1e-6 && cbrt_fast(0.f) == 0.f ? " PASS" : " FAIL") << std::endl;
+
+    // k larger than the palette
+    PaletteIndex small = PaletteIndex::from_argb32(palette.data(), 3);
+    PaletteMatch all[8];
+    int found = small.nearest(queries[0], 8, all);
+    bool sorted = found == 3 && all[0].distance <= all[1].distance && all[1].distance <= all[2].distance;
+    std::cout << "k larger than the palette: " << found << (sorted ? " PASS" : " FAIL") << std::endl;
+
+    // Batch queries on an empty palette
+    PaletteIndex empty;
+    std::vector<uint32_t> none(4, 0), none_mapped(4, 0), none_dithered(4, 0);
+    empty.nearest(queries.data(), none.data(), none.size());
+    empty.map_argb32(palette.data(), none_mapped.data(), none_mapped.size());
+    dither_argb32(empty, palette.data(), 2, none_dithered.data(), 2, 2, 2);
+    bool unmatched = true;
+    for (size_t i = 0; i < none.size(); ++i)
+        unmatched = unmatched && none[i] == UINT32_MAX && none_mapped[i] == UINT32_MAX && none_dithered[i] == UINT32_MAX;
+    std::cout << "empty palette batches:" << (unmatched ? " PASS" : " FAIL") << std::endl;
+}
+
+// ------------------------ Dithering test cases ------------------------ //
+
+void dither_test_cases() {
+    std::cout << "\nRunning dither tests:" << std::endl;
+    std::cout << std::fixed << std::setprecision(9);
+
+    uint32_t black_white[2] = { 0xff000000, 0xffffffff };
+    PaletteIndex index = PaletteIndex::from_argb32(black_white, 2);
+
+    // A flat gray dithers to black and white in proportion to its OkLab lightness
+    const int width = 64, height = 64;
+    uint32_t gray = 0xff777777;
+    float L = linear_srgb_to_oklab(argb32_to_linear_srgb(srgb8_tables(), gray)).L;
+
+    std::vector<uint32_t> image(width * height, gray);
+    std::vector<uint32_t> out(width * height);
+
+    const char* names[] = { "floyd_steinberg", "sierra_lite", "ordered", "blue_noise" };
+    Dither methods[] = { Dither::floyd_steinberg, Dither::sierra_lite, Dither::ordered, Dither::blue_noise };
+    for (int m = 0; m < 4; ++m) {
+        DitherOptions options;
+        options.method = methods[m];
+        dither_argb32(index, image.data(), width, out.data(), width, width, height, options);
+
+        float white = 0.f;
+        for (uint32_t i : out)
+            white += i;
+        white /= width * height;
+
+        float diff = std::abs(white - L);
+        std::cout << names[m] << " white fraction " << white << " for L " << L << (diff < 0.02f ? " PASS" : " FAIL") << std::endl;
+    }
+
+    // Colors in the palette come out unchanged, without any error to diffuse
+    std::vector<uint32_t> palette = { 0xff000000, 0xffffffff, 0xffff0000, 0xff00ff00, 0xff0000ff, 0xff808080 };
+    PaletteIndex colors = PaletteIndex::from_argb32(palette.data(), palette.size());
+    for (int i = 0; i < width * height; ++i)
+        image[i] = palette[(i * 7 + i / width) % palette.size()];
+
+    dither_argb32(colors, image.data(), width, out.data(), width, width, height);
+    bool same = true;
+    for (int i = 0; i < width * height; ++i)
+        same = same && palette[out[i]] == image[i];
+    std::cout << "palette colors unchanged:" << (same ? " PASS" : " FAIL") << std::endl;
+
+    // The blue noise tile holds every rank once
+    std::vector<int> seen(64 * 64, 0);
+    for (int i = 0; i < 64 * 64; ++i)
+        seen[blue_noise_tile()[i]]++;
+    bool permutation = std::all_of(seen.begin(), seen.end(), [](int n) { return n == 1; });
+    std::cout << "blue noise ranks:" << (permutation ? " PASS" : " FAIL") << std::endl;
+}
+
+// ------------------------ Palette extraction test cases ------------------------ //
+
+void palette_extraction_test_cases() {
+    std::cout << "\nRunning palette extraction tests:" << std::endl;
+    std::cout << std::fixed << std::setprecision(9);
+
+    // Four flat colors covering 40%, 30%, 20% and 10% of the image
+    uint32_t colors[4] = { 0xff2050c0, 0xffe0e0d0, 0xffc03020, 0xff30a040 };
+    float shares[4] = { 0.4f, 0.3f, 0.2f, 0.1f };
+
+    std::vector<uint32_t> image;
+    for (int c = 0; c < 4; ++c)
+        image.insert(image.end(), (size_t)(shares[c] * 100000), colors[c]);
+
+    PaletteExtraction options;
+    options.colors = 4;
+    options.share_samples = 0;
+    std::vector<PaletteColor> palette = extract_palette_argb32(image.data(), image.size(), options);
+
+    bool found = palette.size() == 4;
+    for (size_t c = 0; found && c < 4; ++c) {
+        Lch expected = oklab_to_lch(linear_srgb_to_oklab(argb32_to_linear_srgb(srgb8_tables(), colors[c])));
+        Lch actual = palette[c].lch;
+        float diff = std::max({std::abs(actual.l - expected.l), std::abs(actual.c - expected.c), std::abs(actual.h - expected.h)});
+
+        std::cout << "share " << palette[c].share << " L " << actual.l << " C " << actual.c << " h " << actual.h;
+        bool pass = diff < 1e-3f && std::abs(palette[c].share - shares[c]) < 1e-4f;
+        std::cout << (pass ? " PASS" : " FAIL") << std::endl;
+        found = found && pass;
+    }
+    if (palette.size() != 4)
+        std::cout << "found " << palette.size() << " colors FAIL" << std::endl;
+
+    // Out of gamut cluster centers are snapped into sRGB when asked to
+    std::vector<Lab> wide = { { 0.6f, 0.35f, 0.1f }, { 0.5f, -0.3f, -0.2f } };
+    options.colors = 2;
+    options.clip = GamutClip::preserve_chroma;
+    palette = extract_palette(wide.data(), wide.size(), options);
+
+    bool in_gamut = palette.size() == 2;
+    for (const PaletteColor& color : palette) {
+        RGB rgb = ok_color::oklab_to_linear_srgb(lch_to_oklab(color.lch));
+        in_gamut = in_gamut && std::min({rgb.r, rgb.g, rgb.b}) > -1e-4f && std::max({rgb.r, rgb.g, rgb.b}) < 1 + 1e-4f;
+    }
+    std::cout << "snapped into gamut:" << (in_gamut ? " PASS" : " FAIL") << std::endl;
+
+    // Same palette whatever the thread count
+    std::vector<uint32_t> noise(50000);
+    for (size_t i = 0; i < noise.size(); ++i)
+        noise[i] = 0xff000000 | (uint32_t)((i * 2654435761u) & 0x00ffffff);
+    PaletteExtraction threaded;
+    threaded.colors = 8;
+    threaded.max_iterations = 10;
+    threaded.threads = 1;
+    std::vector<PaletteColor> one = extract_palette_argb32(noise.data(), noise.size(), threaded);
+    threaded.threads = 3;
+    std::vector<PaletteColor> three = extract_palette_argb32(noise.data(), noise.size(), threaded);
+    bool deterministic = one.size() == three.size() && !one.empty();
+    for (size_t c = 0; deterministic && c < one.size(); ++c)
+        deterministic = memcmp(&one[c], &three[c], sizeof(PaletteColor)) == 0;
+    std::cout << "same palette on 1 and 3 threads:" << (deterministic ? " PASS" : " FAIL") << std::endl;
+}
+
+// ------------------------ Histogram test cases ------------------------ //
+
+void histogram_test_cases() {
+    std::cout << "\nRunning histogram tests:" << std::endl;
+    std::cout << std::fixed << std::setprecision(9);
+
+    const int width = 300, height = 200;
+    std::vector<uint32_t> image(width * height);
+    for (int i = 0; i < width * height; ++i)
+        image[i] = 0xff000000 | ((i * 2654435761u) >> 8);
+
+    // Reference statistics, one pixel at a time
+    std::vector<Lab> lab(image.size());
+    double L = 0, a = 0, b = 0, C = 0, L2 = 0, C2 = 0, a2 = 0, b2 = 0;
+    for (size_t i = 0; i < image.size(); ++i) {
+        lab[i] = linear_srgb_to_oklab(argb32_to_linear_srgb(srgb8_tables(), image[i]));
+        Lch lch = oklab_to_lch(lab[i]);
+        L += lab[i].L; a += lab[i].a; b += lab[i].b; C += lch.c;
+        L2 += lab[i].L * lab[i].L; C2 += lch.c * lch.c; a2 += lab[i].a * lab[i].a; b2 += lab[i].b * lab[i].b;
+    }
+    double n = (double)image.size();
+    L /= n; a /= n; b /= n; C /= n;
+    double a_var = a2 / n - a * a, b_var = b2 / n - b * b;
+    float colorfulness = (float)(sqrt(a_var + b_var) + 0.3 * sqrt(a * a + b * b));
+
+    std::vector<float> sorted_L;
+    for (const Lab& c : lab)
+        sorted_L.push_back(c.L);
+    std::sort(sorted_L.begin(), sorted_L.end());
+
+    // Whole image across threads, and the same image fed as two separately accumulated halves
+    HistogramConfig config;
+    ColorHistogram whole(config);
+    accumulate_argb32(whole, image.data(), width, height, width);
+
+    ColorHistogram top(config), bottom(config);
+    top.add_argb32(image.data(), width * height / 2);
+    bottom.add(lab.data() + width * height / 2, width * height / 2);
+    bool merge_ok = top.merge(bottom);
+
+    ColorStatistics stats = whole.statistics();
+    float max_diff = std::max({
+        std::abs(stats.mean.L - (float)L), std::abs(stats.mean.a - (float)a), std::abs(stats.mean.b - (float)b),
+        std::abs(stats.C_mean - (float)C), std::abs(stats.L_std - (float)sqrt(L2 / n - L * L)),
+        std::abs(stats.C_std - (float)sqrt(C2 / n - C * C)), std::abs(stats.colorfulness - colorfulness),
+        std::abs(stats.hue_mean - (float)atan2(b, a))});
+    std::cout << "statistics against per pixel conversion: " << max_diff << (max_diff < 1e-5 ? " PASS" : " FAIL") << std::endl;
+
+    float median_diff = std::abs(stats.L_median - sorted_L[sorted_L.size() / 2]);
+    std::cout << "L median: " << stats.L_median << (median_diff < 1.f / config.L_bins ? " PASS" : " FAIL") << std::endl;
+
+    uint64_t binned = 0;
+    for (uint64_t count : whole.bins())
+        binned += count;
+    bool merged = top.bins() == whole.bins() && top.L_histogram() == whole.L_histogram() && top.count() == whole.count();
+    std::cout << "bins hold every pixel: " << binned << (binned == image.size() ? " PASS" : " FAIL") << std::endl;
+    std::cout << "merged halves match the whole image:" << (merged ? " PASS" : " FAIL") << std::endl;
+
+    // Histograms with other bins are refused
+    HistogramConfig coarse;
+    coarse.bins[2] = 16;
+    ColorHistogram other(coarse);
+    other.add(lab.data(), 10);
+    bool refused = merge_ok && !top.merge(other) && top.count() == whole.count() && top.bins() == whole.bins();
+    std::cout << "merge refuses other configs:" << (refused ? " PASS" : " FAIL") << std::endl;
+
+    // A single hue is fully concentrated, in the right (h, C) bin
+    HistogramConfig hue_config;
+    hue_config.space = HistogramSpace::hue_chroma;
+    hue_config.bins[0] = 36;
+    hue_config.bins[1] = 8;
+    ColorHistogram hues(hue_config);
+    Lch red = { 0.6f, 0.2f, 0.5f };
+    for (int i = 0; i < 10; ++i)
+        hues.add(lch_to_oklab(red));
+
+    size_t expected_bin = (size_t)((red.h + pi) / (2 * pi) * 36) * 8 + (size_t)(red.c / 0.4f * 8);
+    ColorStatistics hue_stats = hues.statistics();
+    bool pass = hues.bins()[expected_bin] == 10 && std::abs(hue_stats.hue_mean - red.h) < 1e-5f && std::abs(hue_stats.hue_concentration - 1.f) < 1e-5f;
+    std::cout << "single hue: " << hue_stats.hue_mean << " " << hue_stats.hue_concentration << (pass ? " PASS" : " FAIL") << std::endl;
+}
+
+// ------------------------ Distance test cases ------------------------ //
+
+void distance_test_cases() {
+    std::cout << "\nRunning distance tests:" << std::endl;
+    std::cout << std::fixed << std::setprecision(9);
+
+    std::vector<uint32_t> argb_x, argb_y;
+    std::vector<Lab> x, y;
+    for (int i = 0; i < 3000; ++i) {
+        argb_x.push_back(0xff000000 | ((i * 2654435761u) >> 8));
+        argb_y.push_back(0xff000000 | ((i * 40503u + 12345u) & 0xffffff));
+    }
+    argb_x[10] = argb_x[20]; // exact duplicate
+    for (int i = 0; i < 3000; ++i) {
+        x.push_back(linear_srgb_to_oklab(argb32_to_linear_srgb(srgb8_tables(), argb_x[i])));
+        y.push_back(linear_srgb_to_oklab(argb32_to_linear_srgb(srgb8_tables(), argb_y[i])));
+    }
+
+    // Element wise, from OkLab and from 8 bit colors
+    std::vector<float> d(x.size()), d8(x.size());
+    delta_e(x.data(), y.data(), d.data(), x.size());
+    delta_e_argb32(argb_x.data(), argb_y.data(), d8.data(), x.size());
+    float max_diff = 0.f;
+    for (size_t i = 0; i < x.size(); ++i) {
+        float expected = sqrtf((x[i].L - y[i].L) * (x[i].L - y[i].L) + (x[i].a - y[i].a) * (x[i].a - y[i].a) + (x[i].b - y[i].b) * (x[i].b - y[i].b));
+        max_diff = std::max({max_diff, std::abs(d[i] - expected), std::abs(d8[i] - expected)});
+    }
+    std::cout << "element wise delta E: " << max_diff << (max_diff < 1e-5 ? " PASS" : " FAIL") << std::endl;
+
+    // Matrix against element wise
+    const size_t rows = 300, cols = 700;
+    std::vector<float> matrix(rows * cols);
+    distance_matrix(x.data(), rows, y.data(), cols, matrix.data());
+    max_diff = 0.f;
+    for (size_t i = 0; i < rows; ++i)
+        for (size_t j = 0; j < cols; ++j)
+            max_diff = std::max(max_diff, std::abs(matrix[i * cols + j] - delta_e(x[i], y[j])));
+    std::cout << "distance matrix: " << max_diff << (max_diff < 1e-6 ? " PASS" : " FAIL") << std::endl;
+
+    // Close pairs against a brute force search, within a set and across two sets
+    for (float epsilon : { 0.f, 0.01f, 0.05f }) {
+        std::vector<ColorPair> within = close_pairs(x.data(), x.size(), epsilon);
+        std::vector<ColorPair> across = close_pairs(x.data(), x.size(), y.data(), y.size(), epsilon);
+
+        std::vector<std::pair<uint32_t, uint32_t>> expected_within, expected_across, found_within, found_across;
+        for (uint32_t i = 0; i < x.size(); ++i) {
+            for (uint32_t j = 0; j < x.size(); ++j) {
+                if (i < j && delta_e(x[i], x[j]) <= epsilon)
+                    expected_within.push_back({i, j});
+                if (delta_e(x[i], y[j]) <= epsilon)
+                    expected_across.push_back({i, j});
+            }
+        }
+        for (const ColorPair& p : within)
+            found_within.push_back({p.i, p.j});
+        for (const ColorPair& p : across)
+            found_across.push_back({p.i, p.j});
+
+        bool pass = found_within == expected_within && found_across == expected_across;
+        std::cout << "close pairs within " << epsilon << ": " << within.size() << " and " << across.size() << (pass ? " PASS" : " FAIL") << std::endl;
+    }
+}
+
+// ------------------------ Image diff test cases ------------------------ //
+
+void image_diff_test_cases() {
+    std::cout << "\nRunning image diff tests:" << std::endl;
+    std::cout << std::fixed << std::setprecision(9);
+
+    // Two 4 channel images, the second with a few changed pixels
+    const int width = 97, height = 61;
+    std::vector<uint8_t> x(width * height * 4), y;
+    for (size_t i = 0; i < x.size(); ++i)
+        x[i] = (uint8_t)(i * 37 + i / 300);
+    y = x;
+
+    int changed[][2] = { {5, 3}, {96, 60}, {40, 30} };
+    for (auto& p : changed)
+        y[(p[1] * width + p[0]) * 4 + 1] ^= 0x80;
+    y[(10 * width + 10) * 4 + 3] ^= 0xff; // alpha only, ignored
+
+    auto lab_at = [&](const std::vector<uint8_t>& image, int px, int py) {
+        const uint8_t* p = &image[(py * width + px) * 4];
+        return linear_srgb_to_oklab(argb32_to_linear_srgb(srgb8_tables(), 0xff000000 | p[0] << 16 | p[1] << 8 | p[2]));
+    };
+
+    ImageView8 vx = { x.data(), width, height, 4, (size_t)width * 4 };
+    ImageView8 vy = { y.data(), width, height, 4, (size_t)width * 4 };
+
+    const char* names[] = { "delta_e", "lightness", "chroma" };
+    DiffComponent components[] = { DiffComponent::delta_e, DiffComponent::lightness, DiffComponent::chroma };
+    for (int c = 0; c < 3; ++c) {
+        DiffOptions options;
+        options.component = components[c];
+        options.threshold = 0.f;
+        options.tile_rows = 7;
+
+        std::vector<uint8_t> heatmap(width * height * 3);
+        DiffSummary summary = diff_images(vx, vy, options, heatmap.data(), width * 3);
+
+        float max = 0.f;
+        double sum = 0.0;
+        for (auto& p : changed) {
+            float d = pixel_difference(lab_at(x, p[0], p[1]), lab_at(y, p[0], p[1]), components[c]);
+            max = std::max(max, d);
+            sum += d;
+        }
+
+        uint8_t* unchanged = &heatmap[(1 * width + 1) * 3];
+        bool heat = unchanged[0] == unchanged[1] && unchanged[1] == unchanged[2];
+        bool pass = std::abs(summary.max - max) < 1e-5f && std::abs(summary.mean - (float)(sum / (width * height))) < 1e-7f
+            && summary.above_threshold == 3 && summary.p99 == 0.f && summary.pixels == (uint64_t)width * height && heat;
+        std::cout << names[c] << " max " << summary.max << " at (" << summary.max_x << ", " << summary.max_y << ")"
+                  << (pass ? " PASS" : " FAIL") << std::endl;
+    }
+
+    // PPM and PAM headers written by pnm_header parse back
+    bool parsed = true;
+    for (int channels : { 3, 4 }) {
+        std::string header = pnm_header(width, height, channels);
+        std::vector<uint8_t> file(header.begin(), header.end());
+        file.resize(file.size() + width * height * channels);
+
+        PnmHeader parsed_header;
+        parsed = parsed && parse_pnm_header(file.data(), file.size(), parsed_header)
+            && parsed_header.width == width && parsed_header.height == height
+            && parsed_header.channels == channels && parsed_header.data_offset == header.size();
+        parsed = parsed && !parse_pnm_header(file.data(), file.size() - 1, parsed_header);
+
+        // 16 bit samples parse as images, not as 8 bit PNM
+        header = pnm_header(width, height, channels, 65535);
+        file.assign(header.begin(), header.end());
+        file.resize(file.size() + width * height * channels * 2);
+        parsed = parsed && parse_image_header(file.data(), file.size(), parsed_header)
+            && parsed_header.sample == PnmSample::u16 && parsed_header.maxval == 65535
+            && parsed_header.row_offset(1) == header.size() + width * channels * 2;
+        parsed = parsed && !parse_pnm_header(file.data(), file.size(), parsed_header);
+    }
+
+    // PFM rows are stored bottom up
+    {
+        std::string header = pfm_header(width, height);
+        std::vector<uint8_t> file(header.begin(), header.end());
+        file.resize(file.size() + width * height * 12);
+
+        PnmHeader parsed_header;
+        parsed = parsed && parse_image_header(file.data(), file.size(), parsed_header)
+            && parsed_header.sample == PnmSample::f32 && parsed_header.channels == 3
+            && parsed_header.big_endian != host_is_little_endian()
+            && parsed_header.row_offset(0) == header.size() + (size_t)(height - 1) * width * 12
+            && parsed_header.row_offset(height - 1) == header.size();
+        parsed = parsed && !parse_image_header(file.data(), file.size() - 1, parsed_header);
+    }
+    std::cout << "PNM headers:" << (parsed ? " PASS" : " FAIL") << std::endl;
+}
+
+// ------------------------ Image conversion test cases ------------------------ //
+
+void image_convert_test_cases() {
+    std::cout << "\nRunning image convert tests:" << std::endl;
+
+    auto write_file = [](const char* path, const std::string& header, const std::vector<uint8_t>& data) {
+        FILE* f = fopen(path, "wb");
+        if (!f)
+            return false;
+        bool ok = fwrite(header.data(), 1, header.size(), f) == header.size() && fwrite(data.data(), 1, data.size(), f) == data.size();
+        return fclose(f) == 0 && ok;
+    };
+    auto read_file = [](const char* path) {
+        std::vector<uint8_t> data;
+        if (FILE* f = fopen(path, "rb")) {
+            uint8_t buffer[4096];
+            size_t n;
+            while ((n = fread(buffer, 1, sizeof(buffer), f)) > 0)
+                data.insert(data.end(), buffer, buffer + n);
+            fclose(f);
+        }
+        return data;
+    };
+
+    // 8 bit PPM through each Ok space and back, one row per band so every band release runs
+    const int width = 61, height = 37;
+    std::vector<uint8_t> pixels(width * height * 3);
+    for (size_t i = 0; i < pixels.size(); ++i)
+        pixels[i] = (uint8_t)(i * 97 + i / 7);
+    if (!write_file("oklab_convert_test_in.ppm", pnm_header(width, height, 3), pixels))
+        std::cout << "can't write oklab_convert_test_in.ppm FAIL" << std::endl;
+    std::vector<uint8_t> original = read_file("oklab_convert_test_in.ppm");
+
+    const char* names[] = { "oklab", "oklch", "okhsv", "okhsl" };
+    ImageSpace spaces[] = { ImageSpace::oklab, ImageSpace::oklch, ImageSpace::okhsv, ImageSpace::okhsl };
+    for (int s = 0; s < 4; ++s) {
+        ImageConversion options;
+        options.to = spaces[s];
+        options.band_mb = 1e-4;
+        options.threads = 3;
+        ImageConvertResult there = convert_image("oklab_convert_test_in.ppm", "oklab_convert_test.pfm", options);
+
+        options.from = spaces[s];
+        options.to = ImageSpace::srgb;
+        ImageConvertResult back = convert_image("oklab_convert_test.pfm", "oklab_convert_test_out.ppm", options);
+
+        bool pass = there.status == ImageConvertStatus::ok && back.status == ImageConvertStatus::ok
+            && there.out.sample == PnmSample::f32 && back.out.sample == PnmSample::u8
+            && read_file("oklab_convert_test_out.ppm") == original;
+        std::cout << "ppm -> " << names[s] << " -> ppm:" << (pass ? " PASS" : " FAIL") << std::endl;
+    }
+
+    // Out of gamut OkLab clipped into linear sRGB
+    {
+        std::vector<uint8_t> lab(width * height * 12);
+        for (int i = 0; i < width * height; ++i) {
+            float h = i * 0.37f;
+            float values[3] = { 0.05f + 0.9f * (i % 11) / 10.f, 0.4f * cosf(h), 0.4f * sinf(h) };
+            memcpy(&lab[i * 12], values, 12);
+        }
+        write_file("oklab_convert_test.pfm", pfm_header(width, height), lab);
+
+        ImageConversion options;
+        options.from = ImageSpace::oklab;
+        options.to = ImageSpace::srgb;
+        options.band_mb = 1e-4;
+
+        // Values outside [0, 1], within the accuracy of the clipping, with and without clipping
+        auto outside = [&](GamutClip clip) {
+            options.clip = clip;
+            ImageConvertResult result = convert_image("oklab_convert_test.pfm", "oklab_convert_test_out.pfm", options);
+            std::vector<uint8_t> rgb = read_file("oklab_convert_test_out.pfm");
+            PnmHeader header;
+            if (result.status != ImageConvertStatus::ok || !parse_image_header(rgb.data(), rgb.size(), header)
+                || header.width != width || header.height != height)
+                return -1;
+            int count = 0;
+            for (int y = 0; y < height; ++y) {
+                for (int x = 0; x < width * 3; ++x) {
+                    float v;
+                    memcpy(&v, &rgb[header.row_offset(y) + 4 * x], 4);
+                    count += v < -1e-3f || v > 1.f + 1e-3f;
+                }
+            }
+            return count;
+        };
+        int clipped = outside(GamutClip::preserve_chroma), unclipped = outside(GamutClip::none);
+        std::cout << "clipped into gamut: " << clipped << " of " << unclipped << " outside"
+                  << (clipped == 0 && unclipped > 0 ? " PASS" : " FAIL") << std::endl;
+    }
+
+    // The output path has to match the format written
+    {
+        ImageConversion options;
+        bool pass = convert_image("oklab_convert_test_in.ppm", "oklab_convert_test_out.ppm", options).status == ImageConvertStatus::output_extension;
+        options.to = ImageSpace::srgb;
+        options.depth = 32;
+        pass = pass && convert_image("oklab_convert_test_in.ppm", "oklab_convert_test_out.pam", options).status == ImageConvertStatus::output_extension;
+        options.depth = 8;
+        pass = pass && convert_image("oklab_convert_test_in.ppm", "oklab_convert_test_out.pfm", options).status == ImageConvertStatus::output_extension;
+        options.from = ImageSpace::oklab;
+        pass = pass && convert_image("oklab_convert_test_in.ppm", "oklab_convert_test_out.ppm", options).status == ImageConvertStatus::input_not_pfm;
+        std::cout << "output extension checked:" << (pass ? " PASS" : " FAIL") << std::endl;
+    }
+
+    for (const char* path : { "oklab_convert_test_in.ppm", "oklab_convert_test.pfm", "oklab_convert_test_out.ppm", "oklab_convert_test_out.pfm" })
+        std::remove(path);
+}
+
+// ------------------------ Distinct palette test cases ------------------------ //
+
+void distinct_palette_test_cases() {
+    std::cout << "\nRunning distinct palette tests:" << std::endl;
+    std::cout << std::fixed << std::setprecision(9);
+
+    Lab background = { 1.f, 0.f, 0.f };
+
+    for (int colors : { 2, 12, 40 }) {
+        DistinctPaletteOptions options;
+        options.colors = colors;
+        options.L_min = 0.5f;
+        options.L_max = 0.85f;
+        options.C_max = 0.25f;
+        options.fixed = &background;
+        options.fixed_count = 1;
+        options.threads = 1;
+
+        DistinctPalette palette = distinct_palette(options);
+
+        // Smallest distance is reported correctly, including the distance to the background
+        float min_distance = INFINITY;
+        bool inside = (int)palette.colors.size() == colors;
+        for (size_t i = 0; i < palette.colors.size(); i++) {
+            const Lab& c = palette.colors[i];
+            min_distance = std::min(min_distance, delta_e(c, background));
+            for (size_t j = i + 1; j < palette.colors.size(); j++)
+                min_distance = std::min(min_distance, delta_e(c, palette.colors[j]));
+
+            RGB rgb = oklab_to_linear_srgb(c);
+            float C = sqrtf(c.a * c.a + c.b * c.b);
+            inside = inside && c.L >= 0.5f && c.L <= 0.85f && C <= 0.25f + 1e-6f
+                && std::min({ rgb.r, rgb.g, rgb.b }) >= -1e-4f && std::max({ rgb.r, rgb.g, rgb.b }) <= 1.f + 1e-4f;
+        }
+
+        // Refinement improves on the seeding, threads don't change the result
+        DistinctPaletteOptions seeded = options;
+        seeded.iterations = 0;
+        float seeded_distance = distinct_palette(seeded).min_distance;
+
+        DistinctPaletteOptions threaded = options;
+        threaded.threads = 4;
+        DistinctPalette other = distinct_palette(threaded);
+        bool same = other.colors.size() == palette.colors.size() && other.min_distance == palette.min_distance;
+        for (size_t i = 0; same && i < palette.colors.size(); i++)
+            same = other.colors[i].L == palette.colors[i].L && other.colors[i].a == palette.colors[i].a;
+
+        bool pass = inside && same && std::abs(min_distance - palette.min_distance) < 1e-6f
+            && palette.min_distance >= seeded_distance;
+        std::cout << colors << " colors, min distance " << palette.min_distance << " (seeded " << seeded_distance << ")"
+                  << (pass ? " PASS" : " FAIL") << std::endl;
+    }
+}
+
+// ------------------------ Tonal palette test cases ------------------------ //
+
+void tonal_palette_test_cases() {
+    std::cout << "\nRunning tonal palette tests:" << std::endl;
+    std::cout << std::fixed << std::setprecision(9);
+
+    std::vector<Lch> seeds = { { 0.6f, 0.1f, 0.5f }, { 0.3f, 0.3f, 4.f }, { 0.9f, 0.05f, -1.f } };
+
+    // Without gamut mapping the harmonies and shades match the OkLch methods
+    struct Named { const char* name; PaletteSpec spec; };
+    Named specs[] = {
+        { "triadic", triadic_spec() },
+        { "analogous", analogous_spec(2, 30.f) },
+        { "shades", shades_spec(5) },
+        { "tints", tints_spec(4) },
+    };
+    for (const Named& named : specs) {
+        size_t n = seeds.size() * named.spec.size();
+        std::vector<float> l(n), c(n), h(n);
+        PaletteOutput out;
+        out.l = l.data();
+        out.c = c.data();
+        out.h = h.data();
+        generate_palettes(seeds.data(), seeds.size(), named.spec, out, false, 1);
+
+        float max_error = 0.f;
+        for (size_t i = 0; i < seeds.size(); i++) {
+            for (size_t j = 0; j < named.spec.size(); j++) {
+                const PaletteEntry& e = named.spec[j];
+                float L = seeds[i].l + e.lightness_mix * (e.lightness_target - seeds[i].l);
+                float hue = fmodf(seeds[i].h + e.hue_degrees * pi / 180.f + 4.f * pi, 2.f * pi);
+                size_t k = i * named.spec.size() + j;
+                max_error = std::max({ max_error, std::abs(l[k] - L), std::abs(c[k] - seeds[i].c), std::abs(h[k] - hue) });
+            }
+        }
+        std::cout << named.name << " max error " << max_error << (max_error < 1e-5f ? " PASS" : " FAIL") << std::endl;
+    }
+
+    // Tonal scales: gamut mapped colors keep L and h and are in sRGB, chroma is only reduced when needed
+    std::vector<PaletteEntry> roles(3);
+    roles[1].chroma_scale = 0.3f;
+    roles[2].hue_degrees = 60.f;
+    roles[2].chroma_max = 0.02f;
+    PaletteSpec spec = tonal_spec({ 0.f, 0.1f, 0.3f, 0.5f, 0.7f, 0.9f, 0.99f, 1.f }, roles);
+
+    size_t n = seeds.size() * spec.size();
+    std::vector<float> l(n), c(n), h(n);
+    std::vector<uint32_t> argb(n);
+    PaletteOutput out = { l.data(), c.data(), h.data(), argb.data() };
+    generate_palettes(seeds.data(), seeds.size(), spec, out, true, 2);
+
+    bool pass = true;
+    for (size_t i = 0; i < seeds.size(); i++) {
+        for (size_t j = 0; j < spec.size(); j++) {
+            size_t k = i * spec.size() + j;
+            float requested = std::min(seeds[i].c * spec[j].chroma_scale, spec[j].chroma_max);
+            RGB rgb = oklab_to_linear_srgb(lch_to_oklab({ l[k], c[k], h[k] }));
+            bool in_gamut = std::min({ rgb.r, rgb.g, rgb.b }) >= -1e-3f && std::max({ rgb.r, rgb.g, rgb.b }) <= 1.f + 1e-3f;
+
+            // Reduced chroma sits on the boundary: a bit more would leave sRGB
+            RGB beyond = oklab_to_linear_srgb(lch_to_oklab({ l[k], c[k] + 0.01f, h[k] }));
+            bool on_boundary = c[k] == requested || l[k] == 0.f || l[k] == 1.f
+                || std::min({ beyond.r, beyond.g, beyond.b }) < 0.f || std::max({ beyond.r, beyond.g, beyond.b }) > 1.f;
+
+            pass = pass && in_gamut && on_boundary && c[k] <= requested && l[k] == spec[j].lightness_target
+                && argb[k] == linear_srgb_to_argb32(srgb8_tables(), rgb);
+        }
+    }
+    std::cout << "gamut mapped tonal scales:" << (pass ? " PASS" : " FAIL") << std::endl;
+}
+
+// ------------------------ Contrast solver test cases ------------------------ //
+
+void contrast_solver_test_cases() {
+    std::cout << "\nRunning contrast solver tests:" << std::endl;
+    std::cout << std::fixed << std::setprecision(9);
+
+    // Gray text on white at the WCAG AA ratio is about #767676
+    {
+        Lch seed = { 0.5f, 0.f, 0.f };
+        uint32_t white = 0xffffffff;
+        float target = 4.5f;
+        Lch out;
+        float achieved;
+        ContrastOptions options;
+        options.polarity = ContrastPolarity::darker;
+        size_t reached = solve_contrast(&seed, &white, &target, 1, &out, &achieved, options);
+
+        RGB rgb = oklch_to_srgb(out);
+        bool pass = reached == 1 && achieved >= 4.5f && achieved < 4.5f * 1.0001f && std::abs(rgb.r * 255.f - 118.f) < 1.f;
+        std::cout << "WCAG 4.5 gray on white " << rgb.r * 255.f << (pass ? " PASS" : " FAIL") << std::endl;
+    }
+
+    // APCA Lc 75 light text on black, checked with the exact APCA formulas
+    {
+        Lch seed = { 0.5f, 0.1f, 2.f };
+        uint32_t black = 0xff000000;
+        float target = 75.f;
+        Lch out;
+        float achieved;
+        ContrastOptions options;
+        options.metric = ContrastMetric::apca;
+        size_t reached = solve_contrast(&seed, &black, &target, 1, &out, &achieved, options);
+
+        RGB srgb = oklch_to_srgb(out);
+        auto channel = [](float x) { return powf(clamp(x, 0.f, 1.f), 2.4f); };
+        float Y_text = apca_clamp(0.2126729f * channel(srgb.r) + 0.7151522f * channel(srgb.g) + 0.0721750f * channel(srgb.b));
+        float Lc = apca_contrast(Y_text, apca_clamp(0.f));
+
+        bool pass = reached == 1 && out.l > 0.5f && std::abs(out.h - 2.f) < 1e-6f && std::abs(Lc + 75.f) < 0.01f;
+        std::cout << "APCA 75 on black, Lc " << Lc << (pass ? " PASS" : " FAIL") << std::endl;
+    }
+
+    // Random triples: reached targets are met just barely, missed ones can't be reached along the hue
+    for (ContrastMetric metric : { ContrastMetric::wcag, ContrastMetric::apca }) {
+        const size_t n = 2000;
+        std::vector<Lch> seeds(n), out(n);
+        std::vector<uint32_t> backgrounds(n);
+        std::vector<float> targets(n), achieved(n);
+        for (size_t i = 0; i < n; i++) {
+            uint32_t x = (uint32_t)(i * 2654435761u);
+            seeds[i] = { 0.2f + 0.6f * (x & 1023) / 1023.f, 0.3f * ((x >> 10) & 1023) / 1023.f, 2.f * pi * (x >> 20) / 4096.f };
+            backgrounds[i] = 0xff000000 | (x * 7919u & 0xffffff);
+            targets[i] = metric == ContrastMetric::wcag ? 3.f + (i % 3) * 1.5f : 30.f + (i % 4) * 15.f;
+        }
+
+        ContrastOptions options;
+        options.metric = metric;
+        size_t reached = solve_contrast(seeds.data(), backgrounds.data(), targets.data(), n, out.data(), achieved.data(), options);
+
+        size_t met = 0;
+        bool pass = true;
+        for (size_t i = 0; i < n; i++) {
+            HueBoundary boundary(seeds[i].h);
+            float Y_background = contrast_luminance(backgrounds[i], metric);
+
+            if (achieved[i] >= targets[i] * (1.f - 1e-5f)) {
+                met++;
+                pass = pass && achieved[i] < targets[i] * 1.001f && out[i].c <= seeds[i].c;
+                continue;
+            }
+
+            for (int k = 0; k <= 200; k++) {
+                float Y = path_luminance(boundary, seeds[i].c, k / 200.f, metric, apca_tables());
+                pass = pass && contrast(Y, Y_background, metric) < targets[i];
+            }
+        }
+        pass = pass && met == reached;
+        std::cout << (metric == ContrastMetric::wcag ? "WCAG" : "APCA") << " batch, " << reached << " of " << n << " reached"
+                  << (pass ? " PASS" : " FAIL") << std::endl;
+    }
+}
+
+// ------------------------ Jacobian test cases ------------------------ //
+
+void jacobian_test_cases() {
+    std::cout << "\nRunning jacobian tests:" << std::endl;
+    std::cout << std::fixed << std::setprecision(9);
+
+    // Points well inside the gamut and away from the hue wrap, where the conversions are smooth
+    const int n = 2000;
+    std::vector<HSL> hsl(n);
+    std::vector<Lab> lab(n);
+    for (int i = 0; i < n; i++) {
+        uint32_t x = (uint32_t)(i * 2654435761u);
+        hsl[i] = { 0.05f + 0.9f * (x & 1023) / 1023.f, 0.1f + 0.6f * ((x >> 10) & 1023) / 1023.f, 0.2f + 0.6f * (x >> 22) / 1023.f };
+        lab[i] = okhsl_to_oklab(hsl[i]);
+    }
+
+    // The templates with float agree with the originals
+    {
+        float worst = 0.f;
+        for (int i = 0; i < n; i++) {
+            HSL a = oklab_to_okhsl(lab[i]);
+            generic::HSL<float> b = generic::oklab_to_okhsl(generic::Lab<float>{ lab[i].L, lab[i].a, lab[i].b });
+            Lab c = okhsv_to_oklab({ hsl[i].h, hsl[i].s, hsl[i].l });
+            generic::Lab<float> d = generic::okhsv_to_oklab(generic::HSV<float>{ hsl[i].h, hsl[i].s, hsl[i].l });
+            worst = std::max({ worst, std::abs(a.h - b.h), std::abs(a.s - b.s), std::abs(a.l - b.l),
+                std::abs(c.L - d.L), std::abs(c.a - d.a), std::abs(c.b - d.b) });
+        }
+        bool pass = worst < 1e-5f;
+        std::cout << "Generic float vs original, max difference " << worst << (pass ? " PASS" : " FAIL") << std::endl;
+    }
+
+    // Jacobians against finite differences, relative to the size of the entries. The approximations of the
+    // cusp switch polynomials between hue sectors, so the derivatives jump there: next to a switch,
+    // the difference on the other side of it doesn't apply and the best of the three is kept.
+    auto check = [&](const char* name, auto f, auto point) {
+        float worst = 0.f;
+        for (int i = 0; i < n; i++) {
+            float x[3], y[3];
+            point(i, x);
+            Jacobian J;
+            f(x, &J, y);
+            for (int j = 0; j < 3; j++) {
+                const float h = 1e-4f;
+                float xp[3] = { x[0], x[1], x[2] }, xm[3] = { x[0], x[1], x[2] }, yp[3], ym[3];
+                xp[j] += h;
+                xm[j] -= h;
+                f(xp, nullptr, yp);
+                f(xm, nullptr, ym);
+
+                float central = 0.f, forward = 0.f, backward = 0.f;
+                for (int k = 0; k < 3; k++) {
+                    float scale = 1.f + std::abs(J.m[k][j]);
+                    central = std::max(central, std::abs(J.m[k][j] - (yp[k] - ym[k]) / (2.f * h)) / scale);
+                    forward = std::max(forward, std::abs(J.m[k][j] - (yp[k] - y[k]) / h) / scale);
+                    backward = std::max(backward, std::abs(J.m[k][j] - (y[k] - ym[k]) / h) / scale);
+                }
+                worst = std::max(worst, std::min({ central, forward, backward }));
+            }
+        }
+        bool pass = worst < 1e-2f;
+        std::cout << name << " vs finite differences, max error " << worst << (pass ? " PASS" : " FAIL") << std::endl;
+    };
+
+    auto from_hsl = [&](int i, float* x) { x[0] = hsl[i].h; x[1] = hsl[i].s; x[2] = hsl[i].l; };
+    auto from_lab = [&](int i, float* x) { x[0] = lab[i].L; x[1] = lab[i].a; x[2] = lab[i].b; };
+    auto from_rgb = [&](int i, float* x) { RGB c = oklab_to_linear_srgb(lab[i]); x[0] = c.r; x[1] = c.g; x[2] = c.b; };
+
+    // f(x, J, y): J is filled in when not null
+    check("linear_srgb_to_oklab", [](const float* x, Jacobian* J, float* y) {
+        Jacobian unused;
+        Lab c = linear_srgb_to_oklab(RGB{ x[0], x[1], x[2] }, J ? *J : unused);
+        y[0] = c.L; y[1] = c.a; y[2] = c.b;
+    }, from_rgb);
+    check("oklab_to_linear_srgb", [](const float* x, Jacobian* J, float* y) {
+        Jacobian unused;
+        RGB c = oklab_to_linear_srgb(Lab{ x[0], x[1], x[2] }, J ? *J : unused);
+        y[0] = c.r; y[1] = c.g; y[2] = c.b;
+    }, from_lab);
+    check("okhsl_to_oklab", [](const float* x, Jacobian* J, float* y) {
+        Jacobian unused;
+        Lab c = okhsl_to_oklab(HSL{ x[0], x[1], x[2] }, J ? *J : unused);
+        y[0] = c.L; y[1] = c.a; y[2] = c.b;
+    }, from_hsl);
+    check("oklab_to_okhsl", [](const float* x, Jacobian* J, float* y) {
+        Jacobian unused;
+        HSL c = oklab_to_okhsl(Lab{ x[0], x[1], x[2] }, J ? *J : unused);
+        y[0] = c.h; y[1] = c.s; y[2] = c.l;
+    }, from_lab);
+    check("okhsv_to_oklab", [](const float* x, Jacobian* J, float* y) {
+        Jacobian unused;
+        Lab c = okhsv_to_oklab(HSV{ x[0], x[1], x[2] }, J ? *J : unused);
+        y[0] = c.L; y[1] = c.a; y[2] = c.b;
+    }, from_hsl);
+    check("oklab_to_okhsv", [](const float* x, Jacobian* J, float* y) {
+        Jacobian unused;
+        HSV c = oklab_to_okhsv(Lab{ x[0], x[1], x[2] }, J ? *J : unused);
+        y[0] = c.h; y[1] = c.s; y[2] = c.v;
+    }, from_lab);
+
+    // Chain rule: the Jacobians of a conversion and its inverse multiply to the identity
+    {
+        std::vector<Lab> back(n);
+        std::vector<HSL> forward(n);
+        std::vector<Jacobian> A(n), B(n);
+        oklab_to_okhsl(lab.data(), forward.data(), A.data(), n);
+        okhsl_to_oklab(forward.data(), back.data(), B.data(), n);
+
+        float worst = 0.f;
+        for (int i = 0; i < n; i++) {
+            Jacobian I = B[i] * A[i];
+            for (int r = 0; r < 3; r++)
+                for (int c = 0; c < 3; c++)
+                    worst = std::max(worst, std::abs(I.m[r][c] - (r == c ? 1.f : 0.f)));
+        }
+        bool pass = worst < 1e-3f;
+        std::cout << "okhsl round trip Jacobian vs identity, max error " << worst << (pass ? " PASS" : " FAIL") << std::endl;
+    }
+
+    // Dual<1>: derivative of OkHSL lightness along a direction in OkLab
+    {
+        using D = generic::Dual<1>;
+        Lab p = lab[7];
+        float dL = 0.3f, da = -0.5f, db = 0.8f;
+        D L(p.L), a(p.a), b(p.b);
+        L.d[0] = dL;
+        a.d[0] = da;
+        b.d[0] = db;
+        generic::HSL<D> y = generic::oklab_to_okhsl(generic::Lab<D>{ L, a, b });
+
+        Jacobian J;
+        oklab_to_okhsl(p, J);
+        float expected = J.m[2][0] * dL + J.m[2][1] * da + J.m[2][2] * db;
+        bool pass = std::abs(y.l.d[0] - expected) < 1e-5f;
+        std::cout << "Directional derivative " << y.l.d[0] << (pass ? " PASS" : " FAIL") << std::endl;
+    }
+}
+
+// ------------------------ Wide gamut test cases ------------------------ //
+
+template <class G>
+void wide_gamut_test_cases(const char* name) {
+    auto max_channel = [](RGB c) { return std::max({ c.r, c.g, c.b }); };
+    auto min_channel = [](RGB c) { return std::min({ c.r, c.g, c.b }); };
+
+    // The cusp is the most saturated color of its hue: one channel at 0 and one at 1
+    {
+        float worst = 0.f;
+        for (int i = 0; i < 3600; i++) {
+            float h = 2.f * pi * i / 3600.f;
+            float a = cosf(h), b = sinf(h);
+            LC cusp = find_cusp<G>(a, b);
+            RGB c = oklab_to_linear_rgb<G>({ cusp.L, cusp.C * a, cusp.C * b });
+            worst = std::max({ worst, std::abs(max_channel(c) - 1.f), std::abs(min_channel(c)) });
+        }
+        bool pass = worst < 2e-3f;
+        std::cout << name << " cusp channels, max error " << worst << (pass ? " PASS" : " FAIL") << std::endl;
+    }
+
+    // Clipped colors are inside the gamut and keep their hue
+    {
+        float worst = 0.f;
+        for (int i = 0; i < 2000; i++) {
+            uint32_t x = (uint32_t)(i * 2654435761u);
+            float h = 2.f * pi * (x & 1023) / 1024.f;
+            float C = 0.5f * ((x >> 10) & 1023) / 1023.f;
+            Lab lab = { 0.05f + 0.9f * (x >> 22) / 1023.f, C * cosf(h), C * sinf(h) };
+            RGB c = gamut_clip_oklab<G>(lab, GamutClip::adaptive_L0_0_5);
+            Lab clipped = linear_rgb_to_oklab<G>(c);
+            float hue = std::abs(std::remainder(atan2f(clipped.b, clipped.a) - h, 2.f * pi));
+            worst = std::max({ worst, max_channel(c) - 1.f, -min_channel(c), C > 0.01f ? hue : 0.f });
+        }
+        bool pass = worst < 1e-3f;
+        std::cout << name << " gamut clip, max error " << worst << (pass ? " PASS" : " FAIL") << std::endl;
+    }
+
+    // OkHSL and OkHSV round trips, and s = 1 at the edge of the gamut
+    {
+        float round_trip = 0.f, edge = 0.f;
+        for (int i = 0; i < 2000; i++) {
+            uint32_t x = (uint32_t)(i * 2654435761u);
+            float h = (x & 1023) / 1024.f;
+            float s = ((x >> 10) & 1023) / 1023.f;
+            float l = 0.05f + 0.9f * (x >> 22) / 1023.f;
+
+            HSL hsl = oklab_to_okhsl<G>(okhsl_to_oklab<G>({ h, s, l }));
+            HSV hsv = oklab_to_okhsv<G>(okhsv_to_oklab<G>({ h, s, l }));
+            round_trip = std::max({ round_trip, std::abs(hsl.s - s), std::abs(hsl.l - l), std::abs(hsv.s - s), std::abs(hsv.v - l) });
+
+            RGB c = oklab_to_linear_rgb<G>(okhsl_to_oklab<G>({ h, 1.f, l }));
+            edge = std::max(edge, std::min(std::abs(max_channel(c) - 1.f), std::abs(min_channel(c))));
+            c = oklab_to_linear_rgb<G>(okhsv_to_oklab<G>({ h, 1.f, l }));
+            edge = std::max(edge, std::abs(min_channel(c)));
+        }
+        bool pass = round_trip < 1e-3f && edge < 2e-3f;
+        std::cout << name << " OkHSL and OkHSV, round trip " << round_trip << ", edge " << edge << (pass ? " PASS" : " FAIL") << std::endl;
+    }
+}
+
+void gamut_test_cases() {
+    std::cout << "\nRunning gamut tests:" << std::endl;
+    std::cout << std::fixed << std::setprecision(9);
+
+    // The sRGB instances are the functions of oklab_source.h
+    {
+        bool same = true;
+        for (int i = 0; i < 2000; i++) {
+            uint32_t x = (uint32_t)(i * 2654435761u);
+            float h = (x & 1023) / 1024.f;
+            float s = ((x >> 10) & 1023) / 1023.f;
+            float l = 0.05f + 0.9f * (x >> 22) / 1023.f;
+            float a = cosf(2.f * pi * h), b = sinf(2.f * pi * h);
+
+            Lab p = okhsl_to_oklab({ h, s, l }), q = okhsl_to_oklab<SrgbGamut>({ h, s, l });
+            Lab u = okhsv_to_oklab({ h, s, l }), v = okhsv_to_oklab<SrgbGamut>({ h, s, l });
+            HSL p_hsl = oklab_to_okhsl(p), q_hsl = oklab_to_okhsl<SrgbGamut>(p);
+            HSV u_hsv = oklab_to_okhsv(u), v_hsv = oklab_to_okhsv<SrgbGamut>(u);
+            LC c = find_cusp(a, b), d = find_cusp<SrgbGamut>(a, b);
+            Lab outside = { l, 0.4f * s * a, 0.4f * s * b };
+            RGB e = gamut_clip_oklab(outside, GamutClip::adaptive_L0_L_cusp), f = gamut_clip_oklab<SrgbGamut>(outside, GamutClip::adaptive_L0_L_cusp);
+
+            // Compared bit for bit, gray has a NaN hue
+            same = same && !memcmp(&p, &q, sizeof(p)) && !memcmp(&u, &v, sizeof(u)) && !memcmp(&p_hsl, &q_hsl, sizeof(p_hsl))
+                && !memcmp(&u_hsv, &v_hsv, sizeof(u_hsv)) && !memcmp(&c, &d, sizeof(c)) && !memcmp(&e, &f, sizeof(e));
+        }
+        std::cout << "sRGB instances same as originals" << (same ? " PASS" : " FAIL") << std::endl;
+    }
+
+    wide_gamut_test_cases<SrgbGamut>("sRGB");
+    wide_gamut_test_cases<DisplayP3Gamut>("Display P3");
+    wide_gamut_test_cases<Rec2020Gamut>("Rec. 2020");
+
+    // The sRGB primaries are inside Display P3, Display P3 green is outside sRGB
+    {
+        Lab red = linear_srgb_to_oklab({ 1.f, 0.f, 0.f });
+        RGB p3 = oklab_to_linear_rgb<DisplayP3Gamut>(red);
+        HSV hsv = oklab_to_okhsv<DisplayP3Gamut>(red);
+        RGB green = oklab_to_linear_srgb(linear_rgb_to_oklab<DisplayP3Gamut>({ 0.f, 1.f, 0.f }));
+        bool pass = p3.r < 1.f && p3.g > 0.f && p3.b > 0.f && hsv.s < 0.99f && green.r < 0.f && green.b < 0.f;
+        std::cout << "sRGB red in Display P3 (" << p3.r << ", " << p3.g << ", " << p3.b << ")" << (pass ? " PASS" : " FAIL") << std::endl;
+    }
+
+    // Transfer function round trip
+    {
+        float worst = 0.f;
+        for (int i = 0; i <= 1000; i++) {
+            float x = i / 1000.f;
+            worst = std::max(worst, std::abs(rec2020_transfer_function_inv(rec2020_transfer_function(x)) - x));
+        }
+        bool pass = worst < 1e-6f && std::abs(rec2020_transfer_function(1.f) - 1.f) < 1e-6f;
+        std::cout << "Rec. 2020 transfer function round trip " << worst << (pass ? " PASS" : " FAIL") << std::endl;
+    }
+}
+
+// ------------------------ XYZ and CIELAB test cases ------------------------ //
+
+void xyz_test_cases() {
+    std::cout << "\nRunning XYZ and CIELAB tests:" << std::endl;
+    std::cout << std::fixed << std::setprecision(9);
+
+    // White is OkLab white from either illuminant, up to the rounding of the published M1 (about 1e-4)
+    {
+        Lab from_xyz = xyz_to_oklab({ 0.3127f / 0.3290f, 1.f, (1.f - 0.3127f - 0.3290f) / 0.3290f });
+        Lab from_d50 = xyz_to_oklab({ 0.3457f / 0.3585f, 1.f, (1.f - 0.3457f - 0.3585f) / 0.3585f }, Illuminant::d50);
+        Lab from_lab = cielab_to_oklab({ 100.f, 0.f, 0.f });
+        float error = std::max({ std::abs(from_xyz.L - 1.f), std::abs(from_xyz.a), std::abs(from_xyz.b),
+            std::abs(from_d50.L - 1.f), std::abs(from_d50.a), std::abs(from_d50.b),
+            std::abs(from_lab.L - 1.f), std::abs(from_lab.a), std::abs(from_lab.b) });
+        bool pass = error < 5e-4f;
+        std::cout << "White, max error " << error << (pass ? " PASS" : " FAIL") << std::endl;
+    }
+
+    // Linear sRGB through XYZ (IEC 61966-2-1 matrix) agrees with linear_srgb_to_oklab
+    {
+        float worst = 0.f;
+        for (int i = 0; i < 1000; i++) {
+            uint32_t x = (uint32_t)(i * 2654435761u);
+            RGB c = { (x & 1023) / 1023.f, ((x >> 10) & 1023) / 1023.f, (x >> 22) / 1023.f };
+            XYZ xyz = {
+                0.4124564f * c.r + 0.3575761f * c.g + 0.1804375f * c.b,
+                0.2126729f * c.r + 0.7151522f * c.g + 0.0721750f * c.b,
+                0.0193339f * c.r + 0.1191920f * c.g + 0.9503041f * c.b,
+            };
+            Lab p = xyz_to_oklab(xyz), q = linear_srgb_to_oklab(c);
+            worst = std::max({ worst, std::abs(p.L - q.L), std::abs(p.a - q.a), std::abs(p.b - q.b) });
+        }
+        bool pass = worst < 1e-3f;
+        std::cout << "XYZ vs linear sRGB, max difference " << worst << (pass ? " PASS" : " FAIL") << std::endl;
+    }
+
+    // sRGB red, CIELAB D50 values of CSS Color 4
+    {
+        Lab lab = cielab_to_oklab({ 54.290539f, 80.804947f, 69.890961f });
+        Lab red = linear_srgb_to_oklab({ 1.f, 0.f, 0.f });
+        CieLab back = oklab_to_cielab(red);
+        bool pass = std::abs(lab.L - red.L) < 1e-3f && std::abs(lab.a - red.a) < 1e-3f && std::abs(lab.b - red.b) < 1e-3f
+            && std::abs(back.L - 54.290539f) < 0.05f && std::abs(back.a - 80.804947f) < 0.1f && std::abs(back.b - 69.890961f) < 0.1f;
+        std::cout << "sRGB red CIELAB (" << back.L << ", " << back.a << ", " << back.b << ")" << (pass ? " PASS" : " FAIL") << std::endl;
+    }
+
+    // Round trips, batches agree with single conversions
+    for (Illuminant white : { Illuminant::d65, Illuminant::d50 }) {
+        const size_t n = 1000;
+        std::vector<Lab> lab(n), from_xyz(n), from_cielab(n);
+        std::vector<XYZ> xyz(n);
+        std::vector<CieLab> cielab(n);
+        for (size_t i = 0; i < n; i++) {
+            uint32_t x = (uint32_t)(i * 2654435761u);
+            lab[i] = linear_srgb_to_oklab({ (x & 1023) / 1023.f, ((x >> 10) & 1023) / 1023.f, (x >> 22) / 1023.f });
+        }
+
+        oklab_to_xyz(lab.data(), xyz.data(), n, white);
+        xyz_to_oklab(xyz.data(), from_xyz.data(), n, white);
+        oklab_to_cielab(lab.data(), cielab.data(), n, white);
+        cielab_to_oklab(cielab.data(), from_cielab.data(), n, white);
+
+        float worst = 0.f;
+        bool same = true;
+        for (size_t i = 0; i < n; i++) {
+            worst = std::max({ worst, std::abs(from_xyz[i].L - lab[i].L), std::abs(from_xyz[i].a - lab[i].a), std::abs(from_xyz[i].b - lab[i].b),
+                std::abs(from_cielab[i].L - lab[i].L), std::abs(from_cielab[i].a - lab[i].a), std::abs(from_cielab[i].b - lab[i].b) });
+
+            XYZ p = oklab_to_xyz(lab[i], white);
+            CieLab q = oklab_to_cielab(lab[i], white);
+            same = same && !memcmp(&p, &xyz[i], sizeof(p)) && !memcmp(&q, &cielab[i], sizeof(q));
+        }
+        bool pass = worst < 1e-5f && same;
+        std::cout << (white == Illuminant::d65 ? "D65" : "D50") << " round trips, max error " << worst << (pass ? " PASS" : " FAIL") << std::endl;
+    }
+}
+
+// ------------------------ YUV test cases ------------------------ //
+
+// Frame filled with encoded RGB colors given per chroma sample, for yuv_to_oklab tests
+struct TestYuvFrame {
+    std::vector<uint8_t> y, u, v;
+    YuvFrame frame;
+
+    TestYuvFrame(YuvFormat format, int width, int height, YuvMatrix matrix, YuvRange range, RGB (*color)(int cx, int cy)) {
+        float Kr = matrix == YuvMatrix::bt601 ? 0.299f : matrix == YuvMatrix::bt709 ? 0.2126f : 0.2627f;
+        float Kb = matrix == YuvMatrix::bt601 ? 0.114f : matrix == YuvMatrix::bt709 ? 0.0722f : 0.0593f;
+        bool wide = format == YuvFormat::p010;
+        float max = wide ? 1023.f : 255.f, unit = wide ? 4.f : 1.f;
+
+        auto quantize_y = [&](float x) { return range == YuvRange::limited ? std::round((16.f + 219.f * x) * unit) : std::round(x * max); };
+        auto quantize_c = [&](float x) { return range == YuvRange::limited ? std::round((128.f + 224.f * x) * unit) : std::min(std::round(128.f * unit + x * max), max); };
+        auto encode = [&](RGB c, float& Y, float& Cb, float& Cr) {
+            Y = Kr * c.r + (1.f - Kr - Kb) * c.g + Kb * c.b;
+            Cb = (c.b - Y) / (2.f * (1.f - Kb));
+            Cr = (c.r - Y) / (2.f * (1.f - Kr));
+        };
+
+        int cw = (width + 1) / 2, ch = (height + 1) / 2, bytes = wide ? 2 : 1;
+        frame.format = format;
+        frame.width = width;
+        frame.height = height;
+        frame.y_stride = width * bytes + 3;
+        frame.uv_stride = (format == YuvFormat::i420 ? cw : 2 * cw) * bytes + 5;
+        y.assign(frame.y_stride * height, 0);
+        u.assign(frame.uv_stride * ch, 0);
+        v.assign(frame.uv_stride * ch, 0);
+
+        auto store = [&](uint8_t* p, float value) {
+            if (wide) {
+                uint16_t word = (uint16_t)((int)value << 6);
+                p[0] = word & 0xff;
+                p[1] = word >> 8;
+            }
+            else
+                p[0] = (uint8_t)value;
+        };
+
+        for (int py = 0; py < height; py++)
+            for (int px = 0; px < width; px++) {
+                float Y, Cb, Cr;
+                encode(color(px / 2, py / 2), Y, Cb, Cr);
+                store(&y[py * frame.y_stride + px * bytes], quantize_y(Y));
+            }
+        for (int cy = 0; cy < ch; cy++)
+            for (int cx = 0; cx < cw; cx++) {
+                float Y, Cb, Cr;
+                encode(color(cx, cy), Y, Cb, Cr);
+                if (format == YuvFormat::i420) {
+                    store(&u[cy * frame.uv_stride + cx], quantize_c(Cb));
+                    store(&v[cy * frame.uv_stride + cx], quantize_c(Cr));
+                }
+                else {
+                    store(&u[cy * frame.uv_stride + 2 * cx * bytes], quantize_c(Cb));
+                    store(&u[cy * frame.uv_stride + (2 * cx + 1) * bytes], quantize_c(Cr));
+                }
+            }
+
+        frame.y = y.data();
+        frame.u = u.data();
+        frame.v = format == YuvFormat::i420 ? v.data() : nullptr;
+    }
+};
+
+void yuv_test_cases() {
+    std::cout << "\nRunning YUV tests:" << std::endl;
+    std::cout << std::fixed << std::setprecision(9);
+
+    // Solid colors in every format, matrix and range, odd sizes included
+    {
+        static RGB color;
+        const RGB colors[] = { { 1.f, 0.f, 0.f }, { 0.2f, 0.6f, 0.3f }, { 0.5f, 0.5f, 0.5f }, { 0.9f, 0.8f, 0.1f }, { 0.1f, 0.2f, 0.9f } };
+
+        for (YuvFormat format : { YuvFormat::i420, YuvFormat::nv12, YuvFormat::p010 }) {
+            float worst = 0.f;
+            for (YuvMatrix matrix : { YuvMatrix::bt601, YuvMatrix::bt709, YuvMatrix::bt2020 })
+                for (YuvRange range : { YuvRange::limited, YuvRange::full })
+                    for (const RGB& c : colors) {
+                        color = c;
+                        const int width = 7, height = 5;
+                        TestYuvFrame test(format, width, height, matrix, range, [](int, int) { return color; });
+
+                        std::vector<float> L(width * height), a(width * height), b(width * height);
+                        YuvOptions options;
+                        options.matrix = matrix;
+                        options.range = range;
+                        yuv_to_oklab(test.frame, { L.data(), a.data(), b.data(), (size_t)width }, options);
+
+                        Lab expected = matrix == YuvMatrix::bt2020
+                            ? linear_rgb_to_oklab<Rec2020Gamut>({ rec2020_transfer_function_inv(c.r), rec2020_transfer_function_inv(c.g), rec2020_transfer_function_inv(c.b) })
+                            : linear_srgb_to_oklab({ srgb_transfer_function_inv(c.r), srgb_transfer_function_inv(c.g), srgb_transfer_function_inv(c.b) });
+                        for (int i = 0; i < width * height; i++)
+                            worst = std::max({ worst, std::abs(L[i] - expected.L), std::abs(a[i] - expected.a), std::abs(b[i] - expected.b) });
+                    }
+
+            // Within the quantization of the samples
+            bool pass = worst < (format == YuvFormat::p010 ? 0.003f : 0.01f);
+            const char* name = format == YuvFormat::i420 ? "I420" : format == YuvFormat::nv12 ? "NV12" : "P010";
+            std::cout << name << " solid colors, max error " << worst << (pass ? " PASS" : " FAIL") << std::endl;
+        }
+    }
+
+    // Chroma edge between columns: nearest keeps the left color at odd columns, bilinear blends
+    {
+        const int width = 8, height = 4;
+        TestYuvFrame test(YuvFormat::nv12, width, height, YuvMatrix::bt709, YuvRange::full, [](int cx, int) {
+            return cx < 2 ? RGB{ 0.8f, 0.2f, 0.2f } : RGB{ 0.2f, 0.2f, 0.8f };
+        });
+
+        std::vector<float> L(width * height), a(width * height), b(width * height);
+        YuvOptions options;
+        options.range = YuvRange::full;
+        options.upsampling = ChromaUpsampling::nearest;
+        yuv_to_oklab(test.frame, { L.data(), a.data(), b.data(), (size_t)width }, options);
+        float nearest_a = a[3], left_a = a[2], right_a = a[4];
+
+        options.upsampling = ChromaUpsampling::bilinear;
+        yuv_to_oklab(test.frame, { L.data(), a.data(), b.data(), (size_t)width }, options);
+        float bilinear_a = a[3];
+
+        bool pass = std::abs(nearest_a - left_a) < 0.02f && std::min(left_a, right_a) < bilinear_a && bilinear_a < std::max(left_a, right_a)
+            && std::abs(bilinear_a - nearest_a) > 0.01f;
+        std::cout << "Chroma upsampling, nearest " << nearest_a << ", bilinear " << bilinear_a << (pass ? " PASS" : " FAIL") << std::endl;
+    }
+
+    // OkLch planes, and missing planes rejected
+    {
+        const int width = 6, height = 6;
+        TestYuvFrame test(YuvFormat::i420, width, height, YuvMatrix::bt601, YuvRange::limited, [](int cx, int cy) {
+            return RGB{ 0.2f + 0.2f * cx, 0.7f - 0.2f * cy, 0.4f };
+        });
+
+        std::vector<float> L(width * height), a(width * height), b(width * height), l(width * height), c(width * height), h(width * height);
+        yuv_to_oklab(test.frame, { L.data(), a.data(), b.data(), (size_t)width });
+        YuvOptions options;
+        options.lch = true;
+        yuv_to_oklab(test.frame, { l.data(), c.data(), h.data(), (size_t)width }, options);
+
+        bool pass = true;
+        for (int i = 0; i < width * height; i++) {
+            Lch lch = oklab_to_lch({ L[i], a[i], b[i] });
+            pass = pass && lch.l == l[i] && lch.c == c[i] && lch.h == h[i];
+        }
+
+        YuvFrame missing = test.frame;
+        missing.v = nullptr;
+        pass = pass && !yuv_to_oklab(missing, { L.data(), a.data(), b.data(), (size_t)width });
+        std::cout << "OkLch planes" << (pass ? " PASS" : " FAIL") << std::endl;
+    }
+}
+
+// ------------------------ Pixel format test cases ------------------------ //
+
+void pixel_format_test_cases() {
+    std::cout << "\nRunning pixel format tests:" << std::endl;
+    std::cout << std::fixed << std::setprecision(9);
+
+    // Every half survives the round trip through float, NaNs stay NaN
+    {
+        bool pass = true;
+        for (uint32_t h = 0; h < 0x10000; h++) {
+            float f = half_to_float((uint16_t)h);
+            uint16_t back = float_to_half(f);
+            pass = pass && (std::isnan(f) ? (back & 0x7c00) == 0x7c00 && (back & 0x3ff) != 0 : back == h);
+        }
+
+        std::vector<uint16_t> halves(0x10000), bulk(0x10000);
+        std::vector<float> floats(0x10000);
+        for (uint32_t h = 0; h < 0x10000; h++)
+            halves[h] = (uint16_t)h;
+        halves_to_floats(halves.data(), floats.data(), halves.size());
+        for (uint32_t h = 0; h < 0x10000; h++) {
+            float f = half_to_float((uint16_t)h);
+            pass = pass && (std::isnan(f) ? std::isnan(floats[h]) : memcmp(&f, &floats[h], sizeof(f)) == 0);
+        }
+        std::cout << "Half round trip" << (pass ? " PASS" : " FAIL") << std::endl;
+    }
+
+    // Rounding to nearest even, overflow, subnormals, and the bulk path agreeing with the scalar one
+    {
+        bool pass = float_to_half(1.f) == 0x3c00 && float_to_half(-2.f) == 0xc000 && float_to_half(65504.f) == 0x7bff
+            && float_to_half(65519.f) == 0x7bff && float_to_half(65520.f) == 0x7c00 && float_to_half(1e10f) == 0x7c00
+            && float_to_half(1.f + 1.f / 2048.f) == 0x3c00 && float_to_half(1.f + 3.f / 2048.f) == 0x3c02
+            && float_to_half(5.9604645e-08f) == 0x0001 && float_to_half(2.9802322e-08f) == 0x0000
+            && float_to_half(6.1035156e-05f) == 0x0400 && float_to_half(-0.f) == 0x8000;
+
+        std::vector<float> values;
+        for (int i = 0; i < 100003; i++)
+            values.push_back((float)std::ldexp((i * 7919 % 100003) / 100003.0 - 0.5, i % 40 - 28));
+        std::vector<uint16_t> bulk(values.size());
+        floats_to_halves(values.data(), bulk.data(), values.size());
+        for (size_t i = 0; i < values.size(); i++)
+            pass = pass && bulk[i] == float_to_half(values[i]);
+        std::cout << "Half rounding" << (pass ? " PASS" : " FAIL") << std::endl;
+    }
+
+    std::vector<Lab> colors;
+    for (int i = 0; i < 4096; i++) {
+        float r = (i % 16) / 15.f, g = (i / 16 % 16) / 15.f, b = (i / 256) / 15.f;
+        colors.push_back(linear_srgb_to_oklab({ r, g, b }));
+    }
+
+    // Half pixels keep about 3 decimal digits
+    {
+        std::vector<RgbaHalf> pixels(colors.size());
+        std::vector<Lab> back(colors.size());
+        oklab_to_rgba_half(colors.data(), pixels.data(), colors.size());
+        rgba_half_to_oklab(pixels.data(), back.data(), pixels.size());
+
+        float worst = 0.f;
+        for (size_t i = 0; i < colors.size(); i++)
+            worst = std::max({ worst, std::abs(back[i].L - colors[i].L), std::abs(back[i].a - colors[i].a), std::abs(back[i].b - colors[i].b) });
+        bool pass = worst < 1e-3f && pixels[0].a == 0x3c00;
+        std::cout << "RGBA half round trip, max error " << worst << (pass ? " PASS" : " FAIL") << std::endl;
+    }
+
+    // Unorm formats, both transfers: every code of the input grid comes back
+    for (PixelTransfer transfer : { PixelTransfer::linear, PixelTransfer::srgb }) {
+        PixelOutput options;
+        options.transfer = transfer;
+
+        std::vector<uint32_t> packed(1024 * 3);
+        for (uint32_t i = 0; i < packed.size(); i++)
+            packed[i] = (i % 1024) | ((i * 7 % 1024) << 10) | ((i * 13 % 1024) << 20) | (3u << 30);
+        std::vector<Lab> lab(packed.size());
+        std::vector<uint32_t> packed_back(packed.size());
+        rgb10a2_to_oklab(packed.data(), lab.data(), packed.size(), transfer);
+        oklab_to_rgb10a2(lab.data(), packed_back.data(), lab.size(), options);
+        bool pass = packed == packed_back;
+
+        std::vector<Rgb16> wide(65536);
+        for (uint32_t i = 0; i < wide.size(); i++)
+            wide[i] = { (uint16_t)i, (uint16_t)(i * 31), (uint16_t)(i * 257 + 3) };
+        lab.resize(wide.size());
+        std::vector<Rgb16> wide_back(wide.size());
+        rgb16_to_oklab(wide.data(), lab.data(), wide.size(), transfer);
+        oklab_to_rgb16(lab.data(), wide_back.data(), lab.size(), options);
+        int worst = 0;
+        for (size_t i = 0; i < wide.size(); i++)
+            worst = std::max({ worst, std::abs(wide[i].r - wide_back[i].r), std::abs(wide[i].g - wide_back[i].g), std::abs(wide[i].b - wide_back[i].b) });
+
+        // Float precision of the conversion is below 16 bits near white
+        pass = pass && worst <= 2;
+        std::cout << (transfer == PixelTransfer::srgb ? "sRGB" : "Linear") << " RGB10A2 and RGB16 round trip, RGB16 max error " << worst
+            << (pass ? " PASS" : " FAIL") << std::endl;
+    }
+
+    // HDR clipping keeps in gamut colors up to the peak and brings the others to [0, peak]
+    {
+        const float peak = 4.f;
+        bool pass = true;
+        for (GamutClip clip : { GamutClip::preserve_chroma, GamutClip::project_to_0_5, GamutClip::adaptive_L0_L_cusp }) {
+            for (int i = 0; i < 1000; i++) {
+                Lab lab = { 0.05f + 1.5f * (i % 10) / 9.f, 0.6f * ((i / 10) % 10) / 9.f - 0.3f, 0.6f * (i / 100) / 9.f - 0.3f };
+                // Within the accuracy of the approximate gamut intersection
+                RGB rgb = gamut_clip_oklab_hdr(lab, peak, clip);
+                pass = pass && rgb.r >= -1e-3f * peak && rgb.g >= -1e-3f * peak && rgb.b >= -1e-3f * peak
+                    && rgb.r <= peak * 1.001f && rgb.g <= peak * 1.001f && rgb.b <= peak * 1.001f;
+            }
+        }
+
+        RGB bright = { 3.f, 2.f, 0.5f };
+        RGB kept = gamut_clip_hdr(bright, peak, GamutClip::preserve_chroma);
+        RGB clipped = gamut_clip_hdr(bright, 1.f, GamutClip::preserve_chroma);
+        pass = pass && kept.r == bright.r && kept.g == bright.g && kept.b == bright.b && clipped.r <= 1.0001f;
+
+        std::vector<Lab> lab = { linear_srgb_to_oklab(bright), linear_srgb_to_oklab({ 8.f, -0.5f, 1.f }) };
+        std::vector<RgbaHalf> pixels(lab.size());
+        PixelOutput options;
+        options.peak = peak;
+        oklab_to_rgba_half(lab.data(), pixels.data(), lab.size(), options);
+        for (const RgbaHalf& p : pixels)
+            for (uint16_t h : { p.r, p.g, p.b })
+                pass = pass && half_to_float(h) >= 0.f && half_to_float(h) <= peak;
+        pass = pass && std::abs(half_to_float(pixels[0].r) - 3.f) < 0.01f;
+        std::cout << "HDR gamut clipping" << (pass ? " PASS" : " FAIL") << std::endl;
+    }
+
+    // Half OkLab planes
+    {
+        std::vector<uint16_t> L(colors.size()), a(colors.size()), b(colors.size());
+        std::vector<Lab> back(colors.size());
+        oklab_to_half_planes(colors.data(), L.data(), a.data(), b.data(), colors.size());
+        half_planes_to_oklab(L.data(), a.data(), b.data(), back.data(), colors.size());
+
+        float worst = 0.f;
+        for (size_t i = 0; i < colors.size(); i++)
+            worst = std::max({ worst, std::abs(back[i].L - colors[i].L), std::abs(back[i].a - colors[i].a), std::abs(back[i].b - colors[i].b) });
+        bool pass = worst < 5e-4f;
+        std::cout << "Half OkLab planes, max error " << worst << (pass ? " PASS" : " FAIL") << std::endl;
+    }
+}
+
+// ------------------------ Packed OkLab test cases ------------------------ //
+
+void packed_test_cases() {
+    std::cout << "\nRunning packed OkLab tests:" << std::endl;
+    std::cout << std::fixed << std::setprecision(9);
+
+    // sRGB cube surface and inside, the extremes of a and b are on the surface
+    std::vector<Lab> colors;
+    for (int r = 0; r <= 32; r++)
+        for (int g = 0; g <= 32; g++)
+            for (int b = 0; b <= 32; b++)
+                colors.push_back(linear_srgb_to_oklab({ srgb_transfer_function_inv(r / 32.f), srgb_transfer_function_inv(g / 32.f), srgb_transfer_function_inv(b / 32.f) }));
+    const size_t count = colors.size();
+
+    // Every sRGB color within the documented bounds
+    {
+        std::vector<PackedLab> packed(count);
+        std::vector<Lab> back(count);
+        pack_oklab(colors.data(), packed.data(), count);
+        unpack_oklab(packed.data(), back.data(), count);
+
+        float worst_L = 0.f, worst_ab = 0.f, worst_de = 0.f;
+        bool pass = true;
+        for (size_t i = 0; i < count; i++) {
+            worst_L = std::max(worst_L, std::abs(back[i].L - colors[i].L));
+            worst_ab = std::max({ worst_ab, std::abs(back[i].a - colors[i].a), std::abs(back[i].b - colors[i].b) });
+            worst_de = std::max(worst_de, delta_e(back[i], colors[i]));
+            pass = pass && packed[i].bits == pack_oklab(colors[i]).bits;
+        }
+        pass = pass && worst_L <= 4.9e-4f && worst_ab <= 1.3e-4f && worst_de <= 5.2e-4f;
+        std::cout << "Packed OkLab, max errors L " << worst_L << ", a b " << worst_ab << ", delta E " << worst_de << (pass ? " PASS" : " FAIL") << std::endl;
+    }
+
+    // Half floats
+    {
+        std::vector<HalfLab> packed(count);
+        std::vector<Lab> back(count);
+        pack_oklab_half(colors.data(), packed.data(), count);
+        unpack_oklab_half(packed.data(), back.data(), count);
+
+        float worst_L = 0.f, worst_ab = 0.f;
+        bool pass = true;
+        for (size_t i = 0; i < count; i++) {
+            worst_L = std::max(worst_L, std::abs(back[i].L - colors[i].L));
+            worst_ab = std::max({ worst_ab, std::abs(back[i].a - colors[i].a), std::abs(back[i].b - colors[i].b) });
+            Lab single = unpack_oklab_half(pack_oklab_half(colors[i]));
+            pass = pass && !memcmp(&single, &back[i], sizeof(single));
+        }
+        pass = pass && worst_L <= 2.5e-4f && worst_ab <= 1.3e-4f;
+        std::cout << "Half OkLab, max errors L " << worst_L << ", a b " << worst_ab << (pass ? " PASS" : " FAIL") << std::endl;
+    }
+
+    // OkLch, hue wrapping around
+    {
+        std::vector<Lch> lch(count), back(count);
+        std::vector<PackedLch> packed(count);
+        for (size_t i = 0; i < count; i++)
+            lch[i] = oklab_to_lch(colors[i]);
+        pack_oklch(lch.data(), packed.data(), count);
+        unpack_oklch(packed.data(), back.data(), count);
+
+        float worst = 0.f;
+        for (size_t i = 0; i < count; i++)
+            worst = std::max(worst, delta_e(lch_to_oklab(back[i]), colors[i]));
+
+        Lch wrapped = unpack_oklch(pack_oklch({ 0.5f, 0.1f, 2.f * pi - 1e-4f }));
+        bool pass = worst <= 7e-4f && wrapped.h == 0.f && unpack_oklch(pack_oklch({ 0.5f, 0.1f, -pi / 2 })).h == 1.5f * pi;
+        std::cout << "Packed OkLch, max delta E " << worst << (pass ? " PASS" : " FAIL") << std::endl;
+    }
+
+    // The batches, SIMD or not, give the results of the single color functions, also for NaN and
+    // values outside the ranges
+    {
+        std::vector<Lab> labs = colors;
+        labs.insert(labs.begin() + 5, { { NAN, 2.f, -2.f }, { 1.5f, NAN, 0.3f }, { -0.5f, 0.f, NAN }, { 1e30f, -1e30f, 1e30f } });
+        const size_t n = labs.size();
+        std::vector<Lch> lch(n);
+        for (size_t i = 0; i < n; i++)
+            lch[i] = { labs[i].L, std::abs(labs[i].a), labs[i].b * 20.f };
+
+        std::vector<PackedLab> packed(n);
+        std::vector<PackedLch> packed_lch(n);
+        std::vector<float> d(n - 1);
+        pack_oklab(labs.data(), packed.data(), n);
+        pack_oklch(lch.data(), packed_lch.data(), n);
+        delta_e(packed.data(), packed.data() + 1, d.data(), n - 1);
+
+        bool pass = true;
+        for (size_t i = 0; i < n; i++) {
+            pass = pass && packed[i].bits == pack_oklab(labs[i]).bits && packed_lch[i].bits == pack_oklch(lch[i]).bits;
+            // Up to the rounding of fused multiply adds in the single color function
+            if (i + 1 < n)
+                pass = pass && std::abs(delta_e(packed[i], packed[i + 1]) - d[i]) <= 1e-6f * d[i];
+        }
+        std::cout << "Packing batches same as single colors" << (pass ? " PASS" : " FAIL") << std::endl;
+    }
+
+    // Distances and nearest colors on the packed form match those of the decoded colors
+    {
+        std::vector<PackedLab> packed(count);
+        pack_oklab(colors.data(), packed.data(), count);
+
+        bool pass = true;
+        for (size_t i = 0; i + 1 < count; i += 97) {
+            float expected = delta_e(unpack_oklab(packed[i]), unpack_oklab(packed[i + 1]));
+            pass = pass && std::abs(delta_e(packed[i], packed[i + 1]) - expected) < 1e-6f;
+        }
+
+        const size_t palette_size = 3000;
+        std::vector<Lab> queries;
+        for (int i = 0; i < 200; i++)
+            queries.push_back(colors[(i * 7919) % count]);
+        std::vector<uint32_t> found(queries.size());
+        nearest_packed(queries.data(), found.data(), queries.size(), packed.data(), palette_size);
+
+        for (size_t q = 0; q < queries.size(); q++) {
+            uint32_t best = 0;
+            float best_distance = INFINITY;
+            for (uint32_t j = 0; j < palette_size; j++) {
+                float d = delta_e(queries[q], unpack_oklab(packed[j]));
+                if (d < best_distance) {
+                    best_distance = d;
+                    best = j;
+                }
+            }
+            PaletteMatch match = nearest_packed(queries[q], packed.data(), palette_size);
+            pass = pass && found[q] == match.index && std::abs(match.distance - best_distance) < 1e-6f
+                && delta_e(queries[q], unpack_oklab(packed[match.index])) == delta_e(queries[q], unpack_oklab(packed[best]));
+        }
+        pass = pass && nearest_packed(queries[0], packed.data(), 0).index == UINT32_MAX;
+        std::cout << "Packed distances and nearest colors" << (pass ? " PASS" : " FAIL") << std::endl;
+    }
+}
+
+// ------------------------ Fixed point test cases ------------------------ //
+
+void fixed_point_test_cases() {
+    std::cout << "\nRunning fixed point tests:" << std::endl;
+    std::cout << std::fixed << std::setprecision(9);
+
+    const FixedTables& fixed = fixed_tables();
+    const Srgb8Tables& tables = srgb8_tables();
+
+    // Sampled colors within the documented error of the float conversion, grays exact
+    {
+        std::vector<uint32_t> pixels;
+        for (uint32_t p = 0; p < (1u << 24); p += 97)
+            pixels.push_back(p);
+        for (uint32_t v = 0; v < 256; v++)
+            pixels.push_back(v * 0x010101u);
+
+        std::vector<Lab16> lab(pixels.size());
+        argb32_to_lab16(pixels.data(), lab.data(), pixels.size());
+
+        float worst_L = 0.f, worst_ab = 0.f;
+        bool pass = true;
+        for (size_t i = 0; i < pixels.size(); i++) {
+            Lab expected = linear_srgb_to_oklab(argb32_to_linear_srgb(tables, pixels[i]));
+            Lab found = lab16_to_oklab(lab[i]);
+            worst_L = std::max(worst_L, std::abs(found.L - expected.L));
+            worst_ab = std::max({ worst_ab, std::abs(found.a - expected.a), std::abs(found.b - expected.b) });
+
+            uint32_t p = pixels[i];
+            if (((p >> 16) & 0xff) == (p & 0xff) && ((p >> 8) & 0xff) == (p & 0xff))
+                pass = pass && lab[i].a == 0 && lab[i].b == 0;
+        }
+        pass = pass && worst_L < 5e-5f && worst_ab < 1.5e-4f && argb32_to_lab16(fixed, 0xffffffff).L == 32768 && argb32_to_lab16(fixed, 0).L == 0;
+        std::cout << "sRGB8 to Lab16, max errors L " << worst_L << ", a b " << worst_ab << (pass ? " PASS" : " FAIL") << std::endl;
+    }
+
+    // Back to sRGB8: round trips and the float path agree up to one code
+    {
+        std::vector<uint32_t> pixels;
+        for (uint32_t p = 0; p < (1u << 24); p += 89)
+            pixels.push_back(0xff000000u | p);
+
+        std::vector<Lab16> lab(pixels.size());
+        std::vector<uint32_t> back(pixels.size());
+        argb32_to_lab16(pixels.data(), lab.data(), pixels.size());
+        lab16_to_argb32(lab.data(), back.data(), lab.size());
+
+        auto max_difference = [](uint32_t x, uint32_t y) {
+            int worst = 0;
+            for (int shift = 0; shift < 32; shift += 8)
+                worst = std::max(worst, std::abs((int)((x >> shift) & 0xff) - (int)((y >> shift) & 0xff)));
+            return worst;
+        };
+
+        int worst = 0, worst_float = 0;
+        size_t exact = 0;
+        for (size_t i = 0; i < pixels.size(); i++) {
+            worst = std::max(worst, max_difference(back[i], pixels[i]));
+            exact += back[i] == pixels[i];
+
+            Lab16 q = oklab_to_lab16(linear_srgb_to_oklab(argb32_to_linear_srgb(tables, pixels[i])));
+            uint32_t expected = linear_srgb_to_argb32(tables, oklab_to_linear_srgb(lab16_to_oklab(q)));
+            worst_float = std::max(worst_float, max_difference(lab16_to_argb32(fixed, q), expected));
+        }
+        float exact_share = (float)exact / pixels.size();
+
+        // Out of gamut values clamp
+        bool pass = worst <= 2 && worst_float <= 1 && exact_share > 0.99f
+            && lab16_to_argb32(fixed, { 32768, 20000, -20000 }) >> 24 == 0xff && lab16_to_argb32(fixed, { 0, 0, 0 }) == 0xff000000u;
+        std::cout << "Lab16 to sRGB8, round trips exact " << exact_share << ", max code errors " << worst << " and " << worst_float
+            << " from float" << (pass ? " PASS" : " FAIL") << std::endl;
+    }
+
+    // The batches, SIMD or not, give the results of the single color functions: every sRGB color,
+    // and Lab16 values over their whole range
+    {
+        std::vector<uint32_t> pixels(1u << 24);
+        for (uint32_t p = 0; p < (1u << 24); p++)
+            pixels[p] = 0xff000000u | p;
+        std::vector<Lab16> lab(pixels.size());
+        argb32_to_lab16(pixels.data(), lab.data(), pixels.size());
+
+        bool pass = true;
+        for (size_t i = 0; i < pixels.size(); i++) {
+            Lab16 single = argb32_to_lab16(fixed, pixels[i]);
+            pass = pass && single.L == lab[i].L && single.a == lab[i].a && single.b == lab[i].b;
+        }
+
+        std::vector<Lab16> any;
+        for (uint32_t i = 0; i < 1000003; i++) {
+            uint32_t h = i * 2654435761u;
+            any.push_back({ (uint16_t)(h % 32769), (int16_t)(h >> 16), (int16_t)((h >> 8) * 40503u) });
+        }
+        std::vector<uint32_t> back(any.size());
+        lab16_to_argb32(any.data(), back.data(), any.size());
+        for (size_t i = 0; i < any.size(); i++)
+            pass = pass && back[i] == lab16_to_argb32(fixed, any[i]);
+        std::cout << "Fixed point batches same as single colors" << (pass ? " PASS" : " FAIL") << std::endl;
+    }
+}
+
+// ------------------------ Tile pipeline test cases ------------------------ //
+
+void tile_pipeline_test_cases() {
+    std::cout << "\nRunning tile pipeline tests:" << std::endl;
+
+    // Several consumers see every value once
+    {
+        BoundedQueue<uint32_t> queue(100);
+        const uint32_t values = 200000;
+        std::atomic<uint64_t> sum{ 0 }, popped{ 0 };
+
+        std::vector<std::thread> consumers;
+        for (int c = 0; c < 3; c++) {
+            consumers.emplace_back([&] {
+                uint32_t value;
+                for (;;) {
+                    queue.pop(value);
+                    if (value == UINT32_MAX)
+                        break;
+                    sum += value;
+                    popped++;
+                }
+            });
+        }
+        for (uint32_t v = 0; v < values; v++)
+            queue.push(v);
+        for (int c = 0; c < 3; c++)
+            queue.push(UINT32_MAX);
+        for (std::thread& thread : consumers)
+            thread.join();
+
+        uint32_t value;
+        bool pass = popped == values && sum == (uint64_t)values * (values - 1) / 2 && !queue.try_pop(value);
+        std::cout << "Bounded queue, 3 consumers" << (pass ? " PASS" : " FAIL") << std::endl;
+    }
+
+    // Tiles are written in read order and give the same results as a direct conversion,
+    // with more workers than tiles
+    for (size_t tiles : { (size_t)0, (size_t)2 }) {
+        const size_t pixels = 300000, tile_pixels = 4096;
+        std::vector<uint32_t> in(pixels);
+        for (size_t i = 0; i < pixels; i++)
+            in[i] = (uint32_t)(i * 2654435761u);
+
+        std::vector<Lab> out, expected(pixels);
+        const Srgb8Tables& tables = srgb8_tables();
+        for (size_t i = 0; i < pixels; i++)
+            expected[i] = linear_srgb_to_oklab_fast(argb32_to_linear_srgb(tables, in[i]));
+
+        TilePipelineOptions options;
+        options.workers = 3;
+        options.tiles = tiles;
+        options.input_bytes = tile_pixels * sizeof(uint32_t);
+        options.output_bytes = tile_pixels * sizeof(Lab);
+
+        size_t position = 0;
+        bool ordered = true;
+        TilePipelineStats stats = run_tile_pipeline(
+            [&](Tile& tile) {
+                tile.count = std::min(tile_pixels, pixels - position);
+                tile.tag = position;
+                memcpy(tile.input.data(), &in[position], tile.count * sizeof(uint32_t));
+                position += tile.count;
+                return tile.count > 0;
+            },
+            [&](Tile& tile) {
+                for (size_t i = 0; i < tile.count; i++)
+                    tile.output_as<Lab>()[i] = linear_srgb_to_oklab_fast(argb32_to_linear_srgb(tables, tile.input_as<uint32_t>()[i]));
+            },
+            [&](Tile& tile) {
+                ordered = ordered && tile.tag == out.size();
+                out.insert(out.end(), tile.output_as<Lab>(), tile.output_as<Lab>() + tile.count);
+            },
+            options);
+
+        bool pass = ordered && out.size() == pixels && !memcmp(out.data(), expected.data(), pixels * sizeof(Lab))
+            && stats.tiles == (pixels + tile_pixels - 1) / tile_pixels && stats.items == pixels
+            && stats.convert_busy > 0.0 && stats.seconds >= stats.read_busy;
+        std::cout << "Tile pipeline, " << (tiles ? "2 tiles" : "default pool") << ", " << stats.tiles << " tiles"
+                  << (pass ? " PASS" : " FAIL") << std::endl;
+    }
+
+    // Empty streams end cleanly
+    {
+        TilePipelineStats stats = run_tile_pipeline([](Tile&) { return false; }, [](Tile&) {}, [](Tile&) {});
+        bool pass = stats.tiles == 0 && stats.items == 0;
+        std::cout << "Tile pipeline, empty stream" << (pass ? " PASS" : " FAIL") << std::endl;
+    }
+
+    // An exception in any stage stops reading, lets the threads finish and reaches the caller
+    const char* stages[] = { "read", "convert", "write" };
+    for (int stage = 0; stage < 3; stage++) {
+        TilePipelineOptions options;
+        options.workers = 3;
+        uint64_t read = 0, written = 0;
+        auto maybe_throw = [&](int s, const Tile& tile) {
+            if (s == stage && tile.sequence == 5)
+                throw std::runtime_error(stages[s]);
+        };
+
+        std::string caught;
+        try {
+            run_tile_pipeline(
+                [&](Tile& tile) { maybe_throw(0, tile); tile.count = 1; return ++read < 1000000; },
+                [&](Tile& tile) { maybe_throw(1, tile); },
+                [&](Tile& tile) { maybe_throw(2, tile); written++; },
+                options);
+        } catch (const std::runtime_error& e) {
+            caught = e.what();
+        }
+
+        bool pass = caught == stages[stage] && read < 1000000 && written <= 5;
+        std::cout << "Tile pipeline, " << stages[stage] << " throws after " << read << " reads" << (pass ? " PASS" : " FAIL") << std::endl;
+    }
+}
+
+// ------------------------ Counters test cases ------------------------ //
+
+void counters_test_cases() {
+    std::cout << "\nRunning counters tests:" << std::endl;
+
+    // Without OKLAB_COUNTERS the counting compiles away and snapshots are zeros
+    if (!counters_enabled) {
+        gamut_clip_preserve_chroma({ 1.5f, -0.2f, 0.3f });
+        CounterSnapshot snapshot = counters_snapshot();
+        bool pass = true;
+        for (int i = 0; i < counter_count; i++)
+            pass = pass && snapshot.values[i] == 0;
+        std::cout << "Counters disabled, zero snapshot" << (pass ? " PASS" : " FAIL") << std::endl;
+        return;
+    }
+
+    // Known branches on one thread
+    {
+        counters_reset();
+        gamut_clip_preserve_chroma({ 0.5f, 0.5f, 0.5f });
+        gamut_clip_preserve_chroma({ 1.5f, -0.2f, 0.3f });
+        gamut_clip({ 0.2f, 0.3f, 0.4f }, GamutClip::adaptive_L0_0_5);
+        CounterSnapshot snapshot = counters_snapshot();
+        bool pass = snapshot[Counter::gamut_clip_in_gamut] == 2 && snapshot[Counter::gamut_clip_clipped] == 1
+            && snapshot[Counter::gamut_intersection_lower] + snapshot[Counter::gamut_intersection_upper] == 1;
+
+        // OkHSL and OkHSV intersect the gamut boundary too
+        oklab_to_okhsl({ 0.5f, 0.f, 0.f });
+        oklab_to_okhsv({ 0.5f, 0.f, 0.f });
+        snapshot = counters_snapshot();
+        pass = pass && snapshot[Counter::okhsl_zero_chroma] == 1 && snapshot[Counter::okhsv_zero_chroma] == 1;
+        std::cout << "Counted branches" << (pass ? " PASS" : " FAIL") << std::endl;
+
+        // Nothing is counted when no clipping is asked for
+        counters_reset();
+        gamut_clip({ 1.5f, -0.2f, 0.3f }, GamutClip::none);
+        gamut_clip({ 0.2f, 0.3f, 0.4f }, GamutClip::none);
+        snapshot = counters_snapshot();
+        pass = snapshot[Counter::gamut_clip_in_gamut] == 0 && snapshot[Counter::gamut_clip_clipped] == 0;
+        std::cout << "No clipping not counted" << (pass ? " PASS" : " FAIL") << std::endl;
+
+        // The gamut templates, the generic conversions and the hue table batches count too
+        counters_reset();
+        oklab_to_okhsl<DisplayP3Gamut>({ 0.5f, 0.f, 0.f });
+        generic::oklab_to_okhsv(generic::Lab<float>{ 0.5f, 0.f, 0.f });
+        HueTable table = make_hue_table(256);
+        RGB black = { 0.f, 0.f, 0.f };
+        HSL hsl;
+        HSV hsv;
+        srgb_to_okhsl(table, &black, &hsl, 1);
+        srgb_to_okhsv(table, &black, &hsv, 1);
+
+        // Saturation a little above 1 is outside the gamut
+        HSL vivid_hsl = { 0.4f, 1.05f, 0.5f };
+        HSV vivid_hsv = { 0.4f, 1.2f, 1.f };
+        RGB rgb;
+        okhsl_to_srgb(table, &vivid_hsl, &rgb, 1);
+        okhsv_to_srgb(table, &vivid_hsv, &rgb, 1);
+        okhsl_to_srgb(vivid_hsl);
+        okhsv_to_srgb(vivid_hsv);
+        snapshot = counters_snapshot();
+        pass = snapshot[Counter::okhsl_zero_chroma] == 2 && snapshot[Counter::okhsv_zero_chroma] == 2
+            && snapshot[Counter::okhsl_out_of_range] == 2 && snapshot[Counter::okhsv_out_of_range] == 2;
+        std::cout << "Counted in every version" << (pass ? " PASS" : " FAIL") << std::endl;
+
+        counters_reset();
+        snapshot = counters_snapshot();
+        pass = true;
+        for (int i = 0; i < counter_count; i++)
+            pass = pass && snapshot.values[i] == 0;
+        std::cout << "Reset" << (pass ? " PASS" : " FAIL") << std::endl;
+    }
+
+    // Threads that have exited are still in the totals
+    {
+        counters_reset();
+        const int thread_count = 4, clips = 1000;
+        std::vector<std::thread> threads;
+        for (int t = 0; t < thread_count; t++) {
+            threads.emplace_back([] {
+                for (int i = 0; i < clips; i++)
+                    gamut_clip_preserve_chroma({ 1.2f + i * 1e-4f, 0.1f, -0.1f });
+            });
+        }
+        for (std::thread& thread : threads)
+            thread.join();
+
+        CounterSnapshot snapshot = counters_snapshot();
+        bool pass = snapshot[Counter::gamut_clip_clipped] == (uint64_t)thread_count * clips
+            && snapshot[Counter::gamut_intersection_lower] + snapshot[Counter::gamut_intersection_upper] == (uint64_t)thread_count * clips;
+        std::cout << "Totals over exited threads" << (pass ? " PASS" : " FAIL") << std::endl;
+    }
+
+    bool named = strcmp(counter_name(Counter::okhsv_out_of_range), "okhsv_out_of_range") == 0;
+    std::cout << "Counter names" << (named ? " PASS" : " FAIL") << std::endl;
+}
+
+// ------------------------ Profile test cases ------------------------ //
+
+void profile_test_cases() {
+    std::cout << "\nRunning profile tests:" << std::endl;
+
+    // Every value falls in a bucket at most 1/32 of it wide, and percentiles land in the right bucket
+    {
+        bool pass = true;
+        for (uint64_t v = 0; v < 100000; v = v < 200 ? v + 1 : v * 1.01) {
+            int b = LatencyHistogram::bucket(v);
+            uint64_t lo = LatencyHistogram::lower_bound(b), w = LatencyHistogram::width(b);
+            pass = pass && lo <= v && v < lo + w && (v < 64 || w * 32 <= v);
+        }
+        pass = pass && LatencyHistogram::bucket(UINT64_MAX) == LatencyHistogram::bucket_count - 1;
+
+        LatencyHistogram h;
+        for (uint64_t v = 1; v <= 10000; v++)
+            h.record(v * 1000);
+        pass = pass && h.count() == 10000 && h.min() == 1000 && h.max() == 10000000
+            && fabs(h.mean() - 5000500.0) < 1e-6;
+        for (double q : { 0.5, 0.9, 0.99 }) {
+            double expected = q * 10000 * 1000;
+            pass = pass && fabs((double)h.percentile(q) - expected) <= expected / 32;
+        }
+        std::cout << "Latency histogram buckets and percentiles" << (pass ? " PASS" : " FAIL") << std::endl;
+    }
+
+    // Without OKLAB_PROFILE nothing is recorded
+    if (!profiling_enabled) {
+        std::vector<Rgb16> in(100000, Rgb16{ 1000, 20000, 40000 });
+        std::vector<Lab> out(in.size());
+        rgb16_to_oklab(in.data(), out.data(), in.size(), PixelTransfer::srgb, 2);
+        bool pass = profile_spans().empty() && profile_latencies().empty();
+        std::cout << "Profiling disabled, empty profile" << (pass ? " PASS" : " FAIL") << std::endl;
+        return;
+    }
+
+    // Calls cover their ranges, which are named after the call
+    {
+        profile_reset();
+        std::vector<Rgb16> in(100000, Rgb16{ 1000, 20000, 40000 });
+        std::vector<Lab> out(in.size());
+        for (int i = 0; i < 3; i++)
+            rgb16_to_oklab(in.data(), out.data(), in.size(), PixelTransfer::srgb, 2);
+
+        std::vector<ProfileSpan> spans = profile_spans();
+        int calls = 0, ranges = 0;
+        bool inside = true;
+        for (const ProfileSpan& call : spans) {
+            if (call.kind != SpanKind::call)
+                continue;
+            calls += strcmp(call.name, "rgb16_to_oklab") == 0;
+            for (const ProfileSpan& range : spans) {
+                if (range.kind != SpanKind::range || range.start_ns < call.start_ns || range.start_ns > call.start_ns + call.duration_ns)
+                    continue;
+                ranges++;
+                inside = inside && strcmp(range.name, call.name) == 0 && range.start_ns + range.duration_ns <= call.start_ns + call.duration_ns;
+            }
+        }
+
+        std::vector<ProfileEntry> latencies = profile_latencies();
+        bool counted = latencies.size() == 2 && latencies[0].name == "rgb16_to_oklab" && latencies[0].latency.count() == 3
+            && latencies[1].latency.count() == 6;
+        bool pass = calls == 3 && ranges == 6 && inside && counted;
+        std::cout << "Call and range spans" << (pass ? " PASS" : " FAIL") << std::endl;
+    }
+
+    // Stages name the ranges they start, the span limit drops spans but not histogram counts
+    {
+        profile_reset();
+        profile_span_limit(2);
+        {
+            OKLAB_PROFILE_SCOPE(stage, "test stage");
+            parallel_for(10, [](size_t, size_t) {}, 2, 1);
+        }
+        std::vector<ProfileSpan> spans = profile_spans();
+        std::vector<ProfileEntry> latencies = profile_latencies();
+        bool pass = spans.size() == 2 && profile_dropped_spans() == 1 && strcmp(spans[0].name, "test stage") == 0
+            && latencies.size() == 2 && latencies[0].latency.count() == 2 && latencies[1].latency.count() == 1;
+        profile_span_limit((size_t)1 << 20);
+        std::cout << "Stage spans and span limit" << (pass ? " PASS" : " FAIL") << std::endl;
+    }
+
+    // Exports
+    {
+        const char* trace_path = "oklab_profile_test.json";
+        const char* csv_path = "oklab_profile_test.csv";
+        bool pass = write_profile_trace(trace_path) && write_profile_csv(csv_path);
+
+        auto read_file = [](const char* path) {
+            std::string text;
+            if (FILE* file = fopen(path, "r")) {
+                char buffer[4096];
+                size_t n;
+                while ((n = fread(buffer, 1, sizeof(buffer), file)) > 0)
+                    text.append(buffer, n);
+                fclose(file);
+            }
+            return text;
+        };
+        std::string trace = read_file(trace_path), csv = read_file(csv_path);
+        pass = pass && trace.find("\"traceEvents\":[") != std::string::npos
+            && trace.find("\"name\":\"test stage\",\"cat\":\"range\",\"ph\":\"X\"") != std::string::npos
+            && csv.find("kind,name,calls,") == 0 && csv.find("\nrange,test stage,2,") != std::string::npos
+            && csv.find("\nstage,test stage,1,") != std::string::npos;
+        remove(trace_path);
+        remove(csv_path);
+        std::cout << "Trace and CSV export" << (pass ? " PASS" : " FAIL") << std::endl;
+    }
+
+    // Threads started by each parallel_for reuse the ids of the previous ones
+    {
+        profile_reset();
+        // At most 4 threads run at once, without reuse there would be 61 ids
+        for (int i = 0; i < 20; i++)
+            parallel_for(4, [](size_t, size_t) { OKLAB_PROFILE_SCOPE(stage, "thread id stage"); }, 4, 1);
+
+        std::vector<uint32_t> ids;
+        for (const ProfileSpan& span : profile_spans())
+            ids.push_back(span.thread);
+        std::sort(ids.begin(), ids.end());
+        size_t distinct = std::unique(ids.begin(), ids.end()) - ids.begin();
+        bool pass = profile_spans().size() == 160 && distinct <= 4;
+        std::cout << "Thread ids reused, " << distinct << " ids" << (pass ? " PASS" : " FAIL") << std::endl;
+    }
+}
+
 // ------------------------ Main ------------------------ //
 
 int main() {
@@ -415,6 +2683,31 @@ int main() {
 	okhsl_srgb_test_cases();
     okhsv_srgb_test_cases();
     oklch_srgb_test_cases();
+    hue_batch_test_cases();
+    conversion_cache_test_cases();
+    color_test_cases();
+    pipeline_test_cases();
+    lch_adjustment_test_cases();
+    palette_index_test_cases();
+    dither_test_cases();
+    palette_extraction_test_cases();
+    histogram_test_cases();
+    distance_test_cases();
+    image_diff_test_cases();
+    image_convert_test_cases();
+    distinct_palette_test_cases();
+    tonal_palette_test_cases();
+    contrast_solver_test_cases();
+    jacobian_test_cases();
+    gamut_test_cases();
+    xyz_test_cases();
+    yuv_test_cases();
+    pixel_format_test_cases();
+    packed_test_cases();
+    fixed_point_test_cases();
+    tile_pipeline_test_cases();
+    counters_test_cases();
+    profile_test_cases();
 	return 0;
 }
 
@@ -0,0 +1,118 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include "oklab_source.h"
+
+namespace ok_color
+{
+
+// ------------------------ 8 bit sRGB ------------------------ //
+
+// Table driven transfer functions for 8 bit sRGB, which avoid powf for every channel.
+//
+// Decoding is a direct lookup. Encoding looks up a first guess from a table indexed by the linear
+// value and corrects it against the exact decision thresholds between neighboring codes, so the
+// result is the same as rounding srgb_transfer_function(x) * 255, except for values within float
+// rounding of a decision threshold.
+struct Srgb8Tables
+{
+	static constexpr int encode_size = 4096;
+
+	float decode[256];
+	float threshold[256];             // linear value where code i rounds up to i + 1
+	uint8_t encode[encode_size + 1];  // lowest code reachable from each bucket of linear values
+};
+
+const Srgb8Tables& srgb8_tables()
+{
+	static const Srgb8Tables tables = [] {
+		Srgb8Tables t;
+
+		for (int i = 0; i < 256; i++)
+		{
+			t.decode[i] = srgb_transfer_function_inv(i / 255.f);
+			t.threshold[i] = i < 255 ? srgb_transfer_function_inv((i + 0.5f) / 255.f) : FLT_MAX;
+		}
+
+		int code = 0;
+		for (int i = 0; i <= Srgb8Tables::encode_size; i++)
+		{
+			float x = (float)i / Srgb8Tables::encode_size;
+			while (x >= t.threshold[code])
+				code++;
+			t.encode[i] = (uint8_t)code;
+		}
+
+		return t;
+	}();
+
+	return tables;
+}
+
+float srgb8_to_linear(const Srgb8Tables& tables, uint32_t code)
+{
+	return tables.decode[code & 0xff];
+}
+
+// Clamps to [0, 1], NaN maps to 0
+uint32_t linear_to_srgb8(const Srgb8Tables& tables, float x)
+{
+	x = x > 0.f ? (x < 1.f ? x : 1.f) : 0.f;
+
+	uint32_t code = tables.encode[(int)(x * Srgb8Tables::encode_size)];
+	while (x >= tables.threshold[code])
+		code++;
+
+	return code;
+}
+
+uint32_t linear_srgb_to_argb32(const Srgb8Tables& tables, RGB rgb, uint32_t alpha = 0xff)
+{
+	return (alpha << 24)
+		| (linear_to_srgb8(tables, rgb.r) << 16)
+		| (linear_to_srgb8(tables, rgb.g) << 8)
+		| linear_to_srgb8(tables, rgb.b);
+}
+
+RGB argb32_to_linear_srgb(const Srgb8Tables& tables, uint32_t argb)
+{
+	return {
+		srgb8_to_linear(tables, argb >> 16),
+		srgb8_to_linear(tables, argb >> 8),
+		srgb8_to_linear(tables, argb),
+	};
+}
+
+// ------------------------ Transfer tables ------------------------ //
+
+// Inverse transfer function over encoded values in [0, 1], linearly interpolated
+// (error below 1e-6), so decoding doesn't take a powf per channel
+struct TransferTable
+{
+	static constexpr int size = 4096;
+
+	float linear[size + 1];
+
+	explicit TransferTable(float (*inverse)(float))
+	{
+		for (int i = 0; i <= size; i++)
+			linear[i] = inverse((float)i / size);
+	}
+
+	// Clamps to [0, 1]
+	float operator()(float x) const
+	{
+		float pos = (x > 0.f ? (x < 1.f ? x : 1.f) : 0.f) * size;
+		int i = std::min((int)pos, size - 1);
+		return linear[i] + (pos - i) * (linear[i + 1] - linear[i]);
+	}
+};
+
+const TransferTable& srgb_transfer_table()
+{
+	static const TransferTable table(srgb_transfer_function_inv);
+	return table;
+}
+
+} // namespace ok_color
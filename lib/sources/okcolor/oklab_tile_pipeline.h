@@ -0,0 +1,366 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "oklab_parallel.h"
+
+namespace ok_color
+{
+
+// ------------------------ Tile pipelines ------------------------ //
+
+// Overlaps I/O with conversion: a reader thread fills tiles, worker threads convert them and a writer
+// thread consumes them in the order they were read, for example
+//
+//   run_tile_pipeline(
+//       [&](Tile& tile) { return read_rows(file, tile); },                    // false at the end
+//       [&](Tile& tile) { argb32_to_lab16(tile.input_as<uint32_t>(), tile.output_as<Lab16>(), tile.count, 1); },
+//       [&](Tile& tile) { write_rows(out, tile); },
+//       options);
+//
+// Tiles come from a fixed pool and are recycled once written, so nothing is allocated per tile and
+// the reader blocks when every tile is in flight, which bounds memory when the writer or the workers
+// are slower than the reader. Stages are connected by bounded lock-free queues. With OKLAB_PROFILE,
+// every read, convert and write of a tile is a stage span.
+
+// Bounded lock-free queue of a power of two capacity (D. Vyukov's bounded MPMC queue). Each cell
+// has a sequence number telling producers and consumers whose turn it is, so a push or a pop is one
+// compare and swap on the shared position and no locks are taken.
+template <class T>
+class BoundedQueue
+{
+public:
+	explicit BoundedQueue(size_t min_capacity)
+	{
+		size_t capacity = 2;
+		while (capacity < min_capacity)
+			capacity *= 2;
+
+		cells = std::unique_ptr<Cell[]>(new Cell[capacity]);
+		mask = capacity - 1;
+		for (size_t i = 0; i < capacity; i++)
+			cells[i].sequence.store(i, std::memory_order_relaxed);
+	}
+
+	// Returns false when the queue is full
+	bool try_push(const T& value)
+	{
+		size_t pos = push_pos.load(std::memory_order_relaxed);
+		for (;;)
+		{
+			Cell& cell = cells[pos & mask];
+			size_t sequence = cell.sequence.load(std::memory_order_acquire);
+			intptr_t difference = (intptr_t)sequence - (intptr_t)pos;
+			if (difference == 0)
+			{
+				if (push_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+				{
+					cell.value = value;
+					cell.sequence.store(pos + 1, std::memory_order_release);
+					return true;
+				}
+			}
+			else if (difference < 0)
+				return false;
+			else
+				pos = push_pos.load(std::memory_order_relaxed);
+		}
+	}
+
+	// Returns false when the queue is empty
+	bool try_pop(T& value)
+	{
+		size_t pos = pop_pos.load(std::memory_order_relaxed);
+		for (;;)
+		{
+			Cell& cell = cells[pos & mask];
+			size_t sequence = cell.sequence.load(std::memory_order_acquire);
+			intptr_t difference = (intptr_t)sequence - (intptr_t)(pos + 1);
+			if (difference == 0)
+			{
+				if (pop_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+				{
+					value = cell.value;
+					cell.sequence.store(pos + mask + 1, std::memory_order_release);
+					return true;
+				}
+			}
+			else if (difference < 0)
+				return false;
+			else
+				pos = pop_pos.load(std::memory_order_relaxed);
+		}
+	}
+
+	// Blocking versions, spinning briefly then yielding. Return the seconds spent waiting.
+	double push(const T& value)
+	{
+		return wait([&] { return try_push(value); });
+	}
+
+	double pop(T& value)
+	{
+		return wait([&] { return try_pop(value); });
+	}
+
+private:
+	struct Cell
+	{
+		std::atomic<size_t> sequence;
+		T value;
+	};
+
+	template <class F>
+	static double wait(F attempt)
+	{
+		if (attempt())
+			return 0.0;
+
+		auto start = std::chrono::steady_clock::now();
+		for (int spins = 0; !attempt(); spins++)
+		{
+			if (spins < 64)
+				continue;
+			if (spins < 1024)
+				std::this_thread::yield();
+			else
+				std::this_thread::sleep_for(std::chrono::microseconds(50));
+		}
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	std::unique_ptr<Cell[]> cells;
+	size_t mask;
+
+	// On their own cache lines, producers and consumers don't share one
+	alignas(64) std::atomic<size_t> push_pos{ 0 };
+	alignas(64) std::atomic<size_t> pop_pos{ 0 };
+};
+
+// Unit of work. The buffers are allocated once, when the pool is created.
+struct Tile
+{
+	uint64_t sequence = 0;  // position in the stream, set by the pipeline
+	uint64_t tag = 0;       // free for the stages, e.g. a file index or a first row
+	size_t count = 0;       // items in the tile, set by the reader
+
+	std::vector<uint8_t> input, output;
+
+	template <class T>
+	T* input_as()
+	{
+		return reinterpret_cast<T*>(input.data());
+	}
+
+	template <class T>
+	T* output_as()
+	{
+		return reinterpret_cast<T*>(output.data());
+	}
+};
+
+struct TilePipelineOptions
+{
+	unsigned workers = 0;       // converter threads, 0 for one per core
+	size_t tiles = 0;           // tiles in the pool, 0 for 2 per worker plus 2
+	size_t input_bytes = 0;     // size of each tile's input buffer
+	size_t output_bytes = 0;    // size of each tile's output buffer
+};
+
+// Seconds spent by each stage in its function (busy) and blocked on a queue (waiting). Busy and
+// waiting times of the workers are summed over the workers.
+struct TilePipelineStats
+{
+	uint64_t tiles = 0;
+	uint64_t items = 0;
+	double seconds = 0.0;
+
+	double read_busy = 0.0, read_waiting = 0.0;
+	double convert_busy = 0.0, convert_waiting = 0.0;
+	double write_busy = 0.0, write_waiting = 0.0;
+};
+
+// Runs the pipeline until read returns false, then waits for every tile read to be written.
+// read(Tile&) -> bool fills a tile, convert(Tile&) runs on the workers, write(Tile&) gets the tiles
+// in read order.
+//
+// If a stage throws, reading stops, the tiles in flight pass through the remaining stages without
+// being converted or written, and the first exception is rethrown once every thread has finished.
+template <class Read, class Convert, class Write>
+TilePipelineStats run_tile_pipeline(Read read, Convert convert, Write write, const TilePipelineOptions& options = {})
+{
+	using clock = std::chrono::steady_clock;
+	auto seconds_since = [](clock::time_point start) {
+		return std::chrono::duration<double>(clock::now() - start).count();
+	};
+
+	const unsigned workers = options.workers > 0 ? options.workers : default_thread_count();
+	const size_t tile_count = options.tiles > 0 ? options.tiles : 2 * (size_t)workers + 2;
+
+	std::vector<Tile> pool(tile_count);
+	for (Tile& tile : pool)
+	{
+		tile.input.resize(options.input_bytes);
+		tile.output.resize(options.output_bytes);
+	}
+
+	// A null tile tells a worker that reading is done, and the writer that a worker is done.
+	// Every queue can hold the whole pool and the end markers, so pushes only wait while a
+	// concurrent pop finishes.
+	BoundedQueue<Tile*> free_tiles(tile_count), work(tile_count + workers), done(tile_count + workers);
+	for (Tile& tile : pool)
+		free_tiles.push(&tile);
+
+	// First exception thrown by a stage. Once failed is set the stages only pass tiles along.
+	std::exception_ptr error;
+	std::mutex error_mutex;
+	std::atomic<bool> failed{ false };
+	auto fail = [&] {
+		std::lock_guard<std::mutex> lock(error_mutex);
+		if (!error)
+			error = std::current_exception();
+		failed.store(true, std::memory_order_relaxed);
+	};
+
+	TilePipelineStats stats;
+	const auto start = clock::now();
+
+	// Each worker's times on its own cache line
+	struct alignas(64) WorkerTimes
+	{
+		double busy = 0.0;
+		double waiting = 0.0;
+	};
+	std::vector<WorkerTimes> times(workers);
+
+	std::vector<std::thread> threads;
+	for (unsigned w = 0; w < workers; w++)
+	{
+		threads.emplace_back([&, w] {
+			Tile* tile;
+			for (;;)
+			{
+				times[w].waiting += work.pop(tile);
+				if (!tile)
+					break;
+
+				auto begin = clock::now();
+				if (!failed.load(std::memory_order_relaxed))
+				{
+					try
+					{
+						OKLAB_PROFILE_SCOPE(stage, "tile convert");
+						convert(*tile);
+					}
+					catch (...)
+					{
+						fail();
+					}
+				}
+				times[w].busy += seconds_since(begin);
+				times[w].waiting += done.push(tile);
+			}
+			done.push(nullptr);
+		});
+	}
+
+	// The writer reorders tiles, holding those that arrive early until their turn. At most the whole
+	// pool is in flight, so a tile's slot is its sequence modulo the pool size.
+	std::thread writer([&] {
+		std::vector<Tile*> early(tile_count, nullptr);
+		uint64_t next = 0;
+		unsigned finished = 0;
+		Tile* tile;
+		while (finished < workers)
+		{
+			stats.write_waiting += done.pop(tile);
+			if (!tile)
+			{
+				finished++;
+				continue;
+			}
+
+			early[tile->sequence % tile_count] = tile;
+			while (Tile* ready = early[next % tile_count])
+			{
+				early[next % tile_count] = nullptr;
+				next++;
+
+				auto begin = clock::now();
+				if (!failed.load(std::memory_order_relaxed))
+				{
+					try
+					{
+						OKLAB_PROFILE_SCOPE(stage, "tile write");
+						write(*ready);
+					}
+					catch (...)
+					{
+						fail();
+					}
+				}
+				stats.write_busy += seconds_since(begin);
+				free_tiles.push(ready);
+			}
+		}
+	});
+
+	// Reading on the calling thread
+	for (uint64_t sequence = 0; !failed.load(std::memory_order_relaxed); sequence++)
+	{
+		Tile* tile;
+		stats.read_waiting += free_tiles.pop(tile);
+
+		tile->sequence = sequence;
+		tile->tag = 0;
+		tile->count = 0;
+		auto begin = clock::now();
+		bool more = false;
+		try
+		{
+			OKLAB_PROFILE_SCOPE(stage, "tile read");
+			more = read(*tile);
+		}
+		catch (...)
+		{
+			fail();
+		}
+		stats.read_busy += seconds_since(begin);
+		if (!more)
+		{
+			free_tiles.push(tile);
+			break;
+		}
+
+		stats.tiles++;
+		stats.items += tile->count;
+		stats.read_waiting += work.push(tile);
+	}
+	for (unsigned w = 0; w < workers; w++)
+		work.push(nullptr);
+
+	for (std::thread& thread : threads)
+		thread.join();
+	writer.join();
+
+	if (error)
+		std::rethrow_exception(error);
+
+	for (unsigned w = 0; w < workers; w++)
+	{
+		stats.convert_busy += times[w].busy;
+		stats.convert_waiting += times[w].waiting;
+	}
+	stats.seconds = seconds_since(start);
+	return stats;
+}
+
+} // namespace ok_color
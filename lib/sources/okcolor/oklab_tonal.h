@@ -0,0 +1,207 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <vector>
+#include "oklab_source.h"
+#include "oklab_parallel.h"
+#include "oklab_srgb8.h"
+
+namespace ok_color
+{
+
+// ------------------------ Palette specs ------------------------ //
+
+// One color of a palette, derived from the seed color. Lightness, chroma and hue are handled
+// like the OkLch methods on the Dart side: rotated, darker / lighter, withChroma.
+struct PaletteEntry
+{
+	float hue_degrees = 0.f;         // added to the seed hue
+
+	float chroma_scale = 1.f;        // seed chroma is multiplied by this...
+	float chroma_max = INFINITY;     // ...and capped to this
+
+	// L moves towards lightness_target by the fraction lightness_mix: darker(t) is target 0 and
+	// mix t, lighter(t) is target 1 and mix t, a fixed tone T is target T and mix 1
+	float lightness_target = 0.f;
+	float lightness_mix = 0.f;
+};
+
+using PaletteSpec = std::vector<PaletteEntry>;
+
+PaletteSpec hue_rotations(std::initializer_list<float> degrees)
+{
+	PaletteSpec spec;
+	for (float d : degrees)
+	{
+		PaletteEntry entry;
+		entry.hue_degrees = d;
+		spec.push_back(entry);
+	}
+	return spec;
+}
+
+// Same colors, in the same order, as the OkLch methods of the same names
+PaletteSpec complementary_spec()
+{
+	return hue_rotations({ 180.f });
+}
+
+PaletteSpec split_complementary_spec()
+{
+	return hue_rotations({ 150.f, 0.f, 210.f });
+}
+
+PaletteSpec triadic_spec()
+{
+	return hue_rotations({ 120.f, 0.f, 240.f });
+}
+
+PaletteSpec tetradic_spec()
+{
+	return hue_rotations({ 0.f, 180.f, 90.f, 270.f });
+}
+
+PaletteSpec analogous_spec(int count = 2, float angle = 30.f)
+{
+	PaletteSpec spec;
+	for (int i = -count; i <= count; i++)
+	{
+		PaletteEntry entry;
+		entry.hue_degrees = -angle * i;
+		spec.push_back(entry);
+	}
+	return spec;
+}
+
+PaletteSpec shades_spec(int count = 5)
+{
+	PaletteSpec spec(count);
+	for (int i = 0; i < count; i++)
+		spec[i].lightness_mix = count > 1 ? (float)i / (count - 1) : 0.f;
+	return spec;
+}
+
+PaletteSpec tints_spec(int count = 5)
+{
+	PaletteSpec spec = shades_spec(count);
+	for (PaletteEntry& entry : spec)
+		entry.lightness_target = 1.f;
+	return spec;
+}
+
+// Every role at every tone (absolute L), role by role, e.g. 13 tones for each of
+// primary, secondary, tertiary, neutral and neutral variant roles
+PaletteSpec tonal_spec(const std::vector<float>& tones, const std::vector<PaletteEntry>& roles)
+{
+	PaletteSpec spec;
+	for (const PaletteEntry& role : roles)
+	{
+		for (float tone : tones)
+		{
+			PaletteEntry entry = role;
+			entry.lightness_target = tone;
+			entry.lightness_mix = 1.f;
+			spec.push_back(entry);
+		}
+	}
+	return spec;
+}
+
+// ------------------------ Batch palettes ------------------------ //
+
+// Gamut boundary along one hue. Below the cusp the boundary is the straight line from black to
+// the cusp, so only lightnesses above it need find_gamut_intersection.
+struct HueBoundary
+{
+	float a_, b_;
+	LC cusp;
+
+	HueBoundary() : a_(1.f), b_(0.f), cusp{ 1.f, 0.f }
+	{
+	}
+
+	HueBoundary(float h) : a_(cosf(h)), b_(sinf(h)), cusp(find_cusp(a_, b_))
+	{
+	}
+
+	float max_chroma(float L) const
+	{
+		if (L <= 0.f || L >= 1.f)
+			return 0.f;
+		if (L <= cusp.L)
+			return cusp.C * L / cusp.L;
+		return find_gamut_intersection(a_, b_, L, 1.f, L, cusp);
+	}
+};
+
+// Structure of arrays output, each array holds seeds x entries values, entry j of seed i at i * entries + j.
+// Arrays left null are not written.
+struct PaletteOutput
+{
+	float* l = nullptr;
+	float* c = nullptr;
+	float* h = nullptr;          // radians in [0, 2 pi)
+	uint32_t* argb = nullptr;    // 0xAARRGGBB sRGB
+};
+
+// Applies spec to every seed (h in radians). With gamut_map, colors outside sRGB get the largest
+// chroma inside it at the same lightness and hue. The boundary is found once per seed and hue
+// rotation and shared by all tones along it, instead of clipping every color on its own.
+void generate_palettes(const Lch* seeds, size_t count, const PaletteSpec& spec, const PaletteOutput& out,
+	bool gamut_map = true, unsigned threads = 0)
+{
+	OKLAB_PROFILE_SCOPE(call, "generate_palettes");
+	const Srgb8Tables& tables = srgb8_tables();
+	const size_t entries = spec.size();
+	const float two_pi = 2.f * pi;
+
+	parallel_for(count, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++)
+		{
+			const Lch seed = seeds[i];
+
+			float boundary_hue = NAN;
+			HueBoundary boundary;
+
+			for (size_t j = 0; j < entries; j++)
+			{
+				const PaletteEntry& entry = spec[j];
+
+				float h = seed.h + entry.hue_degrees * (pi / 180.f);
+				h -= two_pi * floorf(h / two_pi);
+				h = h < two_pi ? h : 0.f;
+
+				float L = (1.f - entry.lightness_mix) * seed.l + entry.lightness_mix * entry.lightness_target;
+				float C = std::min(seed.c * entry.chroma_scale, entry.chroma_max);
+
+				if (gamut_map)
+				{
+					// Entries of a role share their hue, so this runs once per role
+					if (h != boundary_hue)
+					{
+						boundary = HueBoundary(h);
+						boundary_hue = h;
+					}
+
+					L = clamp(L, 0.f, 1.f);
+					C = clamp(C, 0.f, boundary.max_chroma(L));
+				}
+
+				size_t k = i * entries + j;
+				if (out.l)
+					out.l[k] = L;
+				if (out.c)
+					out.c[k] = C;
+				if (out.h)
+					out.h[k] = h;
+				if (out.argb)
+					out.argb[k] = linear_srgb_to_argb32(tables, oklab_to_linear_srgb(lch_to_oklab({ L, C, h })));
+			}
+		}
+	}, threads, std::max<size_t>(1, 4096 / std::max<size_t>(entries, 1)));
+}
+
+} // namespace ok_color
@@ -0,0 +1,265 @@
+#pragma once
+
+#include <cstddef>
+#include "oklab_source.h"
+#include "oklab_parallel.h"
+
+namespace ok_color
+{
+
+// ------------------------ CIE XYZ and CIELAB ------------------------ //
+
+struct XYZ { float X; float Y; float Z; };
+
+// CIELAB, L in [0, 100]
+struct CieLab { float L; float a; float b; };
+
+// White point of XYZ and CIELAB values. Other whites are adapted to the D65 white of OkLab
+// with the Bradford transform.
+enum class Illuminant
+{
+	d65,
+	d50,  // ICC profile connection space, CSS lab()
+};
+
+// ------ Matrices ------ //
+
+// Everything is chained in double precision at compile time, so each conversion below
+// has a single 3x3 matrix between its input and the LMS cone responses of OkLab.
+
+struct Matrix3
+{
+	double m[3][3];
+};
+
+constexpr Matrix3 operator*(const Matrix3& A, const Matrix3& B)
+{
+	Matrix3 r = {};
+	for (int i = 0; i < 3; i++)
+		for (int j = 0; j < 3; j++)
+			r.m[i][j] = A.m[i][0] * B.m[0][j] + A.m[i][1] * B.m[1][j] + A.m[i][2] * B.m[2][j];
+	return r;
+}
+
+constexpr Matrix3 inverse(const Matrix3& A)
+{
+	const auto& m = A.m;
+	double det = m[0][0] * (m[1][1] * m[2][2] - m[1][2] * m[2][1])
+		- m[0][1] * (m[1][0] * m[2][2] - m[1][2] * m[2][0])
+		+ m[0][2] * (m[1][0] * m[2][1] - m[1][1] * m[2][0]);
+
+	Matrix3 r = {};
+	for (int i = 0; i < 3; i++)
+	{
+		for (int j = 0; j < 3; j++)
+		{
+			int i1 = (j + 1) % 3, i2 = (j + 2) % 3, j1 = (i + 1) % 3, j2 = (i + 2) % 3;
+			r.m[i][j] = (m[i1][j1] * m[i2][j2] - m[i1][j2] * m[i2][j1]) / det;
+		}
+	}
+	return r;
+}
+
+constexpr Matrix3 diagonal(double x, double y, double z)
+{
+	return { { { x, 0.0, 0.0 }, { 0.0, y, 0.0 }, { 0.0, 0.0, z } } };
+}
+
+// XYZ (D65) to LMS, M1 of the OkLab reference
+constexpr Matrix3 oklab_xyz_to_lms = { {
+	{ 0.8189330101, 0.3618667424, -0.1288597137 },
+	{ 0.0329845436, 0.9293118715, 0.0361456387 },
+	{ 0.0482003018, 0.2643662691, 0.6338517070 },
+} };
+
+constexpr Matrix3 bradford = { {
+	{ +0.8951, +0.2664, -0.1614 },
+	{ -0.7502, +1.7135, +0.0367 },
+	{ +0.0389, -0.0685, +1.0296 },
+} };
+
+// Whites with Y = 1, those of the CSS Color 4 conversions
+constexpr double d65_white[3] = { 0.3127 / 0.3290, 1.0, (1.0 - 0.3127 - 0.3290) / 0.3290 };
+constexpr double d50_white[3] = { 0.3457 / 0.3585, 1.0, (1.0 - 0.3457 - 0.3585) / 0.3585 };
+
+// Scales the cone responses of Bradford's space by the ratio of the two whites
+constexpr Matrix3 bradford_adaptation(const double (&from)[3], const double (&to)[3])
+{
+	double cone_from[3] = {}, cone_to[3] = {};
+	for (int i = 0; i < 3; i++)
+	{
+		cone_from[i] = bradford.m[i][0] * from[0] + bradford.m[i][1] * from[1] + bradford.m[i][2] * from[2];
+		cone_to[i] = bradford.m[i][0] * to[0] + bradford.m[i][1] * to[1] + bradford.m[i][2] * to[2];
+	}
+	return inverse(bradford) * diagonal(cone_to[0] / cone_from[0], cone_to[1] / cone_from[1], cone_to[2] / cone_from[2]) * bradford;
+}
+
+// Single precision matrices used by the conversions, from XYZ (or CIELAB's XYZ / white) to LMS and back
+struct XyzMatrices
+{
+	float to_lms[3][3];
+	float from_lms[3][3];
+
+	constexpr XyzMatrices(const Matrix3& M) : to_lms{}, from_lms{}
+	{
+		Matrix3 M_inv = inverse(M);
+		for (int i = 0; i < 3; i++)
+		{
+			for (int j = 0; j < 3; j++)
+			{
+				to_lms[i][j] = (float)M.m[i][j];
+				from_lms[i][j] = (float)M_inv.m[i][j];
+			}
+		}
+	}
+};
+
+const XyzMatrices& xyz_matrices(Illuminant white)
+{
+	static constexpr XyzMatrices d65(oklab_xyz_to_lms);
+	static constexpr XyzMatrices d50(oklab_xyz_to_lms * bradford_adaptation(d50_white, d65_white));
+	return white == Illuminant::d50 ? d50 : d65;
+}
+
+// CIELAB is relative to its white, which is folded into the matrix as well
+const XyzMatrices& cielab_matrices(Illuminant white)
+{
+	static constexpr XyzMatrices d65(oklab_xyz_to_lms * diagonal(d65_white[0], d65_white[1], d65_white[2]));
+	static constexpr XyzMatrices d50(oklab_xyz_to_lms * bradford_adaptation(d50_white, d65_white) * diagonal(d50_white[0], d50_white[1], d50_white[2]));
+	return white == Illuminant::d50 ? d50 : d65;
+}
+
+// ------ Conversions ------ //
+
+Lab lms_to_oklab(const XyzMatrices& M, float x, float y, float z)
+{
+	float l_ = cbrtf(M.to_lms[0][0] * x + M.to_lms[0][1] * y + M.to_lms[0][2] * z);
+	float m_ = cbrtf(M.to_lms[1][0] * x + M.to_lms[1][1] * y + M.to_lms[1][2] * z);
+	float s_ = cbrtf(M.to_lms[2][0] * x + M.to_lms[2][1] * y + M.to_lms[2][2] * z);
+
+	return {
+		0.2104542553f * l_ + 0.7936177850f * m_ - 0.0040720468f * s_,
+		1.9779984951f * l_ - 2.4285922050f * m_ + 0.4505937099f * s_,
+		0.0259040371f * l_ + 0.7827717662f * m_ - 0.8086757660f * s_,
+	};
+}
+
+// Inverse of lms_to_oklab, into out[3]
+void oklab_to_lms(const XyzMatrices& M, Lab c, float* out)
+{
+	float l_ = c.L + 0.3963377774f * c.a + 0.2158037573f * c.b;
+	float m_ = c.L - 0.1055613458f * c.a - 0.0638541728f * c.b;
+	float s_ = c.L - 0.0894841775f * c.a - 1.2914855480f * c.b;
+
+	float l = l_ * l_ * l_;
+	float m = m_ * m_ * m_;
+	float s = s_ * s_ * s_;
+
+	for (int i = 0; i < 3; i++)
+		out[i] = M.from_lms[i][0] * l + M.from_lms[i][1] * m + M.from_lms[i][2] * s;
+}
+
+// CIELAB's companding, t = XYZ / white
+float cielab_f(float t)
+{
+	constexpr float delta = 6.f / 29.f;
+	return t > delta * delta * delta ? cbrtf(t) : t / (3.f * delta * delta) + 4.f / 29.f;
+}
+
+float cielab_f_inv(float t)
+{
+	constexpr float delta = 6.f / 29.f;
+	return t > delta ? t * t * t : 3.f * delta * delta * (t - 4.f / 29.f);
+}
+
+Lab xyz_to_oklab(XYZ c, Illuminant white = Illuminant::d65)
+{
+	return lms_to_oklab(xyz_matrices(white), c.X, c.Y, c.Z);
+}
+
+XYZ oklab_to_xyz(Lab c, Illuminant white = Illuminant::d65)
+{
+	float xyz[3];
+	oklab_to_lms(xyz_matrices(white), c, xyz);
+	return { xyz[0], xyz[1], xyz[2] };
+}
+
+Lab cielab_to_oklab(CieLab c, Illuminant white = Illuminant::d50)
+{
+	float fy = (c.L + 16.f) / 116.f;
+	float fx = fy + c.a / 500.f;
+	float fz = fy - c.b / 200.f;
+	return lms_to_oklab(cielab_matrices(white), cielab_f_inv(fx), cielab_f_inv(fy), cielab_f_inv(fz));
+}
+
+CieLab oklab_to_cielab(Lab c, Illuminant white = Illuminant::d50)
+{
+	float t[3];
+	oklab_to_lms(cielab_matrices(white), c, t);
+
+	float fx = cielab_f(t[0]);
+	float fy = cielab_f(t[1]);
+	float fz = cielab_f(t[2]);
+	return { 116.f * fy - 16.f, 500.f * (fx - fy), 200.f * (fy - fz) };
+}
+
+// ------ Batches ------ //
+
+void xyz_to_oklab(const XYZ* in, Lab* out, size_t count, Illuminant white = Illuminant::d65, unsigned threads = 0)
+{
+	OKLAB_PROFILE_SCOPE(call, "xyz_to_oklab");
+	const XyzMatrices& M = xyz_matrices(white);
+	parallel_for(count, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++)
+			out[i] = lms_to_oklab(M, in[i].X, in[i].Y, in[i].Z);
+	}, threads);
+}
+
+void oklab_to_xyz(const Lab* in, XYZ* out, size_t count, Illuminant white = Illuminant::d65, unsigned threads = 0)
+{
+	OKLAB_PROFILE_SCOPE(call, "oklab_to_xyz");
+	const XyzMatrices& M = xyz_matrices(white);
+	parallel_for(count, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++)
+		{
+			float xyz[3];
+			oklab_to_lms(M, in[i], xyz);
+			out[i] = { xyz[0], xyz[1], xyz[2] };
+		}
+	}, threads);
+}
+
+void cielab_to_oklab(const CieLab* in, Lab* out, size_t count, Illuminant white = Illuminant::d50, unsigned threads = 0)
+{
+	OKLAB_PROFILE_SCOPE(call, "cielab_to_oklab");
+	const XyzMatrices& M = cielab_matrices(white);
+	parallel_for(count, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++)
+		{
+			float fy = (in[i].L + 16.f) / 116.f;
+			float fx = fy + in[i].a / 500.f;
+			float fz = fy - in[i].b / 200.f;
+			out[i] = lms_to_oklab(M, cielab_f_inv(fx), cielab_f_inv(fy), cielab_f_inv(fz));
+		}
+	}, threads);
+}
+
+void oklab_to_cielab(const Lab* in, CieLab* out, size_t count, Illuminant white = Illuminant::d50, unsigned threads = 0)
+{
+	OKLAB_PROFILE_SCOPE(call, "oklab_to_cielab");
+	const XyzMatrices& M = cielab_matrices(white);
+	parallel_for(count, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++)
+		{
+			float t[3];
+			oklab_to_lms(M, in[i], t);
+
+			float fx = cielab_f(t[0]);
+			float fy = cielab_f(t[1]);
+			float fz = cielab_f(t[2]);
+			out[i] = { 116.f * fy - 16.f, 500.f * (fx - fy), 200.f * (fy - fz) };
+		}
+	}, threads);
+}
+
+} // namespace ok_color
@@ -0,0 +1,266 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "oklab_source.h"
+#include "oklab_parallel.h"
+#include "oklab_gamut.h"
+#include "oklab_srgb8.h"
+
+namespace ok_color
+{
+
+// ------------------------ YUV frames ------------------------ //
+
+enum class YuvFormat
+{
+	i420,  // 8 bit, Y plane then separate U and V planes at half resolution
+	nv12,  // 8 bit, Y plane then one interleaved UV plane at half resolution
+	p010,  // 10 bit in the high bits of little endian 16 bit samples, planes as nv12
+};
+
+// Y'CbCr matrix. BT.601 and BT.709 are decoded with the sRGB primaries and transfer function, as an
+// RGBA8 decoder followed by srgb_transfer_function_inv would; BT.2020 with its own primaries
+// (Rec2020Gamut) and transfer function. PQ and HLG frames would need their own transfer functions.
+enum class YuvMatrix
+{
+	bt601,
+	bt709,
+	bt2020,
+};
+
+enum class YuvRange
+{
+	limited,  // Y in [16, 235], U and V in [16, 240] (scaled by 4 for 10 bit)
+	full,
+};
+
+enum class ChromaUpsampling
+{
+	nearest,
+	bilinear,  // chroma sited as in MPEG-2 and H.264: co-sited horizontally, between rows vertically
+};
+
+struct YuvFrame
+{
+	YuvFormat format = YuvFormat::nv12;
+	int width = 0, height = 0;
+
+	// Strides in bytes. Chroma planes are (width + 1) / 2 by (height + 1) / 2 samples.
+	const uint8_t* y = nullptr;
+	size_t y_stride = 0;
+	const uint8_t* u = nullptr;  // U plane, or the interleaved UV plane
+	const uint8_t* v = nullptr;  // i420 only
+	size_t uv_stride = 0;
+};
+
+struct YuvOptions
+{
+	YuvMatrix matrix = YuvMatrix::bt709;
+	YuvRange range = YuvRange::limited;
+	ChromaUpsampling upsampling = ChromaUpsampling::bilinear;
+
+	bool lch = false;  // planes receive OkLch L, C and h (radians) instead of OkLab
+	unsigned threads = 0;
+};
+
+// Output planes, pixel (x, y) at [y * stride + x]
+struct OkLabPlanes
+{
+	float* L = nullptr;
+	float* a = nullptr;
+	float* b = nullptr;
+	size_t stride = 0;
+};
+
+// ------ Transfer tables ------ //
+
+// As srgb_transfer_table, for BT.2020 frames
+const TransferTable& rec2020_transfer_table()
+{
+	static const TransferTable table(rec2020_transfer_function_inv);
+	return table;
+}
+
+// ------ Conversion ------ //
+
+// Decoding constants for one frame: Y' = (Y - y_offset) * y_scale, Cb = (U - c_offset) * c_scale,
+// R' = Y' + r_cr Cr, G' = Y' + g_cb Cb + g_cr Cr, B' = Y' + b_cb Cb
+struct YuvDecoder
+{
+	float y_offset, y_scale, c_offset, c_scale;
+	float r_cr, g_cb, g_cr, b_cb;
+
+	const TransferTable* transfer;
+	const float (*to_lms)[3];
+
+	YuvDecoder(YuvFormat format, const YuvOptions& options)
+	{
+		float Kr = 0.2126f, Kb = 0.0722f;
+		if (options.matrix == YuvMatrix::bt601)
+		{
+			Kr = 0.299f;
+			Kb = 0.114f;
+		}
+		else if (options.matrix == YuvMatrix::bt2020)
+		{
+			Kr = 0.2627f;
+			Kb = 0.0593f;
+		}
+		float Kg = 1.f - Kr - Kb;
+
+		r_cr = 2.f * (1.f - Kr);
+		b_cb = 2.f * (1.f - Kb);
+		g_cb = -b_cb * Kb / Kg;
+		g_cr = -r_cr * Kr / Kg;
+
+		// 10 bit samples are kept in 16 bit units, so the ranges scale by 64 more
+		float unit = format == YuvFormat::p010 ? 256.f : 1.f;
+		if (options.range == YuvRange::limited)
+		{
+			y_offset = 16.f * unit;
+			y_scale = 1.f / (219.f * unit);
+			c_offset = 128.f * unit;
+			c_scale = 1.f / (224.f * unit);
+		}
+		else
+		{
+			float max = format == YuvFormat::p010 ? 1023.f * 64.f : 255.f;
+			y_offset = 0.f;
+			y_scale = 1.f / max;
+			c_offset = 128.f * unit;
+			c_scale = 1.f / max;
+		}
+
+		bool rec2020 = options.matrix == YuvMatrix::bt2020;
+		transfer = rec2020 ? &rec2020_transfer_table() : &srgb_transfer_table();
+		to_lms = rec2020 ? Rec2020Gamut::to_lms : SrgbGamut::to_lms;
+	}
+
+	Lab to_oklab(float Y, float Cb, float Cr) const
+	{
+		float y = (Y - y_offset) * y_scale;
+		float cb = (Cb - c_offset) * c_scale;
+		float cr = (Cr - c_offset) * c_scale;
+
+		float r = (*transfer)(y + r_cr * cr);
+		float g = (*transfer)(y + g_cb * cb + g_cr * cr);
+		float b = (*transfer)(y + b_cb * cb);
+
+		float l_ = cbrt_fast(to_lms[0][0] * r + to_lms[0][1] * g + to_lms[0][2] * b);
+		float m_ = cbrt_fast(to_lms[1][0] * r + to_lms[1][1] * g + to_lms[1][2] * b);
+		float s_ = cbrt_fast(to_lms[2][0] * r + to_lms[2][1] * g + to_lms[2][2] * b);
+
+		return {
+			0.2104542553f * l_ + 0.7936177850f * m_ - 0.0040720468f * s_,
+			1.9779984951f * l_ - 2.4285922050f * m_ + 0.4505937099f * s_,
+			0.0259040371f * l_ + 0.7827717662f * m_ - 0.8086757660f * s_,
+		};
+	}
+};
+
+// Sample x of a chroma row, channel 0 (U) or 1 (V)
+float chroma_sample(const YuvFrame& frame, int row, int x, int channel)
+{
+	if (frame.format == YuvFormat::i420)
+		return (channel == 0 ? frame.u : frame.v)[row * frame.uv_stride + x];
+
+	const uint8_t* p = frame.u + row * frame.uv_stride;
+	if (frame.format == YuvFormat::nv12)
+		return p[2 * x + channel];
+
+	const uint8_t* s = p + 4 * x + 2 * channel;
+	return (float)(s[0] | (s[1] << 8));
+}
+
+float luma_sample(const YuvFrame& frame, int row, int x)
+{
+	const uint8_t* p = frame.y + row * frame.y_stride;
+	if (frame.format == YuvFormat::p010)
+		return (float)(p[2 * x] | (p[2 * x + 1] << 8));
+	return p[x];
+}
+
+// Converts a 4:2:0 frame to OkLab (or OkLch) planes in one pass: rows are upsampled, decoded and converted
+// a row at a time, without an RGB frame in between. Returns false when the frame is missing a plane.
+bool yuv_to_oklab(const YuvFrame& frame, const OkLabPlanes& out, const YuvOptions& options = {})
+{
+	OKLAB_PROFILE_SCOPE(call, "yuv_to_oklab");
+	if (frame.width <= 0 || frame.height <= 0 || !frame.y || !frame.u || (frame.format == YuvFormat::i420 && !frame.v)
+		|| !out.L || !out.a || !out.b)
+		return false;
+
+	const YuvDecoder decoder(frame.format, options);
+	const int width = frame.width;
+	const int chroma_width = (width + 1) / 2;
+	const int chroma_height = (frame.height + 1) / 2;
+	const bool bilinear = options.upsampling == ChromaUpsampling::bilinear;
+
+	parallel_for((size_t)frame.height, [&](size_t begin, size_t end) {
+		// Chroma of the current row at chroma resolution, then at full resolution
+		std::vector<float> row_u(chroma_width), row_v(chroma_width), u(width), v(width);
+
+		for (size_t y = begin; y < end; y++)
+		{
+			int row = (int)y / 2;
+
+			// Chroma rows are sited between luma rows 2j and 2j + 1, blend with the one on the other side
+			int other = (y % 2 == 0 ? row - 1 : row + 1);
+			other = other < 0 ? 0 : (other >= chroma_height ? chroma_height - 1 : other);
+			for (int x = 0; x < chroma_width; x++)
+			{
+				float near_u = chroma_sample(frame, row, x, 0), near_v = chroma_sample(frame, row, x, 1);
+				if (bilinear)
+				{
+					row_u[x] = 0.75f * near_u + 0.25f * chroma_sample(frame, other, x, 0);
+					row_v[x] = 0.75f * near_v + 0.25f * chroma_sample(frame, other, x, 1);
+				}
+				else
+				{
+					row_u[x] = near_u;
+					row_v[x] = near_v;
+				}
+			}
+
+			for (int x = 0; x < width; x++)
+			{
+				int cx = x / 2;
+				if (bilinear && (x & 1) && cx + 1 < chroma_width)
+				{
+					u[x] = 0.5f * (row_u[cx] + row_u[cx + 1]);
+					v[x] = 0.5f * (row_v[cx] + row_v[cx + 1]);
+				}
+				else
+				{
+					u[x] = row_u[cx];
+					v[x] = row_v[cx];
+				}
+			}
+
+			size_t o = y * out.stride;
+			for (int x = 0; x < width; x++)
+			{
+				Lab lab = decoder.to_oklab(luma_sample(frame, (int)y, x), u[x], v[x]);
+				if (options.lch)
+				{
+					Lch lch = oklab_to_lch(lab);
+					out.L[o + x] = lch.l;
+					out.a[o + x] = lch.c;
+					out.b[o + x] = lch.h;
+				}
+				else
+				{
+					out.L[o + x] = lab.L;
+					out.a[o + x] = lab.a;
+					out.b[o + x] = lab.b;
+				}
+			}
+		}
+	}, options.threads, 16);
+
+	return true;
+}
+
+} // namespace ok_color